@@ -16,6 +16,7 @@
 #include "apEventHandler.h"
 
 #include "apGraphicsDevice_DX12.h"
+#include "apGraphicsDevice_Null.h"
 
 #include <string>
 #include <algorithm>
@@ -122,6 +123,9 @@ namespace ap
 		// Wake up the events that need to be executed on the main thread, in thread safe manner:
 		ap::eventhandler::FireEvent(ap::eventhandler::EVENT_THREAD_SAFE_POINT, 0);
 
+		// Swap in the streamed textures and start loading the requested mips:
+		ap::resourcemanager::UpdateStreamingResources();
+
 		const float dt = framerate_lock ? (1.0f / targetFrameRate) : deltaTime;
 
 		fadeManager.Update(dt);
@@ -338,6 +342,10 @@ namespace ap
 					infodisplay_str += "[Vulkan]";
 				}
 #endif
+				if (dynamic_cast<GraphicsDevice_Null*>(graphicsDevice.get()))
+				{
+					infodisplay_str += "[Null]";
+				}
 
 #ifdef _DEBUG
 				infodisplay_str += "[DEBUG]";
@@ -439,6 +447,7 @@ namespace ap
 
 			bool use_dx12 = ap::arguments::HasArgument("dx12");
 			bool use_vulkan = ap::arguments::HasArgument("vulkan");
+			bool use_null = ap::arguments::HasArgument("nulldevice"); // no GPU, for headless runs
 
 #ifndef APPLEENGINE_BUILD_DX12
 			if (use_dx12) {
@@ -453,7 +462,7 @@ namespace ap
 			}
 #endif
 
-			if (!use_dx12 && !use_vulkan)
+			if (!use_dx12 && !use_vulkan && !use_null)
 			{
 #if defined(APPLEENGINE_BUILD_DX12)
 				use_dx12 = true;
@@ -464,9 +473,14 @@ namespace ap
 				assert(false);
 #endif
 			}
-			assert(use_dx12 || use_vulkan);
+			assert(use_dx12 || use_vulkan || use_null);
 
-			if (use_vulkan)
+			if (use_null)
+			{
+				ap::renderer::SetShaderPath(ap::renderer::GetShaderPath() + "hlsl6/"); // shaders are still loaded the same way, the null device reports HLSL6
+				graphicsDevice = std::make_unique<GraphicsDevice_Null>();
+			}
+			else if (use_vulkan)
 			{
 #ifdef APPLEENGINE_BUILD_VULKAN
 				ap::renderer::SetShaderPath(ap::renderer::GetShaderPath() + "spirv/");
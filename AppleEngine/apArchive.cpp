@@ -1,5 +1,8 @@
 #include "apArchive.h"
 #include "apHelper.h"
+#include "apJobSystem.h"
+
+#include "Utility/basis_universal/zstd/zstd.h"
 
 #include <fstream>
 
@@ -7,12 +10,134 @@ namespace ap
 {
 
 	// this should always be only INCREMENTED and only if a new serialization is implemeted somewhere!
-	static constexpr uint64_t __archiveVersion = 73;
+	static constexpr uint64_t __archiveVersion = 75;
 	// this is the version number of which below the archive is not compatible with the current version
 	static constexpr uint64_t __archiveVersionBarrier = 22;
 
 	// version history is logged in ArchiveVersionHistory.txt file!
 
+	// The compressed container format:
+	//	header, compressed size of each block (uint64_t), blocks
+	//	Every block is an independent zstd frame, which decompresses to blockSize bytes (except the last one)
+	//	The magic can't be mistaken for a raw archive, because those start with the version number
+	struct CompressedHeader
+	{
+		uint64_t magic;
+		uint64_t size; // size of the decompressed data
+		uint64_t blockSize;
+		uint64_t blockCount;
+	};
+	static constexpr uint64_t __compressedMagic = 0x315A50414E435241ull; // "ARCNAPZ1"
+	static constexpr uint64_t __compressedBlockSize = 256 * 1024;
+	static constexpr int __compressionLevel = 3;
+
+	static bool IsCompressed(const uint8_t* data, size_t size)
+	{
+		if (data == nullptr || size < sizeof(CompressedHeader))
+			return false;
+		CompressedHeader header;
+		std::memcpy(&header, data, sizeof(header));
+		return header.magic == __compressedMagic;
+	}
+
+	// The blocks are compressed concurrently on the job system
+	static bool Compress(const uint8_t* data, size_t size, ap::vector<uint8_t>& result)
+	{
+		CompressedHeader header;
+		header.magic = __compressedMagic;
+		header.size = size;
+		header.blockSize = __compressedBlockSize;
+		header.blockCount = (size + __compressedBlockSize - 1) / __compressedBlockSize;
+
+		ap::vector<ap::vector<uint8_t>> blocks(header.blockCount);
+		std::atomic_bool success{ true };
+
+		ap::jobsystem::context ctx;
+		ctx.priority = ap::jobsystem::GetLoadingPriority();
+		ap::jobsystem::Dispatch(ctx, (uint32_t)header.blockCount, 1, [&](ap::jobsystem::JobArgs args) {
+			const size_t offset = (size_t)args.jobIndex * __compressedBlockSize;
+			const size_t blocksize = std::min(size - offset, (size_t)__compressedBlockSize);
+			ap::vector<uint8_t>& block = blocks[args.jobIndex];
+			block.resize(ZSTD_compressBound(blocksize));
+			const size_t compressed_size = ZSTD_compress(block.data(), block.size(), data + offset, blocksize, __compressionLevel);
+			if (ZSTD_isError(compressed_size))
+			{
+				success.store(false);
+				return;
+			}
+			block.resize(compressed_size);
+		});
+		ap::jobsystem::Wait(ctx);
+
+		if (!success.load())
+			return false;
+
+		size_t total = sizeof(header) + blocks.size() * sizeof(uint64_t);
+		for (auto& block : blocks)
+		{
+			total += block.size();
+		}
+		result.resize(total);
+		uint8_t* dst = result.data();
+		std::memcpy(dst, &header, sizeof(header));
+		dst += sizeof(header);
+		for (auto& block : blocks)
+		{
+			const uint64_t compressed_size = block.size();
+			std::memcpy(dst, &compressed_size, sizeof(compressed_size));
+			dst += sizeof(compressed_size);
+		}
+		for (auto& block : blocks)
+		{
+			std::memcpy(dst, block.data(), block.size());
+			dst += block.size();
+		}
+		return true;
+	}
+
+	// The blocks are decompressed concurrently on the job system
+	//	If the source is a mapped file, reading of the file is overlapped with decompression too, as each block faults in its own pages
+	static bool Decompress(const uint8_t* data, size_t size, ap::vector<uint8_t>& result)
+	{
+		CompressedHeader header;
+		std::memcpy(&header, data, sizeof(header));
+		const size_t table_end = sizeof(header) + (size_t)header.blockCount * sizeof(uint64_t);
+		if (header.blockSize == 0 || table_end > size || header.blockCount != (header.size + header.blockSize - 1) / header.blockSize)
+			return false;
+
+		// The block offsets are resolved up front, so that every block can be decompressed independently:
+		ap::vector<uint64_t> offsets(header.blockCount + 1);
+		offsets[0] = table_end;
+		for (size_t i = 0; i < header.blockCount; ++i)
+		{
+			uint64_t compressed_size;
+			std::memcpy(&compressed_size, data + sizeof(header) + i * sizeof(uint64_t), sizeof(compressed_size));
+			offsets[i + 1] = offsets[i] + compressed_size;
+		}
+		if (offsets.back() > size)
+			return false;
+
+		result.resize((size_t)header.size);
+		std::atomic_bool success{ true };
+
+		ap::jobsystem::context ctx;
+		ctx.priority = ap::jobsystem::GetLoadingPriority();
+		ap::jobsystem::Dispatch(ctx, (uint32_t)header.blockCount, 1, [&](ap::jobsystem::JobArgs args) {
+			const size_t offset = (size_t)args.jobIndex * (size_t)header.blockSize;
+			const size_t blocksize = std::min((size_t)header.size - offset, (size_t)header.blockSize);
+			const size_t src_offset = (size_t)offsets[args.jobIndex];
+			const size_t src_size = (size_t)(offsets[args.jobIndex + 1] - offsets[args.jobIndex]);
+			const size_t decompressed_size = ZSTD_decompress(result.data() + offset, blocksize, data + src_offset, src_size);
+			if (ZSTD_isError(decompressed_size) || decompressed_size != blocksize)
+			{
+				success.store(false);
+			}
+		});
+		ap::jobsystem::Wait(ctx);
+
+		return success.load();
+	}
+
 	Archive::Archive()
 	{
 		CreateEmpty();
@@ -24,9 +149,25 @@ namespace ap
 			directory = ap::helper::GetDirectoryFromPath(fileName);
 			if (readMode)
 			{
-				if (ap::helper::FileRead(fileName, DATA))
+				size_t mapped_size = 0;
+				mapped_file = ap::helper::FileMap(fileName, mapped_size);
+				if (mapped_file != nullptr || ap::helper::FileRead(fileName, DATA))
 				{
-					data_ptr = DATA.data();
+					data_ptr = mapped_file != nullptr ? mapped_file.get() : DATA.data();
+					const size_t size = mapped_file != nullptr ? mapped_size : DATA.size();
+					if (IsCompressed(data_ptr, size))
+					{
+						ap::vector<uint8_t> decompressed;
+						if (!Decompress(data_ptr, size, decompressed))
+						{
+							ap::helper::messageBox("The compressed archive is corrupted!", "Error!");
+							Close();
+							return;
+						}
+						mapped_file.reset();
+						DATA = std::move(decompressed);
+						data_ptr = DATA.data();
+					}
 					(*this) >> version;
 					if (version < __archiveVersionBarrier)
 					{
@@ -66,6 +207,14 @@ namespace ap
 		readMode = isReadMode;
 		pos = 0;
 
+		if (!readMode && mapped_file != nullptr)
+		{
+			// The mapped file is read only, writing continues in an owned buffer
+			mapped_file.reset();
+			DATA.resize(128);
+			data_ptr = DATA.data();
+		}
+
 		if (readMode)
 		{
 			(*this) >> version;
@@ -80,16 +229,59 @@ namespace ap
 	{
 		if (!readMode && !fileName.empty())
 		{
-			SaveFile(fileName);
+			SaveFile(fileName, fileCompression);
 		}
 		DATA.clear();
+		mapped_file.reset();
+		data_ptr = nullptr;
 	}
 
-	bool Archive::SaveFile(const std::string& fileName)
+	bool Archive::SaveFile(const std::string& fileName, bool compressed)
 	{
+		if (compressed)
+		{
+			ap::vector<uint8_t> compressed_data;
+			if (!Compress(data_ptr, pos, compressed_data))
+			{
+				return false;
+			}
+			return ap::helper::FileWrite(fileName, compressed_data.data(), compressed_data.size());
+		}
 		return ap::helper::FileWrite(fileName, data_ptr, pos);
 	}
 
+	bool Archive::ConvertFile(const std::string& srcFileName, const std::string& dstFileName, bool compressed)
+	{
+		ap::vector<uint8_t> data;
+		if (!ap::helper::FileRead(srcFileName, data))
+		{
+			return false;
+		}
+		if (IsCompressed(data.data(), data.size()))
+		{
+			if (compressed)
+			{
+				return srcFileName == dstFileName || ap::helper::FileWrite(dstFileName, data.data(), data.size());
+			}
+			ap::vector<uint8_t> decompressed;
+			if (!Decompress(data.data(), data.size(), decompressed))
+			{
+				return false;
+			}
+			return ap::helper::FileWrite(dstFileName, decompressed.data(), decompressed.size());
+		}
+		if (compressed)
+		{
+			ap::vector<uint8_t> compressed_data;
+			if (!Compress(data.data(), data.size(), compressed_data))
+			{
+				return false;
+			}
+			return ap::helper::FileWrite(dstFileName, compressed_data.data(), compressed_data.size());
+		}
+		return srcFileName == dstFileName || ap::helper::FileWrite(dstFileName, data.data(), data.size());
+	}
+
 	bool Archive::SaveHeaderFile(const std::string& fileName, const std::string& dataName)
 	{
 		return ap::helper::Bin2H(data_ptr, pos, fileName, dataName.c_str());
@@ -105,4 +297,46 @@ namespace ap
 		return fileName;
 	}
 
+	Archive Archive::CreateChunk() const
+	{
+		Archive chunk;
+		chunk.directory = directory; // not the file name, because the chunk must not be saved to a file on closing
+		return chunk;
+	}
+
+	void Archive::WriteChunks(const Archive* chunks, size_t count)
+	{
+		(*this) << count;
+		for (size_t i = 0; i < count; ++i)
+		{
+			assert(!chunks[i].IsReadMode());
+			(*this) << chunks[i].GetPos();
+		}
+		for (size_t i = 0; i < count; ++i)
+		{
+			_write_bytes(chunks[i].GetData(), chunks[i].GetPos());
+		}
+	}
+
+	void Archive::ReadChunks(ap::vector<Archive>& chunks)
+	{
+		size_t count;
+		(*this) >> count;
+		chunks.resize(count);
+
+		// The size table is followed by the chunks, so all their offsets are known before opening any of them:
+		size_t offset = pos + count * sizeof(uint64_t);
+		for (size_t i = 0; i < count; ++i)
+		{
+			uint64_t size;
+			(*this) >> size;
+			Archive& chunk = chunks[i];
+			chunk = Archive(data_ptr + offset);
+			chunk.directory = directory;
+			chunk.mapped_file = mapped_file;
+			offset += (size_t)size;
+		}
+		pos = offset;
+	}
+
 }
@@ -4,6 +4,7 @@
 #include "apVector.h"
 
 #include <string>
+#include <memory>
 
 namespace ap
 {
@@ -19,9 +20,11 @@ namespace ap
 		size_t pos = 0; // position of the next memory operation, relative to the data's beginning
 		ap::vector<uint8_t> DATA; // data suitable for read/write operations
 		const uint8_t* data_ptr = nullptr; // this can either be a memory mapped pointer (read only), or the DATA's pointer
+		std::shared_ptr<const uint8_t> mapped_file; // keeps the file mapping alive while the archive (or a copy of it) is open
 
 		std::string fileName; // save to this file on closing if not empty
 		std::string directory; // the directory part from the fileName
+		bool fileCompression = false; // save the file in the compressed container format
 
 		void CreateEmpty(); // creates new archive in write mode
 
@@ -31,7 +34,8 @@ namespace ap
 		Archive(const Archive&) = default;
 		Archive(Archive&&) = default;
 		// Create archive from a file.
-		//	If readMode == true, the whole file will be loaded into the archive in read mode
+		//	If readMode == true, the file will be memory mapped in read mode (or loaded entirely if mapping is not supported)
+		//		Compressed files are detected and decompressed in parallel when opening
 		//	If readMode == false, the file will be written when the archive is destroyed or Close() is called
 		Archive(const std::string& fileName, bool readMode = true);
 		// Creates a memory mapped archive in read mode
@@ -52,9 +56,15 @@ namespace ap
 		//	If it was opened from a file in write mode, the file will be written at this point
 		//	The data will be deleted, the archive will be empty after this
 		void Close();
+		// If enabled, the file will be written in the compressed container format on closing
+		void SetFileCompression(bool value) { fileCompression = value; }
 		// Write the archive contents to a specific file
 		//	The archive data will be written starting from the beginning, to the current position
-		bool SaveFile(const std::string& fileName);
+		//	compressed : the data is written as independently compressed blocks, which can be decompressed in parallel when opening
+		bool SaveFile(const std::string& fileName, bool compressed = false);
+		// Convert an archive file between the raw and the compressed container format
+		//	srcFileName and dstFileName can be the same file
+		static bool ConvertFile(const std::string& srcFileName, const std::string& dstFileName, bool compressed);
 		// Write the archive contents into a C++ header file
 		//	dataName : it will be the name of the byte data array in the header, that can be memory mapped
 		bool SaveHeaderFile(const std::string& fileName, const std::string& dataName);
@@ -63,6 +73,17 @@ namespace ap
 		// If the archive was opened from a file, this will return the file's name
 		//	The file's name will include the directory as well
 		const std::string& GetSourceFileName() const;
+		// Returns the position of the next memory operation, which is also the size of the written data in write mode
+		constexpr size_t GetPos() const { return pos; }
+
+		// Chunks are independent archives stored inside an archive, they can be read concurrently with each other
+		//	Create an empty chunk in write mode, it inherits the source directory of this archive
+		Archive CreateChunk() const;
+		// Write the chunks into this archive, preceded by a table of their sizes
+		void WriteChunks(const Archive* chunks, size_t count);
+		// Open all the chunks that were written with WriteChunks() in read mode, and skip past them
+		//	The chunks reference this archive's memory, so they are only valid while this archive is open
+		void ReadChunks(ap::vector<Archive>& chunks);
 
 		// It could be templated but we have to be extremely careful of different datasizes on different platforms
 		// because serialized data should be interchangeable!
@@ -172,20 +193,32 @@ namespace ap
 		inline Archive& operator<<(const std::string& data)
 		{
 			(*this) << data.length();
-			for (const auto& x : data)
-			{
-				(*this) << x;
-			}
+			_write_bytes(data.data(), data.length()); // chars are serialized as int8_t, the same as in memory
 			return *this;
 		}
 		template<typename T>
 		inline Archive& operator<<(const ap::vector<T>& data)
 		{
-			// Here we will use the << operator so that non-specified types will have compile error!
 			(*this) << data.size();
-			for (const T& x : data)
+			if constexpr (_is_bulk_type<T>())
+			{
+				_write_bytes(data.data(), data.size() * sizeof(T));
+			}
+			else
 			{
-				(*this) << x;
+				if constexpr (_is_bulk_type_since_74<T>())
+				{
+					if (GetVersion() >= 74)
+					{
+						_write_bytes(data.data(), data.size() * sizeof(T));
+						return *this;
+					}
+				}
+				// Here we will use the << operator so that non-specified types will have compile error!
+				for (const T& x : data)
+				{
+					(*this) << x;
+				}
 			}
 			return *this;
 		}
@@ -314,10 +347,7 @@ namespace ap
 			uint64_t len;
 			(*this) >> len;
 			data.resize(len);
-			for (size_t i = 0; i < len; ++i)
-			{
-				(*this) >> data[i];
-			}
+			_read_bytes(data.data(), len);
 			if (!data.empty() && GetVersion() < 73)
 			{
 				// earlier versions of archive saved the strings with 0 terminator
@@ -328,17 +358,49 @@ namespace ap
 		template<typename T>
 		inline Archive& operator>>(ap::vector<T>& data)
 		{
-			// Here we will use the >> operator so that non-specified types will have compile error!
 			size_t count;
 			(*this) >> count;
 			data.resize(count);
-			for (size_t i = 0; i < count; ++i)
+			if constexpr (_is_bulk_type<T>())
 			{
-				(*this) >> data[i];
+				_read_bytes(data.data(), count * sizeof(T));
+			}
+			else
+			{
+				if constexpr (_is_bulk_type_since_74<T>())
+				{
+					if (GetVersion() >= 74)
+					{
+						_read_bytes(data.data(), count * sizeof(T));
+						return *this;
+					}
+				}
+				// Here we will use the >> operator so that non-specified types will have compile error!
+				for (size_t i = 0; i < count; ++i)
+				{
+					(*this) >> data[i];
+				}
 			}
 			return *this;
 		}
 
+		// Zero-copy read of an array that was written with operator<<(const ap::vector<T>&)
+		//	Instead of copying, it returns a pointer to the bytes of the array in the archive memory, or nullptr if the array is empty
+		//	count is the number of T elements, the array is count * sizeof(T) bytes
+		//	The pointer is only valid while the archive is open
+		//	It is not aligned for T, so elements must be read with memcpy, except for byte arrays, which can be used in place
+		template<typename T>
+		inline const uint8_t* MapVector(size_t& count)
+		{
+			static_assert(_is_bulk_type<T>(), "Only arrays that are serialized exactly as they are in memory can be mapped!");
+			assert(readMode);
+			assert(data_ptr != nullptr);
+			(*this) >> count;
+			const uint8_t* data = count > 0 ? data_ptr + pos : nullptr;
+			pos += count * sizeof(T);
+			return data;
+		}
+
 
 
 	private:
@@ -372,5 +434,63 @@ namespace ap
 			data = *(const T*)(data_ptr + pos);
 			pos += (size_t)(sizeof(data));
 		}
+
+		// Write a block of memory with a single bounds check
+		inline void _write_bytes(const void* data, size_t size)
+		{
+			assert(!readMode);
+			assert(!DATA.empty());
+			if (size == 0)
+				return;
+			const size_t _right = pos + size;
+			if (_right > DATA.size())
+			{
+				DATA.resize(_right * 2);
+				data_ptr = DATA.data();
+			}
+			std::memcpy(DATA.data() + pos, data, size);
+			pos = _right;
+		}
+
+		// Read a block of memory
+		inline void _read_bytes(void* data, size_t size)
+		{
+			assert(readMode);
+			assert(data_ptr != nullptr);
+			if (size == 0)
+				return;
+			std::memcpy(data, data_ptr + pos, size);
+			pos += size;
+		}
+
+		// Arrays of these types are serialized with a single memcpy, because every archive version stored them exactly as they are in memory
+		template<typename T>
+		static constexpr bool _is_bulk_type()
+		{
+			return
+				std::is_same_v<T, char> ||
+				std::is_same_v<T, uint8_t> ||
+				std::is_same_v<T, int64_t> ||
+				std::is_same_v<T, uint64_t> ||
+				std::is_same_v<T, float> ||
+				std::is_same_v<T, double> ||
+				std::is_same_v<T, XMFLOAT2> ||
+				std::is_same_v<T, XMFLOAT3> ||
+				std::is_same_v<T, XMFLOAT4> ||
+				std::is_same_v<T, XMFLOAT3X3> ||
+				std::is_same_v<T, XMFLOAT4X3> ||
+				std::is_same_v<T, XMFLOAT4X4> ||
+				std::is_same_v<T, XMUINT2> ||
+				std::is_same_v<T, XMUINT3> ||
+				std::is_same_v<T, XMUINT4>;
+		}
+		// Before archive version 74, 32-bit integer arrays were serialized element by element, widened to 64 bits
+		template<typename T>
+		static constexpr bool _is_bulk_type_since_74()
+		{
+			return
+				std::is_same_v<T, int32_t> ||
+				std::is_same_v<T, uint32_t>;
+		}
 	};
 }
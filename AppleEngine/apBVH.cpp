@@ -0,0 +1,377 @@
+#include "apBVH.h"
+
+using namespace ap::primitive;
+
+namespace ap
+{
+	static constexpr uint32_t BVH_BIN_COUNT = 16;
+	static constexpr uint32_t BVH_MAX_SAH_DEPTH = 64; // below this depth, nodes are split in half to keep the traversal stack bounded
+
+	static inline float SurfaceArea(const AABB& aabb)
+	{
+		const float x = std::max(0.0f, aabb._max.x - aabb._min.x);
+		const float y = std::max(0.0f, aabb._max.y - aabb._min.y);
+		const float z = std::max(0.0f, aabb._max.z - aabb._min.z);
+		return 2 * (x * y + y * z + z * x);
+	}
+	static inline void Grow(AABB& dst, const AABB& src)
+	{
+		dst._min = ap::math::Min(dst._min, src._min);
+		dst._max = ap::math::Max(dst._max, src._max);
+		dst.layerMask |= src.layerMask;
+	}
+
+	// Node area weighted by the intersection count that it costs, the sum of these relative to the root is proportional to the expected traversal cost of a random ray
+	static inline float NodeArea(const BVH::Node& node)
+	{
+		const float area = SurfaceArea(node.aabb);
+		return node.IsLeaf() ? area * node.count : area;
+	}
+	static float ComputeAreaSum(const ap::vector<BVH::Node>& nodes)
+	{
+		float sum = 0;
+		for (auto& node : nodes)
+		{
+			sum += NodeArea(node);
+		}
+		return sum;
+	}
+	static inline float ComputeCost(const ap::vector<BVH::Node>& nodes, float area_sum)
+	{
+		const float root_area = SurfaceArea(nodes[0].aabb);
+		return root_area > 0 ? area_sum / root_area : 0;
+	}
+
+	void BVH::Build(const AABB* aabbs, uint32_t count, uint32_t max_leaf_size)
+	{
+		Clear();
+		if (count == 0)
+			return;
+
+		// The leaves are sorted in a copy of their bounds, so that the build reads memory linearly:
+		struct Leaf
+		{
+			AABB aabb;
+			XMFLOAT3 center;
+			uint32_t index;
+		};
+		ap::vector<Leaf> leaves(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			leaves[i].aabb = aabbs[i];
+			leaves[i].center = XMFLOAT3(
+				(aabbs[i]._min.x + aabbs[i]._max.x) * 0.5f,
+				(aabbs[i]._min.y + aabbs[i]._max.y) * 0.5f,
+				(aabbs[i]._min.z + aabbs[i]._max.z) * 0.5f
+			);
+			leaves[i].index = i;
+		}
+
+		nodes.reserve(count * 2 - 1);
+		parents.reserve(count * 2 - 1);
+		nodes.emplace_back();
+		parents.push_back(0);
+		nodes[0].offset = 0;
+		nodes[0].count = count;
+
+		struct Task
+		{
+			uint32_t node;
+			uint32_t depth;
+		};
+		ap::vector<Task> tasks;
+		tasks.push_back({ 0, 0 });
+
+		struct Bin
+		{
+			AABB aabb;
+			uint32_t count = 0;
+		};
+
+		while (!tasks.empty())
+		{
+			const Task task = tasks.back();
+			tasks.pop_back();
+
+			const uint32_t first = nodes[task.node].offset;
+			const uint32_t node_count = nodes[task.node].count;
+
+			AABB bounds;
+			bounds.layerMask = 0;
+			AABB center_bounds;
+			for (uint32_t i = first; i < first + node_count; ++i)
+			{
+				const Leaf& leaf = leaves[i];
+				Grow(bounds, leaf.aabb);
+				center_bounds._min = ap::math::Min(center_bounds._min, leaf.center);
+				center_bounds._max = ap::math::Max(center_bounds._max, leaf.center);
+			}
+			nodes[task.node].aabb = bounds;
+
+			if (node_count <= 1)
+				continue;
+
+			// Find the cheapest binned split plane over all three axes:
+			int best_axis = -1;
+			uint32_t best_split = 0;
+			float best_cost = std::numeric_limits<float>::max();
+			// Two leaves that must be split can only be split one way, binning them would be wasted work:
+			const bool trivial_split = node_count == 2 && node_count > max_leaf_size;
+			if (task.depth < BVH_MAX_SAH_DEPTH && !trivial_split)
+			{
+				// All three axes are binned in one pass over the leaves:
+				Bin bins[3][BVH_BIN_COUNT];
+				float axis_min[3];
+				float axis_scale[3];
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					axis_min[axis] = (&center_bounds._min.x)[axis];
+					const float extent = (&center_bounds._max.x)[axis] - axis_min[axis];
+					axis_scale[axis] = extent > 0 ? BVH_BIN_COUNT / extent : 0;
+				}
+				for (uint32_t i = first; i < first + node_count; ++i)
+				{
+					const Leaf& leaf = leaves[i];
+					for (int axis = 0; axis < 3; ++axis)
+					{
+						const uint32_t bin = std::min(BVH_BIN_COUNT - 1, uint32_t(((&leaf.center.x)[axis] - axis_min[axis]) * axis_scale[axis]));
+						bins[axis][bin].count++;
+						Grow(bins[axis][bin].aabb, leaf.aabb);
+					}
+				}
+
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					if (axis_scale[axis] <= 0)
+						continue;
+
+					float right_area[BVH_BIN_COUNT - 1];
+					uint32_t right_count[BVH_BIN_COUNT - 1];
+					AABB right_bounds;
+					uint32_t right_sum = 0;
+					for (uint32_t i = BVH_BIN_COUNT - 1; i > 0; --i)
+					{
+						right_sum += bins[axis][i].count;
+						Grow(right_bounds, bins[axis][i].aabb);
+						right_count[i - 1] = right_sum;
+						right_area[i - 1] = SurfaceArea(right_bounds);
+					}
+
+					AABB left_bounds;
+					uint32_t left_sum = 0;
+					for (uint32_t i = 0; i < BVH_BIN_COUNT - 1; ++i)
+					{
+						left_sum += bins[axis][i].count;
+						Grow(left_bounds, bins[axis][i].aabb);
+						if (left_sum == 0 || right_count[i] == 0)
+							continue;
+						const float cost = SurfaceArea(left_bounds) * left_sum + right_area[i] * right_count[i];
+						if (cost < best_cost)
+						{
+							best_cost = cost;
+							best_axis = axis;
+							best_split = i + 1;
+						}
+					}
+				}
+			}
+
+			uint32_t mid = first;
+			if (best_axis >= 0)
+			{
+				// Make a leaf if splitting doesn't pay off (traversal cost is counted as one intersection):
+				const float parent_area = SurfaceArea(bounds);
+				const float split_cost = parent_area > 0 ? 1 + best_cost / parent_area : std::numeric_limits<float>::max();
+				if (node_count <= max_leaf_size && split_cost >= float(node_count))
+					continue;
+
+				const float axis_min = (&center_bounds._min.x)[best_axis];
+				const float scale = BVH_BIN_COUNT / ((&center_bounds._max.x)[best_axis] - axis_min);
+				Leaf* begin = leaves.data() + first;
+				Leaf* end = begin + node_count;
+				mid = uint32_t(std::partition(begin, end, [&](const Leaf& leaf) {
+					const uint32_t bin = std::min(BVH_BIN_COUNT - 1, uint32_t(((&leaf.center.x)[best_axis] - axis_min) * scale));
+					return bin < best_split;
+				}) - leaves.data());
+			}
+			else
+			{
+				if (node_count <= max_leaf_size)
+					continue;
+				if (task.depth >= BVH_MAX_SAH_DEPTH)
+				{
+					// Too deep, split at the median of the widest centroid axis:
+					const XMFLOAT3 extent = XMFLOAT3(
+						center_bounds._max.x - center_bounds._min.x,
+						center_bounds._max.y - center_bounds._min.y,
+						center_bounds._max.z - center_bounds._min.z
+					);
+					const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+					Leaf* begin = leaves.data() + first;
+					std::nth_element(begin, begin + node_count / 2, begin + node_count, [&](const Leaf& a, const Leaf& b) {
+						return (&a.center.x)[axis] < (&b.center.x)[axis];
+					});
+				}
+			}
+			if (mid == first || mid == first + node_count)
+			{
+				// All centers are at the same place (or the depth limit was reached), just split in half:
+				mid = first + node_count / 2;
+			}
+
+			const uint32_t left = (uint32_t)nodes.size();
+			nodes.emplace_back();
+			nodes.emplace_back();
+			parents.push_back(task.node);
+			parents.push_back(task.node);
+			nodes[left].offset = first;
+			nodes[left].count = mid - first;
+			nodes[left + 1].offset = mid;
+			nodes[left + 1].count = first + node_count - mid;
+			nodes[task.node].offset = left;
+			nodes[task.node].count = 0;
+
+			tasks.push_back({ left + 1, task.depth + 1 });
+			tasks.push_back({ left, task.depth + 1 });
+		}
+
+		leaf_count = count;
+		leaf_indices.resize(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			leaf_indices[i] = leaves[i].index;
+		}
+		leaf_nodes.resize(count);
+		for (uint32_t i = 0; i < (uint32_t)nodes.size(); ++i)
+		{
+			const Node& node = nodes[i];
+			for (uint32_t j = 0; j < node.count; ++j)
+			{
+				leaf_nodes[leaf_indices[node.offset + j]] = i;
+			}
+		}
+
+		area_sum = ComputeAreaSum(nodes);
+		build_cost = ComputeCost(nodes, area_sum);
+		cost = build_cost;
+	}
+
+	void BVH::Refit(const AABB* aabbs)
+	{
+		// Children are always placed after their parent, so a reverse iteration updates bottom-up:
+		for (size_t i = nodes.size(); i > 0; --i)
+		{
+			Node& node = nodes[i - 1];
+			AABB bounds;
+			bounds.layerMask = 0;
+			if (node.IsLeaf())
+			{
+				for (uint32_t j = 0; j < node.count; ++j)
+				{
+					Grow(bounds, aabbs[leaf_indices[node.offset + j]]);
+				}
+			}
+			else
+			{
+				Grow(bounds, nodes[node.offset].aabb);
+				Grow(bounds, nodes[node.offset + 1].aabb);
+			}
+			node.aabb = bounds;
+		}
+
+		if (!nodes.empty())
+		{
+			area_sum = ComputeAreaSum(nodes);
+			cost = ComputeCost(nodes, area_sum);
+		}
+	}
+
+	void BVH::Refit(const AABB* aabbs, const uint32_t* changed, uint32_t changed_count)
+	{
+		if (nodes.empty() || changed_count == 0)
+			return;
+
+		for (uint32_t i = 0; i < changed_count; ++i)
+		{
+			assert(changed[i] < leaf_count);
+			uint32_t index = leaf_nodes[changed[i]];
+			while (true)
+			{
+				Node& node = nodes[index];
+				AABB bounds;
+				bounds.layerMask = 0;
+				if (node.IsLeaf())
+				{
+					for (uint32_t j = 0; j < node.count; ++j)
+					{
+						Grow(bounds, aabbs[leaf_indices[node.offset + j]]);
+					}
+				}
+				else
+				{
+					Grow(bounds, nodes[node.offset].aabb);
+					Grow(bounds, nodes[node.offset + 1].aabb);
+				}
+
+				if (bounds._min.x == node.aabb._min.x && bounds._min.y == node.aabb._min.y && bounds._min.z == node.aabb._min.z &&
+					bounds._max.x == node.aabb._max.x && bounds._max.y == node.aabb._max.y && bounds._max.z == node.aabb._max.z &&
+					bounds.layerMask == node.aabb.layerMask)
+				{
+					break; // the nodes above didn't change either
+				}
+
+				area_sum -= NodeArea(node);
+				node.aabb = bounds;
+				area_sum += NodeArea(node);
+
+				if (index == 0)
+					break;
+				index = parents[index];
+			}
+		}
+
+		cost = ComputeCost(nodes, area_sum);
+	}
+
+	bool BVH::IsRebuildRecommended() const
+	{
+		return cost > build_cost * 1.5f;
+	}
+
+	void BVH::Clear()
+	{
+		nodes.clear();
+		leaf_indices.clear();
+		parents.clear();
+		leaf_nodes.clear();
+		leaf_count = 0;
+		build_cost = 0;
+		cost = 0;
+		area_sum = 0;
+	}
+
+	void BVH::GetSubtrees(uint32_t count, ap::vector<uint32_t>& roots) const
+	{
+		roots.clear();
+		if (nodes.empty())
+			return;
+
+		// Split the subtrees breadth first, so that they will have similar sizes:
+		roots.push_back(0);
+		bool split = true;
+		while (split && roots.size() < count)
+		{
+			split = false;
+			const size_t level_count = roots.size();
+			for (size_t i = 0; i < level_count && roots.size() < count; ++i)
+			{
+				const Node& node = nodes[roots[i]];
+				if (node.IsLeaf())
+					continue;
+				roots[i] = node.offset;
+				roots.push_back(node.offset + 1);
+				split = true;
+			}
+		}
+	}
+}
@@ -0,0 +1,328 @@
+#pragma once
+#include "CommonInclude.h"
+#include "apPrimitive.h"
+#include "apVector.h"
+
+namespace ap
+{
+	// CPU bounding volume hierarchy over an array of AABBs (triangles of a mesh, objects of a scene, etc.)
+	//	Build() makes a binned SAH tree, Refit() updates the node bounds in place when the leaf AABBs moved but the topology can stay
+	struct BVH
+	{
+		struct Node
+		{
+			ap::primitive::AABB aabb; // aabb.layerMask is the union of the leaf layer masks below this node
+			uint32_t offset = 0; // interior: index of left child (right child is offset + 1), leaf: index of first entry in leaf_indices
+			uint32_t count = 0; // 0 for interior nodes, otherwise the number of leaves
+
+			constexpr bool IsLeaf() const { return count > 0; }
+		};
+		ap::vector<Node> nodes;
+		ap::vector<uint32_t> leaf_indices; // indices into the AABB array that the tree was built from
+		ap::vector<uint32_t> parents; // parent node index of every node, the root is its own parent
+		ap::vector<uint32_t> leaf_nodes; // leaf node index of every AABB that the tree was built from
+		uint32_t leaf_count = 0; // number of AABBs that the tree was built from
+		float build_cost = 0; // SAH cost of the tree right after Build()
+		float cost = 0; // SAH cost of the tree after the last Build() or Refit()
+		float area_sum = 0; // cost before it was divided by the root area, so that partial refits can update it
+
+		bool IsValid() const { return !nodes.empty(); }
+
+		// Build the tree from scratch using the surface area heuristic
+		//	max_leaf_size: leaves with more AABBs than this are always split
+		void Build(const ap::primitive::AABB* aabbs, uint32_t count, uint32_t max_leaf_size = 4);
+
+		// Update the node bounds from the same leaf AABB array, the tree structure is not modified
+		//	The leaf count must match the count that was used in Build()
+		void Refit(const ap::primitive::AABB* aabbs);
+
+		// Update only the nodes above the AABBs that changed (changed: indices into the AABB array)
+		//	This is cheaper than the full Refit() when only a few leaves moved, for example the dynamic objects of a mostly static scene
+		void Refit(const ap::primitive::AABB* aabbs, const uint32_t* changed, uint32_t changed_count);
+
+		// Returns true if the tree bounds got so much worse because of Refit() that it should be rebuilt
+		bool IsRebuildRecommended() const;
+
+		void Clear();
+
+		size_t GetMemorySize() const { return nodes.size() * (sizeof(Node) + sizeof(uint32_t)) + leaf_indices.size() * sizeof(uint32_t) * 2; }
+
+		// Gather at least count disjoint subtrees that together cover the whole tree (unless the tree has fewer leaves)
+		//	The subtrees can be traversed in parallel by passing them as root to the traversal functions
+		void GetSubtrees(uint32_t count, ap::vector<uint32_t>& roots) const;
+
+		// Traverse the tree by nearest nodes first along a ray
+		//	tmax: the farthest distance to look for hits, the callback can shrink it to cull the remaining nodes
+		//	callback: void(uint32_t leaf_index, float& tmax), leaf_index is the index into the AABB array that the tree was built from
+		template<typename LeafCallback>
+		void IntersectsRay(const ap::primitive::Ray& ray, float& tmax, uint32_t layerMask, LeafCallback callback) const;
+
+		// Traverse all nodes that the test accepts
+		//	test: bool(const ap::primitive::AABB& aabb), for example an overlap test with a query volume
+		//	callback: bool(uint32_t leaf_index), return false to stop the traversal
+		template<typename NodeTest, typename LeafCallback>
+		void Intersects(NodeTest test, uint32_t layerMask, LeafCallback callback) const;
+
+		// Traverse all nodes that are not outside of the frustum, subtrees that are completely inside are accepted without further tests
+		//	callback: void(uint32_t leaf_index), the leaves are only tested by their node bounds (so exactly when max_leaf_size was 1)
+		//	root: the node to start from, see GetSubtrees()
+		template<typename LeafCallback>
+		void IntersectsFrustum(const ap::primitive::Frustum& frustum, uint32_t layerMask, LeafCallback callback, uint32_t root = 0) const;
+
+		// Same as above, but the nodes that are not outside of the frustum must also be accepted by the test
+		//	test: bool(const ap::primitive::AABB& aabb), for example an occlusion test, rejected nodes are skipped with their whole subtree
+		template<typename NodeTest, typename LeafCallback>
+		void IntersectsFrustum(const ap::primitive::Frustum& frustum, uint32_t layerMask, NodeTest test, LeafCallback callback, uint32_t root = 0) const;
+
+		// Traverse the tree with four rays at once, nodes are visited while at least one ray of the packet hits them
+		//	callback: void(uint32_t leaf_index, uint32_t ray_mask), ray_mask has the bits of the rays that reached the leaf
+		//	The callback can shrink the tmax of the packet lanes with RayPacket4::SetTMax() to cull the remaining nodes
+		template<typename LeafCallback>
+		void IntersectsRayPacket(ap::primitive::RayPacket4& packet, uint32_t layerMask, LeafCallback callback) const;
+
+		// Returns true if the ray enters the box before tmax, distance receives the entry distance
+		static inline bool RayIntersects(
+			const XMVECTOR& origin,
+			const XMVECTOR& direction_inverse,
+			float tmax,
+			const ap::primitive::AABB& aabb,
+			float& distance
+		)
+		{
+			const XMVECTOR t0 = XMVectorMultiply(XMVectorSubtract(XMLoadFloat3(&aabb._min), origin), direction_inverse);
+			const XMVECTOR t1 = XMVectorMultiply(XMVectorSubtract(XMLoadFloat3(&aabb._max), origin), direction_inverse);
+			// Slabs that are parallel to the ray and contain it don't limit it, the same as in RayPacket4::intersects()
+			const XMVECTOR unlimited = XMVectorIsNaN(XMVectorAdd(t0, t1));
+			const XMVECTOR tmin3 = XMVectorSelect(XMVectorMin(t0, t1), g_XMNegInfinity, unlimited);
+			const XMVECTOR tmax3 = XMVectorSelect(XMVectorMax(t0, t1), g_XMInfinity, unlimited);
+			const float tenter = std::max(std::max(XMVectorGetX(tmin3), XMVectorGetY(tmin3)), std::max(XMVectorGetZ(tmin3), 0.0f));
+			const float texit = std::min(std::min(XMVectorGetX(tmax3), XMVectorGetY(tmax3)), std::min(XMVectorGetZ(tmax3), tmax));
+			distance = tenter;
+			return tenter <= texit;
+		}
+	};
+
+	template<typename LeafCallback>
+	inline void BVH::IntersectsRay(const ap::primitive::Ray& ray, float& tmax, uint32_t layerMask, LeafCallback callback) const
+	{
+		if (nodes.empty())
+			return;
+
+		const XMVECTOR origin = XMLoadFloat3(&ray.origin);
+		const XMVECTOR direction_inverse = XMLoadFloat3(&ray.direction_inverse);
+
+		float distance;
+		if ((nodes[0].aabb.layerMask & layerMask) == 0 || !RayIntersects(origin, direction_inverse, tmax, nodes[0].aabb, distance))
+			return;
+
+		struct StackEntry
+		{
+			uint32_t node;
+			float distance;
+		};
+		StackEntry stack[128];
+		uint32_t stack_size = 0;
+		stack[stack_size++] = { 0, distance };
+
+		while (stack_size > 0)
+		{
+			const StackEntry entry = stack[--stack_size];
+			if (entry.distance > tmax)
+				continue; // a closer hit was found since this node was pushed
+
+			const Node& node = nodes[entry.node];
+			if (node.IsLeaf())
+			{
+				for (uint32_t i = 0; i < node.count; ++i)
+				{
+					callback(leaf_indices[node.offset + i], tmax);
+				}
+				continue;
+			}
+
+			const Node& left = nodes[node.offset];
+			const Node& right = nodes[node.offset + 1];
+			float dist_left;
+			float dist_right;
+			const bool hit_left = (left.aabb.layerMask & layerMask) && RayIntersects(origin, direction_inverse, tmax, left.aabb, dist_left);
+			const bool hit_right = (right.aabb.layerMask & layerMask) && RayIntersects(origin, direction_inverse, tmax, right.aabb, dist_right);
+
+			// The farther child is pushed first so that the nearer child will be popped first:
+			if (hit_left && hit_right)
+			{
+				assert(stack_size + 2 <= arraysize(stack));
+				if (dist_left < dist_right)
+				{
+					stack[stack_size++] = { node.offset + 1, dist_right };
+					stack[stack_size++] = { node.offset, dist_left };
+				}
+				else
+				{
+					stack[stack_size++] = { node.offset, dist_left };
+					stack[stack_size++] = { node.offset + 1, dist_right };
+				}
+			}
+			else if (hit_left)
+			{
+				assert(stack_size < arraysize(stack));
+				stack[stack_size++] = { node.offset, dist_left };
+			}
+			else if (hit_right)
+			{
+				assert(stack_size < arraysize(stack));
+				stack[stack_size++] = { node.offset + 1, dist_right };
+			}
+		}
+	}
+
+	template<typename NodeTest, typename LeafCallback>
+	inline void BVH::Intersects(NodeTest test, uint32_t layerMask, LeafCallback callback) const
+	{
+		if (nodes.empty())
+			return;
+
+		uint32_t stack[128];
+		uint32_t stack_size = 0;
+		stack[stack_size++] = 0;
+
+		while (stack_size > 0)
+		{
+			const Node& node = nodes[stack[--stack_size]];
+			if ((node.aabb.layerMask & layerMask) == 0 || !test(node.aabb))
+				continue;
+
+			if (node.IsLeaf())
+			{
+				for (uint32_t i = 0; i < node.count; ++i)
+				{
+					if (!callback(leaf_indices[node.offset + i]))
+						return;
+				}
+				continue;
+			}
+
+			assert(stack_size + 2 <= arraysize(stack));
+			stack[stack_size++] = node.offset + 1;
+			stack[stack_size++] = node.offset;
+		}
+	}
+
+	template<typename LeafCallback>
+	inline void BVH::IntersectsRayPacket(ap::primitive::RayPacket4& packet, uint32_t layerMask, LeafCallback callback) const
+	{
+		if (nodes.empty())
+			return;
+
+		uint32_t stack[128];
+		uint32_t stack_size = 0;
+		stack[stack_size++] = 0;
+
+		while (stack_size > 0)
+		{
+			const Node& node = nodes[stack[--stack_size]];
+			if ((node.aabb.layerMask & layerMask) == 0)
+				continue;
+
+			// The node is tested again when it is popped, because the callback could have shrunk tmax since it was pushed:
+			XMVECTOR distance;
+			const uint32_t mask = packet.intersects(node.aabb, &distance);
+			if (mask == 0)
+				continue;
+
+			if (node.IsLeaf())
+			{
+				for (uint32_t i = 0; i < node.count; ++i)
+				{
+					callback(leaf_indices[node.offset + i], mask);
+				}
+				continue;
+			}
+
+			// Children are ordered by the entry distances of the rays that hit this node, nearer child is popped first:
+			const Node& left = nodes[node.offset];
+			const Node& right = nodes[node.offset + 1];
+			XMVECTOR dist_left;
+			XMVECTOR dist_right;
+			const uint32_t mask_left = packet.intersects(left.aabb, &dist_left) & mask;
+			const uint32_t mask_right = packet.intersects(right.aabb, &dist_right) & mask;
+			const uint32_t closer_left = ap::math::VectorMoveMask(XMVectorLess(dist_left, dist_right)) & mask_left & mask_right;
+
+			assert(stack_size + 2 <= arraysize(stack));
+			if (mask_left && mask_right)
+			{
+				if (closer_left)
+				{
+					stack[stack_size++] = node.offset + 1;
+					stack[stack_size++] = node.offset;
+				}
+				else
+				{
+					stack[stack_size++] = node.offset;
+					stack[stack_size++] = node.offset + 1;
+				}
+			}
+			else if (mask_left)
+			{
+				stack[stack_size++] = node.offset;
+			}
+			else if (mask_right)
+			{
+				stack[stack_size++] = node.offset + 1;
+			}
+		}
+	}
+
+	template<typename LeafCallback>
+	inline void BVH::IntersectsFrustum(const ap::primitive::Frustum& frustum, uint32_t layerMask, LeafCallback callback, uint32_t root) const
+	{
+		IntersectsFrustum(frustum, layerMask, [](const ap::primitive::AABB&) { return true; }, callback, root);
+	}
+
+	template<typename NodeTest, typename LeafCallback>
+	inline void BVH::IntersectsFrustum(const ap::primitive::Frustum& frustum, uint32_t layerMask, NodeTest test, LeafCallback callback, uint32_t root) const
+	{
+		if (nodes.empty())
+			return;
+
+		struct StackEntry
+		{
+			uint32_t node;
+			bool inside; // the parent was completely inside the frustum
+		};
+		StackEntry stack[128];
+		uint32_t stack_size = 0;
+		stack[stack_size++] = { root, false };
+
+		while (stack_size > 0)
+		{
+			const StackEntry entry = stack[--stack_size];
+			const Node& node = nodes[entry.node];
+			if ((node.aabb.layerMask & layerMask) == 0)
+				continue;
+
+			bool inside = entry.inside;
+			if (!inside)
+			{
+				const ap::primitive::Frustum::BoxFrustumIntersect result = frustum.CheckBox(node.aabb);
+				if (result == ap::primitive::Frustum::BOX_FRUSTUM_OUTSIDE)
+					continue;
+				inside = result == ap::primitive::Frustum::BOX_FRUSTUM_INSIDE;
+			}
+			if (!test(node.aabb))
+				continue;
+
+			if (node.IsLeaf())
+			{
+				for (uint32_t i = 0; i < node.count; ++i)
+				{
+					callback(leaf_indices[node.offset + i]);
+				}
+				continue;
+			}
+
+			assert(stack_size + 2 <= arraysize(stack));
+			stack[stack_size++] = { node.offset + 1, inside };
+			stack[stack_size++] = { node.offset, inside };
+		}
+	}
+}
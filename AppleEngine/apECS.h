@@ -29,9 +29,14 @@ namespace ap::ecs
 	struct EntitySerializer
 	{
 		ap::jobsystem::context ctx; // allow components to spawn serialization subtasks
-		ap::unordered_map<uint64_t, Entity> remap;
+		ap::unordered_map<uint64_t, Entity> remap; // only used in read mode
 		bool allow_remap = true;
+		bool remap_resolved = false; // the remap was filled up front, it will be only read, so it can be used from multiple threads
 
+		EntitySerializer()
+		{
+			ctx.priority = ap::jobsystem::GetLoadingPriority(); // streaming only when this is an asynchronous load, synchronous loads use all frame workers
+		}
 		~EntitySerializer()
 		{
 			ap::jobsystem::Wait(ctx); // automatically wait for all subtasks after serialization
@@ -57,7 +62,12 @@ namespace ap::ecs
 				auto it = seri.remap.find(mem);
 				if (it == seri.remap.end())
 				{
-
+					if (seri.remap_resolved)
+					{
+						// the entity was not written in the entity table (it had no components), the reference can't be resolved
+						entity = INVALID_ENTITY;
+						return;
+					}
 					entity = CreateEntity();
 					seri.remap[mem] = entity;
 				}
@@ -77,8 +87,127 @@ namespace ap::ecs
 		}
 	}
 
+	// Component index that is returned when an entity doesn't have the component
+	static constexpr size_t INVALID_INDEX = ~size_t(0);
+
+	// Entity -> component index lookup that uses a hash map
+	//	Memory is proportional to the number of components, this is the default
+	class HashLookup
+	{
+	public:
+		inline void Reserve(size_t count) { lookup.reserve(count); }
+		inline void Clear() { lookup.clear(); }
+		inline size_t GetCount() const { return lookup.size(); }
+
+		inline size_t Find(Entity entity) const
+		{
+			const auto it = lookup.find(entity);
+			if (it != lookup.end())
+			{
+				return it->second;
+			}
+			return INVALID_INDEX;
+		}
+		inline void Set(Entity entity, size_t index)
+		{
+			lookup[entity] = index;
+		}
+		inline void Erase(Entity entity)
+		{
+			lookup.erase(entity);
+		}
+
+	private:
+		ap::unordered_map<Entity, size_t> lookup;
+	};
+
+	// Entity -> component index lookup that uses a paged sparse array indexed by the entity
+	//	Lookup is an array read without hashing, which is best for components that most entities have and that are looked up in hot loops
+	//	Memory is proportional to the range of entities that have the component, pages are allocated on demand and freed when they become empty
+	class SparseLookup
+	{
+	public:
+		inline void Reserve(size_t count) {}
+		inline void Clear()
+		{
+			pages.clear();
+			count = 0;
+		}
+		inline size_t GetCount() const { return count; }
+
+		inline size_t Find(Entity entity) const
+		{
+			const size_t page = entity >> PAGE_SHIFT;
+			if (page < pages.size() && !pages[page].indices.empty())
+			{
+				const uint32_t index = pages[page].indices[entity & PAGE_MASK];
+				if (index != INVALID_SLOT)
+				{
+					return index;
+				}
+			}
+			return INVALID_INDEX;
+		}
+		inline void Set(Entity entity, size_t index)
+		{
+			assert(index < INVALID_SLOT);
+			const size_t page = entity >> PAGE_SHIFT;
+			if (page >= pages.size())
+			{
+				pages.resize(page + 1);
+			}
+			Page& p = pages[page];
+			if (p.indices.empty())
+			{
+				p.indices.resize(PAGE_SIZE, INVALID_SLOT);
+			}
+			uint32_t& slot = p.indices[entity & PAGE_MASK];
+			if (slot == INVALID_SLOT)
+			{
+				p.count++;
+				count++;
+			}
+			slot = (uint32_t)index;
+		}
+		inline void Erase(Entity entity)
+		{
+			const size_t page = entity >> PAGE_SHIFT;
+			if (page >= pages.size() || pages[page].indices.empty())
+			{
+				return;
+			}
+			Page& p = pages[page];
+			uint32_t& slot = p.indices[entity & PAGE_MASK];
+			if (slot == INVALID_SLOT)
+			{
+				return;
+			}
+			slot = INVALID_SLOT;
+			count--;
+			if (--p.count == 0)
+			{
+				p.indices.clear();
+				p.indices.shrink_to_fit();
+			}
+		}
+
+	private:
+		static constexpr uint32_t PAGE_SHIFT = 12;
+		static constexpr uint32_t PAGE_SIZE = 1u << PAGE_SHIFT;
+		static constexpr uint32_t PAGE_MASK = PAGE_SIZE - 1;
+		static constexpr uint32_t INVALID_SLOT = ~0u;
+		struct Page
+		{
+			ap::vector<uint32_t> indices; // empty if the page is not allocated
+			uint32_t count = 0;
+		};
+		ap::vector<Page> pages;
+		size_t count = 0;
+	};
+
 	// The ComponentManager is a container that stores components and matches them with entities
-	template<typename Component>
+	//	The Lookup parameter selects how entities are mapped to components (HashLookup or SparseLookup)
+	template<typename Component, typename Lookup = HashLookup>
 	class ComponentManager
 	{
 	public:
@@ -88,7 +217,7 @@ namespace ap::ecs
 		{
 			components.reserve(reservedCount);
 			entities.reserve(reservedCount);
-			lookup.reserve(reservedCount);
+			lookup.Reserve(reservedCount);
 		}
 
 		// Clear the whole container
@@ -96,11 +225,11 @@ namespace ap::ecs
 		{
 			components.clear();
 			entities.clear();
-			lookup.clear();
+			lookup.Clear();
 		}
 
 		// Perform deep copy of all the contents of "other" into this
-		inline void Copy(const ComponentManager<Component>& other)
+		inline void Copy(const ComponentManager<Component, Lookup>& other)
 		{
 			Clear();
 			components = other.components;
@@ -111,18 +240,18 @@ namespace ap::ecs
 		// Merge in an other component manager of the same type to this. 
 		//	The other component manager MUST NOT contain any of the same entities!
 		//	The other component manager is not retained after this operation!
-		inline void Merge(ComponentManager<Component>& other)
+		inline void Merge(ComponentManager<Component, Lookup>& other)
 		{
 			components.reserve(GetCount() + other.GetCount());
 			entities.reserve(GetCount() + other.GetCount());
-			lookup.reserve(GetCount() + other.GetCount());
+			lookup.Reserve(GetCount() + other.GetCount());
 
 			for (size_t i = 0; i < other.GetCount(); ++i)
 			{
 				Entity entity = other.entities[i];
 				assert(!Contains(entity));
 				entities.push_back(entity);
-				lookup[entity] = components.size();
+				lookup.Set(entity, components.size());
 				components.push_back(std::move(other.components[i]));
 			}
 
@@ -151,7 +280,7 @@ namespace ap::ecs
 					Entity entity;
 					SerializeEntity(archive, entity, seri);
 					entities[i] = entity;
-					lookup[entity] = i;
+					lookup.Set(entity, i);
 				}
 			}
 			else
@@ -168,6 +297,35 @@ namespace ap::ecs
 			}
 		}
 
+		// Read/Write the components in the range [offset, offset + count) together with their entities
+		//	This is used to split serialization into independent parts, which can be read concurrently
+		//	In read mode, the manager must be prepared with BeginSerializeRanges() and the ranges must not overlap
+		inline void SerializeRange(ap::Archive& archive, EntitySerializer& seri, size_t offset, size_t count)
+		{
+			assert(offset + count <= components.size());
+			for (size_t i = offset; i < offset + count; ++i)
+			{
+				components[i].Serialize(archive, seri);
+				SerializeEntity(archive, entities[i], seri);
+			}
+		}
+		// Clear the manager and make room for count components, that will be read with SerializeRange()
+		inline void BeginSerializeRanges(size_t count)
+		{
+			Clear();
+			components.resize(count);
+			entities.resize(count);
+		}
+		// Build the entity lookup after all ranges were read with SerializeRange()
+		inline void EndSerializeRanges()
+		{
+			lookup.Reserve(entities.size());
+			for (size_t i = 0; i < entities.size(); ++i)
+			{
+				lookup.Set(entities[i], i);
+			}
+		}
+
 		// Create a new component and retrieve a reference to it
 		inline Component& Create(Entity entity)
 		{
@@ -175,14 +333,14 @@ namespace ap::ecs
 			assert(entity != INVALID_ENTITY);
 
 			// Only one of this component type per entity is allowed!
-			assert(lookup.find(entity) == lookup.end());
+			assert(!Contains(entity));
 
 			// Entity count must always be the same as the number of coponents!
 			assert(entities.size() == components.size());
-			assert(lookup.size() == components.size());
+			assert(lookup.GetCount() == components.size());
 
 			// Update the entity lookup table:
-			lookup[entity] = components.size();
+			lookup.Set(entity, components.size());
 
 			// New components are always pushed to the end:
 			components.emplace_back();
@@ -196,11 +354,10 @@ namespace ap::ecs
 		// Remove a component of a certain entity if it exists
 		inline void Remove(Entity entity)
 		{
-			auto it = lookup.find(entity);
-			if (it != lookup.end())
+			const size_t index = lookup.Find(entity);
+			if (index != INVALID_INDEX)
 			{
 				// Directly index into components and entities array:
-				const size_t index = it->second;
 				const Entity entity = entities[index];
 
 				if (index < components.size() - 1)
@@ -210,24 +367,23 @@ namespace ap::ecs
 					entities[index] = entities.back();
 
 					// Update the lookup table:
-					lookup[entities[index]] = index;
+					lookup.Set(entities[index], index);
 				}
 
 				// Shrink the container:
 				components.pop_back();
 				entities.pop_back();
-				lookup.erase(entity);
+				lookup.Erase(entity);
 			}
 		}
 
 		// Remove a component of a certain entity if it exists while keeping the current ordering
 		inline void Remove_KeepSorted(Entity entity)
 		{
-			auto it = lookup.find(entity);
-			if (it != lookup.end())
+			const size_t index = lookup.Find(entity);
+			if (index != INVALID_INDEX)
 			{
 				// Directly index into components and entities array:
-				const size_t index = it->second;
 				const Entity entity = entities[index];
 
 				if (index < components.size() - 1)
@@ -241,14 +397,14 @@ namespace ap::ecs
 					for (size_t i = index + 1; i < entities.size(); ++i)
 					{
 						entities[i - 1] = entities[i];
-						lookup[entities[i - 1]] = i - 1;
+						lookup.Set(entities[i - 1], i - 1);
 					}
 				}
 
 				// Shrink the container:
 				components.pop_back();
 				entities.pop_back();
-				lookup.erase(entity);
+				lookup.Erase(entity);
 			}
 		}
 
@@ -273,28 +429,28 @@ namespace ap::ecs
 				const size_t next = i + direction;
 				components[i] = std::move(components[next]);
 				entities[i] = entities[next];
-				lookup[entities[i]] = i;
+				lookup.Set(entities[i], i);
 			}
 
 			// Saved entity-component moved to the required position:
 			components[index_to] = std::move(component);
 			entities[index_to] = entity;
-			lookup[entity] = index_to;
+			lookup.Set(entity, index_to);
 		}
 
 		// Check if a component exists for a given entity or not
 		inline bool Contains(Entity entity) const
 		{
-			return lookup.find(entity) != lookup.end();
+			return lookup.Find(entity) != INVALID_INDEX;
 		}
 
 		// Retrieve a [read/write] component specified by an entity (if it exists, otherwise nullptr)
 		inline Component* GetComponent(Entity entity)
 		{
-			auto it = lookup.find(entity);
-			if (it != lookup.end())
+			const size_t index = lookup.Find(entity);
+			if (index != INVALID_INDEX)
 			{
-				return &components[it->second];
+				return &components[index];
 			}
 			return nullptr;
 		}
@@ -302,10 +458,10 @@ namespace ap::ecs
 		// Retrieve a [read only] component specified by an entity (if it exists, otherwise nullptr)
 		inline const Component* GetComponent(Entity entity) const
 		{
-			const auto it = lookup.find(entity);
-			if (it != lookup.end())
+			const size_t index = lookup.Find(entity);
+			if (index != INVALID_INDEX)
 			{
-				return &components[it->second];
+				return &components[index];
 			}
 			return nullptr;
 		}
@@ -313,12 +469,7 @@ namespace ap::ecs
 		// Retrieve component index by entity handle (if not exists, returns ~0 value)
 		inline size_t GetIndex(Entity entity) const 
 		{
-			const auto it = lookup.find(entity);
-			if (it != lookup.end())
-			{
-				return it->second;
-			}
-			return ~0;
+			return lookup.Find(entity);
 		}
 
 		// Retrieve the number of existing entries
@@ -342,7 +493,7 @@ namespace ap::ecs
 		// This is a linear array of entities corresponding to each alive component
 		ap::vector<Entity> entities;
 		// This is a lookup table for entities
-		ap::unordered_map<Entity, size_t> lookup;
+		Lookup lookup;
 
 		// Disallow this to be copied by mistake
 		ComponentManager(const ComponentManager&) = delete;
@@ -59,20 +59,21 @@ namespace ap::eventhandler
 	void FireEvent(int id, uint64_t userdata)
 	{
 		// Callbacks that only live for once:
+		//	They are taken out of the manager before calling them, because other threads can subscribe in the meantime
 		{
+			ap::vector<std::function<void(uint64_t)>> callbacks;
 			manager->locker.lock();
 			auto it = manager->subscribers_once.find(id);
-			bool found = it != manager->subscribers_once.end();
+			if (it != manager->subscribers_once.end())
+			{
+				callbacks = std::move(it->second);
+				it->second.clear();
+			}
 			manager->locker.unlock();
 
-			if (found)
+			for (auto& callback : callbacks)
 			{
-				auto& callbacks = it->second;
-				for (auto& callback : callbacks)
-				{
-					callback(userdata);
-				}
-				callbacks.clear();
+				callback(userdata);
 			}
 		}
 		// Callbacks that live until deleted:
@@ -0,0 +1,232 @@
+#include "apGraphicsDevice_Null.h"
+#include "apVector.h"
+
+#include <cstring>
+
+namespace ap::graphics
+{
+	namespace null_internal
+	{
+		// Every created object needs some internal state to be valid, resources that the CPU can map also own their memory:
+		struct Resource_Null
+		{
+			ap::vector<uint8_t> memory;
+		};
+
+		std::shared_ptr<Resource_Null> CreateInternalState(size_t mapped_size = 0)
+		{
+			auto internal_state = std::make_shared<Resource_Null>();
+			internal_state->memory.resize(mapped_size);
+			return internal_state;
+		}
+
+		uint64_t ComputeTextureMemorySize(const TextureDesc& desc)
+		{
+			const uint32_t block_size = GetFormatBlockSize(desc.format);
+			const uint32_t stride = GetFormatStride(desc.format);
+			uint64_t size = 0;
+			for (uint32_t mip = 0; mip < desc.mip_levels; ++mip)
+			{
+				const uint64_t width = std::max(1u, desc.width >> mip);
+				const uint64_t height = std::max(1u, desc.height >> mip);
+				const uint64_t depth = std::max(1u, desc.depth >> mip);
+				size += ((width + block_size - 1) / block_size) * ((height + block_size - 1) / block_size) * depth * stride;
+			}
+			return size * desc.array_size;
+		}
+	}
+	using namespace null_internal;
+
+	GraphicsDevice_Null::GraphicsDevice_Null()
+	{
+		capabilities = GraphicsDeviceCapability::NONE;
+		TIMESTAMP_FREQUENCY = 1000000;
+		ALLOCATION_MIN_ALIGNMENT = 256;
+
+		swapchain_renderpass.internal_state = CreateInternalState();
+	}
+
+	bool GraphicsDevice_Null::CreateSwapChain(const SwapChainDesc* pDesc, ap::platform::window_type window, SwapChain* swapChain) const
+	{
+		swapChain->internal_state = CreateInternalState();
+		swapChain->desc = *pDesc;
+		return true;
+	}
+	bool GraphicsDevice_Null::CreateBuffer(const GPUBufferDesc* pDesc, const void* pInitialData, GPUBuffer* pBuffer) const
+	{
+		const bool mappable = pDesc->usage == Usage::UPLOAD || pDesc->usage == Usage::READBACK;
+		auto internal_state = CreateInternalState(mappable ? (size_t)pDesc->size : 0);
+
+		pBuffer->internal_state = internal_state;
+		pBuffer->type = GPUResource::Type::BUFFER;
+		pBuffer->desc = *pDesc;
+		pBuffer->mapped_data = nullptr;
+		pBuffer->mapped_rowpitch = 0;
+		if (mappable)
+		{
+			pBuffer->mapped_data = internal_state->memory.data();
+			pBuffer->mapped_rowpitch = (uint32_t)pDesc->size;
+			if (pInitialData != nullptr)
+			{
+				std::memcpy(pBuffer->mapped_data, pInitialData, (size_t)pDesc->size);
+			}
+		}
+		return true;
+	}
+	bool GraphicsDevice_Null::CreateTexture(const TextureDesc* pDesc, const SubresourceData* pInitialData, Texture* pTexture) const
+	{
+		const bool mappable = pDesc->usage == Usage::UPLOAD || pDesc->usage == Usage::READBACK;
+		auto internal_state = CreateInternalState(mappable ? (size_t)ComputeTextureMemorySize(*pDesc) : 0);
+
+		pTexture->internal_state = internal_state;
+		pTexture->type = GPUResource::Type::TEXTURE;
+		pTexture->desc = *pDesc;
+		pTexture->mapped_data = nullptr;
+		pTexture->mapped_rowpitch = 0;
+		if (mappable)
+		{
+			pTexture->mapped_data = internal_state->memory.data();
+			pTexture->mapped_rowpitch = (pDesc->width + GetFormatBlockSize(pDesc->format) - 1) / GetFormatBlockSize(pDesc->format) * GetFormatStride(pDesc->format);
+		}
+		return true;
+	}
+	bool GraphicsDevice_Null::CreateShader(ShaderStage stage, const void* pShaderBytecode, size_t BytecodeLength, Shader* pShader) const
+	{
+		pShader->internal_state = CreateInternalState();
+		pShader->stage = stage;
+		return true;
+	}
+	bool GraphicsDevice_Null::CreateSampler(const SamplerDesc* pSamplerDesc, Sampler* pSamplerState) const
+	{
+		pSamplerState->internal_state = CreateInternalState();
+		pSamplerState->desc = *pSamplerDesc;
+		return true;
+	}
+	bool GraphicsDevice_Null::CreateQueryHeap(const GPUQueryHeapDesc* pDesc, GPUQueryHeap* pQueryHeap) const
+	{
+		pQueryHeap->internal_state = CreateInternalState();
+		pQueryHeap->desc = *pDesc;
+		return true;
+	}
+	bool GraphicsDevice_Null::CreatePipelineState(const PipelineStateDesc* pDesc, PipelineState* pso) const
+	{
+		pso->internal_state = CreateInternalState();
+		pso->desc = *pDesc;
+		pso->hash = (size_t)pso->internal_state.get();
+		return true;
+	}
+	bool GraphicsDevice_Null::CreateRenderPass(const RenderPassDesc* pDesc, RenderPass* renderpass) const
+	{
+		renderpass->internal_state = CreateInternalState();
+		renderpass->desc = *pDesc;
+		renderpass->hash = (size_t)renderpass->internal_state.get();
+		return true;
+	}
+
+	CommandList GraphicsDevice_Null::BeginCommandList(QUEUE_TYPE queue)
+	{
+		CommandList cmd{ cmd_count.fetch_add(1) };
+		assert(cmd < COMMANDLIST_COUNT);
+		active_renderpass[cmd] = nullptr;
+		active_pso[cmd] = nullptr;
+		statistics[cmd] = {};
+		return cmd;
+	}
+	void GraphicsDevice_Null::SubmitCommandLists()
+	{
+		submitted_count = cmd_count.load();
+		cmd_count.store(0);
+		for (uint32_t cmd = 0; cmd < submitted_count; ++cmd)
+		{
+			assert(active_renderpass[cmd] == nullptr); // render pass was not ended!
+			submitted_statistics[cmd] = statistics[cmd];
+		}
+
+		FRAMECOUNT++;
+	}
+
+	Texture GraphicsDevice_Null::GetBackBuffer(const SwapChain* swapchain) const
+	{
+		Texture result;
+		result.type = GPUResource::Type::TEXTURE;
+		result.internal_state = CreateInternalState();
+		result.desc.width = swapchain->desc.width;
+		result.desc.height = swapchain->desc.height;
+		result.desc.format = swapchain->desc.format;
+		result.desc.bind_flags = BindFlag::RENDER_TARGET;
+		return result;
+	}
+
+	void GraphicsDevice_Null::RenderPassBegin(const SwapChain* swapchain, CommandList cmd)
+	{
+		assert(active_renderpass[cmd] == nullptr); // render passes can't be nested
+		record(cmd);
+		statistics[cmd].render_passes++;
+		active_renderpass[cmd] = &swapchain_renderpass;
+	}
+	void GraphicsDevice_Null::RenderPassBegin(const RenderPass* renderpass, CommandList cmd)
+	{
+		assert(active_renderpass[cmd] == nullptr); // render passes can't be nested
+		record(cmd);
+		statistics[cmd].render_passes++;
+		active_renderpass[cmd] = renderpass;
+	}
+	void GraphicsDevice_Null::RenderPassEnd(CommandList cmd)
+	{
+		record(cmd);
+		active_renderpass[cmd] = nullptr;
+	}
+	void GraphicsDevice_Null::BindPipelineState(const PipelineState* pso, CommandList cmd)
+	{
+		if (active_pso[cmd] == pso)
+			return;
+		active_pso[cmd] = pso;
+		record(cmd);
+		statistics[cmd].pipeline_changes++;
+	}
+	void GraphicsDevice_Null::Draw(uint32_t vertexCount, uint32_t startVertexLocation, CommandList cmd)
+	{
+		record(cmd);
+		statistics[cmd].draws++;
+	}
+	void GraphicsDevice_Null::DrawIndexed(uint32_t indexCount, uint32_t startIndexLocation, int32_t baseVertexLocation, CommandList cmd)
+	{
+		record(cmd);
+		statistics[cmd].draws++;
+	}
+	void GraphicsDevice_Null::DrawInstanced(uint32_t vertexCount, uint32_t instanceCount, uint32_t startVertexLocation, uint32_t startInstanceLocation, CommandList cmd)
+	{
+		record(cmd);
+		statistics[cmd].draws++;
+	}
+	void GraphicsDevice_Null::DrawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndexLocation, int32_t baseVertexLocation, uint32_t startInstanceLocation, CommandList cmd)
+	{
+		record(cmd);
+		statistics[cmd].draws++;
+	}
+	void GraphicsDevice_Null::DrawInstancedIndirect(const GPUBuffer* args, uint64_t args_offset, CommandList cmd)
+	{
+		record(cmd);
+		statistics[cmd].draws++;
+	}
+	void GraphicsDevice_Null::DrawIndexedInstancedIndirect(const GPUBuffer* args, uint64_t args_offset, CommandList cmd)
+	{
+		record(cmd);
+		statistics[cmd].draws++;
+	}
+	void GraphicsDevice_Null::Dispatch(uint32_t threadGroupCountX, uint32_t threadGroupCountY, uint32_t threadGroupCountZ, CommandList cmd)
+	{
+		record(cmd);
+		statistics[cmd].dispatches++;
+	}
+	void GraphicsDevice_Null::DispatchIndirect(const GPUBuffer* args, uint64_t args_offset, CommandList cmd)
+	{
+		record(cmd);
+		statistics[cmd].dispatches++;
+	}
+	void GraphicsDevice_Null::Barrier(const GPUBarrier* barriers, uint32_t numBarriers, CommandList cmd)
+	{
+		record(cmd);
+		statistics[cmd].barriers += numBarriers;
+	}
+}
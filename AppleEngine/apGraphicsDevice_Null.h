@@ -0,0 +1,130 @@
+#pragma once
+#include "CommonInclude.h"
+#include "apGraphicsDevice.h"
+
+#include <atomic>
+
+namespace ap::graphics
+{
+	// Graphics device that doesn't talk to any GPU
+	//	Resources are only CPU memory (mapped buffers are writable), commands are counted but not executed
+	//	It can run the whole renderer headless (for example on CI machines without a GPU) to measure CPU side recording
+	class GraphicsDevice_Null final : public GraphicsDevice
+	{
+	public:
+		// The number of commands that were recorded into one command list
+		struct CommandListStatistics
+		{
+			uint32_t commands = 0;			// every command that was recorded
+			uint32_t render_passes = 0;
+			uint32_t pipeline_changes = 0;	// pipeline binds that changed the pipeline
+			uint32_t draws = 0;
+			uint32_t dispatches = 0;
+			uint32_t barriers = 0;
+		};
+
+	protected:
+		std::atomic<CommandList::index_type> cmd_count{ 0 };
+		const RenderPass* active_renderpass[COMMANDLIST_COUNT] = {};
+		RenderPass swapchain_renderpass; // reported as the current render pass while a swapchain is rendered to
+		const PipelineState* active_pso[COMMANDLIST_COUNT] = {};
+		CommandListStatistics statistics[COMMANDLIST_COUNT];
+
+		CommandListStatistics submitted_statistics[COMMANDLIST_COUNT];
+		uint32_t submitted_count = 0;
+
+		void record(CommandList cmd) { statistics[cmd].commands++; }
+
+	public:
+		GraphicsDevice_Null();
+
+		bool CreateSwapChain(const SwapChainDesc* pDesc, ap::platform::window_type window, SwapChain* swapChain) const override;
+		bool CreateBuffer(const GPUBufferDesc *pDesc, const void* pInitialData, GPUBuffer *pBuffer) const override;
+		bool CreateTexture(const TextureDesc* pDesc, const SubresourceData *pInitialData, Texture *pTexture) const override;
+		bool CreateShader(ShaderStage stage, const void *pShaderBytecode, size_t BytecodeLength, Shader *pShader) const override;
+		bool CreateSampler(const SamplerDesc *pSamplerDesc, Sampler *pSamplerState) const override;
+		bool CreateQueryHeap(const GPUQueryHeapDesc* pDesc, GPUQueryHeap* pQueryHeap) const override;
+		bool CreatePipelineState(const PipelineStateDesc* pDesc, PipelineState* pso) const override;
+		bool CreateRenderPass(const RenderPassDesc* pDesc, RenderPass* renderpass) const override;
+
+		bool RecreateTextureFromNativeTexture(const TextureDesc* pDesc, Texture* pTexture, void* nativeTexture) const override { return false; }
+
+		int CreateSubresource(Texture* texture, SubresourceType type, uint32_t firstSlice, uint32_t sliceCount, uint32_t firstMip, uint32_t mipCount) const override { return 0; }
+		int CreateSubresource(GPUBuffer* buffer, SubresourceType type, uint64_t offset, uint64_t size = ~0) const override { return 0; }
+
+		int GetDescriptorIndex(const GPUResource* resource, SubresourceType type, int subresource = -1) const override { return -1; }
+		int GetDescriptorIndex(const Sampler* sampler) const override { return -1; }
+
+		void SetName(GPUResource* pResource, const char* name) override {}
+
+		CommandList BeginCommandList(QUEUE_TYPE queue = QUEUE_GRAPHICS) override;
+		void SubmitCommandLists() override;
+
+		void WaitForGPU() const override {}
+		void ClearPipelineStateCache() override {}
+		size_t GetActivePipelineCount() const override { return 0; }
+
+		ShaderFormat GetShaderFormat() const override { return ShaderFormat::HLSL6; }
+
+		Texture GetBackBuffer(const SwapChain* swapchain) const override;
+
+		ColorSpace GetSwapChainColorSpace(const SwapChain* swapchain) const override { return ColorSpace::SRGB; }
+		bool IsSwapChainSupportsHDR(const SwapChain* swapchain) const override { return false; }
+
+		// Returns how many command lists were submitted in the last SubmitCommandLists()
+		uint32_t GetSubmittedCommandListCount() const { return submitted_count; }
+		// Returns what was recorded into a command list that was submitted in the last SubmitCommandLists()
+		//	index is the order of BeginCommandList() calls, in range [0, GetSubmittedCommandListCount() - 1]
+		const CommandListStatistics& GetSubmittedStatistics(uint32_t index) const { return submitted_statistics[index]; }
+
+		///////////////Thread-sensitive////////////////////////
+
+		void WaitCommandList(CommandList cmd, CommandList wait_for) override {}
+		void RenderPassBegin(const SwapChain* swapchain, CommandList cmd) override;
+		void RenderPassBegin(const RenderPass* renderpass, CommandList cmd) override;
+		void RenderPassEnd(CommandList cmd) override;
+		void BindScissorRects(uint32_t numRects, const Rect* rects, CommandList cmd) override { record(cmd); }
+		void BindViewports(uint32_t NumViewports, const Viewport* pViewports, CommandList cmd) override { record(cmd); }
+		void BindResource(const GPUResource* resource, uint32_t slot, CommandList cmd, int subresource = -1) override { record(cmd); }
+		void BindResources(const GPUResource *const* resources, uint32_t slot, uint32_t count, CommandList cmd) override { record(cmd); }
+		void BindUAV(const GPUResource* resource, uint32_t slot, CommandList cmd, int subresource = -1) override { record(cmd); }
+		void BindUAVs(const GPUResource *const* resources, uint32_t slot, uint32_t count, CommandList cmd) override { record(cmd); }
+		void BindSampler(const Sampler* sampler, uint32_t slot, CommandList cmd) override { record(cmd); }
+		void BindConstantBuffer(const GPUBuffer* buffer, uint32_t slot, CommandList cmd, uint64_t offset = 0ull) override { record(cmd); }
+		void BindVertexBuffers(const GPUBuffer *const* vertexBuffers, uint32_t slot, uint32_t count, const uint32_t* strides, const uint64_t* offsets, CommandList cmd) override { record(cmd); }
+		void BindIndexBuffer(const GPUBuffer* indexBuffer, const IndexBufferFormat format, uint64_t offset, CommandList cmd) override { record(cmd); }
+		void BindStencilRef(uint32_t value, CommandList cmd) override { record(cmd); }
+		void BindBlendFactor(float r, float g, float b, float a, CommandList cmd) override { record(cmd); }
+		void BindShadingRate(ShadingRate rate, CommandList cmd) override { record(cmd); }
+		void BindPipelineState(const PipelineState* pso, CommandList cmd) override;
+		void BindComputeShader(const Shader* cs, CommandList cmd) override { record(cmd); }
+		void BindDepthBounds(float min_bounds, float max_bounds, CommandList cmd) override { record(cmd); }
+		void Draw(uint32_t vertexCount, uint32_t startVertexLocation, CommandList cmd) override;
+		void DrawIndexed(uint32_t indexCount, uint32_t startIndexLocation, int32_t baseVertexLocation, CommandList cmd) override;
+		void DrawInstanced(uint32_t vertexCount, uint32_t instanceCount, uint32_t startVertexLocation, uint32_t startInstanceLocation, CommandList cmd) override;
+		void DrawIndexedInstanced(uint32_t indexCount, uint32_t instanceCount, uint32_t startIndexLocation, int32_t baseVertexLocation, uint32_t startInstanceLocation, CommandList cmd) override;
+		void DrawInstancedIndirect(const GPUBuffer* args, uint64_t args_offset, CommandList cmd) override;
+		void DrawIndexedInstancedIndirect(const GPUBuffer* args, uint64_t args_offset, CommandList cmd) override;
+		void Dispatch(uint32_t threadGroupCountX, uint32_t threadGroupCountY, uint32_t threadGroupCountZ, CommandList cmd) override;
+		void DispatchIndirect(const GPUBuffer* args, uint64_t args_offset, CommandList cmd) override;
+		void CopyResource(const GPUResource* pDst, const GPUResource* pSrc, CommandList cmd) override { record(cmd); }
+		void CopyBuffer(const GPUBuffer* pDst, uint64_t dst_offset, const GPUBuffer* pSrc, uint64_t src_offset, uint64_t size, CommandList cmd) override { record(cmd); }
+		void QueryBegin(const GPUQueryHeap* heap, uint32_t index, CommandList cmd) override { record(cmd); }
+		void QueryEnd(const GPUQueryHeap* heap, uint32_t index, CommandList cmd) override { record(cmd); }
+		void QueryResolve(const GPUQueryHeap* heap, uint32_t index, uint32_t count, const GPUBuffer* dest, uint64_t dest_offset, CommandList cmd) override { record(cmd); }
+		void Barrier(const GPUBarrier* barriers, uint32_t numBarriers, CommandList cmd) override;
+		void PushConstants(const void* data, uint32_t size, CommandList cmd, uint32_t offset = 0) override { record(cmd); }
+
+		void EventBegin(const char* name, CommandList cmd) override {}
+		void EventEnd(CommandList cmd) override {}
+		void SetMarker(const char* name, CommandList cmd) override {}
+
+		const RenderPass* GetCurrentRenderPass(CommandList cmd) const override { return active_renderpass[cmd]; }
+
+		void InitImGui(ap::platform::window_type window) override {}
+		void DestoryImGui() override {}
+		void BeginImGui() override {}
+		void EndImGui(CommandList cmd) override {}
+		uint64_t CopyDescriptorToImGui(const Texture* texture, int subresource = -1) const override { return 0; }
+	};
+}
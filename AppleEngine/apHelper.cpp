@@ -35,12 +35,85 @@ extern basist::etc1_global_selector_codebook g_basis_global_codebook;
 #endif // PLATFORM_UWP
 #else
 #include "Utility/portable-file-dialogs.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif // _WIN32
 
 
 namespace ap::helper
 {
 
+	uint64_t data_hash(const void* data, size_t size, uint64_t seed)
+	{
+		static constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+		static constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+		static constexpr uint64_t PRIME3 = 0x165667B19E3779F9ull;
+		static constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ull;
+		static constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ull;
+		auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+		auto round = [&](uint64_t acc, uint64_t input) { return rotl(acc + input * PRIME2, 31) * PRIME1; };
+		auto merge = [&](uint64_t acc, uint64_t value) { return (acc ^ round(0, value)) * PRIME1 + PRIME4; };
+		auto read64 = [](const uint8_t* ptr) { uint64_t value; std::memcpy(&value, ptr, sizeof(value)); return value; };
+		auto read32 = [](const uint8_t* ptr) { uint32_t value; std::memcpy(&value, ptr, sizeof(value)); return value; };
+
+		const uint8_t* ptr = (const uint8_t*)data;
+		const uint8_t* end = ptr + size;
+		uint64_t hash;
+		if (size >= 32)
+		{
+			uint64_t v1 = seed + PRIME1 + PRIME2;
+			uint64_t v2 = seed + PRIME2;
+			uint64_t v3 = seed;
+			uint64_t v4 = seed - PRIME1;
+			while (end - ptr >= 32)
+			{
+				v1 = round(v1, read64(ptr));
+				v2 = round(v2, read64(ptr + 8));
+				v3 = round(v3, read64(ptr + 16));
+				v4 = round(v4, read64(ptr + 24));
+				ptr += 32;
+			}
+			hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+			hash = merge(hash, v1);
+			hash = merge(hash, v2);
+			hash = merge(hash, v3);
+			hash = merge(hash, v4);
+		}
+		else
+		{
+			hash = seed + PRIME5;
+		}
+		hash += (uint64_t)size;
+
+		while (end - ptr >= 8)
+		{
+			hash ^= round(0, read64(ptr));
+			hash = rotl(hash, 27) * PRIME1 + PRIME4;
+			ptr += 8;
+		}
+		if (end - ptr >= 4)
+		{
+			hash ^= (uint64_t)read32(ptr) * PRIME1;
+			hash = rotl(hash, 23) * PRIME2 + PRIME3;
+			ptr += 4;
+		}
+		while (ptr < end)
+		{
+			hash ^= (*ptr) * PRIME5;
+			hash = rotl(hash, 11) * PRIME1;
+			ptr++;
+		}
+
+		hash ^= hash >> 33;
+		hash *= PRIME2;
+		hash ^= hash >> 29;
+		hash *= PRIME3;
+		hash ^= hash >> 32;
+		return hash;
+	}
+
 	std::string toUpper(const std::string& s)
 	{
 		std::string result;
@@ -657,6 +730,73 @@ namespace ap::helper
 	}
 #endif // WI_VECTOR_TYPE
 
+	std::shared_ptr<const uint8_t> FileMap(const std::string& fileName, size_t& size)
+	{
+		size = 0;
+#ifdef _WIN32
+#ifndef PLATFORM_UWP
+		std::wstring wstr;
+		StringConvert(fileName, wstr);
+		HANDLE filehandle = CreateFileW(wstr.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (filehandle == INVALID_HANDLE_VALUE)
+		{
+			return nullptr;
+		}
+		LARGE_INTEGER filesize = {};
+		if (!GetFileSizeEx(filehandle, &filesize) || filesize.QuadPart == 0)
+		{
+			CloseHandle(filehandle);
+			return nullptr;
+		}
+		HANDLE mappinghandle = CreateFileMappingW(filehandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		CloseHandle(filehandle); // the mapping keeps the file open
+		if (mappinghandle == nullptr)
+		{
+			return nullptr;
+		}
+		const void* view = MapViewOfFile(mappinghandle, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mappinghandle); // the view keeps the mapping alive
+		if (view == nullptr)
+		{
+			return nullptr;
+		}
+		size = (size_t)filesize.QuadPart;
+		return std::shared_ptr<const uint8_t>((const uint8_t*)view, [](const uint8_t* ptr) {
+			UnmapViewOfFile(ptr);
+		});
+#else
+		// UWP file access goes through StorageFile, which can't be mapped
+		return nullptr;
+#endif // PLATFORM_UWP
+#else
+		std::string filepath = fileName;
+		std::replace(filepath.begin(), filepath.end(), '\\', '/');
+		int fd = open(filepath.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return nullptr;
+		}
+		struct stat st = {};
+		if (fstat(fd, &st) != 0 || st.st_size <= 0)
+		{
+			close(fd);
+			return nullptr;
+		}
+		void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd); // the mapping keeps the file open
+		if (view == MAP_FAILED)
+		{
+			return nullptr;
+		}
+		const size_t mapped_size = (size_t)st.st_size;
+		madvise(view, mapped_size, MADV_SEQUENTIAL);
+		size = mapped_size;
+		return std::shared_ptr<const uint8_t>((const uint8_t*)view, [mapped_size](const uint8_t* ptr) {
+			munmap((void*)ptr, mapped_size);
+		});
+#endif // _WIN32
+	}
+
 	bool FileWrite(const std::string& fileName, const uint8_t* data, size_t size)
 	{
 		if (size <= 0)
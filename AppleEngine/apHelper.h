@@ -5,6 +5,7 @@
 
 #include <string>
 #include <functional>
+#include <memory>
 
 #if WI_VECTOR_TYPE
 namespace std
@@ -38,6 +39,9 @@ namespace ap::helper
 		return hash;
 	}
 
+	// Computes the 64-bit hash of a memory block with the XXH64 algorithm, suitable for identifying file contents
+	uint64_t data_hash(const void* data, size_t size, uint64_t seed = 0);
+
 	std::string toUpper(const std::string& s);
 
 	void messageBox(const std::string& msg, const std::string& caption = "Warning!");
@@ -86,6 +90,11 @@ namespace ap::helper
 	bool FileRead(const std::string& fileName, std::vector<uint8_t>& data);
 #endif // WI_VECTOR_TYPE
 
+	// Maps the whole file into memory in read only mode, without copying it
+	//	The mapping is released when the last copy of the returned pointer is destroyed
+	//	Returns nullptr if the file could not be mapped, in that case FileRead() should be used instead
+	std::shared_ptr<const uint8_t> FileMap(const std::string& fileName, size_t& size);
+
 	bool FileWrite(const std::string& fileName, const uint8_t* data, size_t size);
 
 	bool FileExists(const std::string& fileName);
@@ -8,9 +8,29 @@
 #include <condition_variable>
 #include <string>
 #include <algorithm>
+#include <cassert>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <tuple>
 
 #ifdef PLATFORM_LINUX
 #include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JOBSYSTEM_CPU_RELAX() _mm_pause()
+#else
+#define JOBSYSTEM_CPU_RELAX() std::this_thread::yield()
 #endif
 
 namespace ap::jobsystem
@@ -18,40 +38,199 @@ namespace ap::jobsystem
 	struct Job
 	{
 		context* ctx;
-		std::function<void(JobArgs)> task;
+		Job* owner;		// the job that holds the task, all groups of a Dispatch share the same owner
+		JobFunction task;
+		std::atomic<uint32_t> refCount{ 0 }; // how many groups are still referencing the task of the owner
 		uint32_t groupID;
 		uint32_t groupJobOffset;
 		uint32_t groupJobEnd;
 		uint32_t sharedmemory_size;
+		Job* next = nullptr;		// free list link
+		Job* nextBatch = nullptr;	// free batch list link
 	};
-	struct WorkerState
+
+	// Jobs are allocated from blocks that are never freed, and are recycled through per thread free lists
+	//	The free lists are exchanged with a shared pool in batches, so the pool lock is rarely touched
+	//	After warming up there are no memory allocations when submitting jobs
+	static constexpr uint32_t JOB_BATCH_SIZE = 64;
+	struct JobCache
 	{
-		std::atomic_bool alive{ true };
-		std::condition_variable wakeCondition;
-		std::mutex wakeMutex;
+		Job* head = nullptr;
+		uint32_t count = 0;
+	};
+	static thread_local JobCache tls_job_cache; // jobs in the cache of an exited thread are not returned to the pool
+	class JobAllocator
+	{
+	public:
+		inline Job* allocate()
+		{
+			JobCache& cache = tls_job_cache;
+			if (cache.head == nullptr)
+			{
+				refill(cache);
+			}
+			Job* job = cache.head;
+			cache.head = job->next;
+			cache.count--;
+			job->next = nullptr;
+			return job;
+		}
+
+		inline void free(Job* job)
+		{
+			JobCache& cache = tls_job_cache;
+			job->next = cache.head;
+			cache.head = job;
+			cache.count++;
+
+			if (cache.count >= JOB_BATCH_SIZE * 2)
+			{
+				// Give one batch back to the pool, so that jobs don't pile up on threads that mostly execute but don't submit:
+				Job* batch = cache.head;
+				Job* last = batch;
+				for (uint32_t i = 1; i < JOB_BATCH_SIZE; ++i)
+				{
+					last = last->next;
+				}
+				cache.head = last->next;
+				cache.count -= JOB_BATCH_SIZE;
+				last->next = nullptr;
+
+				lock.lock();
+				batch->nextBatch = freeBatches;
+				freeBatches = batch;
+				lock.unlock();
+			}
+		}
+
+	private:
+		inline void refill(JobCache& cache)
+		{
+			lock.lock();
+			Job* batch = freeBatches;
+			if (batch != nullptr)
+			{
+				freeBatches = batch->nextBatch;
+				lock.unlock();
+				batch->nextBatch = nullptr;
+			}
+			else
+			{
+				// The pool is empty, allocate a new block (this only happens until the pool is warmed up):
+				blocks.emplace_back(new Job[JOB_BATCH_SIZE]);
+				batch = blocks.back().get();
+				lock.unlock();
+				for (uint32_t i = 0; i < JOB_BATCH_SIZE - 1; ++i)
+				{
+					batch[i].next = &batch[i + 1];
+				}
+			}
+			cache.head = batch;
+			cache.count = JOB_BATCH_SIZE;
+		}
+
+		std::deque<std::unique_ptr<Job[]>> blocks;
+		Job* freeBatches = nullptr;
+		ap::SpinLock lock;
 	};
 
-	// Fixed size very simple thread safe ring buffer
+	// Lock-free work stealing deque (Chase-Lev), based on:
+	//	"Correct and Efficient Work-Stealing for Weak Memory Models" (Le, Pop, Cohen, Zappa Nardelli, 2013)
+	//	Only the owner thread is allowed to call push_back() and pop_back(), any thread can call steal()
+	//	The capacity is fixed, push_back() fails when the deque is full so the caller can fall back to the global queue
 	template <typename T, size_t capacity>
-	class ThreadSafeRingBuffer
+	class WorkStealingQueue
 	{
+		static_assert((capacity & (capacity - 1)) == 0, "WorkStealingQueue capacity must be power of two!");
+		static_assert(std::is_trivially_copyable<T>::value, "WorkStealingQueue items must be trivially copyable!");
 	public:
-		// Push an item to the end if there is free space
+		// Push an item to the bottom (owner thread only)
 		//	Returns true if succesful
 		//	Returns false if there is not enough space
-		inline bool push_back(const T& item)
+		inline bool push_back(T item)
+		{
+			const int64_t b = bottom.load(std::memory_order_relaxed);
+			const int64_t t = top.load(std::memory_order_acquire);
+			if (b - t >= (int64_t)capacity)
+			{
+				return false;
+			}
+			data[b & (capacity - 1)].store(item, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return true;
+		}
+
+		// Take the most recently pushed item (owner thread only)
+		//	Returns true if succesful
+		//	Returns false if there are no items
+		inline bool pop_back(T& item)
+		{
+			const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+			bottom.store(b, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t t = top.load(std::memory_order_relaxed);
+			if (t <= b)
+			{
+				item = data[b & (capacity - 1)].load(std::memory_order_relaxed);
+				if (t == b)
+				{
+					// This was the last item, race against stealers for it:
+					const bool result = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+					bottom.store(b + 1, std::memory_order_relaxed);
+					return result;
+				}
+				return true;
+			}
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+
+		// Take the oldest item (any thread)
+		//	Returns true if succesful
+		//	Returns false if there are no items or an other thread was faster
+		inline bool steal(T& item)
+		{
+			int64_t t = top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			const int64_t b = bottom.load(std::memory_order_acquire);
+			if (t < b)
+			{
+				item = data[t & (capacity - 1)].load(std::memory_order_relaxed);
+				return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			}
+			return false;
+		}
+
+		// Approximation, only useful as a hint
+		inline bool empty() const
+		{
+			return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+		}
+
+	private:
+		alignas(64) std::atomic<int64_t> top{ 0 };
+		alignas(64) std::atomic<int64_t> bottom{ 0 };
+		alignas(64) std::atomic<T> data[capacity];
+	};
+
+	// Unbounded multi producer, multi consumer queue
+	//	Used as the global injection queue for threads without their own deque, and when a deque is full
+	//	It is a ring buffer that only grows, so it doesn't allocate memory after it reached its peak size
+	template <typename T>
+	class ThreadSafeQueue
+	{
+	public:
+		inline void push_back(const T& item)
 		{
-			bool result = false;
 			lock.lock();
-			size_t next = (head + 1) % capacity;
-			if (next != tail)
+			if (count.load(std::memory_order_relaxed) == data.size())
 			{
-				data[head] = item;
-				head = next;
-				result = true;
+				grow();
 			}
+			data[(head + count.load(std::memory_order_relaxed)) & (data.size() - 1)] = item;
+			count.fetch_add(1, std::memory_order_release);
 			lock.unlock();
-			return result;
 		}
 
 		// Get an item if there are any
@@ -59,23 +238,105 @@ namespace ap::jobsystem
 		//	Returns false if there are no items
 		inline bool pop_front(T& item)
 		{
+			if (empty())
+			{
+				return false; // early out without locking
+			}
 			bool result = false;
 			lock.lock();
-			if (tail != head)
+			if (count.load(std::memory_order_relaxed) > 0)
 			{
-				item = data[tail];
-				tail = (tail + 1) % capacity;
+				item = data[head];
+				head = (head + 1) & (data.size() - 1);
+				count.fetch_sub(1, std::memory_order_release);
 				result = true;
 			}
 			lock.unlock();
 			return result;
 		}
 
+		// Approximation, only useful as a hint
+		inline bool empty() const
+		{
+			return count.load(std::memory_order_acquire) == 0;
+		}
+
 	private:
-		T data[capacity];
+		std::vector<T> data;
 		size_t head = 0;
-		size_t tail = 0;
+		std::atomic<size_t> count{ 0 };
 		ap::SpinLock lock;
+
+		inline void grow()
+		{
+			const size_t size = data.size();
+			std::vector<T> grown(std::max(size_t(256), size * 2)); // power of two
+			for (size_t i = 0; i < size; ++i)
+			{
+				grown[i] = data[(head + i) & (size - 1)];
+			}
+			data = std::move(grown);
+			head = 0;
+		}
+	};
+
+	static constexpr size_t JOB_QUEUE_CAPACITY = 4096;
+	static constexpr uint32_t MAX_EXTERNAL_QUEUES = 16; // non-worker threads that can submit jobs through their own deque (main thread, render thread, etc.)
+	static constexpr int STREAMING_THREAD_NICE = 10; // nice value of the streaming threads on Linux, the counterpart of THREAD_PRIORITY_BELOW_NORMAL on Windows
+	using JobQueue = WorkStealingQueue<Job*, JOB_QUEUE_CAPACITY>;
+
+	// Every priority has its own set of queues, so that waiting on a context never picks up a job of a different priority
+	struct PriorityQueues
+	{
+		std::unique_ptr<JobQueue[]> jobQueuePerThread; // [0, numThreads) are owned by workers, the rest are given to other submitting threads on demand
+		uint32_t jobQueueCapacity = 0;
+		std::atomic<uint32_t> jobQueueCount{ 0 };
+		ThreadSafeQueue<Job*> globalQueue;
+	};
+
+	// Sleeping state of one worker thread, so that every worker can be woken up individually
+	struct WorkerSignal
+	{
+		std::mutex mutex;
+		std::condition_variable condition;
+		bool signaled = false;
+	};
+
+	// A set of worker threads that are executing the same priorities
+	//	Parked workers are put on an idle stack, submitters wake only as many of them as the number of submitted jobs
+	struct WorkerPool
+	{
+		uint32_t numThreads = 0;
+		std::unique_ptr<WorkerSignal[]> signals;
+		std::unique_ptr<uint32_t[]> idleWorkers;
+		uint32_t idleCount = 0; // protected by idleLock
+		std::atomic<uint32_t> parkedCount{ 0 }; // checked by submitters without locking
+		ap::SpinLock idleLock;
+	};
+	static constexpr int POOL_FRAME = 0;		// High and Normal priority workers
+	static constexpr int POOL_STREAMING = 1;	// Streaming priority workers
+	static constexpr int POOL_COUNT = 2;
+	inline int GetPool(Priority priority) { return priority == Priority::Streaming ? POOL_STREAMING : POOL_FRAME; }
+
+	struct alignas(64) WorkerCounters
+	{
+		std::atomic<uint64_t> jobs{ 0 };
+		std::atomic<uint64_t> steals{ 0 };
+		std::atomic<uint64_t> parks{ 0 };
+		std::atomic<uint64_t> unparks{ 0 };
+	};
+
+	struct WorkerState
+	{
+		std::atomic_bool alive{ true };
+		std::atomic<uint32_t> spin_count{ IdlePolicy().spin_count };
+		std::atomic<uint32_t> yield_count{ IdlePolicy().yield_count };
+		WorkerPool pools[POOL_COUNT];
+		PriorityQueues queues[int(Priority::Count)];
+		JobAllocator jobAllocator;
+		std::unique_ptr<WorkerCounters[]> workerCounters; // one for each worker thread
+		uint32_t workerCounterCount = 0;
+		WorkerCounters externalCounters; // shared by all other threads
 	};
 
 	// This structure is responsible to stop worker thread loops.
@@ -85,48 +346,490 @@ namespace ap::jobsystem
 	{
 		uint32_t numCores = 0;
 		uint32_t numThreads = 0;
+		uint32_t numStreamingThreads = 0;
+		uint32_t numNumaNodes = 1;
+		std::vector<uint32_t> cpuNumaNodes; // NUMA node of each logical processor, indexed by processor number
 		std::shared_ptr<WorkerState> worker_state = std::make_shared<WorkerState>(); // kept alive by both threads and internal_state
-		ThreadSafeRingBuffer<Job, 256> jobQueue;
 		~InternalState()
 		{
 			worker_state->alive.store(false);
-			worker_state->wakeCondition.notify_all(); // wakes up sleeping worker threads
+
+			// wakes up sleeping worker threads:
+			for (WorkerPool& pool : worker_state->pools)
+			{
+				for (uint32_t i = 0; i < pool.numThreads; ++i)
+				{
+					WorkerSignal& signal = pool.signals[i];
+					std::unique_lock<std::mutex> lock(signal.mutex);
+					signal.signaled = true;
+					signal.condition.notify_one();
+				}
+			}
 		}
 	} static internal_state;
 
-	// This function executes the next item from the job queue. Returns true if successful, false if there was no job available
-	inline bool work()
+	static constexpr uint32_t QUEUE_UNASSIGNED = ~0u;
+	static constexpr uint32_t QUEUE_NONE = ~0u - 1;
+	static thread_local uint32_t tls_queue_index[int(Priority::Count)] = { QUEUE_UNASSIGNED, QUEUE_UNASSIGNED, QUEUE_UNASSIGNED };
+	static thread_local uint32_t tls_random_state = 0;
+	static thread_local WorkerCounters* tls_counters = nullptr;
+	static constexpr uint32_t WORKER_NONE = ~0u;
+	static thread_local uint32_t tls_worker_index = WORKER_NONE;
+	static thread_local uint32_t tls_numa_node = ~0u; // only known for pinned workers
+
+	inline WorkerCounters& GetCounters(WorkerState& state)
+	{
+		return tls_counters == nullptr ? state.externalCounters : *tls_counters;
+	}
+
+	// Returns the deque owned by the calling thread, or nullptr if it couldn't get one
+	inline JobQueue* GetThreadQueue(PriorityQueues& queues, Priority priority)
+	{
+		uint32_t& queue_index = tls_queue_index[int(priority)];
+		if (queue_index == QUEUE_UNASSIGNED && queues.jobQueueCapacity > 0)
+		{
+			queue_index = QUEUE_NONE;
+			uint32_t index = queues.jobQueueCount.load();
+			while (index < queues.jobQueueCapacity)
+			{
+				if (queues.jobQueueCount.compare_exchange_weak(index, index + 1))
+				{
+					queue_index = index;
+					break;
+				}
+			}
+		}
+		if (queue_index >= queues.jobQueueCapacity)
+		{
+			return nullptr;
+		}
+		return &queues.jobQueuePerThread[queue_index];
+	}
+
+	inline void SubmitJob(WorkerState& state, Priority priority, Job* job)
+	{
+		PriorityQueues& queues = state.queues[int(priority)];
+		JobQueue* queue = GetThreadQueue(queues, priority);
+		if (queue == nullptr || !queue->push_back(job))
+		{
+			queues.globalQueue.push_back(job);
+		}
+	}
+
+	// Wakes up to count parked workers that can execute jobs of the given priority
+	inline void WakeWorkers(WorkerState& state, Priority priority, uint32_t count)
+	{
+		WorkerPool& pool = state.pools[GetPool(priority)];
+
+		// Pairs with the fence in Park(): either this sees the parked worker, or the worker sees the submitted job
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		while (count > 0 && pool.parkedCount.load(std::memory_order_relaxed) > 0)
+		{
+			pool.idleLock.lock();
+			if (pool.idleCount == 0)
+			{
+				pool.idleLock.unlock();
+				break;
+			}
+			const uint32_t worker = pool.idleWorkers[--pool.idleCount];
+			pool.parkedCount.fetch_sub(1, std::memory_order_relaxed);
+			pool.idleLock.unlock();
+
+			WorkerSignal& signal = pool.signals[worker];
+			signal.mutex.lock();
+			signal.signaled = true;
+			signal.mutex.unlock();
+			signal.condition.notify_one();
+			count--;
+		}
+	}
+
+	// Checks if there could be any job of the given priority, without taking it
+	inline bool HasJob(WorkerState& state, Priority priority)
 	{
-		Job job;
-		if (internal_state.jobQueue.pop_front(job))
+		PriorityQueues& queues = state.queues[int(priority)];
+		if (!queues.globalQueue.empty())
 		{
+			return true;
+		}
+		const uint32_t queueCount = queues.jobQueueCount.load(std::memory_order_acquire);
+		for (uint32_t i = 0; i < queueCount; ++i)
+		{
+			if (!queues.jobQueuePerThread[i].empty())
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Try to take a job: first from the own deque, then the global queue, then steal from other threads' deques
+	inline bool FindJob(WorkerState& state, Priority priority, Job*& job)
+	{
+		PriorityQueues& queues = state.queues[int(priority)];
+		const uint32_t own = tls_queue_index[int(priority)];
+		const uint32_t queueCount = queues.jobQueueCount.load(std::memory_order_acquire);
+		if (own < queueCount && queues.jobQueuePerThread[own].pop_back(job))
+		{
+			return true;
+		}
+		if (queues.globalQueue.pop_front(job))
+		{
+			return true;
+		}
+		if (queueCount == 0)
+		{
+			return false;
+		}
+
+		// Start stealing from a random victim so that thieves don't all hammer the same deque:
+		uint32_t x = tls_random_state;
+		if (x == 0)
+		{
+			x = (uint32_t)std::hash<std::thread::id>{}(std::this_thread::get_id()) | 1u;
+		}
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		tls_random_state = x;
+
+		const uint32_t offset = x % queueCount;
+		for (uint32_t i = 0; i < queueCount; ++i)
+		{
+			const uint32_t victim = (offset + i) % queueCount;
+			if (victim == own)
+				continue;
+			JobQueue& queue = queues.jobQueuePerThread[victim];
+			while (!queue.empty())
+			{
+				if (queue.steal(job))
+				{
+					GetCounters(state).steals.fetch_add(1, std::memory_order_relaxed);
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	// Signals that a job of the context was finished, and notifies the owning task graph when the context became idle
+	void FinishJob(context& ctx)
+	{
+		// The context can be destroyed by a waiting thread right after the counter reached zero, so read everything before:
+		TaskGraph* graph = ctx.graph;
+		const uint32_t graph_task = ctx.graph_task;
+		if (ctx.counter.fetch_sub(1) == 1 && graph != nullptr)
+		{
+			graph->OnTaskFinished(graph_task);
+		}
+	}
+
+	// This function executes the next item from the job queue of the given priority. Returns true if successful, false if there was no job available
+	inline bool work(WorkerState& state, Priority priority)
+	{
+		Job* job = nullptr;
+		if (FindJob(state, priority, job))
+		{
+			Job* owner = job->owner;
+
 			JobArgs args;
-			args.groupID = job.groupID;
-			if (job.sharedmemory_size > 0)
+			args.groupID = job->groupID;
+			if (job->sharedmemory_size > 0)
 			{
-				args.sharedmemory = alloca(job.sharedmemory_size);
+				args.sharedmemory = alloca(job->sharedmemory_size);
 			}
 			else
 			{
 				args.sharedmemory = nullptr;
 			}
 
-			for (uint32_t i = job.groupJobOffset; i < job.groupJobEnd; ++i)
+			for (uint32_t i = job->groupJobOffset; i < job->groupJobEnd; ++i)
 			{
 				args.jobIndex = i;
-				args.groupIndex = i - job.groupJobOffset;
-				args.isFirstJobInGroup = (i == job.groupJobOffset);
-				args.isLastJobInGroup = (i == job.groupJobEnd - 1);
-				job.task(args);
+				args.groupIndex = i - job->groupJobOffset;
+				args.isFirstJobInGroup = (i == job->groupJobOffset);
+				args.isLastJobInGroup = (i == job->groupJobEnd - 1);
+				owner->task(args);
 			}
 
-			job.ctx->counter.fetch_sub(1);
+			context* ctx = job->ctx;
+			if (job != owner)
+			{
+				state.jobAllocator.free(job);
+			}
+			if (owner->refCount.fetch_sub(1) == 1)
+			{
+				owner->task = nullptr;
+				state.jobAllocator.free(owner);
+			}
+			FinishJob(*ctx);
+			GetCounters(state).jobs.fetch_add(1, std::memory_order_relaxed);
 			return true;
 		}
 		return false;
 	}
 
-	void Initialize(uint32_t maxThreadCount)
+	inline bool WorkerExecute(WorkerState& state, int pool)
+	{
+		if (pool == POOL_STREAMING)
+		{
+			return work(state, Priority::Streaming);
+		}
+		// High priority jobs are always preferred:
+		return work(state, Priority::High) || work(state, Priority::Normal);
+	}
+
+	inline bool WorkerHasJob(WorkerState& state, int pool)
+	{
+		if (pool == POOL_STREAMING)
+		{
+			return HasJob(state, Priority::Streaming);
+		}
+		return HasJob(state, Priority::High) || HasJob(state, Priority::Normal);
+	}
+
+	// Puts the worker to sleep until it is woken up by a submitter
+	inline void Park(WorkerState& state, int pool_index, uint32_t worker)
+	{
+		WorkerPool& pool = state.pools[pool_index];
+		WorkerSignal& signal = pool.signals[worker];
+
+		pool.idleLock.lock();
+		pool.idleWorkers[pool.idleCount++] = worker;
+		pool.parkedCount.fetch_add(1, std::memory_order_relaxed);
+		pool.idleLock.unlock();
+
+		// Pairs with the fence in WakeWorkers(): a job that was submitted before this worker was visible as parked must be seen here
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (WorkerHasJob(state, pool_index) || !state.alive.load())
+		{
+			// Try to cancel parking. If the worker was already taken off the idle stack, a wake signal is on its way and it must be consumed:
+			bool cancelled = false;
+			pool.idleLock.lock();
+			for (uint32_t i = 0; i < pool.idleCount; ++i)
+			{
+				if (pool.idleWorkers[i] == worker)
+				{
+					pool.idleWorkers[i] = pool.idleWorkers[--pool.idleCount];
+					pool.parkedCount.fetch_sub(1, std::memory_order_relaxed);
+					cancelled = true;
+					break;
+				}
+			}
+			pool.idleLock.unlock();
+			if (cancelled)
+			{
+				return;
+			}
+		}
+
+		GetCounters(state).parks.fetch_add(1, std::memory_order_relaxed);
+		std::unique_lock<std::mutex> lock(signal.mutex);
+		signal.condition.wait(lock, [&] { return signal.signaled; });
+		signal.signaled = false;
+		GetCounters(state).unparks.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	// Idle workers first spin, then yield, and only then go to sleep
+	inline void WorkerLoop(WorkerState& state, int pool, uint32_t worker)
+	{
+		while (state.alive.load())
+		{
+			if (WorkerExecute(state, pool))
+			{
+				continue;
+			}
+
+			bool found = false;
+			const uint32_t spin_count = state.spin_count.load(std::memory_order_relaxed);
+			for (uint32_t i = 0; i < spin_count && !found; ++i)
+			{
+				JOBSYSTEM_CPU_RELAX();
+				found = WorkerHasJob(state, pool);
+			}
+			const uint32_t yield_count = state.yield_count.load(std::memory_order_relaxed);
+			for (uint32_t i = 0; i < yield_count && !found; ++i)
+			{
+				std::this_thread::yield();
+				found = WorkerHasJob(state, pool);
+			}
+
+			if (!found)
+			{
+				Park(state, pool, worker);
+			}
+		}
+	}
+
+#ifdef PLATFORM_LINUX
+	struct LogicalProcessor
+	{
+		uint32_t cpu = 0;		// processor number as seen by the OS
+		uint32_t package = 0;
+		uint32_t core = 0;		// core id within the package
+		uint32_t node = 0;		// NUMA node index (dense, only counting nodes that have usable processors)
+		uint32_t smt = 0;		// index among the SMT siblings of the same physical core
+	};
+
+	// Reads a single value from a sysfs file, returns false if it couldn't be read
+	inline bool ReadSysfsValue(const std::string& path, uint32_t& value)
+	{
+		std::ifstream file(path);
+		return bool(file >> value);
+	}
+
+	// Reads a sysfs processor list, for example: "0-3,8-11"
+	inline std::vector<uint32_t> ReadSysfsCPUList(const std::string& path)
+	{
+		std::vector<uint32_t> result;
+		std::ifstream file(path);
+		std::string line;
+		if (!std::getline(file, line))
+			return result;
+		std::stringstream stream(line);
+		std::string range;
+		while (std::getline(stream, range, ','))
+		{
+			uint32_t first = 0;
+			uint32_t last = 0;
+			const int count = sscanf(range.c_str(), "%u-%u", &first, &last);
+			if (count < 1)
+				continue;
+			if (count == 1)
+				last = first;
+			for (uint32_t cpu = first; cpu <= last; ++cpu)
+			{
+				result.push_back(cpu);
+			}
+		}
+		return result;
+	}
+
+	// Collects the processors that this process is allowed to run on, with their core, package and NUMA node
+	inline std::vector<LogicalProcessor> DiscoverTopology(uint32_t& numaNodeCount)
+	{
+		numaNodeCount = 1;
+		std::vector<LogicalProcessor> processors;
+
+		cpu_set_t allowed;
+		CPU_ZERO(&allowed);
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+			return processors;
+
+		std::vector<uint32_t> lookup(CPU_SETSIZE, ~0u); // processor number -> index in processors
+		for (uint32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+		{
+			if (!CPU_ISSET(cpu, &allowed))
+				continue;
+			lookup[cpu] = (uint32_t)processors.size();
+			LogicalProcessor& processor = processors.emplace_back();
+			processor.cpu = cpu;
+			const std::string topology = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+			if (!ReadSysfsValue(topology + "physical_package_id", processor.package))
+				processor.package = 0;
+			if (!ReadSysfsValue(topology + "core_id", processor.core))
+				processor.core = cpu; // unknown topology, every processor is treated as a separate core
+		}
+
+		// NUMA nodes are optional in sysfs, without them everything is on node 0:
+		std::vector<uint32_t> nodes;
+		if (DIR* dir = opendir("/sys/devices/system/node"))
+		{
+			while (dirent* entry = readdir(dir))
+			{
+				uint32_t node = 0;
+				char tail = 0;
+				if (sscanf(entry->d_name, "node%u%c", &node, &tail) == 1)
+				{
+					nodes.push_back(node);
+				}
+			}
+			closedir(dir);
+		}
+		std::sort(nodes.begin(), nodes.end());
+		uint32_t nodeIndex = 0;
+		for (uint32_t node : nodes)
+		{
+			bool used = false;
+			for (uint32_t cpu : ReadSysfsCPUList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"))
+			{
+				if (cpu < CPU_SETSIZE && lookup[cpu] != ~0u)
+				{
+					processors[lookup[cpu]].node = nodeIndex;
+					used = true;
+				}
+			}
+			if (used)
+			{
+				nodeIndex++;
+			}
+		}
+		numaNodeCount = std::max(1u, nodeIndex);
+
+		// Number the SMT siblings within each physical core:
+		std::sort(processors.begin(), processors.end(), [](const LogicalProcessor& a, const LogicalProcessor& b) {
+			return std::tie(a.package, a.core, a.cpu) < std::tie(b.package, b.core, b.cpu);
+			});
+		for (size_t i = 1; i < processors.size(); ++i)
+		{
+			const LogicalProcessor& prev = processors[i - 1];
+			LogicalProcessor& processor = processors[i];
+			if (prev.package == processor.package && prev.core == processor.core)
+			{
+				processor.smt = prev.smt + 1;
+			}
+		}
+
+		return processors;
+	}
+
+	// Sorts the processors into the order in which the workers will be placed on them
+	inline void SortProcessors(std::vector<LogicalProcessor>& processors, AffinityPolicy policy)
+	{
+		switch (policy)
+		{
+		case AffinityPolicy::PhysicalCoresFirst:
+			std::sort(processors.begin(), processors.end(), [](const LogicalProcessor& a, const LogicalProcessor& b) {
+				return std::tie(a.smt, a.node, a.package, a.core, a.cpu) < std::tie(b.smt, b.node, b.package, b.core, b.cpu);
+				});
+			break;
+		case AffinityPolicy::Compact:
+			std::sort(processors.begin(), processors.end(), [](const LogicalProcessor& a, const LogicalProcessor& b) {
+				return std::tie(a.node, a.package, a.core, a.smt, a.cpu) < std::tie(b.node, b.package, b.core, b.smt, b.cpu);
+				});
+			break;
+		case AffinityPolicy::Scatter:
+		{
+			// physical cores first within each node, then interleave the nodes by the rank within their node:
+			std::sort(processors.begin(), processors.end(), [](const LogicalProcessor& a, const LogicalProcessor& b) {
+				return std::tie(a.node, a.smt, a.package, a.core, a.cpu) < std::tie(b.node, b.smt, b.package, b.core, b.cpu);
+				});
+			std::vector<std::pair<uint32_t, LogicalProcessor>> ranked;
+			ranked.reserve(processors.size());
+			uint32_t rank = 0;
+			for (size_t i = 0; i < processors.size(); ++i)
+			{
+				rank = (i > 0 && processors[i - 1].node == processors[i].node) ? rank + 1 : 0;
+				ranked.emplace_back(rank, processors[i]);
+			}
+			std::stable_sort(ranked.begin(), ranked.end(), [](const auto& a, const auto& b) {
+				return std::tie(a.first, a.second.node) < std::tie(b.first, b.second.node);
+				});
+			for (size_t i = 0; i < processors.size(); ++i)
+			{
+				processors[i] = ranked[i].second;
+			}
+		}
+		break;
+		default:
+			break;
+		}
+	}
+#endif // PLATFORM_LINUX
+
+	void Initialize(uint32_t maxThreadCount, AffinityPolicy affinityPolicy)
 	{
 		if (internal_state.numThreads > 0)
 			return;
@@ -137,23 +840,75 @@ namespace ap::jobsystem
 		// Retrieve the number of hardware threads in this system:
 		internal_state.numCores = std::thread::hardware_concurrency();
 
+#ifdef PLATFORM_LINUX
+		// Only the processors that the process is allowed to use are counted (hardware_concurrency() doesn't respect cgroup cpusets):
+		std::vector<LogicalProcessor> processors = DiscoverTopology(internal_state.numNumaNodes);
+		if (!processors.empty())
+		{
+			internal_state.numCores = (uint32_t)processors.size();
+			for (const LogicalProcessor& processor : processors)
+			{
+				if (processor.cpu >= internal_state.cpuNumaNodes.size())
+				{
+					internal_state.cpuNumaNodes.resize(processor.cpu + 1, 0);
+				}
+				internal_state.cpuNumaNodes[processor.cpu] = processor.node;
+			}
+			SortProcessors(processors, affinityPolicy);
+		}
+#endif // PLATFORM_LINUX
+
 		// Calculate the actual number of worker threads we want (-1 main thread):
 		internal_state.numThreads = std::min(maxThreadCount, std::max(1u, internal_state.numCores - 1));
 
+		// Streaming threads are extra low priority threads, they can be preempted by the frame workers at any time:
+		//	They are not taken out of the worker budget: they sleep while there is no streaming work, and while there is, they only get the CPU time that the frame workers leave idle
+		//	Taking them out would cost a quarter of the frame workers even when nothing is loading
+		internal_state.numStreamingThreads = std::max(1u, internal_state.numCores / 4);
+
+		// Every worker owns a deque, and some extra deques are reserved for other threads that submit jobs:
+		WorkerState& state = *internal_state.worker_state;
+		for (int priority = 0; priority < int(Priority::Count); ++priority)
+		{
+			const uint32_t workerCount = priority == int(Priority::Streaming) ? internal_state.numStreamingThreads : internal_state.numThreads;
+			PriorityQueues& queues = state.queues[priority];
+			queues.jobQueueCapacity = workerCount + MAX_EXTERNAL_QUEUES;
+			queues.jobQueuePerThread.reset(new JobQueue[queues.jobQueueCapacity]);
+			queues.jobQueueCount.store(workerCount);
+		}
+		for (int pool_index = 0; pool_index < POOL_COUNT; ++pool_index)
+		{
+			WorkerPool& pool = state.pools[pool_index];
+			pool.numThreads = pool_index == POOL_STREAMING ? internal_state.numStreamingThreads : internal_state.numThreads;
+			pool.signals.reset(new WorkerSignal[pool.numThreads]);
+			pool.idleWorkers.reset(new uint32_t[pool.numThreads]);
+		}
+		state.workerCounterCount = internal_state.numThreads + internal_state.numStreamingThreads;
+		state.workerCounters.reset(new WorkerCounters[state.workerCounterCount]);
+
 		for (uint32_t threadID = 0; threadID < internal_state.numThreads; ++threadID)
 		{
-			std::thread worker([] {
+			uint32_t numa_node = ~0u;
+#ifdef PLATFORM_LINUX
+			// The first processor of the placement order is left for the main thread:
+			const LogicalProcessor* processor = nullptr;
+			if (affinityPolicy != AffinityPolicy::None && !processors.empty())
+			{
+				processor = &processors[(threadID + 1) % processors.size()];
+				numa_node = processor->node;
+			}
+#endif // PLATFORM_LINUX
+
+			std::thread worker([threadID, numa_node] {
+
+				tls_queue_index[int(Priority::High)] = threadID;
+				tls_queue_index[int(Priority::Normal)] = threadID;
+				tls_worker_index = threadID;
+				tls_numa_node = numa_node;
 
 				std::shared_ptr<WorkerState> worker_state = internal_state.worker_state; // this is a copy of shared_ptr<WorkerState>, so it will remain alive for the thread's lifetime
-				while (worker_state->alive.load())
-				{
-					if (!work())
-					{
-						// no job, put thread to sleep
-						std::unique_lock<std::mutex> lock(worker_state->wakeMutex);
-						worker_state->wakeCondition.wait(lock);
-					}
-				}
+				tls_counters = &worker_state->workerCounters[threadID];
+				WorkerLoop(*worker_state, POOL_FRAME, threadID);
 
 				});
 
@@ -162,9 +917,12 @@ namespace ap::jobsystem
 			HANDLE handle = (HANDLE)worker.native_handle();
 
 			// Put each thread on to dedicated core:
-			DWORD_PTR affinityMask = 1ull << threadID;
-			DWORD_PTR affinity_result = SetThreadAffinityMask(handle, affinityMask);
-			assert(affinity_result > 0);
+			if (affinityPolicy != AffinityPolicy::None)
+			{
+				DWORD_PTR affinityMask = 1ull << threadID;
+				DWORD_PTR affinity_result = SetThreadAffinityMask(handle, affinityMask);
+				assert(affinity_result > 0);
+			}
 
 			//// Increase thread priority:
 			//BOOL priority_result = SetThreadPriority(handle, THREAD_PRIORITY_HIGHEST);
@@ -179,14 +937,17 @@ namespace ap::jobsystem
                do { errno = en; perror(msg); } while (0)
 
 			int ret;
-			cpu_set_t cpuset;
-			CPU_ZERO(&cpuset);
-			size_t cpusetsize = sizeof(cpuset);
+			if (processor != nullptr)
+			{
+				cpu_set_t cpuset;
+				CPU_ZERO(&cpuset);
+				size_t cpusetsize = sizeof(cpuset);
 
-			CPU_SET(threadID, &cpuset);
-			ret = pthread_setaffinity_np(worker.native_handle(), cpusetsize, &cpuset);
-			if (ret != 0)
-				handle_error_en(ret, std::string(" pthread_setaffinity_np[" + std::to_string(threadID) + ']').c_str());
+				CPU_SET(processor->cpu, &cpuset);
+				ret = pthread_setaffinity_np(worker.native_handle(), cpusetsize, &cpuset);
+				if (ret != 0)
+					handle_error_en(ret, std::string(" pthread_setaffinity_np[" + std::to_string(threadID) + ']').c_str());
+			}
 
 			// Name the thread
 			std::string thread_name = "ap::jobsystem_" + std::to_string(threadID);
@@ -199,64 +960,157 @@ namespace ap::jobsystem
 			worker.detach();
 		}
 
-		ap::backlog::post("ap::jobsystem Initialized with [" + std::to_string(internal_state.numCores) + " cores] [" + std::to_string(internal_state.numThreads) + " threads] (" + std::to_string((int)std::round(timer.elapsed())) + " ms)");
+		for (uint32_t threadID = 0; threadID < internal_state.numStreamingThreads; ++threadID)
+		{
+			std::thread worker([threadID] {
+
+#ifdef PLATFORM_LINUX
+				// The scheduling policy and nice value apply to the calling thread only, so they are set from inside the thread:
+				//	SCHED_BATCH never preempts the frame workers, and the nice value gives the streaming threads a smaller share when they compete
+				sched_param param = {};
+				int ret = pthread_setschedparam(pthread_self(), SCHED_BATCH, &param);
+				if (ret != 0)
+				{
+					errno = ret;
+					perror(std::string(" pthread_setschedparam[streaming " + std::to_string(threadID) + ']').c_str());
+				}
+				if (setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), STREAMING_THREAD_NICE) != 0)
+				{
+					perror(std::string(" setpriority[streaming " + std::to_string(threadID) + ']').c_str());
+				}
+#endif // PLATFORM_LINUX
+
+				tls_queue_index[int(Priority::Streaming)] = threadID;
+				tls_worker_index = internal_state.numThreads + threadID;
+
+				std::shared_ptr<WorkerState> worker_state = internal_state.worker_state; // this is a copy of shared_ptr<WorkerState>, so it will remain alive for the thread's lifetime
+				tls_counters = &worker_state->workerCounters[internal_state.numThreads + threadID];
+				WorkerLoop(*worker_state, POOL_STREAMING, threadID);
+
+				});
+
+#ifdef _WIN32
+			// Do Windows-specific thread setup:
+			HANDLE handle = (HANDLE)worker.native_handle();
+
+			// Streaming threads are not pinned to a core, but they run with lower priority than the frame workers:
+			BOOL priority_result = SetThreadPriority(handle, THREAD_PRIORITY_BELOW_NORMAL);
+			assert(priority_result != 0);
+
+			// Name the thread:
+			std::wstring wthreadname = L"ap::jobsystem_streaming_" + std::to_wstring(threadID);
+			HRESULT hr = SetThreadDescription(handle, wthreadname.c_str());
+			assert(SUCCEEDED(hr));
+#elif defined(PLATFORM_LINUX)
+#define handle_error_en(en, msg) \
+               do { errno = en; perror(msg); } while (0)
+
+			// Name the thread
+			std::string thread_name = "ap::jobstream_" + std::to_string(threadID);
+			int ret = pthread_setname_np(worker.native_handle(), thread_name.c_str());
+			if (ret != 0)
+				handle_error_en(ret, std::string(" pthread_setname_np[streaming " + std::to_string(threadID) + ']').c_str());
+#undef handle_error_en
+#endif // _WIN32
+
+			worker.detach();
+		}
+
+		ap::backlog::post("ap::jobsystem Initialized with [" + std::to_string(internal_state.numCores) + " cores] [" + std::to_string(internal_state.numThreads) + " threads] [" + std::to_string(internal_state.numStreamingThreads) + " streaming threads] [" + std::to_string(internal_state.numNumaNodes) + " NUMA nodes] (" + std::to_string((int)std::round(timer.elapsed())) + " ms)");
+	}
+
+	uint32_t GetThreadCount(Priority priority)
+	{
+		return priority == Priority::Streaming ? internal_state.numStreamingThreads : internal_state.numThreads;
 	}
 
-	uint32_t GetThreadCount()
+	uint32_t GetCurrentWorkerIndex()
 	{
-		return internal_state.numThreads;
+		return tls_worker_index;
 	}
 
-	void Execute(context& ctx, const std::function<void(JobArgs)>& task)
+	Priority GetLoadingPriority()
 	{
+		const bool streaming_worker = tls_worker_index != WORKER_NONE && tls_worker_index >= internal_state.numThreads;
+		return streaming_worker ? Priority::Streaming : Priority::Normal;
+	}
+
+	uint32_t GetCurrentNumaNode()
+	{
+		if (tls_numa_node != ~0u)
+			return tls_numa_node;
+#ifdef PLATFORM_LINUX
+		// Threads that are not pinned can migrate between nodes, so this is only a hint for them:
+		const int cpu = sched_getcpu();
+		if (cpu >= 0 && size_t(cpu) < internal_state.cpuNumaNodes.size())
+			return internal_state.cpuNumaNodes[cpu];
+#endif // PLATFORM_LINUX
+		return 0;
+	}
+
+	uint32_t GetNumaNodeCount()
+	{
+		return internal_state.numNumaNodes;
+	}
+
+	void Execute(context& ctx, const JobFunction& task)
+	{
+		WorkerState& state = *internal_state.worker_state;
+
 		// Context state is updated:
 		ctx.counter.fetch_add(1);
 
-		Job job;
-		job.ctx = &ctx;
-		job.task = task;
-		job.groupID = 0;
-		job.groupJobOffset = 0;
-		job.groupJobEnd = 1;
-		job.sharedmemory_size = 0;
+		Job* job = state.jobAllocator.allocate();
+		job->ctx = &ctx;
+		job->owner = job;
+		job->task = task;
+		job->refCount.store(1, std::memory_order_relaxed);
+		job->groupID = 0;
+		job->groupJobOffset = 0;
+		job->groupJobEnd = 1;
+		job->sharedmemory_size = 0;
 
-		// Try to push a new job until it is pushed successfully:
-		while (!internal_state.jobQueue.push_back(job)) { internal_state.worker_state->wakeCondition.notify_all(); work(); }
+		SubmitJob(state, ctx.priority, job);
 
-		// Wake any one thread that might be sleeping:
-		internal_state.worker_state->wakeCondition.notify_one();
+		// Wake one thread that might be sleeping:
+		WakeWorkers(state, ctx.priority, 1);
 	}
 
-	void Dispatch(context& ctx, uint32_t jobCount, uint32_t groupSize, const std::function<void(JobArgs)>& task, size_t sharedmemory_size)
+	void Dispatch(context& ctx, uint32_t jobCount, uint32_t groupSize, const JobFunction& task, size_t sharedmemory_size)
 	{
 		if (jobCount == 0 || groupSize == 0)
 		{
 			return;
 		}
 
+		WorkerState& state = *internal_state.worker_state;
+
 		const uint32_t groupCount = DispatchGroupCount(jobCount, groupSize);
 
 		// Context state is updated:
 		ctx.counter.fetch_add(groupCount);
 
-		Job job;
-		job.ctx = &ctx;
-		job.task = task;
-		job.sharedmemory_size = (uint32_t)sharedmemory_size;
+		// The task is only stored once, in the first group's job, and it is released by the group that finishes last:
+		Job* owner = state.jobAllocator.allocate();
+		owner->task = task;
+		owner->refCount.store(groupCount, std::memory_order_relaxed);
 
 		for (uint32_t groupID = 0; groupID < groupCount; ++groupID)
 		{
 			// For each group, generate one real job:
-			job.groupID = groupID;
-			job.groupJobOffset = groupID * groupSize;
-			job.groupJobEnd = std::min(job.groupJobOffset + groupSize, jobCount);
+			Job* job = groupID == 0 ? owner : state.jobAllocator.allocate();
+			job->ctx = &ctx;
+			job->owner = owner;
+			job->sharedmemory_size = (uint32_t)sharedmemory_size;
+			job->groupID = groupID;
+			job->groupJobOffset = groupID * groupSize;
+			job->groupJobEnd = std::min(job->groupJobOffset + groupSize, jobCount);
 
-			// Try to push a new job until it is pushed successfully:
-			while (!internal_state.jobQueue.push_back(job)) { internal_state.worker_state->wakeCondition.notify_all(); work(); }
+			SubmitJob(state, ctx.priority, job);
 		}
 
-		// Wake any threads that might be sleeping:
-		internal_state.worker_state->wakeCondition.notify_all();
+		// Wake as many threads as there are new jobs:
+		WakeWorkers(state, ctx.priority, groupCount);
 	}
 
 	uint32_t DispatchGroupCount(uint32_t jobCount, uint32_t groupSize)
@@ -273,10 +1127,126 @@ namespace ap::jobsystem
 
 	void Wait(const context& ctx)
 	{
-		// Wake any threads that might be sleeping:
-		internal_state.worker_state->wakeCondition.notify_all();
+		WorkerState& state = *internal_state.worker_state;
+
+		// Waiting will also put the current thread to good use by working on an other job of the same priority if it can
+		//	(never of a different priority, so a frame Wait() can't get stuck in a long running streaming job):
+		while (IsBusy(ctx)) { work(state, ctx.priority); }
+	}
+
+	void SetIdlePolicy(const IdlePolicy& policy)
+	{
+		internal_state.worker_state->spin_count.store(policy.spin_count);
+		internal_state.worker_state->yield_count.store(policy.yield_count);
+	}
+
+	IdlePolicy GetIdlePolicy()
+	{
+		IdlePolicy policy;
+		policy.spin_count = internal_state.worker_state->spin_count.load();
+		policy.yield_count = internal_state.worker_state->yield_count.load();
+		return policy;
+	}
+
+	Statistics GetStatistics()
+	{
+		WorkerState& state = *internal_state.worker_state;
+		Statistics statistics;
+		auto accumulate = [&](const WorkerCounters& counters) {
+			statistics.jobs += counters.jobs.load(std::memory_order_relaxed);
+			statistics.steals += counters.steals.load(std::memory_order_relaxed);
+			statistics.parks += counters.parks.load(std::memory_order_relaxed);
+			statistics.unparks += counters.unparks.load(std::memory_order_relaxed);
+		};
+		for (uint32_t i = 0; i < state.workerCounterCount; ++i)
+		{
+			accumulate(state.workerCounters[i]);
+		}
+		accumulate(state.externalCounters);
+		for (const WorkerPool& pool : state.pools)
+		{
+			statistics.parked_threads += pool.parkedCount.load(std::memory_order_relaxed);
+		}
+		return statistics;
+	}
+
+	TaskGraph::TaskID TaskGraph::AddTask(const std::function<void(context&)>& task, std::initializer_list<TaskID> dependencies)
+	{
+		const TaskID id = (TaskID)tasks.size();
+		tasks.emplace_back().task = task;
+		for (TaskID dependency : dependencies)
+		{
+			AddDependency(id, dependency);
+		}
+		return id;
+	}
+
+	void TaskGraph::AddDependency(TaskID task, TaskID dependency)
+	{
+		assert(task < tasks.size());
+		assert(dependency < task); // dependencies must be added before, this also rules out cycles
+		tasks[dependency].successors.push_back(task);
+		tasks[task].dependencyCount++;
+	}
+
+	void TaskGraph::Run(context& ctx)
+	{
+		if (tasks.empty())
+		{
+			return;
+		}
+
+		// The graph context is busy until every task is finished:
+		run_ctx = &ctx;
+		ctx.counter.fetch_add((uint32_t)tasks.size());
+
+		// Every dependency counter must be reset before any task is started, because tasks can finish immediately:
+		for (TaskID id = 0; id < (TaskID)tasks.size(); ++id)
+		{
+			Task& task = tasks[id];
+			task.remainingDependencies.store(task.dependencyCount);
+			task.ctx.priority = ctx.priority;
+			task.ctx.graph = this;
+			task.ctx.graph_task = id;
+		}
+
+		for (TaskID id = 0; id < (TaskID)tasks.size(); ++id)
+		{
+			if (tasks[id].dependencyCount == 0)
+			{
+				Start(id);
+			}
+		}
+	}
+
+	void TaskGraph::Clear()
+	{
+		tasks.clear();
+		run_ctx = nullptr;
+	}
+
+	void TaskGraph::Start(TaskID id)
+	{
+		Task& task = tasks[id];
+
+		// The task itself is executed as a job within its own context, so the task is not finished until it returned:
+		Execute(task.ctx, [this, id](JobArgs args) {
+			Task& task = tasks[id];
+			task.task(task.ctx);
+		});
+	}
+
+	void TaskGraph::OnTaskFinished(TaskID id)
+	{
+		for (TaskID successor : tasks[id].successors)
+		{
+			if (tasks[successor].remainingDependencies.fetch_sub(1) == 1)
+			{
+				Start(successor);
+			}
+		}
 
-		// Waiting will also put the current thread to good use by working on an other job if it can:
-		while (IsBusy(ctx)) { work(); }
+		// This must be the last access to the graph, because it can be destroyed after the whole graph is finished:
+		FinishJob(*run_ctx);
 	}
 }
@@ -2,10 +2,29 @@
 
 #include <functional>
 #include <atomic>
+#include <deque>
+#include <vector>
+#include <initializer_list>
+#include <type_traits>
+#include <utility>
+#include <new>
+#include <cstddef>
+#include <cstdint>
 
 namespace ap::jobsystem
 {
-	void Initialize(uint32_t maxThreadCount = ~0u);
+	// Placement of the frame worker threads onto logical processors
+	//	The topology is read from sysfs on Linux and only the processors allowed by the process affinity (cgroup cpuset, taskset) are used
+	//	On other platforms worker N is pinned to logical processor N unless the policy is None
+	enum class AffinityPolicy
+	{
+		PhysicalCoresFirst,	// one worker per physical core, SMT siblings are only used when there are more workers than physical cores
+		Compact,			// fill SMT siblings and cores of the same NUMA node before moving on to the next node
+		Scatter,			// distribute workers round-robin across NUMA nodes, physical cores first within each node
+		None,				// workers are not pinned, the OS scheduler places them
+	};
+
+	void Initialize(uint32_t maxThreadCount = ~0u, AffinityPolicy affinityPolicy = AffinityPolicy::PhysicalCoresFirst);
 
 	struct JobArgs
 	{
@@ -17,22 +36,139 @@ namespace ap::jobsystem
 		void* sharedmemory;		// stack memory shared within the current group (jobs within a group execute serially)
 	};
 
-	uint32_t GetThreadCount();
+	// High priority jobs are meant for per-frame work and they are executed first by the worker threads
+	//	Normal priority jobs are executed by the same workers when there are no high priority jobs
+	//	Streaming priority jobs are executed by separate low priority threads, they are meant for long running work (resource loading, shader compilation, etc.)
+	//	Waiting on a context only helps executing jobs of the same priority, so a frame Wait() will never be blocked by streaming work
+	//	Any thread that waits on a streaming context executes streaming jobs too, but the frame workers never help, so work that is waited on synchronously should not use streaming priority (see GetLoadingPriority())
+	enum class Priority
+	{
+		High,
+		Normal,
+		Streaming,
+		Count
+	};
+
+	// Returns the number of worker threads that execute jobs of the given priority
+	uint32_t GetThreadCount(Priority priority = Priority::High);
+
+	// Returns the index of the worker thread that calls this, or ~0u if it's not called from a worker thread
+	//	Frame workers are in [0, GetThreadCount(High)), streaming workers follow them
+	uint32_t GetCurrentWorkerIndex();
+
+	// Returns the priority for loading work that the calling thread dispatches and then waits on (decoding, decompression, deserialization)
+	//	On streaming workers it is Streaming, so asynchronous loading stays on the streaming threads and never competes with frame jobs
+	//	On every other thread it is Normal, so a synchronous load is executed by all frame workers instead of only the few streaming threads
+	Priority GetLoadingPriority();
+
+	// Returns the NUMA node of the calling thread, this is stable for pinned frame workers so it can be used to select per-node scratch memory
+	//	Returns 0 if the topology is unknown
+	uint32_t GetCurrentNumaNode();
+
+	// Returns the number of NUMA nodes that the worker threads can run on (at least 1)
+	uint32_t GetNumaNodeCount();
+
+	// Function wrapper that stores the callable inline in a fixed capacity buffer, so it never allocates memory
+	//	The callable must fit into the capacity, this is checked at compile time
+	template<typename Signature, size_t capacity>
+	class InlineFunction;
+	template<typename R, typename... Args, size_t capacity>
+	class InlineFunction<R(Args...), capacity>
+	{
+	public:
+		InlineFunction() = default;
+		InlineFunction(std::nullptr_t) {}
+		template<typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, InlineFunction>::value>>
+		InlineFunction(F&& func)
+		{
+			using Func = std::decay_t<F>;
+			static_assert(sizeof(Func) <= capacity, "InlineFunction: the callable is too large, capture less data or capture by reference!");
+			static_assert(alignof(Func) <= alignof(std::max_align_t), "InlineFunction: the callable is over-aligned!");
+			new (storage) Func(std::forward<F>(func));
+			invoke = [](void* target, Args... args) -> R {
+				return (*(Func*)target)(std::forward<Args>(args)...);
+			};
+			manage = [](void* dst, const void* src) {
+				if (src != nullptr)
+				{
+					new (dst) Func(*(const Func*)src);
+				}
+				else
+				{
+					((Func*)dst)->~Func();
+				}
+			};
+		}
+		InlineFunction(const InlineFunction& other) { copy(other); }
+		InlineFunction& operator=(const InlineFunction& other)
+		{
+			if (this != &other)
+			{
+				reset();
+				copy(other);
+			}
+			return *this;
+		}
+		InlineFunction& operator=(std::nullptr_t)
+		{
+			reset();
+			return *this;
+		}
+		~InlineFunction() { reset(); }
+
+		inline R operator()(Args... args) const
+		{
+			return invoke((void*)storage, std::forward<Args>(args)...);
+		}
+		explicit operator bool() const { return invoke != nullptr; }
+
+	private:
+		alignas(std::max_align_t) uint8_t storage[capacity];
+		R(*invoke)(void*, Args...) = nullptr;
+		void(*manage)(void* dst, const void* src) = nullptr; // copy constructs src into dst, or destroys dst if src is nullptr
+
+		inline void copy(const InlineFunction& other)
+		{
+			if (other.manage != nullptr)
+			{
+				other.manage(storage, other.storage);
+			}
+			invoke = other.invoke;
+			manage = other.manage;
+		}
+		inline void reset()
+		{
+			if (manage != nullptr)
+			{
+				manage(storage, nullptr);
+			}
+			invoke = nullptr;
+			manage = nullptr;
+		}
+	};
+
+	// The job callable, it can hold lambdas with up to 64 bytes of captured data (or an std::function) without allocating
+	using JobFunction = InlineFunction<void(JobArgs), 64>;
+
+	class TaskGraph;
 
 	// Defines a state of execution, can be waited on
 	struct context
 	{
 		std::atomic<uint32_t> counter{ 0 };
+		Priority priority = Priority::High;	// all jobs of this context will be executed with this priority
+		TaskGraph* graph = nullptr;	// set by the TaskGraph that owns this context, it will be notified when the counter reaches zero
+		uint32_t graph_task = 0;
 	};
 
 	// Add a task to execute asynchronously. Any idle thread will execute this.
-	void Execute(context& ctx, const std::function<void(JobArgs)>& task);
+	void Execute(context& ctx, const JobFunction& task);
 
 	// Divide a task onto multiple jobs and execute in parallel.
 	//	jobCount	: how many jobs to generate for this task.
 	//	groupSize	: how many jobs to execute per thread. Jobs inside a group execute serially. It might be worth to increase for small jobs
 	//	task		: receives a JobArgs as parameter
-	void Dispatch(context& ctx, uint32_t jobCount, uint32_t groupSize, const std::function<void(JobArgs)>& task, size_t sharedmemory_size = 0);
+	void Dispatch(context& ctx, uint32_t jobCount, uint32_t groupSize, const JobFunction& task, size_t sharedmemory_size = 0);
 
 	// Returns the amount of job groups that will be created for a set number of jobs and group size
 	uint32_t DispatchGroupCount(uint32_t jobCount, uint32_t groupSize);
@@ -42,4 +178,68 @@ namespace ap::jobsystem
 
 	// Wait until all threads become idle
 	void Wait(const context& ctx);
+
+	// Idle worker threads first spin, then yield, and then go to sleep until new jobs are submitted
+	//	Spinning and yielding reduces the wake up latency for frequent small dispatches, at the cost of burning CPU time
+	struct IdlePolicy
+	{
+		uint32_t spin_count = 256;	// how many times to check for jobs while spinning
+		uint32_t yield_count = 8;	// how many times to check for jobs while yielding to other threads
+	};
+	void SetIdlePolicy(const IdlePolicy& policy);
+	IdlePolicy GetIdlePolicy();
+
+	// Cumulative counters since startup, for profiling
+	struct Statistics
+	{
+		uint64_t jobs = 0;			// executed job groups
+		uint64_t steals = 0;		// jobs that were taken from an other thread's deque
+		uint64_t parks = 0;			// how many times worker threads went to sleep
+		uint64_t unparks = 0;		// how many times worker threads were woken up
+		uint32_t parked_threads = 0;	// worker threads that are currently sleeping (not cumulative)
+	};
+	Statistics GetStatistics();
+
+	// Task graph: every task declares its dependencies and the scheduler starts it as soon as all of them are finished,
+	//	so no global Wait() is required between tasks that are independent of each other
+	//	A task receives its own context that it can spawn further jobs into, the task is only finished once all of those are finished too
+	//	The task itself is also counted in its context, so a task must never Wait() on its own context (that would never return)
+	//	If a task needs the results of its jobs before continuing, it should dispatch them into a local context and wait on that
+	class TaskGraph
+	{
+	public:
+		using TaskID = uint32_t;
+
+		// Add a task that will start after all of its dependencies are finished
+		//	dependencies must be tasks that were already added to the graph (this ensures that there are no cycles)
+		TaskID AddTask(const std::function<void(context&)>& task, std::initializer_list<TaskID> dependencies = {});
+
+		// The task will not start until the dependency is finished
+		void AddDependency(TaskID task, TaskID dependency);
+
+		// Start executing the graph asynchronously. The ctx is busy until all tasks are finished, use Wait(ctx) to wait for the whole graph
+		//	The graph must be kept alive and not modified until then
+		void Run(context& ctx);
+
+		// Remove all tasks, the graph must not be running
+		void Clear();
+
+		size_t GetTaskCount() const { return tasks.size(); }
+
+	private:
+		struct Task
+		{
+			std::function<void(context&)> task;
+			std::vector<TaskID> successors;
+			uint32_t dependencyCount = 0;
+			std::atomic<uint32_t> remainingDependencies{ 0 };
+			context ctx;
+		};
+		std::deque<Task> tasks; // deque, because Task is not movable
+		context* run_ctx = nullptr;
+
+		void Start(TaskID id);
+		void OnTaskFinished(TaskID id);
+		friend void FinishJob(context& ctx);
+	};
 }
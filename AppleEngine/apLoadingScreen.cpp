@@ -37,6 +37,8 @@ namespace ap
 
 	void LoadingScreen::Start()
 	{
+		// Loading tasks are running while frames are rendered, so they must not occupy the frame workers:
+		ctx.priority = ap::jobsystem::Priority::Streaming;
 		for (auto& x : tasks)
 		{
 			ap::jobsystem::Execute(ctx, x);
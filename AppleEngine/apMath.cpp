@@ -416,4 +416,137 @@ namespace ap::math
 		return HALTON[idx % arraysize(HALTON)];
 	}
 
+	void ComposeMatrix4(const XMFLOAT3* const S[4], const XMFLOAT4* const R[4], const XMFLOAT3* const T[4], XMFLOAT4X4* const result[4])
+	{
+		// Each vector holds the same component of the 4 transforms:
+		const XMMATRIX scale = XMMatrixTranspose(XMMATRIX(XMLoadFloat3(S[0]), XMLoadFloat3(S[1]), XMLoadFloat3(S[2]), XMLoadFloat3(S[3])));
+		const XMMATRIX rotation = XMMatrixTranspose(XMMATRIX(XMLoadFloat4(R[0]), XMLoadFloat4(R[1]), XMLoadFloat4(R[2]), XMLoadFloat4(R[3])));
+		const XMMATRIX translation = XMMatrixTranspose(XMMATRIX(XMLoadFloat3(T[0]), XMLoadFloat3(T[1]), XMLoadFloat3(T[2]), XMLoadFloat3(T[3])));
+
+		const XMVECTOR x = rotation.r[0];
+		const XMVECTOR y = rotation.r[1];
+		const XMVECTOR z = rotation.r[2];
+		const XMVECTOR w = rotation.r[3];
+		const XMVECTOR x2 = x + x;
+		const XMVECTOR y2 = y + y;
+		const XMVECTOR z2 = z + z;
+		const XMVECTOR xx = x * x2;
+		const XMVECTOR yy = y * y2;
+		const XMVECTOR zz = z * z2;
+		const XMVECTOR xy = x * y2;
+		const XMVECTOR xz = x * z2;
+		const XMVECTOR yz = y * z2;
+		const XMVECTOR wx = w * x2;
+		const XMVECTOR wy = w * y2;
+		const XMVECTOR wz = w * z2;
+		const XMVECTOR one = XMVectorSplatOne();
+		const XMVECTOR zero = XMVectorZero();
+
+		// Rotation matrix rows scaled by the scale components:
+		const XMVECTOR m00 = (one - (yy + zz)) * scale.r[0];
+		const XMVECTOR m01 = (xy + wz) * scale.r[0];
+		const XMVECTOR m02 = (xz - wy) * scale.r[0];
+		const XMVECTOR m10 = (xy - wz) * scale.r[1];
+		const XMVECTOR m11 = (one - (xx + zz)) * scale.r[1];
+		const XMVECTOR m12 = (yz + wx) * scale.r[1];
+		const XMVECTOR m20 = (xz + wy) * scale.r[2];
+		const XMVECTOR m21 = (yz - wx) * scale.r[2];
+		const XMVECTOR m22 = (one - (xx + yy)) * scale.r[2];
+
+		// Transpose back, rowN.r[i] is the Nth row of the ith matrix:
+		const XMMATRIX row0 = XMMatrixTranspose(XMMATRIX(m00, m01, m02, zero));
+		const XMMATRIX row1 = XMMatrixTranspose(XMMATRIX(m10, m11, m12, zero));
+		const XMMATRIX row2 = XMMatrixTranspose(XMMATRIX(m20, m21, m22, zero));
+		const XMMATRIX row3 = XMMatrixTranspose(XMMATRIX(translation.r[0], translation.r[1], translation.r[2], one));
+		for (int i = 0; i < 4; ++i)
+		{
+			XMStoreFloat4x4(result[i], XMMATRIX(row0.r[i], row1.r[i], row2.r[i], row3.r[i]));
+		}
+	}
+
+	uint32_t XM_CALLCONV RayTriangleIntersects8(FXMVECTOR Origin, FXMVECTOR Direction, const TrianglePacket8& tri, float Dist[8], XMFLOAT2 bary[8])
+	{
+#ifdef _XM_AVX2_INTRINSICS_
+		const __m256 g_RayEpsilon = _mm256_set1_ps(1e-20f);
+		const __m256 g_RayNegEpsilon = _mm256_set1_ps(-1e-20f);
+		const __m256 Zero = _mm256_setzero_ps();
+
+		const __m256 Dx = _mm256_set1_ps(XMVectorGetX(Direction));
+		const __m256 Dy = _mm256_set1_ps(XMVectorGetY(Direction));
+		const __m256 Dz = _mm256_set1_ps(XMVectorGetZ(Direction));
+
+		// p = Direction ^ e2;
+		const __m256 px = _mm256_fmsub_ps(Dy, tri.e2[2], _mm256_mul_ps(Dz, tri.e2[1]));
+		const __m256 py = _mm256_fmsub_ps(Dz, tri.e2[0], _mm256_mul_ps(Dx, tri.e2[2]));
+		const __m256 pz = _mm256_fmsub_ps(Dx, tri.e2[1], _mm256_mul_ps(Dy, tri.e2[0]));
+
+		// det = e1 * p;
+		const __m256 det = _mm256_fmadd_ps(tri.e1[2], pz, _mm256_fmadd_ps(tri.e1[1], py, _mm256_mul_ps(tri.e1[0], px)));
+
+		// s = Origin - V0;
+		const __m256 sx = _mm256_sub_ps(_mm256_set1_ps(XMVectorGetX(Origin)), tri.v0[0]);
+		const __m256 sy = _mm256_sub_ps(_mm256_set1_ps(XMVectorGetY(Origin)), tri.v0[1]);
+		const __m256 sz = _mm256_sub_ps(_mm256_set1_ps(XMVectorGetZ(Origin)), tri.v0[2]);
+
+		// u = s * p;
+		const __m256 u = _mm256_fmadd_ps(sz, pz, _mm256_fmadd_ps(sy, py, _mm256_mul_ps(sx, px)));
+
+		// q = s ^ e1;
+		const __m256 qx = _mm256_fmsub_ps(sy, tri.e1[2], _mm256_mul_ps(sz, tri.e1[1]));
+		const __m256 qy = _mm256_fmsub_ps(sz, tri.e1[0], _mm256_mul_ps(sx, tri.e1[2]));
+		const __m256 qz = _mm256_fmsub_ps(sx, tri.e1[1], _mm256_mul_ps(sy, tri.e1[0]));
+
+		// v = Direction * q;
+		const __m256 v = _mm256_fmadd_ps(Dz, qz, _mm256_fmadd_ps(Dy, qy, _mm256_mul_ps(Dx, qx)));
+
+		// t = e2 * q;
+		const __m256 t = _mm256_fmadd_ps(tri.e2[2], qz, _mm256_fmadd_ps(tri.e2[1], qy, _mm256_mul_ps(tri.e2[0], qx)));
+
+		const __m256 uv = _mm256_add_ps(u, v);
+
+		// Front side of the triangle (determinant is positive):
+		__m256 Front = _mm256_cmp_ps(det, g_RayEpsilon, _CMP_GE_OQ);
+		Front = _mm256_and_ps(Front, _mm256_cmp_ps(u, Zero, _CMP_GE_OQ));
+		Front = _mm256_and_ps(Front, _mm256_cmp_ps(u, det, _CMP_LE_OQ));
+		Front = _mm256_and_ps(Front, _mm256_cmp_ps(v, Zero, _CMP_GE_OQ));
+		Front = _mm256_and_ps(Front, _mm256_cmp_ps(uv, det, _CMP_LE_OQ));
+		Front = _mm256_and_ps(Front, _mm256_cmp_ps(t, Zero, _CMP_GE_OQ));
+
+		// Back side of the triangle (determinant is negative):
+		__m256 Back = _mm256_cmp_ps(det, g_RayNegEpsilon, _CMP_LE_OQ);
+		Back = _mm256_and_ps(Back, _mm256_cmp_ps(u, Zero, _CMP_LE_OQ));
+		Back = _mm256_and_ps(Back, _mm256_cmp_ps(u, det, _CMP_GE_OQ));
+		Back = _mm256_and_ps(Back, _mm256_cmp_ps(v, Zero, _CMP_LE_OQ));
+		Back = _mm256_and_ps(Back, _mm256_cmp_ps(uv, det, _CMP_GE_OQ));
+		Back = _mm256_and_ps(Back, _mm256_cmp_ps(t, Zero, _CMP_LE_OQ));
+
+		const uint32_t mask = (uint32_t)_mm256_movemask_ps(_mm256_or_ps(Front, Back));
+		if (mask == 0)
+		{
+			return 0;
+		}
+
+		const __m256 invdet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+		alignas(32) float dist[8];
+		alignas(32) float baryU[8];
+		alignas(32) float baryV[8];
+		_mm256_store_ps(dist, _mm256_div_ps(t, det));
+		_mm256_store_ps(baryU, _mm256_mul_ps(u, invdet));
+		_mm256_store_ps(baryV, _mm256_mul_ps(v, invdet));
+		for (uint32_t i = 0; i < 8; ++i)
+		{
+			if (mask & (1u << i))
+			{
+				Dist[i] = dist[i];
+				bary[i] = XMFLOAT2(baryU[i], baryV[i]);
+			}
+		}
+		return mask;
+#else
+		const uint32_t mask0 = RayTriangleIntersects4(Origin, Direction, tri.packets[0], Dist, bary);
+		const uint32_t mask1 = RayTriangleIntersects4(Origin, Direction, tri.packets[1], Dist + 4, bary + 4);
+		return mask0 | (mask1 << 4);
+#endif // _XM_AVX2_INTRINSICS_
+	}
+
 }
@@ -208,6 +208,11 @@ namespace ap::math
 	// Returns an element of a precomputed halton sequence. Specify which iteration to get with idx >= 0
 	const XMFLOAT4& GetHaltonSequence(int idx);
 
+	// Computes 4 matrices at once from scale, rotation quaternion and translation, each result is equal to:
+	//	XMMatrixScalingFromVector(S) * XMMatrixRotationQuaternion(R) * XMMatrixTranslationFromVector(T)
+	//	The inputs are transposed into structure of arrays form, so every vector operation works on 4 transforms
+	void ComposeMatrix4(const XMFLOAT3* const S[4], const XMFLOAT4* const R[4], const XMFLOAT3* const T[4], XMFLOAT4X4* const result[4]);
+
 	inline uint32_t CompressNormal(const XMFLOAT3& normal)
 	{
 		uint32_t retval = 0;
@@ -368,5 +373,170 @@ namespace ap::math
 
 		return true;
 	}
+
+	// Returns the sign bits of the four lanes of a comparison result as a bitmask (lane 0 is bit 0)
+	inline uint32_t XM_CALLCONV VectorMoveMask(FXMVECTOR V)
+	{
+#if defined(_XM_SSE_INTRINSICS_) && !defined(_XM_NO_INTRINSICS_)
+		return (uint32_t)_mm_movemask_ps(V);
+#else
+		XMUINT4 bits;
+		XMStoreUInt4(&bits, V);
+		return (bits.x >> 31) | ((bits.y >> 31) << 1) | ((bits.z >> 31) << 2) | ((bits.w >> 31) << 3);
+#endif // _XM_SSE_INTRINSICS_
+	}
+
+	// Four triangles in SoA layout for testing one ray against all of them at once (see RayTriangleIntersects4)
+	struct TrianglePacket4
+	{
+		XMVECTOR v0[3]; // x, y, z components of the first vertex
+		XMVECTOR e1[3]; // x, y, z components of V1 - V0
+		XMVECTOR e2[3]; // x, y, z components of V2 - V0
+
+		// Fills the packet from count (at most 4) triangles, the unused lanes are degenerate and never hit
+		inline void XM_CALLCONV Load(const XMVECTOR* V0, const XMVECTOR* V1, const XMVECTOR* V2, uint32_t count)
+		{
+			assert(count > 0 && count <= 4);
+			XMMATRIX P0, P1, P2;
+			for (uint32_t i = 0; i < 4; ++i)
+			{
+				const uint32_t j = i < count ? i : 0;
+				P0.r[i] = V0[j];
+				P1.r[i] = i < count ? V1[j] : V0[j];
+				P2.r[i] = i < count ? V2[j] : V0[j];
+			}
+			P0 = XMMatrixTranspose(P0);
+			P1 = XMMatrixTranspose(P1);
+			P2 = XMMatrixTranspose(P2);
+			for (int i = 0; i < 3; ++i)
+			{
+				v0[i] = P0.r[i];
+				e1[i] = XMVectorSubtract(P1.r[i], P0.r[i]);
+				e2[i] = XMVectorSubtract(P2.r[i], P0.r[i]);
+			}
+		}
+	};
+
+	// Tests one ray against four triangles, with the same results as RayTriangleIntersects() for each lane
+	//	returns the bitmask of triangles that were hit, Dist and bary are written only for those lanes
+	inline uint32_t XM_CALLCONV RayTriangleIntersects4(FXMVECTOR Origin, FXMVECTOR Direction, const TrianglePacket4& tri, float Dist[4], XMFLOAT2 bary[4])
+	{
+		const XMVECTOR g_RayEpsilon = XMVectorReplicate(1e-20f);
+		const XMVECTOR g_RayNegEpsilon = XMVectorReplicate(-1e-20f);
+		const XMVECTOR Zero = XMVectorZero();
+
+		const XMVECTOR Dx = XMVectorSplatX(Direction);
+		const XMVECTOR Dy = XMVectorSplatY(Direction);
+		const XMVECTOR Dz = XMVectorSplatZ(Direction);
+
+		// p = Direction ^ e2;
+		const XMVECTOR px = XMVectorNegativeMultiplySubtract(Dz, tri.e2[1], XMVectorMultiply(Dy, tri.e2[2]));
+		const XMVECTOR py = XMVectorNegativeMultiplySubtract(Dx, tri.e2[2], XMVectorMultiply(Dz, tri.e2[0]));
+		const XMVECTOR pz = XMVectorNegativeMultiplySubtract(Dy, tri.e2[0], XMVectorMultiply(Dx, tri.e2[1]));
+
+		// det = e1 * p;
+		const XMVECTOR det = XMVectorMultiplyAdd(tri.e1[2], pz, XMVectorMultiplyAdd(tri.e1[1], py, XMVectorMultiply(tri.e1[0], px)));
+
+		// s = Origin - V0;
+		const XMVECTOR sx = XMVectorSubtract(XMVectorSplatX(Origin), tri.v0[0]);
+		const XMVECTOR sy = XMVectorSubtract(XMVectorSplatY(Origin), tri.v0[1]);
+		const XMVECTOR sz = XMVectorSubtract(XMVectorSplatZ(Origin), tri.v0[2]);
+
+		// u = s * p;
+		const XMVECTOR u = XMVectorMultiplyAdd(sz, pz, XMVectorMultiplyAdd(sy, py, XMVectorMultiply(sx, px)));
+
+		// q = s ^ e1;
+		const XMVECTOR qx = XMVectorNegativeMultiplySubtract(sz, tri.e1[1], XMVectorMultiply(sy, tri.e1[2]));
+		const XMVECTOR qy = XMVectorNegativeMultiplySubtract(sx, tri.e1[2], XMVectorMultiply(sz, tri.e1[0]));
+		const XMVECTOR qz = XMVectorNegativeMultiplySubtract(sy, tri.e1[0], XMVectorMultiply(sx, tri.e1[1]));
+
+		// v = Direction * q;
+		const XMVECTOR v = XMVectorMultiplyAdd(Dz, qz, XMVectorMultiplyAdd(Dy, qy, XMVectorMultiply(Dx, qx)));
+
+		// t = e2 * q;
+		const XMVECTOR t = XMVectorMultiplyAdd(tri.e2[2], qz, XMVectorMultiplyAdd(tri.e2[1], qy, XMVectorMultiply(tri.e2[0], qx)));
+
+		const XMVECTOR uv = XMVectorAdd(u, v);
+
+		// Front side of the triangle (determinant is positive):
+		XMVECTOR Front = XMVectorGreaterOrEqual(det, g_RayEpsilon);
+		Front = XMVectorAndInt(Front, XMVectorGreaterOrEqual(u, Zero));
+		Front = XMVectorAndInt(Front, XMVectorLessOrEqual(u, det));
+		Front = XMVectorAndInt(Front, XMVectorGreaterOrEqual(v, Zero));
+		Front = XMVectorAndInt(Front, XMVectorLessOrEqual(uv, det));
+		Front = XMVectorAndInt(Front, XMVectorGreaterOrEqual(t, Zero));
+
+		// Back side of the triangle (determinant is negative):
+		XMVECTOR Back = XMVectorLessOrEqual(det, g_RayNegEpsilon);
+		Back = XMVectorAndInt(Back, XMVectorLessOrEqual(u, Zero));
+		Back = XMVectorAndInt(Back, XMVectorGreaterOrEqual(u, det));
+		Back = XMVectorAndInt(Back, XMVectorLessOrEqual(v, Zero));
+		Back = XMVectorAndInt(Back, XMVectorGreaterOrEqual(uv, det));
+		Back = XMVectorAndInt(Back, XMVectorLessOrEqual(t, Zero));
+
+		const uint32_t mask = VectorMoveMask(XMVectorOrInt(Front, Back));
+		if (mask == 0)
+		{
+			return 0;
+		}
+
+		const XMVECTOR invdet = XMVectorReciprocal(det);
+		XMFLOAT4 dist, baryU, baryV;
+		XMStoreFloat4(&dist, XMVectorDivide(t, det));
+		XMStoreFloat4(&baryU, XMVectorMultiply(u, invdet));
+		XMStoreFloat4(&baryV, XMVectorMultiply(v, invdet));
+		for (uint32_t i = 0; i < 4; ++i)
+		{
+			if (mask & (1u << i))
+			{
+				Dist[i] = (&dist.x)[i];
+				bary[i] = XMFLOAT2((&baryU.x)[i], (&baryV.x)[i]);
+			}
+		}
+		return mask;
+	}
+
+	// Eight triangles in SoA layout for testing one ray against all of them at once (see RayTriangleIntersects8)
+	//	With AVX2 this is processed in one 8-wide step, otherwise as two 4-wide packets
+	struct TrianglePacket8
+	{
+#ifdef _XM_AVX2_INTRINSICS_
+		__m256 v0[3];
+		__m256 e1[3];
+		__m256 e2[3];
+#else
+		TrianglePacket4 packets[2];
+#endif // _XM_AVX2_INTRINSICS_
+
+		// Fills the packet from count (at most 8) triangles, the unused lanes are degenerate and never hit
+		inline void XM_CALLCONV Load(const XMVECTOR* V0, const XMVECTOR* V1, const XMVECTOR* V2, uint32_t count)
+		{
+			assert(count > 0 && count <= 8);
+#ifdef _XM_AVX2_INTRINSICS_
+			TrianglePacket4 packets[2];
+#endif // _XM_AVX2_INTRINSICS_
+			packets[0].Load(V0, V1, V2, std::min(count, 4u));
+			if (count > 4)
+			{
+				packets[1].Load(V0 + 4, V1 + 4, V2 + 4, count - 4);
+			}
+			else
+			{
+				packets[1].Load(V0, V0, V0, 1);
+			}
+#ifdef _XM_AVX2_INTRINSICS_
+			for (int i = 0; i < 3; ++i)
+			{
+				v0[i] = _mm256_set_m128(packets[1].v0[i], packets[0].v0[i]);
+				e1[i] = _mm256_set_m128(packets[1].e1[i], packets[0].e1[i]);
+				e2[i] = _mm256_set_m128(packets[1].e2[i], packets[0].e2[i]);
+			}
+#endif // _XM_AVX2_INTRINSICS_
+		}
+	};
+
+	// Tests one ray against eight triangles, with the same results as RayTriangleIntersects() for each lane
+	//	returns the bitmask of triangles that were hit, Dist and bary are written only for those lanes
+	uint32_t XM_CALLCONV RayTriangleIntersects8(FXMVECTOR Origin, FXMVECTOR Direction, const TrianglePacket8& tri, float Dist[8], XMFLOAT2 bary[8]);
 };
 
@@ -0,0 +1,322 @@
+#include "apOcclusionBuffer.h"
+#include "apJobSystem.h"
+
+using namespace ap::primitive;
+
+namespace ap
+{
+	static constexpr uint32_t OCCLUSION_LOCAL_TRIANGLES = 64; // projected triangles are gathered locally before they are appended to the shared list
+
+	// Clips a triangle in clip space against the w = near_w plane, returns the vertex count of the resulting polygon (0, 3 or 4)
+	static inline uint32_t ClipNear(const XMVECTOR in[3], float near_w, XMVECTOR out[4])
+	{
+		uint32_t count = 0;
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			const XMVECTOR& a = in[i];
+			const XMVECTOR& b = in[(i + 1) % 3];
+			const float da = XMVectorGetW(a) - near_w;
+			const float db = XMVectorGetW(b) - near_w;
+			if (da >= 0)
+			{
+				out[count++] = a;
+			}
+			if ((da >= 0) != (db >= 0))
+			{
+				out[count++] = XMVectorLerp(a, b, da / (da - db));
+			}
+		}
+		return count;
+	}
+
+	void OcclusionBuffer::Render(
+		const XMMATRIX& VP,
+		uint32_t _width,
+		uint32_t _height,
+		float _near_w,
+		const Occluder* occluders,
+		uint32_t occluder_count
+	)
+	{
+		width = std::max(1u, (_width + TILE_SIZE - 1) / TILE_SIZE) * TILE_SIZE;
+		height = std::max(1u, (_height + TILE_SIZE - 1) / TILE_SIZE) * TILE_SIZE;
+		near_w = std::max(_near_w, 0.0001f);
+		XMStoreFloat4x4(&view_projection, VP);
+
+		const uint32_t tile_count_x = width / TILE_SIZE;
+		const uint32_t tile_count_y = height / TILE_SIZE;
+		depth.resize(size_t(width) * size_t(height));
+		std::fill(depth.begin(), depth.end(), 0.0f);
+		tiles.resize(size_t(tile_count_x) * size_t(tile_count_y));
+		std::fill(tiles.begin(), tiles.end(), 0.0f);
+
+		// Clipping can make two triangles from one:
+		size_t max_triangle_count = 0;
+		for (uint32_t i = 0; i < occluder_count; ++i)
+		{
+			max_triangle_count += occluders[i].index_count / 3 * 2;
+		}
+		if (triangles.size() < max_triangle_count)
+		{
+			triangles.resize(max_triangle_count);
+		}
+		triangle_count.store(0);
+
+		ap::jobsystem::context ctx;
+
+		// Transform, clip and project the triangles of every occluder:
+		ap::jobsystem::Dispatch(ctx, occluder_count, 1, [&](ap::jobsystem::JobArgs args) {
+			const Occluder& occluder = occluders[args.jobIndex];
+			const XMMATRIX M = XMMatrixMultiply(XMLoadFloat4x4(&occluder.world), VP);
+			const float half_width = width * 0.5f;
+			const float half_height = height * 0.5f;
+
+			Triangle local_list[OCCLUSION_LOCAL_TRIANGLES];
+			uint32_t local_count = 0;
+			auto flush = [&]() {
+				const uint32_t prev_count = triangle_count.fetch_add(local_count);
+				std::copy(local_list, local_list + local_count, triangles.data() + prev_count);
+				local_count = 0;
+			};
+			auto emit = [&](const XMFLOAT4 v[4], uint32_t i0, uint32_t i1, uint32_t i2) {
+				Triangle& tri = local_list[local_count++];
+				const uint32_t indices[] = { i0, i1, i2 };
+				for (int j = 0; j < 3; ++j)
+				{
+					tri.x[j] = v[indices[j]].x;
+					tri.y[j] = v[indices[j]].y;
+					tri.invw[j] = v[indices[j]].w;
+				}
+				if (local_count == arraysize(local_list))
+				{
+					flush();
+				}
+			};
+
+			for (uint32_t i = 0; i + 2 < occluder.index_count; i += 3)
+			{
+				XMVECTOR clip[3];
+				for (uint32_t j = 0; j < 3; ++j)
+				{
+					clip[j] = XMVector3Transform(XMLoadFloat3(&occluder.positions[occluder.indices[i + j]]), M);
+				}
+
+				// Trivial reject if all vertices are outside the same side plane or behind the near plane:
+				const XMVECTOR W0 = XMVectorSplatW(clip[0]);
+				const XMVECTOR W1 = XMVectorSplatW(clip[1]);
+				const XMVECTOR W2 = XMVectorSplatW(clip[2]);
+				const uint32_t outside_positive =
+					ap::math::VectorMoveMask(XMVectorGreater(clip[0], W0)) &
+					ap::math::VectorMoveMask(XMVectorGreater(clip[1], W1)) &
+					ap::math::VectorMoveMask(XMVectorGreater(clip[2], W2));
+				const uint32_t outside_negative =
+					ap::math::VectorMoveMask(XMVectorLess(clip[0], XMVectorNegate(W0))) &
+					ap::math::VectorMoveMask(XMVectorLess(clip[1], XMVectorNegate(W1))) &
+					ap::math::VectorMoveMask(XMVectorLess(clip[2], XMVectorNegate(W2)));
+				if ((outside_positive | outside_negative) & 0x3)
+					continue;
+
+				XMVECTOR polygon[4];
+				uint32_t vertex_count = 3;
+				if (XMVectorGetW(clip[0]) < near_w || XMVectorGetW(clip[1]) < near_w || XMVectorGetW(clip[2]) < near_w)
+				{
+					vertex_count = ClipNear(clip, near_w, polygon);
+					if (vertex_count < 3)
+						continue;
+				}
+				else
+				{
+					polygon[0] = clip[0];
+					polygon[1] = clip[1];
+					polygon[2] = clip[2];
+				}
+
+				// Project to pixel coordinates, w is replaced by 1 / w which can be interpolated linearly on the screen:
+				XMFLOAT4 screen[4];
+				for (uint32_t j = 0; j < vertex_count; ++j)
+				{
+					const float invw = 1.0f / XMVectorGetW(polygon[j]);
+					screen[j].x = (XMVectorGetX(polygon[j]) * invw + 1) * half_width;
+					screen[j].y = (1 - XMVectorGetY(polygon[j]) * invw) * half_height;
+					screen[j].w = invw;
+				}
+				emit(screen, 0, 1, 2);
+				if (vertex_count == 4)
+				{
+					emit(screen, 0, 2, 3);
+				}
+			}
+			if (local_count > 0)
+			{
+				flush();
+			}
+		});
+		ap::jobsystem::Wait(ctx);
+
+		// Rasterize one row of tiles per job, so that the jobs never write the same pixels:
+		const uint32_t count = triangle_count.load();
+		ap::jobsystem::Dispatch(ctx, tile_count_y, 1, [&](ap::jobsystem::JobArgs args) {
+			const int row_begin = int(args.jobIndex * TILE_SIZE);
+			const int row_end = row_begin + int(TILE_SIZE) - 1;
+			const XMVECTOR lane_offsets = XMVectorSet(0.5f, 1.5f, 2.5f, 3.5f); // pixel centers
+			const XMVECTOR zero = XMVectorZero();
+
+			for (uint32_t t = 0; t < count; ++t)
+			{
+				const Triangle& tri = triangles[t];
+
+				// Pixel range whose centers are in the bounding rectangle:
+				const float minx = std::min(tri.x[0], std::min(tri.x[1], tri.x[2]));
+				const float maxx = std::max(tri.x[0], std::max(tri.x[1], tri.x[2]));
+				const float miny = std::min(tri.y[0], std::min(tri.y[1], tri.y[2]));
+				const float maxy = std::max(tri.y[0], std::max(tri.y[1], tri.y[2]));
+				const int y0 = std::max(row_begin, int(std::ceil(miny - 0.5f)));
+				const int y1 = std::min(row_end, int(std::floor(maxy - 0.5f)));
+				if (y0 > y1)
+					continue;
+				const int x0 = std::max(0, int(std::ceil(minx - 0.5f)));
+				const int x1 = std::min(int(width) - 1, int(std::floor(maxx - 0.5f)));
+				if (x0 > x1)
+					continue;
+
+				const float dx1 = tri.x[1] - tri.x[0];
+				const float dy1 = tri.y[1] - tri.y[0];
+				const float dx2 = tri.x[2] - tri.x[0];
+				const float dy2 = tri.y[2] - tri.y[0];
+				const float area = dx1 * dy2 - dx2 * dy1;
+				if (area == 0)
+					continue;
+
+				// Edge functions, oriented so that the inside is positive for both windings:
+				const float sign = area > 0 ? 1.0f : -1.0f;
+				XMVECTOR edge_a[3];
+				float edge_b[3];
+				float edge_c[3];
+				for (int i = 0; i < 3; ++i)
+				{
+					const int j = (i + 1) % 3;
+					edge_a[i] = XMVectorReplicate((tri.y[i] - tri.y[j]) * sign);
+					edge_b[i] = (tri.x[j] - tri.x[i]) * sign;
+					edge_c[i] = (tri.x[i] * tri.y[j] - tri.x[j] * tri.y[i]) * sign;
+				}
+
+				// Depth plane through the three vertices:
+				const float dz1 = tri.invw[1] - tri.invw[0];
+				const float dz2 = tri.invw[2] - tri.invw[0];
+				const float zx = (dz1 * dy2 - dz2 * dy1) / area;
+				const float zy = (dz2 * dx1 - dz1 * dx2) / area;
+				const float zc = tri.invw[0] - zx * tri.x[0] - zy * tri.y[0];
+				const XMVECTOR ZX = XMVectorReplicate(zx);
+
+				for (int y = y0; y <= y1; ++y)
+				{
+					const float py = float(y) + 0.5f;
+					const XMVECTOR e0_row = XMVectorReplicate(edge_b[0] * py + edge_c[0]);
+					const XMVECTOR e1_row = XMVectorReplicate(edge_b[1] * py + edge_c[1]);
+					const XMVECTOR e2_row = XMVectorReplicate(edge_b[2] * py + edge_c[2]);
+					const XMVECTOR z_row = XMVectorReplicate(zy * py + zc);
+					float* row = depth.data() + size_t(y) * width;
+
+					// The width is a multiple of 4, so the 4 pixel steps never leave the row:
+					for (int x = x0 & ~3; x <= x1; x += 4)
+					{
+						const XMVECTOR px = XMVectorAdd(XMVectorReplicate(float(x)), lane_offsets);
+						const XMVECTOR e0 = XMVectorMultiplyAdd(edge_a[0], px, e0_row);
+						const XMVECTOR e1 = XMVectorMultiplyAdd(edge_a[1], px, e1_row);
+						const XMVECTOR e2 = XMVectorMultiplyAdd(edge_a[2], px, e2_row);
+						const XMVECTOR inside = XMVectorAndInt(XMVectorGreaterOrEqual(e0, zero), XMVectorAndInt(XMVectorGreaterOrEqual(e1, zero), XMVectorGreaterOrEqual(e2, zero)));
+						if (ap::math::VectorMoveMask(inside) == 0)
+							continue;
+						const XMVECTOR z = XMVectorMultiplyAdd(ZX, px, z_row);
+						const XMVECTOR prev = XMLoadFloat4((const XMFLOAT4*)(row + x));
+						XMStoreFloat4((XMFLOAT4*)(row + x), XMVectorSelect(prev, XMVectorMax(prev, z), inside));
+					}
+				}
+			}
+
+			// The tiles store the farthest depth of their pixels, if a box is behind that, all pixels of the tile hide it:
+			for (uint32_t tx = 0; tx < tile_count_x; ++tx)
+			{
+				float farthest = std::numeric_limits<float>::max();
+				for (int y = row_begin; y <= row_end; ++y)
+				{
+					const float* row = depth.data() + size_t(y) * width + tx * TILE_SIZE;
+					for (uint32_t x = 0; x < TILE_SIZE; ++x)
+					{
+						farthest = std::min(farthest, row[x]);
+					}
+				}
+				tiles[size_t(args.jobIndex) * tile_count_x + tx] = farthest;
+			}
+		});
+		ap::jobsystem::Wait(ctx);
+	}
+
+	bool OcclusionBuffer::IsOccluded(const AABB& aabb) const
+	{
+		if (depth.empty())
+			return false;
+
+		// Screen rectangle and nearest depth of the box:
+		const XMMATRIX VP = XMLoadFloat4x4(&view_projection);
+		const float half_width = width * 0.5f;
+		const float half_height = height * 0.5f;
+		float minx = std::numeric_limits<float>::max();
+		float miny = std::numeric_limits<float>::max();
+		float maxx = std::numeric_limits<float>::lowest();
+		float maxy = std::numeric_limits<float>::lowest();
+		float nearest = 0;
+		for (int i = 0; i < 8; ++i)
+		{
+			const XMFLOAT3 corner = aabb.corner(i);
+			const XMVECTOR clip = XMVector3Transform(XMLoadFloat3(&corner), VP);
+			const float w = XMVectorGetW(clip);
+			if (w < near_w)
+				return false;
+			const float invw = 1.0f / w;
+			const float x = (XMVectorGetX(clip) * invw + 1) * half_width;
+			const float y = (1 - XMVectorGetY(clip) * invw) * half_height;
+			minx = std::min(minx, x);
+			miny = std::min(miny, y);
+			maxx = std::max(maxx, x);
+			maxy = std::max(maxy, y);
+			nearest = std::max(nearest, invw);
+		}
+		if (maxx < 0 || maxy < 0 || minx >= float(width) || miny >= float(height))
+			return false;
+
+		// Small bias, so that the occluders don't hide their own bounding box because of interpolation errors:
+		nearest *= 1.001f;
+
+		// Every pixel that the rectangle touches must have an occluder in front of the box
+		//	The rectangle is extended by half a pixel, because the occluders only cover the pixels whose centers they contain:
+		const int x0 = std::max(0, int(std::floor(minx - 0.5f)));
+		const int y0 = std::max(0, int(std::floor(miny - 0.5f)));
+		const int x1 = std::min(int(width) - 1, int(std::floor(maxx + 0.5f)));
+		const int y1 = std::min(int(height) - 1, int(std::floor(maxy + 0.5f)));
+		const uint32_t tile_count_x = width / TILE_SIZE;
+		for (int ty = y0 / int(TILE_SIZE); ty <= y1 / int(TILE_SIZE); ++ty)
+		{
+			for (int tx = x0 / int(TILE_SIZE); tx <= x1 / int(TILE_SIZE); ++tx)
+			{
+				if (tiles[size_t(ty) * tile_count_x + tx] > nearest)
+					continue;
+
+				const int tile_y0 = std::max(y0, ty * int(TILE_SIZE));
+				const int tile_y1 = std::min(y1, ty * int(TILE_SIZE) + int(TILE_SIZE) - 1);
+				const int tile_x0 = std::max(x0, tx * int(TILE_SIZE));
+				const int tile_x1 = std::min(x1, tx * int(TILE_SIZE) + int(TILE_SIZE) - 1);
+				for (int y = tile_y0; y <= tile_y1; ++y)
+				{
+					const float* row = depth.data() + size_t(y) * width;
+					for (int x = tile_x0; x <= tile_x1; ++x)
+					{
+						if (row[x] <= nearest)
+							return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "CommonInclude.h"
+#include "apPrimitive.h"
+#include "apVector.h"
+
+#include <atomic>
+
+namespace ap
+{
+	// Low resolution CPU depth buffer for occlusion culling
+	//	A few occluder meshes are rasterized on the job system, then AABBs can be tested against it in the same frame
+	//	The depth is stored as 1 / w (0 is infinitely far), so it doesn't depend on the depth mapping of the projection matrix
+	struct OcclusionBuffer
+	{
+		static constexpr uint32_t TILE_SIZE = 8; // the buffer is split into TILE_SIZE x TILE_SIZE tiles for hierarchical testing
+
+		struct Occluder
+		{
+			const XMFLOAT3* positions = nullptr;
+			const uint32_t* indices = nullptr;
+			uint32_t index_count = 0;
+			XMFLOAT4X4 world;
+		};
+		// Triangle after projection to the screen
+		struct Triangle
+		{
+			float x[3];
+			float y[3];
+			float invw[3];
+		};
+
+		uint32_t width = 0;
+		uint32_t height = 0;
+		float near_w = 0; // triangles are clipped at this view distance, boxes that reach in front of it are never occluded
+		XMFLOAT4X4 view_projection;
+		ap::vector<float> depth; // nearest occluder depth of every pixel
+		ap::vector<float> tiles; // farthest occluder depth of every tile
+		ap::vector<Triangle> triangles;
+		std::atomic<uint32_t> triangle_count{ 0 };
+
+		bool IsValid() const { return !depth.empty(); }
+
+		// Clear the buffer and rasterize the occluders into it, this is parallelized with the job system
+		//	width and height are rounded up to multiples of TILE_SIZE
+		//	near_w: the near plane distance of the camera
+		void Render(
+			const XMMATRIX& view_projection,
+			uint32_t width,
+			uint32_t height,
+			float near_w,
+			const Occluder* occluders,
+			uint32_t occluder_count
+		);
+
+		// Returns true if the box is completely hidden behind the rendered occluders
+		//	Boxes that are not fully in front of the camera or outside the buffer are not occluded
+		bool IsOccluded(const ap::primitive::AABB& aabb) const;
+
+		size_t GetMemorySize() const { return (depth.size() + tiles.size()) * sizeof(float) + triangles.size() * sizeof(Triangle); }
+	};
+}
@@ -3,8 +3,10 @@
 #include <GFSDK_WaveWorks.h>
 #include "apGraphicsDevice.h"
 #include "DirectXMath.h"
+#ifdef _WIN32
 #include "Utility\dx12\d3d12.h"
 #include <wrl/client.h> // ComPtr
+#endif // _WIN32
 
 namespace ap
 { 
@@ -144,7 +146,9 @@ namespace ap
 
 	private:
 
+#ifdef _WIN32
 		Microsoft::WRL::ComPtr<ID3D12Fence> fence;
+#endif // _WIN32
 
 		ap::graphics::GPUBuffer oceanSurfaceVB;
 		ap::graphics::GPUBuffer oceanSurfaceIB;
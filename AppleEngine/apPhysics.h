@@ -29,6 +29,7 @@ namespace ap::physics
 	int GetAccuracy();
 
 	// Update the physics state, run simulation, etc.
+	//	It can be a task of a jobsystem::TaskGraph, ctx is the context of that task
 	void RunPhysicsUpdateSystem(
 		ap::jobsystem::context& ctx,
 		ap::scene::Scene& scene,
@@ -340,8 +340,13 @@ namespace ap::physics
 
 		btVector3 wind = btVector3(scene.weather.windDirection.x, scene.weather.windDirection.y, scene.weather.windDirection.z);
 
+		// The engine state must be updated before the simulation step, so these jobs are waited on here
+		//	ctx can belong to a task graph task that is running this function, waiting on it would never return, so a local context is used:
+		ap::jobsystem::context physics_ctx;
+		physics_ctx.priority = ctx.priority;
+
 		// System will register rigidbodies to objects, and update physics engine state for kinematics:
-		ap::jobsystem::Dispatch(ctx, (uint32_t)scene.rigidbodies.GetCount(), 256, [&](ap::jobsystem::JobArgs args) {
+		ap::jobsystem::Dispatch(physics_ctx, (uint32_t)scene.rigidbodies.GetCount(), 256, [&](ap::jobsystem::JobArgs args) {
 
 			RigidBodyPhysicsComponent& physicscomponent = scene.rigidbodies[args.jobIndex];
 			Entity entity = scene.rigidbodies.GetEntity(args.jobIndex);
@@ -383,9 +388,10 @@ namespace ap::physics
 				rigidbody->setRestitution(physicscomponent.restitution);
 
 				// For kinematic object, system updates physics state, else the physics updates system state:
-				if (physicscomponent.IsKinematic() || !IsSimulationEnabled())
+				//	Transforms that didn't change in this frame are skipped, the physics state already matches them
+				TransformComponent& transform = *scene.transforms.GetComponent(entity);
+				if ((physicscomponent.IsKinematic() || !IsSimulationEnabled()) && transform.IsChanged())
 				{
-					TransformComponent& transform = *scene.transforms.GetComponent(entity);
 
 					btMotionState* motionState = rigidbody->getMotionState();
 					btTransform physicsTransform;
@@ -413,7 +419,7 @@ namespace ap::physics
 		});
 
 		// System will register softbodies to meshes and update physics engine state:
-		ap::jobsystem::Dispatch(ctx, (uint32_t)scene.softbodies.GetCount(), 1, [&](ap::jobsystem::JobArgs args) {
+		ap::jobsystem::Dispatch(physics_ctx, (uint32_t)scene.softbodies.GetCount(), 1, [&](ap::jobsystem::JobArgs args) {
 
 			SoftBodyPhysicsComponent& physicscomponent = scene.softbodies[args.jobIndex];
 			Entity entity = scene.softbodies.GetEntity(args.jobIndex);
@@ -468,7 +474,7 @@ namespace ap::physics
 			}
 		});
 
-		ap::jobsystem::Wait(ctx);
+		ap::jobsystem::Wait(physics_ctx);
 
 		// Perform internal simulation step:
 		if (IsSimulationEnabled())
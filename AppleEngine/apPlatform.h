@@ -93,11 +93,11 @@ namespace ap::platform
 		dest->height = uint32_t(window->Bounds().Height * dpiscale);
 #endif // PLATFORM_UWP
 
-#ifdef PLATFORM_LINUX
+#if defined(PLATFORM_LINUX) && defined(SDL2)
 		int window_width, window_height;
 		SDL_GetWindowSize(window, &window_width, &window_height);
 		SDL_Vulkan_GetDrawableSize(window, &dest->width, &dest->height);
 		dest->dpi = ((float) dest->width / (float) window_width) * 96.0;
-#endif // PLATFORM_LINUX
+#endif // PLATFORM_LINUX && SDL2
 	}
 }
@@ -291,6 +291,102 @@ namespace ap::primitive
 		return b.intersects(*this);
 	}
 
+	void RayPacket4::Load(const Ray* rays, uint32_t count, float _tmax)
+	{
+		assert(count > 0 && count <= 4);
+		XMMATRIX O, D;
+		for (uint32_t i = 0; i < 4; ++i)
+		{
+			const Ray& ray = rays[i < count ? i : 0];
+			O.r[i] = XMLoadFloat3(&ray.origin);
+			D.r[i] = XMLoadFloat3(&ray.direction_inverse);
+		}
+		O = XMMatrixTranspose(O);
+		D = XMMatrixTranspose(D);
+		for (int i = 0; i < 3; ++i)
+		{
+			origin[i] = O.r[i];
+			direction_inverse[i] = D.r[i];
+		}
+		tmax = XMVectorSet(
+			_tmax,
+			count > 1 ? _tmax : -1,
+			count > 2 ? _tmax : -1,
+			count > 3 ? _tmax : -1
+		);
+	}
+
+	void RayPacket8::Load(const Ray* rays, uint32_t count, float _tmax)
+	{
+		assert(count > 0 && count <= 8);
+#ifdef _XM_AVX2_INTRINSICS_
+		RayPacket4 packets[2];
+#endif // _XM_AVX2_INTRINSICS_
+		packets[0].Load(rays, std::min(count, 4u), _tmax);
+		if (count > 4)
+		{
+			packets[1].Load(rays + 4, count - 4, _tmax);
+		}
+		else
+		{
+			packets[1].Load(rays, 1, -1);
+		}
+#ifdef _XM_AVX2_INTRINSICS_
+		for (int i = 0; i < 3; ++i)
+		{
+			origin[i] = _mm256_set_m128(packets[1].origin[i], packets[0].origin[i]);
+			direction_inverse[i] = _mm256_set_m128(packets[1].direction_inverse[i], packets[0].direction_inverse[i]);
+		}
+		tmax = _mm256_set_m128(packets[1].tmax, packets[0].tmax);
+#endif // _XM_AVX2_INTRINSICS_
+	}
+	void RayPacket8::SetTMax(uint32_t lane, float value)
+	{
+		assert(lane < 8);
+#ifdef _XM_AVX2_INTRINSICS_
+		alignas(32) float values[8];
+		_mm256_store_ps(values, tmax);
+		values[lane] = value;
+		tmax = _mm256_load_ps(values);
+#else
+		packets[lane / 4].SetTMax(lane % 4, value);
+#endif // _XM_AVX2_INTRINSICS_
+	}
+	uint32_t RayPacket8::intersects(const AABB& b, float distance[8]) const
+	{
+#ifdef _XM_AVX2_INTRINSICS_
+		__m256 tnear[3];
+		__m256 tfar[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			const __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps((&b._min.x)[i]), origin[i]), direction_inverse[i]);
+			const __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps((&b._max.x)[i]), origin[i]), direction_inverse[i]);
+			// Slabs that are parallel to the ray and contain it don't limit it, the same as in RayPacket4::intersects()
+			const __m256 sum = _mm256_add_ps(t0, t1);
+			const __m256 unlimited = _mm256_cmp_ps(sum, sum, _CMP_UNORD_Q);
+			tnear[i] = _mm256_blendv_ps(_mm256_min_ps(t0, t1), _mm256_set1_ps(-std::numeric_limits<float>::infinity()), unlimited);
+			tfar[i] = _mm256_blendv_ps(_mm256_max_ps(t0, t1), _mm256_set1_ps(std::numeric_limits<float>::infinity()), unlimited);
+		}
+		const __m256 tenter = _mm256_max_ps(_mm256_max_ps(tnear[0], tnear[1]), _mm256_max_ps(tnear[2], _mm256_setzero_ps()));
+		const __m256 texit = _mm256_min_ps(_mm256_min_ps(tfar[0], tfar[1]), _mm256_min_ps(tfar[2], tmax));
+		if (distance != nullptr)
+		{
+			_mm256_storeu_ps(distance, tenter);
+		}
+		return (uint32_t)_mm256_movemask_ps(_mm256_cmp_ps(tenter, texit, _CMP_LE_OQ));
+#else
+		XMVECTOR distance0, distance1;
+		const uint32_t mask0 = packets[0].intersects(b, &distance0);
+		const uint32_t mask1 = packets[1].intersects(b, &distance1);
+		if (distance != nullptr)
+		{
+			XMStoreFloat4((XMFLOAT4*)distance, distance0);
+			XMStoreFloat4((XMFLOAT4*)(distance + 4), distance1);
+		}
+		return mask0 | (mask1 << 4);
+#endif // _XM_AVX2_INTRINSICS_
+	}
+
 
 
 
@@ -347,29 +443,28 @@ namespace ap::primitive
 	}
 	Frustum::BoxFrustumIntersect Frustum::CheckBox(const AABB& box) const
 	{
-		int iTotalIn = 0;
-		for (int p = 0; p < 6; ++p)
+		// Only the box corners that are the furthest and nearest along each plane normal need to be tested:
+		//	if the furthest corner is behind a plane, all corners are, if the nearest corner is in front of all planes, all corners are
+		XMVECTOR max = XMLoadFloat3(&box._max);
+		XMVECTOR min = XMLoadFloat3(&box._min);
+		XMVECTOR zero = XMVectorZero();
+		bool inside = true;
+		for (size_t p = 0; p < 6; ++p)
 		{
-
-			int iInCount = 8;
-			int iPtIn = 1;
-
-			for (int i = 0; i < 8; ++i)
+			XMVECTOR plane = XMLoadFloat4(&planes[p]);
+			auto lt = XMVectorLess(plane, zero);
+			auto furthestFromPlane = XMVectorSelect(max, min, lt);
+			if (XMVectorGetX(XMPlaneDotCoord(plane, furthestFromPlane)) < 0.0f)
 			{
-				XMFLOAT3 C = box.corner(i);
-				if (XMVectorGetX(XMPlaneDotCoord(XMLoadFloat4(&planes[p]), XMLoadFloat3(&C))) < 0.0f)
-				{
-					iPtIn = 0;
-					--iInCount;
-				}
-			}
-			if (iInCount == 0)
 				return BOX_FRUSTUM_OUTSIDE;
-			iTotalIn += iPtIn;
+			}
+			auto nearestToPlane = XMVectorSelect(min, max, lt);
+			if (XMVectorGetX(XMPlaneDotCoord(plane, nearestToPlane)) < 0.0f)
+			{
+				inside = false;
+			}
 		}
-		if (iTotalIn == 6)
-			return(BOX_FRUSTUM_INSIDE);
-		return(BOX_FRUSTUM_INTERSECTS);
+		return inside ? BOX_FRUSTUM_INSIDE : BOX_FRUSTUM_INTERSECTS;
 	}
 	bool Frustum::CheckBoxFast(const AABB& box) const
 	{
@@ -395,6 +490,25 @@ namespace ap::primitive
 	const XMFLOAT4& Frustum::getTopPlane() const { return planes[4]; }
 	const XMFLOAT4& Frustum::getBottomPlane() const { return planes[5]; }
 
+	void FrustumPacket4::Load(const Frustum* frusta, uint32_t count)
+	{
+		assert(count > 0 && count <= 4);
+		for (int p = 0; p < 6; ++p)
+		{
+			XMMATRIX M;
+			for (uint32_t i = 0; i < 4; ++i)
+			{
+				// Unused lanes get a plane that every point is behind:
+				M.r[i] = i < count ? XMLoadFloat4(&frusta[i].planes[p]) : XMVectorSet(0, 0, 0, -1);
+			}
+			M = XMMatrixTranspose(M);
+			for (int c = 0; c < 4; ++c)
+			{
+				planes[p][c] = M.r[c];
+			}
+		}
+	}
+
 
 
 	bool Hitbox2D::intersects(const Hitbox2D& b) const
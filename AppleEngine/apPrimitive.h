@@ -114,6 +114,61 @@ namespace ap::primitive
 		bool intersects(const AABB& b) const;
 		bool intersects(const Sphere& b) const;
 	};
+	// Four rays in SoA layout for testing all of them against one AABB at once
+	//	Unlike AABB::intersects(const Ray&), only the segment of each ray between distance 0 and its tmax is tested
+	struct RayPacket4
+	{
+		XMVECTOR origin[3]; // x, y, z components
+		XMVECTOR direction_inverse[3]; // x, y, z components
+		XMVECTOR tmax; // the max distance of each ray, lanes with negative tmax are inactive
+
+		// Fills the packet from count (at most 4) rays, the unused lanes are inactive
+		void Load(const Ray* rays, uint32_t count, float tmax = std::numeric_limits<float>::max());
+		inline void SetTMax(uint32_t lane, float value) { tmax = XMVectorSetByIndex(tmax, value, lane); }
+
+		// Returns the bitmask of the rays that hit the box, distance (optional) receives the entry distance of every lane
+		inline uint32_t intersects(const AABB& b, XMVECTOR* distance = nullptr) const
+		{
+			XMVECTOR tnear[3];
+			XMVECTOR tfar[3];
+			for (int i = 0; i < 3; ++i)
+			{
+				const XMVECTOR t0 = XMVectorMultiply(XMVectorSubtract(XMVectorReplicate((&b._min.x)[i]), origin[i]), direction_inverse[i]);
+				const XMVECTOR t1 = XMVectorMultiply(XMVectorSubtract(XMVectorReplicate((&b._max.x)[i]), origin[i]), direction_inverse[i]);
+				// A ray that is parallel to the slab gets NaN (0 * inf) when it lies in a boundary plane, or t0 + t1 = NaN (-inf + inf) when it's inside
+				//	The slab doesn't limit the ray in these cases, otherwise the NaN would make the min/max below drop the limits of other slabs
+				const XMVECTOR unlimited = XMVectorIsNaN(XMVectorAdd(t0, t1));
+				tnear[i] = XMVectorSelect(XMVectorMin(t0, t1), g_XMNegInfinity, unlimited);
+				tfar[i] = XMVectorSelect(XMVectorMax(t0, t1), g_XMInfinity, unlimited);
+			}
+			const XMVECTOR tenter = XMVectorMax(XMVectorMax(tnear[0], tnear[1]), XMVectorMax(tnear[2], XMVectorZero()));
+			const XMVECTOR texit = XMVectorMin(XMVectorMin(tfar[0], tfar[1]), XMVectorMin(tfar[2], tmax));
+			if (distance != nullptr)
+			{
+				*distance = tenter;
+			}
+			return ap::math::VectorMoveMask(XMVectorLessOrEqual(tenter, texit));
+		}
+	};
+	// Eight rays in SoA layout for testing all of them against one AABB at once
+	//	With AVX2 this is processed in one 8-wide step, otherwise as two 4-wide packets
+	struct RayPacket8
+	{
+#ifdef _XM_AVX2_INTRINSICS_
+		__m256 origin[3];
+		__m256 direction_inverse[3];
+		__m256 tmax;
+#else
+		RayPacket4 packets[2];
+#endif // _XM_AVX2_INTRINSICS_
+
+		// Fills the packet from count (at most 8) rays, the unused lanes are inactive
+		void Load(const Ray* rays, uint32_t count, float tmax = std::numeric_limits<float>::max());
+		void SetTMax(uint32_t lane, float value);
+
+		// Returns the bitmask of the rays that hit the box, distance (optional) receives the entry distance of every lane
+		uint32_t intersects(const AABB& b, float distance[8] = nullptr) const;
+	};
 
 	struct Frustum
 	{
@@ -140,6 +195,37 @@ namespace ap::primitive
 		const XMFLOAT4& getTopPlane() const;
 		const XMFLOAT4& getBottomPlane() const;
 	};
+	// Four frusta in SoA layout for testing one AABB against all of them at once
+	struct FrustumPacket4
+	{
+		XMVECTOR planes[6][4]; // x, y, z, w components of the same plane of the four frusta
+
+		// Fills the packet from count (at most 4) frusta, the unused lanes never pass the test
+		void Load(const Frustum* frusta, uint32_t count);
+
+		// Returns the bitmask of the frusta that pass Frustum::CheckBoxFast() with the box
+		inline uint32_t CheckBoxFast(const AABB& box) const
+		{
+			const XMVECTOR minx = XMVectorReplicate(box._min.x);
+			const XMVECTOR miny = XMVectorReplicate(box._min.y);
+			const XMVECTOR minz = XMVectorReplicate(box._min.z);
+			const XMVECTOR maxx = XMVectorReplicate(box._max.x);
+			const XMVECTOR maxy = XMVectorReplicate(box._max.y);
+			const XMVECTOR maxz = XMVectorReplicate(box._max.z);
+			const XMVECTOR zero = XMVectorZero();
+			XMVECTOR inside = XMVectorTrueInt();
+			for (int p = 0; p < 6; ++p)
+			{
+				// The box corner that is the furthest along the plane normal:
+				const XMVECTOR x = XMVectorSelect(maxx, minx, XMVectorLess(planes[p][0], zero));
+				const XMVECTOR y = XMVectorSelect(maxy, miny, XMVectorLess(planes[p][1], zero));
+				const XMVECTOR z = XMVectorSelect(maxz, minz, XMVectorLess(planes[p][2], zero));
+				const XMVECTOR dist = XMVectorMultiplyAdd(planes[p][0], x, XMVectorMultiplyAdd(planes[p][1], y, XMVectorMultiplyAdd(planes[p][2], z, planes[p][3])));
+				inside = XMVectorAndInt(inside, XMVectorGreaterOrEqual(dist, zero));
+			}
+			return ap::math::VectorMoveMask(inside);
+		}
+	};
 
 	class Hitbox2D
 	{
@@ -7,6 +7,7 @@
 #include "apHelper.h"
 #include "apUnorderedMap.h"
 #include "apBacklog.h"
+#include "apJobSystem.h"
 
 #if __has_include("Superluminal/PerformanceAPI_capi.h")
 #include "Superluminal/PerformanceAPI_capi.h"
@@ -56,6 +57,9 @@ namespace ap::profiler
 	};
 	ap::unordered_map<size_t, Range> ranges;
 
+	ap::jobsystem::Statistics jobsystem_statistics_prev; // cumulative, at the end of the previous frame
+	ap::jobsystem::Statistics jobsystem_statistics_frame; // difference in the previous frame
+
 	void BeginFrame()
 	{
 		if (!ENABLED)
@@ -168,6 +172,14 @@ namespace ap::profiler
 
 			range.in_use = false;
 		}
+
+		ap::jobsystem::Statistics jobsystem_statistics = ap::jobsystem::GetStatistics();
+		jobsystem_statistics_frame.jobs = jobsystem_statistics.jobs - jobsystem_statistics_prev.jobs;
+		jobsystem_statistics_frame.steals = jobsystem_statistics.steals - jobsystem_statistics_prev.steals;
+		jobsystem_statistics_frame.parks = jobsystem_statistics.parks - jobsystem_statistics_prev.parks;
+		jobsystem_statistics_frame.unparks = jobsystem_statistics.unparks - jobsystem_statistics_prev.unparks;
+		jobsystem_statistics_frame.parked_threads = jobsystem_statistics.parked_threads;
+		jobsystem_statistics_prev = jobsystem_statistics;
 	}
 
 	range_id BeginRangeCPU(const char* name)
@@ -331,6 +343,15 @@ namespace ap::profiler
 			x.second.num_hits = 0;
 			x.second.total_time = 0;
 		}
+		ss << std::endl;
+
+		// Print job system counters:
+		ss << "Job System:" << std::endl;
+		ss << "\tJobs: " << jobsystem_statistics_frame.jobs << std::endl;
+		ss << "\tSteals: " << jobsystem_statistics_frame.steals << std::endl;
+		ss << "\tParks: " << jobsystem_statistics_frame.parks << std::endl;
+		ss << "\tUnparks: " << jobsystem_statistics_frame.unparks << std::endl;
+		ss << "\tSleeping threads: " << jobsystem_statistics_frame.parked_threads << std::endl;
 
 		ap::font::Params params = ap::font::Params(x, y, ap::font::APFONTSIZE_DEFAULT - 4, ap::font::APFALIGN_LEFT, ap::font::APFALIGN_TOP, ap::Color(255, 255, 255, 255), ap::Color(0, 0, 0, 255));
 
@@ -0,0 +1,248 @@
+#pragma once
+#include "CommonInclude.h"
+#include "apJobSystem.h"
+#include "apMath.h"
+#include "apVector.h"
+
+#include <algorithm>
+#include <cassert>
+
+// Render queue entries and their sorting, used by the renderer to order the draws of a render pass
+namespace ap::renderer
+{
+	// Describes how the sort key of a RenderBatch is packed, the first field goes into the most significant bits
+	//	Values that don't fit into their field are truncated: indices keep their low bits, the distance keeps its high bits
+	//	A render pass can trade state changes for depth ordering by choosing the order of the fields
+	struct RenderBatchKey
+	{
+		enum FIELD : uint8_t
+		{
+			FIELD_NONE,
+			FIELD_BUCKET,	// pipeline state bucket of the mesh, see GetMeshSortFields()
+			FIELD_MATERIAL,	// material index of the first subset of the mesh
+			FIELD_MESH,		// mesh index, instances of a mesh must be next to each other to be instanced
+			FIELD_DISTANCE,	// distance from the camera
+		};
+		struct Field
+		{
+			FIELD type = FIELD_NONE;
+			uint8_t bits = 0;
+		};
+		Field fields[4];
+
+		inline uint64_t Build(uint32_t bucket, uint32_t material, uint32_t mesh, float distance) const
+		{
+			uint64_t key = 0;
+			uint32_t total_bits = 0;
+			for (const Field& field : fields)
+			{
+				if (field.type == FIELD_NONE || field.bits == 0)
+					continue;
+				assert(field.bits < 64);
+				uint64_t value = 0;
+				switch (field.type)
+				{
+				case FIELD_BUCKET:
+					value = bucket;
+					break;
+				case FIELD_MATERIAL:
+					value = material;
+					break;
+				case FIELD_MESH:
+					value = mesh;
+					break;
+				case FIELD_DISTANCE:
+					// positive half floats keep their order when compared as integers:
+					value = uint64_t(XMConvertFloatToHalf(std::max(0.0f, distance))) >> (16 - std::min(16u, (uint32_t)field.bits));
+					break;
+				default:
+					break;
+				}
+				key = (key << field.bits) | (value & ((1ull << field.bits) - 1));
+				total_bits += field.bits;
+			}
+			assert(total_bits <= 64);
+			return key;
+		}
+	};
+	// Opaque: grouped by pipeline state and material first, meshes are drawn front to back inside their group
+	static constexpr RenderBatchKey RENDERBATCHKEY_OPAQUE = { {
+		{ RenderBatchKey::FIELD_BUCKET, 8 },
+		{ RenderBatchKey::FIELD_MATERIAL, 16 },
+		{ RenderBatchKey::FIELD_MESH, 24 },
+		{ RenderBatchKey::FIELD_DISTANCE, 16 },
+	} };
+	// Transparent: the distance must come first for correct blending
+	static constexpr RenderBatchKey RENDERBATCHKEY_TRANSPARENT = { {
+		{ RenderBatchKey::FIELD_DISTANCE, 16 },
+		{ RenderBatchKey::FIELD_MESH, 24 },
+		{ RenderBatchKey::FIELD_BUCKET, 8 },
+		{ RenderBatchKey::FIELD_MATERIAL, 16 },
+	} };
+	// Depth only passes without a camera distance, like shadows
+	static constexpr RenderBatchKey RENDERBATCHKEY_STATE = { {
+		{ RenderBatchKey::FIELD_BUCKET, 8 },
+		{ RenderBatchKey::FIELD_MATERIAL, 16 },
+		{ RenderBatchKey::FIELD_MESH, 24 },
+	} };
+
+	// Direct reference to a renderable instance:
+	struct RenderBatch
+	{
+		uint64_t data;
+		uint64_t sortKey; // only used by RenderQueue::sort(), see RenderBatchKey
+
+		inline void Create(size_t meshIndex, size_t instanceIndex, float distance, uint64_t key = 0)
+		{
+			assert(meshIndex < 0x00FFFFFF);
+			assert(instanceIndex < 0x00FFFFFF);
+
+			data = 0;
+			data |= uint64_t(XMConvertFloatToHalf(distance) & 0xFFFF) << 48ull;
+			data |= uint64_t(meshIndex & 0x00FFFFFF) << 24ull;
+			data |= uint64_t(instanceIndex & 0x00FFFFFF) << 0ull;
+			sortKey = key;
+		}
+
+		inline float GetDistance() const
+		{
+			return XMConvertHalfToFloat(HALF(data >> 48ull));
+		}
+		inline uint32_t GetMeshIndex() const
+		{
+			return (data >> 24ull) & 0x00FFFFFF;
+		}
+		inline uint32_t GetInstanceIndex() const
+		{
+			return (data >> 0ull) & 0x00FFFFFF;
+		}
+	};
+
+	static constexpr uint32_t RADIXSORT_MIN_COUNT = 2048; // smaller queues are faster with std::stable_sort
+	static constexpr uint32_t RADIXSORT_PARALLEL_COUNT = 65536; // larger queues are sorted by multiple jobs
+	static constexpr uint32_t RADIXSORT_BLOCK_SIZE = 16384; // batches per job in the parallel sort
+	// Stable LSD radix sort of RenderBatches by their sort keys, 8 bits per pass
+	//	key_flip is XOR-ed to the keys, ~0 sorts in descending order
+	//	Passes where every key has the same digit are skipped, so narrow keys only cost as many passes as their bits need
+	//	In the parallel sort every job counts and scatters its own block, the per block offsets keep the sort stable
+	inline void RadixSort(RenderBatch* batches, RenderBatch* scratch, uint32_t count, uint64_t key_flip)
+	{
+		const uint32_t block_count = count >= RADIXSORT_PARALLEL_COUNT ? (count + RADIXSORT_BLOCK_SIZE - 1) / RADIXSORT_BLOCK_SIZE : 1;
+		const uint32_t block_size = (count + block_count - 1) / block_count;
+		ap::vector<uint32_t> histograms(size_t(block_count) * 8 * 256); // [block][pass][digit]
+		auto count_block = [&](uint32_t block, const RenderBatch* src, uint32_t first_pass, uint32_t pass_count) {
+			uint32_t* histogram = histograms.data() + size_t(block) * 8 * 256;
+			std::fill(histogram + first_pass * 256, histogram + (first_pass + pass_count) * 256, 0u);
+			const uint32_t first = block * block_size;
+			const uint32_t last = std::min(count, first + block_size);
+			const uint64_t flip = key_flip;
+			if (pass_count == 1)
+			{
+				uint32_t* pass_histogram = histogram + first_pass * 256;
+				const uint32_t shift = first_pass * 8;
+				for (uint32_t i = first; i < last; ++i)
+				{
+					pass_histogram[((src[i].sortKey ^ flip) >> shift) & 0xFF]++;
+				}
+				return;
+			}
+			for (uint32_t i = first; i < last; ++i)
+			{
+				const uint64_t key = src[i].sortKey ^ flip;
+				for (uint32_t pass = first_pass; pass < first_pass + pass_count; ++pass)
+				{
+					histogram[pass * 256 + ((key >> (pass * 8)) & 0xFF)]++;
+				}
+			}
+		};
+
+		ap::jobsystem::context ctx;
+		if (block_count > 1)
+		{
+			ap::jobsystem::Dispatch(ctx, block_count, 1, [&](ap::jobsystem::JobArgs args) {
+				count_block(args.jobIndex, batches, 0, 8);
+			});
+			ap::jobsystem::Wait(ctx);
+		}
+		else
+		{
+			count_block(0, batches, 0, 8);
+		}
+
+		RenderBatch* src = batches;
+		RenderBatch* dst = scratch;
+		bool counted = true; // the histograms are valid for the current src order
+		for (uint32_t pass = 0; pass < 8; ++pass)
+		{
+			// Skip the pass if all keys have the same digit, the block histograms of the first counting still tell this for every pass:
+			bool trivial = false;
+			for (uint32_t digit = 0; digit < 256 && !trivial; ++digit)
+			{
+				uint32_t digit_count = 0;
+				for (uint32_t block = 0; block < block_count; ++block)
+				{
+					digit_count += histograms[(size_t(block) * 8 + pass) * 256 + digit];
+				}
+				trivial = digit_count == count;
+				if (digit_count > 0 && !trivial)
+					break;
+			}
+			if (trivial)
+				continue;
+
+			if (!counted)
+			{
+				// The order changed since the first counting, so the blocks have different keys now:
+				ap::jobsystem::Dispatch(ctx, block_count, 1, [&](ap::jobsystem::JobArgs args) {
+					count_block(args.jobIndex, src, pass, 1);
+				});
+				ap::jobsystem::Wait(ctx);
+			}
+			counted = false;
+
+			// Turn the counts into write offsets, digit major and block minor:
+			uint32_t offset = 0;
+			for (uint32_t digit = 0; digit < 256; ++digit)
+			{
+				for (uint32_t block = 0; block < block_count; ++block)
+				{
+					uint32_t& value = histograms[(size_t(block) * 8 + pass) * 256 + digit];
+					const uint32_t digit_count = value;
+					value = offset;
+					offset += digit_count;
+				}
+			}
+
+			auto scatter_block = [&](uint32_t block) {
+				uint32_t* offsets = histograms.data() + (size_t(block) * 8 + pass) * 256;
+				const RenderBatch* in = src;
+				RenderBatch* out = dst;
+				const uint64_t flip = key_flip;
+				const uint32_t shift = pass * 8;
+				const uint32_t first = block * block_size;
+				const uint32_t last = std::min(count, first + block_size);
+				for (uint32_t i = first; i < last; ++i)
+				{
+					out[offsets[((in[i].sortKey ^ flip) >> shift) & 0xFF]++] = in[i];
+				}
+			};
+			if (block_count > 1)
+			{
+				ap::jobsystem::Dispatch(ctx, block_count, 1, [&](ap::jobsystem::JobArgs args) {
+					scatter_block(args.jobIndex);
+				});
+				ap::jobsystem::Wait(ctx);
+			}
+			else
+			{
+				scatter_block(0);
+			}
+			std::swap(src, dst);
+		}
+
+		if (src != batches)
+		{
+			std::copy(src, src + count, batches);
+		}
+	}
+}
@@ -859,9 +859,16 @@ void RenderPath3D::Render() const
 	// Shadow maps:
 	if (getShadowsEnabled())
 	{
-		cmd = device->BeginCommandList();
-		ap::jobsystem::Execute(ctx, [this, cmd](ap::jobsystem::JobArgs args) {
-			ap::renderer::DrawShadowmaps(visibility_main, cmd);
+		// The shadow views can be recorded in parallel into multiple command lists, they are all begun here so that they are submitted in order:
+		static constexpr uint32_t shadow_cmd_max = 4;
+		const uint32_t shadow_cmd_count = std::min(shadow_cmd_max, ap::jobsystem::GetThreadCount());
+		CommandList shadow_cmds[shadow_cmd_max];
+		for (uint32_t i = 0; i < shadow_cmd_count; ++i)
+		{
+			shadow_cmds[i] = device->BeginCommandList();
+		}
+		ap::jobsystem::Execute(ctx, [this, shadow_cmds, shadow_cmd_count](ap::jobsystem::JobArgs args) {
+			ap::renderer::DrawShadowmaps(visibility_main, shadow_cmds, shadow_cmd_count);
 			});
 	}
 
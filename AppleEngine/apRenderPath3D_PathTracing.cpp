@@ -173,6 +173,7 @@ namespace ap
 
 					texturedata_dst.resize(texturedata_src.size());
 
+					denoiserContext.priority = ap::jobsystem::Priority::Streaming; // denoising can take multiple frames
 					ap::jobsystem::Execute(denoiserContext, [&](ap::jobsystem::JobArgs args) {
 
 						size_t width = (size_t)traceResult.desc.width;
@@ -1,4 +1,5 @@
 #include "apRenderer.h"
+#include "apRenderBatch.h"
 #include "apHairParticle.h"
 #include "apEmittedParticle.h"
 #include "apSprite.h"
@@ -141,6 +142,7 @@ bool variableRateShadingClassificationDebug = false;
 float GameSpeed = 1;
 bool debugLightCulling = false;
 bool occlusionCulling = false;
+bool softwareOcclusionCulling = false;
 bool temporalAA = false;
 bool temporalAADEBUG = false;
 uint32_t raytraceBounceCount = 3;
@@ -197,37 +199,33 @@ Texture texture_detailNoise;
 Texture texture_curlNoise;
 Texture texture_weatherMap;
 
-// Direct reference to a renderable instance:
-struct RenderBatch
+// The sort key fields that only depend on the mesh, they are taken from the material of its first subset
+//	The bucket approximates the PSO_object permutation that RenderMeshes() will choose
+inline void GetMeshSortFields(const Scene& scene, size_t meshIndex, uint32_t& bucket, uint32_t& material)
 {
-	uint64_t data;
-
-	inline void Create(size_t meshIndex, size_t instanceIndex, float distance)
-	{
-		assert(meshIndex < 0x00FFFFFF);
-		assert(instanceIndex < 0x00FFFFFF);
-
-		data = 0;
-		data |= uint64_t(XMConvertFloatToHalf(distance) & 0xFFFF) << 48ull;
-		data |= uint64_t(meshIndex & 0x00FFFFFF) << 24ull;
-		data |= uint64_t(instanceIndex & 0x00FFFFFF) << 0ull;
-	}
-
-	inline float GetDistance() const
-	{
-		return XMConvertHalfToFloat(HALF(data >> 48ull));
-	}
-	inline uint32_t GetMeshIndex() const
+	bucket = 0;
+	material = 0;
+	const MeshComponent& mesh = scene.meshes[meshIndex];
+	if (mesh.subsets.empty() || mesh.subsets[0].materialIndex >= scene.materials.GetCount())
+		return;
+	material = mesh.subsets[0].materialIndex;
+	if (mesh.IsTerrain())
 	{
-		return (data >> 24ull) & 0x00FFFFFF;
+		bucket = 0xFF;
+		return;
 	}
-	inline uint32_t GetInstanceIndex() const
+	const MaterialComponent& mat = scene.materials[material];
+	if (mat.IsCustomShader())
 	{
-		return (data >> 0ull) & 0x00FFFFFF;
+		bucket = 0xFE;
+		return;
 	}
-};
+	bucket = mat.shaderType;
+	bucket = bucket * BLENDMODE_COUNT + mat.GetBlendMode();
+	bucket = bucket * 2 + ((mesh.IsDoubleSided() || mat.IsDoubleSided()) ? 1 : 0);
+	bucket = bucket * 2 + (mat.IsAlphaTestEnabled() ? 1 : 0);
+}
 
-// This is just a utility that points to a linear array of render batches:
 struct RenderQueue
 {
 	RenderBatch* batchArray = nullptr;
@@ -249,14 +247,26 @@ struct RenderQueue
 		}
 		batchCount++; 
 	}
-	inline void sort(RenderQueueSortType sortType = SORT_FRONT_TO_BACK)
+	// Sort the batches by their sort keys, the radix sort takes its temporary memory from the frame allocator of cmd
+	inline void sort(RenderQueueSortType sortType, CommandList cmd)
 	{
-		if (batchCount > 1)
+		if (batchCount <= 1)
+			return;
+
+		RenderBatch* scratch = nullptr;
+		if (batchCount >= RADIXSORT_MIN_COUNT)
+		{
+			scratch = (RenderBatch*)GetRenderFrameAllocator(cmd).allocate(sizeof(RenderBatch) * batchCount);
+		}
+		if (scratch == nullptr)
 		{
-			std::sort(batchArray, batchArray + batchCount, [sortType](const RenderBatch& a, const RenderBatch& b) -> bool {
-				return ((sortType == SORT_FRONT_TO_BACK) ? (a.data < b.data) : (a.data > b.data));
+			std::stable_sort(batchArray, batchArray + batchCount, [sortType](const RenderBatch& a, const RenderBatch& b) -> bool {
+				return ((sortType == SORT_FRONT_TO_BACK) ? (a.sortKey < b.sortKey) : (a.sortKey > b.sortKey));
 			});
+			return;
 		}
+		RadixSort(batchArray, scratch, batchCount, sortType == SORT_FRONT_TO_BACK ? 0 : ~0ull);
+		GetRenderFrameAllocator(cmd).free(sizeof(RenderBatch) * batchCount);
 	}
 };
 
@@ -2409,6 +2419,11 @@ void RenderMeshes(
 		AABB aabb;
 	} instancedBatch = {};
 
+	// The states that were last bound by this function, the sorted render queue keeps them the same for neighbouring batches:
+	const GPUBuffer* prev_indexBuffer = nullptr;
+	const PipelineState* prev_pso = nullptr;
+	uint32_t prev_stencilRef = ~0u;
+	ShadingRate prev_shadingRate = ShadingRate::RATE_INVALID;
 
 	// This will be called every time we start a new draw call:
 	auto batch_flush = [&]()
@@ -2429,7 +2444,11 @@ void RenderMeshes(
 			device->BindDynamicConstantBuffer(cb, CB_GETBINDSLOT(ForwardEntityMaskCB), cmd);
 		}
 
-		device->BindIndexBuffer(&mesh.indexBuffer, mesh.GetIndexFormat(), 0, cmd);
+		if (prev_indexBuffer != &mesh.indexBuffer)
+		{
+			device->BindIndexBuffer(&mesh.indexBuffer, mesh.GetIndexFormat(), 0, cmd);
+			prev_indexBuffer = &mesh.indexBuffer;
+		}
 
 		for (size_t subsetIndex = 0; subsetIndex < mesh.subsets.size(); ++subsetIndex)
 		{
@@ -2500,11 +2519,19 @@ void RenderMeshes(
 			STENCILREF engineStencilRef = material.engineStencilRef;
 			uint8_t userStencilRef = userStencilRefOverride > 0 ? userStencilRefOverride : material.userStencilRef;
 			uint32_t stencilRef = CombineStencilrefs(engineStencilRef, userStencilRef);
-			device->BindStencilRef(stencilRef, cmd);
+			if (stencilRef != prev_stencilRef)
+			{
+				device->BindStencilRef(stencilRef, cmd);
+				prev_stencilRef = stencilRef;
+			}
 
 			if (renderPass != RENDERPASS_PREPASS && renderPass != RENDERPASS_VOXELIZE) // depth only alpha test will be full res
 			{
-				device->BindShadingRate(material.shadingRate, cmd);
+				if (material.shadingRate != prev_shadingRate)
+				{
+					device->BindShadingRate(material.shadingRate, cmd);
+					prev_shadingRate = material.shadingRate;
+				}
 			}
 
 			assert(subsetIndex < 256u); // subsets must be represented as 8-bit
@@ -2521,11 +2548,16 @@ void RenderMeshes(
 			if (pso_backside != nullptr)
 			{
 				device->BindPipelineState(pso_backside, cmd);
+				prev_pso = pso_backside;
 				device->PushConstants(&push, sizeof(push), cmd);
 				device->DrawIndexedInstanced(subset.indexCount, instancedBatch.instanceCount, subset.indexOffset, 0, 0, cmd);
 			}
 
-			device->BindPipelineState(pso, cmd);
+			if (pso != prev_pso)
+			{
+				device->BindPipelineState(pso, cmd);
+				prev_pso = pso;
+			}
 			device->PushConstants(&push, sizeof(push), cmd);
 			device->DrawIndexedInstanced(subset.indexCount, instancedBatch.instanceCount, subset.indexOffset, 0, 0, cmd);
 
@@ -2704,6 +2736,111 @@ void ProcessDeferredMipGenRequests(CommandList cmd)
 	deferredMIPGenLock.unlock();
 }
 
+static constexpr uint32_t BVH_CULLING_SUBTREE_COUNT = 64;
+static constexpr uint32_t BVH_CULLING_LOCAL_COUNT = 64;
+// The scene BVHs are only up to date after Scene::Update(), until then the culling falls back to testing every AABB
+inline bool IsBVHCullingAvailable(const ap::BVH& bvh, size_t count)
+{
+	return bvh.IsValid() && bvh.leaf_count == (uint32_t)count;
+}
+// Frustum culling with a scene BVH, the subtrees are traversed by separate jobs
+//	occlusion: if not nullptr, the nodes that are hidden in it are culled too
+//	visible: T(uint32_t index) is called for every visible leaf, its results are written to list and counter is incremented
+//	The results are first gathered in a small local list to reduce atomics, like the stream compaction of the flat culling
+template<typename T, typename VisibleCallback>
+void CullBVH(
+	ap::jobsystem::context& ctx,
+	const ap::BVH& bvh,
+	const Frustum& frustum,
+	uint32_t layerMask,
+	const ap::OcclusionBuffer* occlusion,
+	const ap::vector<uint32_t>& subtrees,
+	ap::vector<T>& list,
+	std::atomic<uint32_t>& counter,
+	const VisibleCallback& visible
+)
+{
+	ap::jobsystem::Dispatch(ctx, (uint32_t)subtrees.size(), 1, [&bvh, &frustum, layerMask, occlusion, &subtrees, &list, &counter, &visible](ap::jobsystem::JobArgs args) {
+		T local_list[BVH_CULLING_LOCAL_COUNT];
+		uint32_t local_count = 0;
+		auto flush = [&]() {
+			const uint32_t prev_count = counter.fetch_add(local_count);
+			for (uint32_t i = 0; i < local_count; ++i)
+			{
+				list[prev_count + i] = local_list[i];
+			}
+			local_count = 0;
+		};
+		auto not_occluded = [occlusion](const AABB& aabb) {
+			return occlusion == nullptr || !occlusion->IsOccluded(aabb);
+		};
+		bvh.IntersectsFrustum(frustum, layerMask, not_occluded, [&](uint32_t index) {
+			local_list[local_count++] = visible(index);
+			if (local_count == arraysize(local_list))
+			{
+				flush();
+			}
+		}, subtrees[args.jobIndex]);
+		if (local_count > 0)
+		{
+			flush();
+		}
+	});
+}
+static constexpr uint32_t OCCLUSION_BUFFER_WIDTH = 256;
+static constexpr uint32_t OCCLUSION_BUFFER_TRIANGLE_BUDGET = 65536;
+// Rasterize the nearest occluder objects in the culling frustum into the occlusion buffer of the visibility
+void RenderOcclusionBuffer(Visibility& vis)
+{
+	auto range = ap::profiler::BeginRangeCPU("Occlusion Buffer");
+	const Scene& scene = *vis.scene;
+	const CameraComponent& camera = *vis.camera;
+
+	struct OccluderCandidate
+	{
+		float distance;
+		uint32_t objectIndex;
+	};
+	ap::vector<OccluderCandidate> candidates;
+	for (uint32_t objectIndex : scene.occluder_objects)
+	{
+		const AABB& aabb = scene.aabb_objects[objectIndex];
+		if ((aabb.layerMask & vis.layerMask) && vis.frustum.CheckBoxFast(aabb))
+		{
+			candidates.push_back({ ap::math::DistanceSquared(camera.Eye, scene.objects[objectIndex].center), objectIndex });
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const OccluderCandidate& a, const OccluderCandidate& b) {
+		return a.distance < b.distance;
+	});
+
+	// Near occluders hide the most, the farther ones are skipped when the triangle budget is used up:
+	vis.occluders.clear();
+	uint32_t triangle_count = 0;
+	for (const OccluderCandidate& candidate : candidates)
+	{
+		const ObjectComponent& object = scene.objects[candidate.objectIndex];
+		const MeshComponent* mesh = scene.meshes.GetComponent(object.meshID);
+		if (mesh == nullptr || object.transform_index < 0)
+			continue;
+		const uint32_t mesh_triangle_count = uint32_t(mesh->indices.size() / 3);
+		if (triangle_count + mesh_triangle_count > OCCLUSION_BUFFER_TRIANGLE_BUDGET)
+			continue;
+		triangle_count += mesh_triangle_count;
+
+		ap::OcclusionBuffer::Occluder& occluder = vis.occluders.emplace_back();
+		occluder.positions = mesh->vertex_positions.data();
+		occluder.indices = mesh->indices.data();
+		occluder.index_count = (uint32_t)mesh->indices.size();
+		occluder.world = scene.transforms[object.transform_index].world;
+	}
+
+	const float aspect = camera.height > 0 ? camera.width / camera.height : 1.0f;
+	const uint32_t height = std::max(1u, uint32_t(OCCLUSION_BUFFER_WIDTH / aspect));
+	vis.occlusion_buffer.Render(camera.GetViewProjection(), OCCLUSION_BUFFER_WIDTH, height, camera.zNearP, vis.occluders.data(), (uint32_t)vis.occluders.size());
+
+	ap::profiler::EndRange(range); // Occlusion Buffer
+}
 void UpdateVisibility(Visibility& vis)
 {
 	// Perform parallel frustum culling and obtain closest reflector:
@@ -2721,6 +2858,11 @@ void UpdateVisibility(Visibility& vis)
 	static const uint32_t groupSize = 64;
 	static const size_t sharedmemory_size = (groupSize + 1) * sizeof(uint32_t); // list + counter per group
 
+	// The BVH subtrees that are culled in parallel, they must stay alive until the culling jobs are finished:
+	ap::vector<uint32_t> light_subtrees;
+	ap::vector<uint32_t> object_subtrees;
+	ap::vector<uint32_t> decal_subtrees;
+
 	// Initialize visible indices:
 	vis.Clear();
 
@@ -2734,173 +2876,258 @@ void UpdateVisibility(Visibility& vis)
 		vis.flags &= ~Visibility::ALLOW_OCCLUSION_CULLING;
 	}
 
-	if (vis.flags & Visibility::ALLOW_LIGHTS)
+	// The occlusion buffer is rendered before the culling so objects can be tested against it in this frame
+	//	While the culling camera is frozen, the occlusion buffer of the frozen frustum is kept
+	if (!GetSoftwareOcclusionCullingEnabled())
 	{
-		// Cull lights:
-		vis.visibleLights.resize(vis.scene->aabb_lights.GetCount());
-		ap::jobsystem::Dispatch(ctx_lights, (uint32_t)vis.scene->aabb_lights.GetCount(), groupSize, [&](ap::jobsystem::JobArgs args) {
+		vis.flags &= ~Visibility::ALLOW_SOFTWARE_OCCLUSION_CULLING;
+	}
+	const ap::OcclusionBuffer* occlusion = nullptr;
+	if ((vis.flags & Visibility::ALLOW_SOFTWARE_OCCLUSION_CULLING) && (vis.flags & Visibility::ALLOW_OBJECTS))
+	{
+		if (!GetFreezeCullingCameraEnabled())
+		{
+			RenderOcclusionBuffer(vis);
+		}
+		if (vis.occlusion_buffer.IsValid() && !vis.occluders.empty())
+		{
+			occlusion = &vis.occlusion_buffer;
+		}
+	}
 
-			// Setup stream compaction:
-			uint32_t& group_count = *(uint32_t*)args.sharedmemory;
-			Visibility::VisibleLight* group_list = (Visibility::VisibleLight*)args.sharedmemory + 1;
-			if (args.isFirstJobInGroup)
+	if (vis.flags & Visibility::ALLOW_LIGHTS)
+	{
+		// Everything that needs to be done for a visible light:
+		auto light_visible = [&](uint32_t lightIndex) {
+			const AABB& aabb = vis.scene->aabb_lights[lightIndex];
+			// (also compute light distance for shadow priority sorting)
+			assert(lightIndex < 0xFFFF);
+			Visibility::VisibleLight visibleLight;
+			visibleLight.index = (uint16_t)lightIndex;
+			const LightComponent& light = vis.scene->lights[lightIndex];
+			float distance = 0;
+			if (light.type != LightComponent::DIRECTIONAL)
 			{
-				group_count = 0; // first thread initializes local counter
+				distance = ap::math::DistanceEstimated(light.position, vis.camera->Eye);
+			}
+			visibleLight.distance = uint16_t(distance * 10);
+			if (light.IsVolumetricsEnabled())
+			{
+				vis.volumetriclight_request.store(true);
 			}
 
-			const AABB& aabb = vis.scene->aabb_lights[args.jobIndex];
-
-			if ((aabb.layerMask & vis.layerMask) && vis.frustum.CheckBoxFast(aabb))
+			if (vis.flags & Visibility::ALLOW_OCCLUSION_CULLING)
 			{
-				// Local stream compaction:
-				//	(also compute light distance for shadow priority sorting)
-				assert(args.jobIndex < 0xFFFF);
-				group_list[group_count].index = (uint16_t)args.jobIndex;
-				const LightComponent& light = vis.scene->lights[args.jobIndex];
-				float distance = 0;
-				if (light.type != LightComponent::DIRECTIONAL)
+				if (!light.IsStatic() && light.GetType() != LightComponent::DIRECTIONAL || light.occlusionquery < 0)
 				{
-					distance = ap::math::DistanceEstimated(light.position, vis.camera->Eye);
+					if (!aabb.intersects(vis.camera->Eye))
+					{
+						light.occlusionquery = vis.scene->queryAllocator.fetch_add(1); // allocate new occlusion query from heap
+					}
 				}
-				group_list[group_count].distance = uint16_t(distance * 10);
-				group_count++;
-				if (light.IsVolumetricsEnabled())
+			}
+			return visibleLight;
+		};
+
+		// Cull lights:
+		vis.visibleLights.resize(vis.scene->aabb_lights.GetCount());
+		if (IsBVHCullingAvailable(vis.scene->light_bvh, vis.scene->aabb_lights.GetCount()))
+		{
+			vis.scene->light_bvh.GetSubtrees(BVH_CULLING_SUBTREE_COUNT, light_subtrees);
+			CullBVH(ctx_lights, vis.scene->light_bvh, vis.frustum, vis.layerMask, nullptr, light_subtrees, vis.visibleLights, vis.light_counter, light_visible);
+		}
+		else
+		{
+			ap::jobsystem::Dispatch(ctx_lights, (uint32_t)vis.scene->aabb_lights.GetCount(), groupSize, [&](ap::jobsystem::JobArgs args) {
+
+				// Setup stream compaction:
+				uint32_t& group_count = *(uint32_t*)args.sharedmemory;
+				Visibility::VisibleLight* group_list = (Visibility::VisibleLight*)args.sharedmemory + 1;
+				if (args.isFirstJobInGroup)
 				{
-					vis.volumetriclight_request.store(true);
+					group_count = 0; // first thread initializes local counter
 				}
 
-				if (vis.flags & Visibility::ALLOW_OCCLUSION_CULLING)
+				const AABB& aabb = vis.scene->aabb_lights[args.jobIndex];
+
+				if ((aabb.layerMask & vis.layerMask) && vis.frustum.CheckBoxFast(aabb))
 				{
-					if (!light.IsStatic() && light.GetType() != LightComponent::DIRECTIONAL || light.occlusionquery < 0)
-					{
-						if (!aabb.intersects(vis.camera->Eye))
-						{
-							light.occlusionquery = vis.scene->queryAllocator.fetch_add(1); // allocate new occlusion query from heap
-						}
-					}
+					// Local stream compaction:
+					group_list[group_count++] = light_visible(args.jobIndex);
 				}
-			}
 
-			// Global stream compaction:
-			if (args.isLastJobInGroup && group_count > 0)
-			{
-				uint32_t prev_count = vis.light_counter.fetch_add(group_count);
-				for (uint32_t i = 0; i < group_count; ++i)
+				// Global stream compaction:
+				if (args.isLastJobInGroup && group_count > 0)
 				{
-					vis.visibleLights[prev_count + i] = group_list[i];
+					uint32_t prev_count = vis.light_counter.fetch_add(group_count);
+					for (uint32_t i = 0; i < group_count; ++i)
+					{
+						vis.visibleLights[prev_count + i] = group_list[i];
+					}
 				}
-			}
 
-			}, sharedmemory_size);
+				}, sharedmemory_size);
+		}
 	}
 
 	if (vis.flags & Visibility::ALLOW_OBJECTS)
 	{
-		// Cull objects:
-		vis.visibleObjects.resize(vis.scene->aabb_objects.GetCount());
-		ap::jobsystem::Dispatch(ctx, (uint32_t)vis.scene->aabb_objects.GetCount(), groupSize, [&](ap::jobsystem::JobArgs args) {
+		// Everything that needs to be done for a visible object:
+		auto object_visible = [&](uint32_t objectIndex) {
+			const AABB& aabb = vis.scene->aabb_objects[objectIndex];
+			const ObjectComponent& object = vis.scene->objects[objectIndex];
 
-			// Setup stream compaction:
-			uint32_t& group_count = *(uint32_t*)args.sharedmemory;
-			uint32_t* group_list = (uint32_t*)args.sharedmemory + 1;
-			if (args.isFirstJobInGroup)
+			if (ap::resourcemanager::IsTextureStreamingEnabled() && object.meshID != INVALID_ENTITY)
 			{
-				group_count = 0; // first thread initializes local counter
-			}
-
-			const AABB& aabb = vis.scene->aabb_objects[args.jobIndex];
-
-			if ((aabb.layerMask & vis.layerMask) && vis.frustum.CheckBoxFast(aabb))
-			{
-				// Local stream compaction:
-				group_list[group_count++] = args.jobIndex;
-
-				const ObjectComponent& object = vis.scene->objects[args.jobIndex];
-
-				if (vis.flags & Visibility::ALLOW_REQUEST_REFLECTION)
+				// Request the texture resolution from the projected size of the object:
+				const MeshComponent* mesh = vis.scene->meshes.GetComponent(object.meshID);
+				if (mesh != nullptr)
 				{
-					if (object.IsRequestPlanarReflection())
+					const float distance = ap::math::Distance(vis.camera->Eye, object.center);
+					const float radius = aabb.getRadius();
+					float resolution = std::numeric_limits<float>::max(); // camera is inside the object, request full resolution
+					if (distance > radius)
 					{
-						float dist = ap::math::DistanceEstimated(vis.camera->Eye, object.center);
-						vis.locker.lock();
-						if (dist < vis.closestRefPlane)
+						resolution = radius / (distance * std::tan(vis.camera->fov * 0.5f)) * std::max(vis.camera->width, vis.camera->height);
+					}
+					for (auto& subset : mesh->subsets)
+					{
+						if (subset.materialIndex >= vis.scene->materials.GetCount())
+						{
+							continue;
+						}
+						const MaterialComponent& material = vis.scene->materials[subset.materialIndex];
+						for (auto& texture : material.textures)
 						{
-							vis.closestRefPlane = dist;
-							const TransformComponent& transform = vis.scene->transforms[object.transform_index];
-							XMVECTOR P = transform.GetPositionV();
-							XMVECTOR N = XMVectorSet(0, 1, 0, 0);
-							N = XMVector3TransformNormal(N, XMLoadFloat4x4(&transform.world));
-							XMVECTOR _refPlane = XMPlaneFromPointNormal(P, N);
-							XMStoreFloat4(&vis.reflectionPlane, _refPlane);
-
-							vis.planar_reflection_visible = true;
+							ap::resourcemanager::StreamingRequest(texture.resource, resolution);
 						}
-						vis.locker.unlock();
 					}
 				}
+			}
 
-				if (vis.flags & Visibility::ALLOW_OCCLUSION_CULLING)
+			if (vis.flags & Visibility::ALLOW_REQUEST_REFLECTION)
+			{
+				if (object.IsRequestPlanarReflection())
 				{
-					if (object.IsRenderable() && object.occlusionQueries[vis.scene->queryheap_idx] < 0)
+					float dist = ap::math::DistanceEstimated(vis.camera->Eye, object.center);
+					vis.locker.lock();
+					if (dist < vis.closestRefPlane)
 					{
-						if (aabb.intersects(vis.camera->Eye))
-						{
-							// camera is inside the instance, mark it as visible in this frame:
-							object.occlusionHistory |= 1;
-						}
-						else
-						{
-							object.occlusionQueries[vis.scene->queryheap_idx] = vis.scene->queryAllocator.fetch_add(1); // allocate new occlusion query from heap
-						}
+						vis.closestRefPlane = dist;
+						const TransformComponent& transform = vis.scene->transforms[object.transform_index];
+						XMVECTOR P = transform.GetPositionV();
+						XMVECTOR N = XMVectorSet(0, 1, 0, 0);
+						N = XMVector3TransformNormal(N, XMLoadFloat4x4(&transform.world));
+						XMVECTOR _refPlane = XMPlaneFromPointNormal(P, N);
+						XMStoreFloat4(&vis.reflectionPlane, _refPlane);
+
+						vis.planar_reflection_visible = true;
 					}
+					vis.locker.unlock();
 				}
 			}
 
-			// Global stream compaction:
-			if (args.isLastJobInGroup && group_count > 0)
+			if (vis.flags & Visibility::ALLOW_OCCLUSION_CULLING)
 			{
-				uint32_t prev_count = vis.object_counter.fetch_add(group_count);
-				for (uint32_t i = 0; i < group_count; ++i)
+				if (object.IsRenderable() && object.occlusionQueries[vis.scene->queryheap_idx] < 0)
 				{
-					vis.visibleObjects[prev_count + i] = group_list[i];
+					if (aabb.intersects(vis.camera->Eye))
+					{
+						// camera is inside the instance, mark it as visible in this frame:
+						object.occlusionHistory |= 1;
+					}
+					else
+					{
+						object.occlusionQueries[vis.scene->queryheap_idx] = vis.scene->queryAllocator.fetch_add(1); // allocate new occlusion query from heap
+					}
 				}
 			}
+			return objectIndex;
+		};
 
-			}, sharedmemory_size);
+		// Cull objects:
+		vis.visibleObjects.resize(vis.scene->aabb_objects.GetCount());
+		if (IsBVHCullingAvailable(vis.scene->object_bvh, vis.scene->aabb_objects.GetCount()))
+		{
+			vis.scene->object_bvh.GetSubtrees(BVH_CULLING_SUBTREE_COUNT, object_subtrees);
+			CullBVH(ctx, vis.scene->object_bvh, vis.frustum, vis.layerMask, occlusion, object_subtrees, vis.visibleObjects, vis.object_counter, object_visible);
+		}
+		else
+		{
+			ap::jobsystem::Dispatch(ctx, (uint32_t)vis.scene->aabb_objects.GetCount(), groupSize, [&](ap::jobsystem::JobArgs args) {
+
+				// Setup stream compaction:
+				uint32_t& group_count = *(uint32_t*)args.sharedmemory;
+				uint32_t* group_list = (uint32_t*)args.sharedmemory + 1;
+				if (args.isFirstJobInGroup)
+				{
+					group_count = 0; // first thread initializes local counter
+				}
+
+				const AABB& aabb = vis.scene->aabb_objects[args.jobIndex];
+
+				if ((aabb.layerMask & vis.layerMask) && vis.frustum.CheckBoxFast(aabb) && (occlusion == nullptr || !occlusion->IsOccluded(aabb)))
+				{
+					// Local stream compaction:
+					group_list[group_count++] = object_visible(args.jobIndex);
+				}
+
+				// Global stream compaction:
+				if (args.isLastJobInGroup && group_count > 0)
+				{
+					uint32_t prev_count = vis.object_counter.fetch_add(group_count);
+					for (uint32_t i = 0; i < group_count; ++i)
+					{
+						vis.visibleObjects[prev_count + i] = group_list[i];
+					}
+				}
+
+				}, sharedmemory_size);
+		}
 	}
 
 	if (vis.flags & Visibility::ALLOW_DECALS)
 	{
+		auto decal_visible = [](uint32_t decalIndex) { return decalIndex; };
+
 		vis.visibleDecals.resize(vis.scene->aabb_decals.GetCount());
-		ap::jobsystem::Dispatch(ctx, (uint32_t)vis.scene->aabb_decals.GetCount(), groupSize, [&](ap::jobsystem::JobArgs args) {
+		if (IsBVHCullingAvailable(vis.scene->decal_bvh, vis.scene->aabb_decals.GetCount()))
+		{
+			vis.scene->decal_bvh.GetSubtrees(BVH_CULLING_SUBTREE_COUNT, decal_subtrees);
+			CullBVH(ctx, vis.scene->decal_bvh, vis.frustum, vis.layerMask, nullptr, decal_subtrees, vis.visibleDecals, vis.decal_counter, decal_visible);
+		}
+		else
+		{
+			ap::jobsystem::Dispatch(ctx, (uint32_t)vis.scene->aabb_decals.GetCount(), groupSize, [&](ap::jobsystem::JobArgs args) {
 
-			// Setup stream compaction:
-			uint32_t& group_count = *(uint32_t*)args.sharedmemory;
-			uint32_t* group_list = (uint32_t*)args.sharedmemory + 1;
-			if (args.isFirstJobInGroup)
-			{
-				group_count = 0; // first thread initializes local counter
-			}
+				// Setup stream compaction:
+				uint32_t& group_count = *(uint32_t*)args.sharedmemory;
+				uint32_t* group_list = (uint32_t*)args.sharedmemory + 1;
+				if (args.isFirstJobInGroup)
+				{
+					group_count = 0; // first thread initializes local counter
+				}
 
-			const AABB& aabb = vis.scene->aabb_decals[args.jobIndex];
+				const AABB& aabb = vis.scene->aabb_decals[args.jobIndex];
 
-			if ((aabb.layerMask & vis.layerMask) && vis.frustum.CheckBoxFast(aabb))
-			{
-				// Local stream compaction:
-				group_list[group_count++] = args.jobIndex;
-			}
+				if ((aabb.layerMask & vis.layerMask) && vis.frustum.CheckBoxFast(aabb))
+				{
+					// Local stream compaction:
+					group_list[group_count++] = args.jobIndex;
+				}
 
-			// Global stream compaction:
-			if (args.isLastJobInGroup && group_count > 0)
-			{
-				uint32_t prev_count = vis.decal_counter.fetch_add(group_count);
-				for (uint32_t i = 0; i < group_count; ++i)
+				// Global stream compaction:
+				if (args.isLastJobInGroup && group_count > 0)
 				{
-					vis.visibleDecals[prev_count + i] = group_list[i];
+					uint32_t prev_count = vis.decal_counter.fetch_add(group_count);
+					for (uint32_t i = 0; i < group_count; ++i)
+					{
+						vis.visibleDecals[prev_count + i] = group_list[i];
+					}
 				}
-			}
 
-			}, sharedmemory_size);
+				}, sharedmemory_size);
+		}
 	}
 
 	if (vis.flags & Visibility::ALLOW_ENVPROBES)
@@ -4576,293 +4803,545 @@ void SetShadowPropsCube(int resolution, int count)
 	}
 
 }
-void DrawShadowmaps(
-	const Visibility& vis,
-	CommandList cmd
-)
+// One view of the shadow rendering (a cascade of a directional light, a spot light or a point light)
+struct ShadowView
 {
-	if (IsWireRender())
-		return;
+	LightComponent::LightType type;
+	uint16_t lightIndex;
+	uint32_t slice;
+	uint32_t cascade;
+	SHCAM shcam; // directional and spot lights
+	Sphere boundingsphere; // point lights
+	RenderQueue renderQueue;
+	uint32_t batchOffset; // index of the first batch of the render queue in ShadowCulling::batches
+	bool transparentShadowsRequested;
+};
+// Memory that is reused by the shadow culling between frames, per command list so that it can be used from multiple render threads
+struct ShadowCulling
+{
+	ap::vector<ShadowView> views;
+	ap::vector<FrustumPacket4> frustum_packets;
+	ap::vector<uint32_t> frustum_views; // view index of each frustum packet lane
+	ap::vector<uint32_t> sphere_views; // view index of each point light
+	ap::vector<uint64_t> object_masks; // bitmask of the views of each object
+	ap::vector<uint32_t> group_offsets; // batch count and then write offset of every view in every object group
+	ap::vector<uint8_t> group_transparent; // whether any transparent object was culled into a view in an object group
+	ap::vector<RenderBatch> batches;
+};
+ShadowCulling shadowCulling[COMMANDLIST_COUNT];
+static constexpr uint32_t SHADOWCULLING_GROUPSIZE = 256;
+static constexpr uint32_t SHADOWRECORDING_MIN_BATCHES = 512; // shadow views are only recorded into more command lists if each one gets about this many batches
 
-	if (!vis.visibleLights.empty())
-	{
-		device->EventBegin("DrawShadowmaps", cmd);
-		auto range = ap::profiler::BeginRangeGPU("Shadow Rendering", cmd);
+// Culls the objects against all shadow views at once and fills the render queue of every view
+//	Each object is tested only once against all frusta (four at a time) on the job system, then the results are compacted into one array of batches
+//	The batches are in the same order as if every view was culled one after the other
+void CullShadowViews(const Visibility& vis, ShadowCulling& culling)
+{
+	auto range = ap::profiler::BeginRangeCPU("Shadow Culling");
 
-		const bool predicationRequest =
-			device->CheckCapability(GraphicsDeviceCapability::PREDICATION) &&
-			GetOcclusionCullingEnabled();
+	const uint32_t view_count = (uint32_t)culling.views.size();
+	const uint32_t view_words = (view_count + 63) / 64;
+	const uint32_t object_count = (uint32_t)vis.scene->aabb_objects.GetCount();
+	const uint32_t group_count = (object_count + SHADOWCULLING_GROUPSIZE - 1) / SHADOWCULLING_GROUPSIZE;
 
-		BindCommonResources(cmd);
+	culling.frustum_packets.clear();
+	culling.frustum_views.clear();
+	culling.sphere_views.clear();
+	Frustum frusta[4];
+	uint32_t frustum_count = 0;
+	for (uint32_t viewIndex = 0; viewIndex < view_count; ++viewIndex)
+	{
+		const ShadowView& view = culling.views[viewIndex];
+		if (view.type == LightComponent::POINT)
+		{
+			culling.sphere_views.push_back(viewIndex);
+			continue;
+		}
+		frusta[frustum_count++] = view.shcam.frustum;
+		culling.frustum_views.push_back(viewIndex);
+		if (frustum_count == arraysize(frusta))
+		{
+			culling.frustum_packets.emplace_back().Load(frusta, frustum_count);
+			frustum_count = 0;
+		}
+	}
+	if (frustum_count > 0)
+	{
+		culling.frustum_packets.emplace_back().Load(frusta, frustum_count);
+	}
 
-		BoundingFrustum cam_frustum;
-		BoundingFrustum::CreateFromMatrix(cam_frustum, vis.camera->GetProjection());
-		std::swap(cam_frustum.Near, cam_frustum.Far);
-		cam_frustum.Transform(cam_frustum, vis.camera->GetInvView());
-		XMStoreFloat4(&cam_frustum.Orientation, XMQuaternionNormalize(XMLoadFloat4(&cam_frustum.Orientation)));
+	culling.object_masks.resize(size_t(object_count) * view_words);
+	culling.group_offsets.resize(size_t(group_count) * view_count);
+	culling.group_transparent.resize(size_t(group_count) * view_count);
 
+	// Pass 1: test every object against every view and count the results per object group:
+	ap::jobsystem::context ctx;
+	ap::jobsystem::Dispatch(ctx, group_count, 1, [&](ap::jobsystem::JobArgs args) {
+		const uint32_t group = args.jobIndex;
+		uint32_t* counts = culling.group_offsets.data() + size_t(group) * view_count;
+		uint8_t* transparent = culling.group_transparent.data() + size_t(group) * view_count;
+		std::fill(counts, counts + view_count, 0u);
+		std::fill(transparent, transparent + view_count, uint8_t(0));
+
+		const uint32_t first = group * SHADOWCULLING_GROUPSIZE;
+		const uint32_t last = std::min(first + SHADOWCULLING_GROUPSIZE, object_count);
+		for (uint32_t i = first; i < last; ++i)
+		{
+			uint64_t* mask = culling.object_masks.data() + size_t(i) * view_words;
+			std::fill(mask, mask + view_words, 0ull);
+
+			const AABB& aabb = vis.scene->aabb_objects[i];
+			if ((aabb.layerMask & vis.layerMask) == 0)
+				continue;
+			const ObjectComponent& object = vis.scene->objects[i];
+			if (!object.IsRenderable() || !object.IsCastingShadow())
+				continue;
 
-		uint32_t shadowCounter_2D = SHADOWRES_2D > 0 ? 0 : SHADOWCOUNT_2D;
-		uint32_t shadowCounter_Cube = SHADOWRES_CUBE > 0 ? 0 : SHADOWCOUNT_CUBE;
+			const uint32_t cascade_limit = CASCADE_COUNT - object.cascadeMask;
+			const bool is_transparent = (object.GetRenderTypes() & RENDERTYPE_TRANSPARENT) || (object.GetRenderTypes() & RENDERTYPE_WATER);
+			auto accept = [&](uint32_t viewIndex) {
+				const ShadowView& view = culling.views[viewIndex];
+				if (view.type == LightComponent::DIRECTIONAL && view.cascade >= cascade_limit)
+					return;
+				mask[viewIndex / 64] |= 1ull << (viewIndex % 64);
+				counts[viewIndex]++;
+				transparent[viewIndex] |= is_transparent ? 1 : 0;
+			};
 
-		for (const auto& visibleLight : vis.visibleLights)
-		{
-			if (shadowCounter_2D >= SHADOWCOUNT_2D && shadowCounter_Cube >= SHADOWCOUNT_CUBE)
+			for (size_t packet = 0; packet < culling.frustum_packets.size(); ++packet)
 			{
-				break;
+				const uint32_t hits = culling.frustum_packets[packet].CheckBoxFast(aabb);
+				for (uint32_t lane = 0; lane < 4; ++lane)
+				{
+					if (hits & (1u << lane))
+					{
+						accept(culling.frustum_views[packet * 4 + lane]);
+					}
+				}
 			}
-
-			uint16_t lightIndex = visibleLight.index;
-			const LightComponent& light = vis.scene->lights[lightIndex];
-			
-			bool shadow = light.IsCastingShadow() && !light.IsStatic();
-			if (!shadow)
+			for (uint32_t viewIndex : culling.sphere_views)
 			{
-				continue;
+				if (culling.views[viewIndex].boundingsphere.intersects(aabb))
+				{
+					accept(viewIndex);
+				}
 			}
+		}
+	});
+	ap::jobsystem::Wait(ctx);
 
-			switch (light.GetType())
-			{
-			case LightComponent::DIRECTIONAL:
-			{
-				if (shadowCounter_2D >= SHADOWCOUNT_2D - CASCADE_COUNT + 1)
-					break;
-				uint32_t slice = shadowCounter_2D;
-				shadowCounter_2D += CASCADE_COUNT;
+	// Turn the group counts into write offsets, the batches of each view are contiguous:
+	uint32_t batch_count = 0;
+	for (uint32_t viewIndex = 0; viewIndex < view_count; ++viewIndex)
+	{
+		ShadowView& view = culling.views[viewIndex];
+		view.batchOffset = batch_count;
+		view.transparentShadowsRequested = false;
+		for (uint32_t group = 0; group < group_count; ++group)
+		{
+			const size_t index = size_t(group) * view_count + viewIndex;
+			const uint32_t count = culling.group_offsets[index];
+			culling.group_offsets[index] = batch_count;
+			batch_count += count;
+			view.transparentShadowsRequested |= culling.group_transparent[index] != 0;
+		}
+		view.renderQueue.batchCount = batch_count - view.batchOffset;
+	}
+	culling.batches.resize(batch_count);
+	for (auto& view : culling.views)
+	{
+		view.renderQueue.batchArray = view.renderQueue.batchCount > 0 ? culling.batches.data() + view.batchOffset : nullptr;
+	}
 
-				std::array<SHCAM, CASCADE_COUNT> shcams;
-				CreateDirLightShadowCams(light, *vis.camera, shcams);
+	// Pass 2: write the batches of every object group to their final place:
+	if (batch_count > 0)
+	{
+		ap::jobsystem::Dispatch(ctx, group_count, 1, [&](ap::jobsystem::JobArgs args) {
+			const uint32_t group = args.jobIndex;
+			uint32_t* offsets = culling.group_offsets.data() + size_t(group) * view_count;
 
-				for (uint32_t cascade = 0; cascade < CASCADE_COUNT; ++cascade)
+			const uint32_t first = group * SHADOWCULLING_GROUPSIZE;
+			const uint32_t last = std::min(first + SHADOWCULLING_GROUPSIZE, object_count);
+			for (uint32_t i = first; i < last; ++i)
+			{
+				const uint64_t* mask = culling.object_masks.data() + size_t(i) * view_words;
+				size_t meshIndex = ~0ull;
+				uint64_t sortKey = 0;
+				for (uint32_t viewIndex = 0; viewIndex < view_count; ++viewIndex)
 				{
-					RenderQueue renderQueue;
-					bool transparentShadowsRequested = false;
-					for (size_t i = 0; i < vis.scene->aabb_objects.GetCount(); ++i)
+					if ((mask[viewIndex / 64] & (1ull << (viewIndex % 64))) == 0)
+						continue;
+					if (meshIndex == ~0ull)
 					{
-						const AABB& aabb = vis.scene->aabb_objects[i];
-						if ((aabb.layerMask & vis.layerMask) && shcams[cascade].frustum.CheckBoxFast(aabb))
-						{
-							const ObjectComponent& object = vis.scene->objects[i];
-							if (object.IsRenderable() && object.IsCastingShadow() && (cascade < (CASCADE_COUNT - object.cascadeMask)))
-							{
-								Entity cullable_entity = vis.scene->aabb_objects.GetEntity(i);
+						meshIndex = vis.scene->meshes.GetIndex(vis.scene->objects[i].meshID);
+						uint32_t bucket;
+						uint32_t material;
+						GetMeshSortFields(*vis.scene, meshIndex, bucket, material);
+						sortKey = RENDERBATCHKEY_STATE.Build(bucket, material, (uint32_t)meshIndex, 0);
+					}
+					culling.batches[offsets[viewIndex]++].Create(meshIndex, i, 0, sortKey);
+				}
+			}
+		});
+		ap::jobsystem::Wait(ctx);
+	}
 
-								RenderBatch* batch = (RenderBatch*)GetRenderFrameAllocator(cmd).allocate(sizeof(RenderBatch));
-								size_t meshIndex = vis.scene->meshes.GetIndex(object.meshID);
-								batch->Create(meshIndex, i, 0);
-								renderQueue.add(batch);
+	ap::profiler::EndRange(range);
+}
+void CullShadowViews(
+	const Visibility& vis,
+	const ShadowCullingView* views,
+	uint32_t view_count,
+	ap::vector<uint32_t>* object_indices,
+	bool* transparent
+)
+{
+	ShadowCulling culling;
+	for (uint32_t viewIndex = 0; viewIndex < view_count; ++viewIndex)
+	{
+		ShadowView& view = culling.views.emplace_back();
+		view.type = views[viewIndex].type;
+		view.lightIndex = 0;
+		view.slice = 0;
+		view.cascade = views[viewIndex].cascade;
+		view.shcam.frustum = views[viewIndex].frustum;
+		view.boundingsphere = views[viewIndex].sphere;
+	}
+	CullShadowViews(vis, culling);
 
-								if (object.GetRenderTypes() & RENDERTYPE_TRANSPARENT || object.GetRenderTypes() & RENDERTYPE_WATER)
-								{
-									transparentShadowsRequested = true;
-								}
-							}
-						}
-					}
+	for (uint32_t viewIndex = 0; viewIndex < view_count; ++viewIndex)
+	{
+		const ShadowView& view = culling.views[viewIndex];
+		object_indices[viewIndex].clear();
+		for (uint32_t i = 0; i < view.renderQueue.batchCount; ++i)
+		{
+			object_indices[viewIndex].push_back(view.renderQueue.batchArray[i].GetInstanceIndex());
+		}
+		if (transparent != nullptr)
+		{
+			transparent[viewIndex] = view.transparentShadowsRequested;
+		}
+	}
+}
+// Records the shadow map of one culled shadow view
+void DrawShadowView(
+	const Visibility& vis,
+	ShadowView& view,
+	const BoundingFrustum& cam_frustum,
+	bool predicationRequest,
+	CommandList cmd
+)
+{
+	const LightComponent& light = vis.scene->lights[view.lightIndex];
 
-					device->RenderPassBegin(&renderpasses_shadow2D[slice + cascade], cmd);
-					if (!renderQueue.empty())
-					{
-						CameraCB cb;
-						XMStoreFloat4x4(&cb.view_projection, shcams[cascade].view_projection);
-						device->BindDynamicConstantBuffer(cb, CBSLOT_RENDERER_CAMERA, cmd);
-
-						Viewport vp;
-						vp.top_left_x = 0;
-						vp.top_left_y = 0;
-						vp.width = (float)SHADOWRES_2D;
-						vp.height = (float)SHADOWRES_2D;
-						vp.min_depth = 0.0f;
-						vp.max_depth = 1.0f;
-						device->BindViewports(1, &vp, cmd);
-
-						RenderMeshes(vis, renderQueue, RENDERPASS_SHADOW, RENDERTYPE_OPAQUE, cmd);
-						if (GetTransparentShadowsEnabled() && transparentShadowsRequested)
-						{
-							RenderMeshes(vis, renderQueue, RENDERPASS_SHADOW, RENDERTYPE_TRANSPARENT | RENDERTYPE_WATER, cmd);
-						}
+	// The shadow casters are culled in object order, sorting groups them by mesh for instancing and by state for fewer pipeline changes:
+	view.renderQueue.sort(RenderQueue::SORT_FRONT_TO_BACK, cmd);
+	const RenderQueue& renderQueue = view.renderQueue;
 
-						GetRenderFrameAllocator(cmd).free(sizeof(RenderBatch) * renderQueue.batchCount);
-					}
-					device->RenderPassEnd(cmd);
+	switch (view.type)
+	{
+	case LightComponent::DIRECTIONAL:
+	{
+		device->RenderPassBegin(&renderpasses_shadow2D[view.slice], cmd);
+		if (!renderQueue.empty())
+		{
+			CameraCB cb;
+			XMStoreFloat4x4(&cb.view_projection, view.shcam.view_projection);
+			device->BindDynamicConstantBuffer(cb, CBSLOT_RENDERER_CAMERA, cmd);
 
-				}
-			}
-			break;
-			case LightComponent::SPOT:
+			Viewport vp;
+			vp.top_left_x = 0;
+			vp.top_left_y = 0;
+			vp.width = (float)SHADOWRES_2D;
+			vp.height = (float)SHADOWRES_2D;
+			vp.min_depth = 0.0f;
+			vp.max_depth = 1.0f;
+			device->BindViewports(1, &vp, cmd);
+
+			RenderMeshes(vis, renderQueue, RENDERPASS_SHADOW, RENDERTYPE_OPAQUE, cmd);
+			if (GetTransparentShadowsEnabled() && view.transparentShadowsRequested)
 			{
-				if (shadowCounter_2D >= SHADOWCOUNT_2D)
-					break;
-				uint32_t slice = shadowCounter_2D;
-				shadowCounter_2D += 1;
+				RenderMeshes(vis, renderQueue, RENDERPASS_SHADOW, RENDERTYPE_TRANSPARENT | RENDERTYPE_WATER, cmd);
+			}
+		}
+		device->RenderPassEnd(cmd);
+	}
+	break;
+	case LightComponent::SPOT:
+	{
+		if (!renderQueue.empty())
+		{
+			if (predicationRequest && light.occlusionquery >= 0)
+				device->PredicationBegin(
+					&vis.scene->queryPredicationBuffer,
+					(uint64_t)light.occlusionquery * sizeof(uint64_t),
+					PredicationOp::EQUAL_ZERO,
+					cmd
+				);
 
-				SHCAM shcam;
-				CreateSpotLightShadowCam(light, shcam);
-				if (!cam_frustum.Intersects(shcam.boundingfrustum))
-					break;
+			CameraCB cb;
+			XMStoreFloat4x4(&cb.view_projection, view.shcam.view_projection);
+			device->BindDynamicConstantBuffer(cb, CBSLOT_RENDERER_CAMERA, cmd);
 
-				RenderQueue renderQueue;
-				bool transparentShadowsRequested = false;
-				for (size_t i = 0; i < vis.scene->aabb_objects.GetCount(); ++i)
-				{
-					const AABB& aabb = vis.scene->aabb_objects[i];
-					if ((aabb.layerMask & vis.layerMask) && shcam.frustum.CheckBoxFast(aabb))
-					{
-						const ObjectComponent& object = vis.scene->objects[i];
-						if (object.IsRenderable() && object.IsCastingShadow())
-						{
-							Entity cullable_entity = vis.scene->aabb_objects.GetEntity(i);
+			Viewport vp;
+			vp.top_left_x = 0;
+			vp.top_left_y = 0;
+			vp.width = (float)SHADOWRES_2D;
+			vp.height = (float)SHADOWRES_2D;
+			vp.min_depth = 0.0f;
+			vp.max_depth = 1.0f;
+			device->BindViewports(1, &vp, cmd);
 
-							RenderBatch* batch = (RenderBatch*)GetRenderFrameAllocator(cmd).allocate(sizeof(RenderBatch));
-							size_t meshIndex = vis.scene->meshes.GetIndex(object.meshID);
-							batch->Create(meshIndex, i, 0);
-							renderQueue.add(batch);
+			device->RenderPassBegin(&renderpasses_shadow2D[view.slice], cmd);
+			RenderMeshes(vis, renderQueue, RENDERPASS_SHADOW, RENDERTYPE_OPAQUE, cmd);
+			if (GetTransparentShadowsEnabled() && view.transparentShadowsRequested)
+			{
+				RenderMeshes(vis, renderQueue, RENDERPASS_SHADOW, RENDERTYPE_TRANSPARENT | RENDERTYPE_WATER, cmd);
+			}
+			device->RenderPassEnd(cmd);
 
-							if (object.GetRenderTypes() & RENDERTYPE_TRANSPARENT || object.GetRenderTypes() & RENDERTYPE_WATER)
-							{
-								transparentShadowsRequested = true;
-							}
-						}
-					}
-				}
-				if (!renderQueue.empty())
-				{
-					if (predicationRequest && light.occlusionquery >= 0)
-						device->PredicationBegin(
-							&vis.scene->queryPredicationBuffer,
-							(uint64_t)light.occlusionquery * sizeof(uint64_t),
-							PredicationOp::EQUAL_ZERO,
-							cmd
-						);
+			if (predicationRequest && light.occlusionquery >= 0)
+				device->PredicationEnd(cmd);
+		}
 
-					CameraCB cb;
-					XMStoreFloat4x4(&cb.view_projection, shcam.view_projection);
-					device->BindDynamicConstantBuffer(cb, CBSLOT_RENDERER_CAMERA, cmd);
-
-					Viewport vp;
-					vp.top_left_x = 0;
-					vp.top_left_y = 0;
-					vp.width = (float)SHADOWRES_2D;
-					vp.height = (float)SHADOWRES_2D;
-					vp.min_depth = 0.0f;
-					vp.max_depth = 1.0f;
-					device->BindViewports(1, &vp, cmd);
-
-					device->RenderPassBegin(&renderpasses_shadow2D[slice], cmd);
-					RenderMeshes(vis, renderQueue, RENDERPASS_SHADOW, RENDERTYPE_OPAQUE, cmd);
-					if (GetTransparentShadowsEnabled() && transparentShadowsRequested)
-					{
-						RenderMeshes(vis, renderQueue, RENDERPASS_SHADOW, RENDERTYPE_TRANSPARENT | RENDERTYPE_WATER, cmd);
-					}
-					device->RenderPassEnd(cmd);
+	}
+	break;
+	case LightComponent::POINT:
+	{
+		if (!renderQueue.empty())
+		{
+			if (predicationRequest && light.occlusionquery >= 0)
+				device->PredicationBegin(
+					&vis.scene->queryPredicationBuffer,
+					(uint64_t)light.occlusionquery * sizeof(uint64_t),
+					PredicationOp::EQUAL_ZERO,
+					cmd
+				);
 
-					GetRenderFrameAllocator(cmd).free(sizeof(RenderBatch) * renderQueue.batchCount);
+			const float zNearP = 0.1f;
+			const float zFarP = std::max(1.0f, light.GetRange());
+			SHCAM cameras[] = {
+				SHCAM(light.position, XMFLOAT4(0.5f, -0.5f, -0.5f, -0.5f), zNearP, zFarP, XM_PIDIV2), //+x
+				SHCAM(light.position, XMFLOAT4(0.5f, 0.5f, 0.5f, -0.5f), zNearP, zFarP, XM_PIDIV2), //-x
+				SHCAM(light.position, XMFLOAT4(1, 0, 0, -0), zNearP, zFarP, XM_PIDIV2), //+y
+				SHCAM(light.position, XMFLOAT4(0, 0, 0, -1), zNearP, zFarP, XM_PIDIV2), //-y
+				SHCAM(light.position, XMFLOAT4(0.707f, 0, 0, -0.707f), zNearP, zFarP, XM_PIDIV2), //+z
+				SHCAM(light.position, XMFLOAT4(0, 0.707f, 0.707f, 0), zNearP, zFarP, XM_PIDIV2), //-z
+			};
+			Frustum frusta[arraysize(cameras)];
+			uint32_t frustum_count = 0;
 
-					if (predicationRequest && light.occlusionquery >= 0)
-						device->PredicationEnd(cmd);
+			CubemapRenderCB cb;
+			for (uint32_t shcam = 0; shcam < arraysize(cameras); ++shcam)
+			{
+				if (cam_frustum.Intersects(cameras[shcam].boundingfrustum))
+				{
+					XMStoreFloat4x4(&cb.xCubemapRenderCams[frustum_count].view_projection, cameras[shcam].view_projection);
+					cb.xCubemapRenderCams[frustum_count].properties = uint4(shcam, 0, 0, 0);
+					frusta[frustum_count] = cameras[shcam].frustum;
+					frustum_count++;
 				}
-
 			}
-			break;
-			case LightComponent::POINT:
+			device->BindDynamicConstantBuffer(cb, CB_GETBINDSLOT(CubemapRenderCB), cmd);
+
+			Viewport vp;
+			vp.top_left_x = 0;
+			vp.top_left_y = 0;
+			vp.width = (float)SHADOWRES_CUBE;
+			vp.height = (float)SHADOWRES_CUBE;
+			vp.min_depth = 0.0f;
+			vp.max_depth = 1.0f;
+			device->BindViewports(1, &vp, cmd);
+
+			device->RenderPassBegin(&renderpasses_shadowCube[view.slice], cmd);
+			RenderMeshes(vis, renderQueue, RENDERPASS_SHADOWCUBE, RENDERTYPE_OPAQUE, cmd, false, frusta, frustum_count);
+			if (GetTransparentShadowsEnabled() && view.transparentShadowsRequested)
 			{
-				if (shadowCounter_Cube >= SHADOWCOUNT_CUBE)
-					break;
-				uint32_t slice = shadowCounter_Cube;
-				shadowCounter_Cube += 1;
+				RenderMeshes(vis, renderQueue, RENDERPASS_SHADOWCUBE, RENDERTYPE_TRANSPARENT | RENDERTYPE_WATER, cmd, false, frusta, frustum_count);
+			}
+			device->RenderPassEnd(cmd);
 
-				Sphere boundingsphere(light.position, light.GetRange());
+			if (predicationRequest && light.occlusionquery >= 0)
+				device->PredicationEnd(cmd);
+		}
 
-				RenderQueue renderQueue;
-				bool transparentShadowsRequested = false;
-				for (size_t i = 0; i < vis.scene->aabb_objects.GetCount(); ++i)
-				{
-					const AABB& aabb = vis.scene->aabb_objects[i];
-					if ((aabb.layerMask & vis.layerMask) && boundingsphere.intersects(aabb))
-					{
-						const ObjectComponent& object = vis.scene->objects[i];
-						if (object.IsRenderable() && object.IsCastingShadow())
-						{
-							Entity cullable_entity = vis.scene->aabb_objects.GetEntity(i);
+	}
+	break;
+	default:
+		break;
+	} // terminate switch
+}
+void DrawShadowmaps(
+	const Visibility& vis,
+	CommandList cmd
+)
+{
+	DrawShadowmaps(vis, &cmd, 1);
+}
+void DrawShadowmaps(
+	const Visibility& vis,
+	const CommandList* cmds,
+	uint32_t cmd_count
+)
+{
+	if (IsWireRender())
+		return;
 
-							RenderBatch* batch = (RenderBatch*)GetRenderFrameAllocator(cmd).allocate(sizeof(RenderBatch));
-							size_t meshIndex = vis.scene->meshes.GetIndex(object.meshID);
-							batch->Create(meshIndex, i, 0);
-							renderQueue.add(batch);
+	if (vis.visibleLights.empty() || cmd_count == 0)
+		return;
 
-							if (object.GetRenderTypes() & RENDERTYPE_TRANSPARENT || object.GetRenderTypes() & RENDERTYPE_WATER)
-							{
-								transparentShadowsRequested = true;
-							}
-						}
-					}
-				}
-				if (!renderQueue.empty())
-				{
-					if (predicationRequest && light.occlusionquery >= 0)
-						device->PredicationBegin(
-							&vis.scene->queryPredicationBuffer,
-							(uint64_t)light.occlusionquery * sizeof(uint64_t),
-							PredicationOp::EQUAL_ZERO,
-							cmd
-						);
+	const bool predicationRequest =
+		device->CheckCapability(GraphicsDeviceCapability::PREDICATION) &&
+		GetOcclusionCullingEnabled();
 
-					const float zNearP = 0.1f;
-					const float zFarP = std::max(1.0f, light.GetRange());
-					SHCAM cameras[] = {
-						SHCAM(light.position, XMFLOAT4(0.5f, -0.5f, -0.5f, -0.5f), zNearP, zFarP, XM_PIDIV2), //+x
-						SHCAM(light.position, XMFLOAT4(0.5f, 0.5f, 0.5f, -0.5f), zNearP, zFarP, XM_PIDIV2), //-x
-						SHCAM(light.position, XMFLOAT4(1, 0, 0, -0), zNearP, zFarP, XM_PIDIV2), //+y
-						SHCAM(light.position, XMFLOAT4(0, 0, 0, -1), zNearP, zFarP, XM_PIDIV2), //-y
-						SHCAM(light.position, XMFLOAT4(0.707f, 0, 0, -0.707f), zNearP, zFarP, XM_PIDIV2), //+z
-						SHCAM(light.position, XMFLOAT4(0, 0.707f, 0.707f, 0), zNearP, zFarP, XM_PIDIV2), //-z
-					};
-					Frustum frusta[arraysize(cameras)];
-					uint32_t frustum_count = 0;
+	BoundingFrustum cam_frustum;
+	BoundingFrustum::CreateFromMatrix(cam_frustum, vis.camera->GetProjection());
+	std::swap(cam_frustum.Near, cam_frustum.Far);
+	cam_frustum.Transform(cam_frustum, vis.camera->GetInvView());
+	XMStoreFloat4(&cam_frustum.Orientation, XMQuaternionNormalize(XMLoadFloat4(&cam_frustum.Orientation)));
 
-					CubemapRenderCB cb;
-					for (uint32_t shcam = 0; shcam < arraysize(cameras); ++shcam)
-					{
-						if (cam_frustum.Intersects(cameras[shcam].boundingfrustum))
-						{
-							XMStoreFloat4x4(&cb.xCubemapRenderCams[frustum_count].view_projection, cameras[shcam].view_projection);
-							cb.xCubemapRenderCams[frustum_count].properties = uint4(shcam, 0, 0, 0);
-							frusta[frustum_count] = cameras[shcam].frustum;
-							frustum_count++;
-						}
-					}
-					device->BindDynamicConstantBuffer(cb, CB_GETBINDSLOT(CubemapRenderCB), cmd);
-
-					Viewport vp;
-					vp.top_left_x = 0;
-					vp.top_left_y = 0;
-					vp.width = (float)SHADOWRES_CUBE;
-					vp.height = (float)SHADOWRES_CUBE;
-					vp.min_depth = 0.0f;
-					vp.max_depth = 1.0f;
-					device->BindViewports(1, &vp, cmd);
-
-					device->RenderPassBegin(&renderpasses_shadowCube[slice], cmd);
-					RenderMeshes(vis, renderQueue, RENDERPASS_SHADOWCUBE, RENDERTYPE_OPAQUE, cmd, false, frusta, frustum_count);
-					if (GetTransparentShadowsEnabled() && transparentShadowsRequested)
-					{
-						RenderMeshes(vis, renderQueue, RENDERPASS_SHADOWCUBE, RENDERTYPE_TRANSPARENT | RENDERTYPE_WATER, cmd, false, frusta, frustum_count);
-					}
-					device->RenderPassEnd(cmd);
+	uint32_t shadowCounter_2D = SHADOWRES_2D > 0 ? 0 : SHADOWCOUNT_2D;
+	uint32_t shadowCounter_Cube = SHADOWRES_CUBE > 0 ? 0 : SHADOWCOUNT_CUBE;
 
-					GetRenderFrameAllocator(cmd).free(sizeof(RenderBatch) * renderQueue.batchCount);
+	// Gather all the shadow views first, so that they can be culled together:
+	ShadowCulling& culling = shadowCulling[cmds[0]];
+	culling.views.clear();
+	for (const auto& visibleLight : vis.visibleLights)
+	{
+		if (shadowCounter_2D >= SHADOWCOUNT_2D && shadowCounter_Cube >= SHADOWCOUNT_CUBE)
+		{
+			break;
+		}
 
-					if (predicationRequest && light.occlusionquery >= 0)
-						device->PredicationEnd(cmd);
-				}
+		uint16_t lightIndex = visibleLight.index;
+		const LightComponent& light = vis.scene->lights[lightIndex];
+		
+		bool shadow = light.IsCastingShadow() && !light.IsStatic();
+		if (!shadow)
+		{
+			continue;
+		}
 
+		switch (light.GetType())
+		{
+		case LightComponent::DIRECTIONAL:
+		{
+			if (shadowCounter_2D >= SHADOWCOUNT_2D - CASCADE_COUNT + 1)
+				break;
+			uint32_t slice = shadowCounter_2D;
+			shadowCounter_2D += CASCADE_COUNT;
+
+			std::array<SHCAM, CASCADE_COUNT> shcams;
+			CreateDirLightShadowCams(light, *vis.camera, shcams);
+
+			for (uint32_t cascade = 0; cascade < CASCADE_COUNT; ++cascade)
+			{
+				ShadowView& view = culling.views.emplace_back();
+				view.type = LightComponent::DIRECTIONAL;
+				view.lightIndex = lightIndex;
+				view.slice = slice + cascade;
+				view.cascade = cascade;
+				view.shcam = shcams[cascade];
 			}
-			break;
-			} // terminate switch
+		}
+		break;
+		case LightComponent::SPOT:
+		{
+			if (shadowCounter_2D >= SHADOWCOUNT_2D)
+				break;
+			uint32_t slice = shadowCounter_2D;
+			shadowCounter_2D += 1;
+
+			SHCAM shcam;
+			CreateSpotLightShadowCam(light, shcam);
+			if (!cam_frustum.Intersects(shcam.boundingfrustum))
+				break;
+
+			ShadowView& view = culling.views.emplace_back();
+			view.type = LightComponent::SPOT;
+			view.lightIndex = lightIndex;
+			view.slice = slice;
+			view.cascade = 0;
+			view.shcam = shcam;
+		}
+		break;
+		case LightComponent::POINT:
+		{
+			if (shadowCounter_Cube >= SHADOWCOUNT_CUBE)
+				break;
+			uint32_t slice = shadowCounter_Cube;
+			shadowCounter_Cube += 1;
+
+			ShadowView& view = culling.views.emplace_back();
+			view.type = LightComponent::POINT;
+			view.lightIndex = lightIndex;
+			view.slice = slice;
+			view.cascade = 0;
+			view.boundingsphere = Sphere(light.position, light.GetRange());
+		}
+		break;
+		} // terminate switch
+	}
+
+	if (!culling.views.empty())
+	{
+		CullShadowViews(vis, culling);
+	}
+
+	// The views are split into contiguous ranges with about the same amount of batches, one range is recorded into each command list:
+	//	Every view begins its own render pass on its own shadow map slice, so the ranges don't depend on each other
+	//	The command lists were begun in order by the caller, so the views are still submitted in the gathered order
+	uint32_t batch_count = 0;
+	for (const ShadowView& view : culling.views)
+	{
+		batch_count += view.renderQueue.batchCount;
+	}
+	uint32_t chunk_count = std::min(cmd_count, (uint32_t)culling.views.size());
+	chunk_count = std::min(chunk_count, std::max(1u, batch_count / SHADOWRECORDING_MIN_BATCHES));
+	chunk_count = std::max(1u, chunk_count);
+	uint32_t chunk_begin[COMMANDLIST_COUNT + 1] = {};
+	uint32_t chunk = 0;
+	uint32_t accumulated = 0;
+	for (uint32_t viewIndex = 0; viewIndex < (uint32_t)culling.views.size() && chunk + 1 < chunk_count; ++viewIndex)
+	{
+		accumulated += culling.views[viewIndex].renderQueue.batchCount;
+		if (uint64_t(accumulated) * chunk_count >= uint64_t(batch_count) * (chunk + 1))
+		{
+			chunk_begin[++chunk] = viewIndex + 1;
+		}
+	}
+	while (chunk < chunk_count)
+	{
+		chunk_begin[++chunk] = (uint32_t)culling.views.size();
+	}
+
+	auto record_chunk = [&](uint32_t chunkIndex) {
+		const CommandList cmd = cmds[chunkIndex];
+		device->EventBegin("DrawShadowmaps", cmd);
+		auto range = ap::profiler::BeginRangeGPU("Shadow Rendering", cmd);
+
+		BindCommonResources(cmd);
+
+		for (uint32_t viewIndex = chunk_begin[chunkIndex]; viewIndex < chunk_begin[chunkIndex + 1]; ++viewIndex)
+		{
+			DrawShadowView(vis, culling.views[viewIndex], cam_frustum, predicationRequest, cmd);
 		}
 
 		ap::profiler::EndRange(range); // Shadow Rendering
 		device->EventEnd(cmd);
+	};
+
+	if (chunk_count > 1)
+	{
+		ap::jobsystem::context ctx;
+		ap::jobsystem::Dispatch(ctx, chunk_count, 1, [&](ap::jobsystem::JobArgs args) {
+			record_chunk(args.jobIndex);
+		});
+		ap::jobsystem::Wait(ctx);
+	}
+	else
+	{
+		record_chunk(0);
 	}
 }
 
@@ -4930,6 +5409,7 @@ void DrawScene(
 		renderTypeFlags = RENDERTYPE_ALL;
 	}
 
+	const RenderBatchKey& sortKey = transparent ? RENDERBATCHKEY_TRANSPARENT : RENDERBATCHKEY_OPAQUE;
 	RenderQueue renderQueue;
 	for (uint32_t instanceIndex : vis.visibleObjects)
 	{
@@ -4947,13 +5427,16 @@ void DrawScene(
 			}
 			RenderBatch* batch = (RenderBatch*)GetRenderFrameAllocator(cmd).allocate(sizeof(RenderBatch));
 			size_t meshIndex = vis.scene->meshes.GetIndex(object.meshID);
-			batch->Create(meshIndex, instanceIndex, distance);
+			uint32_t bucket;
+			uint32_t material;
+			GetMeshSortFields(*vis.scene, meshIndex, bucket, material);
+			batch->Create(meshIndex, instanceIndex, distance, sortKey.Build(bucket, material, (uint32_t)meshIndex, distance));
 			renderQueue.add(batch);
 		}
 	}
 	if (!renderQueue.empty())
 	{
-		renderQueue.sort(transparent ? RenderQueue::SORT_BACK_TO_FRONT : RenderQueue::SORT_FRONT_TO_BACK);
+		renderQueue.sort(transparent ? RenderQueue::SORT_BACK_TO_FRONT : RenderQueue::SORT_FRONT_TO_BACK, cmd);
 		RenderMeshes(vis, renderQueue, renderPass, renderTypeFlags, cmd, tessellation);
 
 		GetRenderFrameAllocator(cmd).free(sizeof(RenderBatch) * renderQueue.batchCount);
@@ -11754,6 +12237,8 @@ void SetOcclusionCullingEnabled(bool value)
 	occlusionCulling = value;
 }
 bool GetOcclusionCullingEnabled() { return occlusionCulling; }
+void SetSoftwareOcclusionCullingEnabled(bool enabled) { softwareOcclusionCulling = enabled; }
+bool GetSoftwareOcclusionCullingEnabled() { return softwareOcclusionCulling; }
 void SetTemporalAAEnabled(bool enabled) { temporalAA = enabled; }
 bool GetTemporalAAEnabled() { return temporalAA; }
 void SetTemporalAADebugEnabled(bool enabled) { temporalAADEBUG = enabled; }
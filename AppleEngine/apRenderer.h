@@ -9,6 +9,7 @@
 #include "apMath.h"
 #include "shaders/ShaderInterop_Renderer.h"
 #include "apVector.h"
+#include "apOcclusionBuffer.h"
 
 #include <memory>
 #include <limits>
@@ -92,6 +93,7 @@ namespace ap::renderer
 			ALLOW_HAIRS = 1 << 5,
 			ALLOW_REQUEST_REFLECTION = 1 << 6,
 			ALLOW_OCCLUSION_CULLING = 1 << 7,
+			ALLOW_SOFTWARE_OCCLUSION_CULLING = 1 << 8,
 
 			ALLOW_EVERYTHING = ~0u
 		};
@@ -113,6 +115,10 @@ namespace ap::renderer
 		};
 		ap::vector<VisibleLight> visibleLights;
 
+		// Software occlusion culling, this keeps its contents while the culling camera is frozen:
+		ap::OcclusionBuffer occlusion_buffer;
+		ap::vector<ap::OcclusionBuffer::Occluder> occluders;
+
 		std::atomic<uint32_t> object_counter;
 		std::atomic<uint32_t> light_counter;
 		std::atomic<uint32_t> decal_counter;
@@ -222,6 +228,32 @@ namespace ap::renderer
 		const Visibility& vis,
 		ap::graphics::CommandList cmd
 	);
+	// Draw shadow maps recorded in parallel into multiple command lists
+	//	The shadow views are split into contiguous ranges in order, the command lists must be begun in the same order that they are given
+	//	Command lists that are not needed (not enough views or batches to split) are left empty
+	void DrawShadowmaps(
+		const Visibility& vis,
+		const ap::graphics::CommandList* cmds,
+		uint32_t cmd_count
+	);
+	// A shadow view that is culled by CullShadowViews(): directional cascades and spot lights use the frustum, point lights the sphere
+	struct ShadowCullingView
+	{
+		ap::scene::LightComponent::LightType type = ap::scene::LightComponent::DIRECTIONAL;
+		uint32_t cascade = 0; // the objects skip cascades with their ObjectComponent::cascadeMask
+		ap::primitive::Frustum frustum;
+		ap::primitive::Sphere sphere;
+	};
+	// Culls the objects against the shadow views exactly like DrawShadowmaps() does, without drawing anything
+	//	object_indices receives the objects that would be drawn into every view, in object order (the render queues are sorted later when they are drawn)
+	//	transparent receives whether any transparent object would be drawn into every view, if it's not nullptr
+	void CullShadowViews(
+		const Visibility& vis,
+		const ShadowCullingView* views,
+		uint32_t view_count,
+		ap::vector<uint32_t>* object_indices,
+		bool* transparent = nullptr
+	);
 	// Draw debug world. You must also enable what parts to draw, eg. SetToDrawGridHelper, etc, see implementation for details what can be enabled.
 	void DrawDebugWorld(
 		const ap::scene::Scene& scene,
@@ -730,6 +762,9 @@ namespace ap::renderer
 	bool GetVariableRateShadingClassificationDebug();
 	void SetOcclusionCullingEnabled(bool enabled);
 	bool GetOcclusionCullingEnabled();
+	// Objects that are hidden by the occluder objects on the CPU are culled in UpdateVisibility(), without the latency of GPU queries
+	void SetSoftwareOcclusionCullingEnabled(bool enabled);
+	bool GetSoftwareOcclusionCullingEnabled();
 	void SetTemporalAAEnabled(bool enabled);
 	bool GetTemporalAAEnabled();
 	void SetTemporalAADebugEnabled(bool enabled);
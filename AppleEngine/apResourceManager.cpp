@@ -3,6 +3,7 @@
 #include "apHelper.h"
 #include "apTextureHelper.h"
 #include "apUnorderedMap.h"
+#include "apEventHandler.h"
 
 #include "Utility/stb_image.h"
 #include "Utility/tinyddsloader.h"
@@ -10,7 +11,11 @@
 extern basist::etc1_global_selector_codebook g_basis_global_codebook;
 
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
 #include <mutex>
+#include <thread>
 
 using namespace ap::graphics;
 
@@ -22,6 +27,38 @@ namespace ap
 		ap::graphics::Texture texture;
 		ap::audio::Sound sound;
 		ap::vector<uint8_t> filedata;
+
+		// The contents above can only be accessed by other threads once the state is LOAD_SUCCEEDED
+		enum LOAD_STATE
+		{
+			LOAD_QUEUED, // LoadAsync() scheduled the load, but no thread started it yet
+			LOAD_RUNNING,
+			LOAD_SUCCEEDED,
+			LOAD_FAILED,
+		};
+		std::atomic<uint32_t> state{ LOAD_SUCCEEDED };
+		std::string name; // the file name of a queued load, so that any thread can take it over
+		std::mutex callback_locker;
+		ap::vector<std::function<void(Resource)>> callbacks; // LoadAsync() callbacks waiting for the load to finish
+
+		// Texture streaming, only used for images loaded with IMPORT_STREAMING:
+		enum STREAMING_STATE
+		{
+			STREAMING_IDLE,
+			STREAMING_RUNNING, // a job is creating streaming_texture
+			STREAMING_DONE, // streaming_texture can be swapped in by the main thread
+		};
+		bool streaming = false;
+		uint32_t streaming_width = 0;
+		uint32_t streaming_height = 0;
+		resourcemanager::StreamingResidency residency;
+		uint32_t resident_mip = 0; // the full resolution mip that is the top mip of texture
+		uint32_t unrequested_frames = 0; // frames since a less detailed mip is requested than residency.requested_mip
+		std::atomic<uint32_t> requested_mip{ ~0u }; // the most detailed mip requested since the last UpdateStreamingResources()
+		std::atomic<uint32_t> streaming_state{ STREAMING_IDLE };
+		ap::graphics::Texture streaming_texture;
+		uint32_t streaming_texture_mip = 0;
+		ap::vector<uint8_t> streaming_filedata; // file data kept for streaming when it is not retained
 	};
 
 	const ap::vector<uint8_t>& Resource::GetFileData() const
@@ -82,6 +119,11 @@ namespace ap
 		static std::mutex locker;
 		static ap::unordered_map<std::string, std::weak_ptr<ResourceInternal>> resources;
 		static Mode mode = Mode::DISCARD_FILEDATA_AFTER_LOAD;
+		static bool texture_streaming_enabled = true;
+		static uint64_t texture_streaming_budget = 1024ull * 1024ull * 1024ull;
+		static std::mutex streaming_locker;
+		static ap::vector<std::weak_ptr<ResourceInternal>> streaming_resources;
+		static std::string texture_cache_directory;
 
 		void SetMode(Mode param)
 		{
@@ -134,564 +176,1417 @@ namespace ap
 			return ret;
 		}
 
-		Resource Load(const std::string& name, Flags flags, const uint8_t* filedata, size_t filesize)
+		// Mip streaming parameters of an image, used by CreateImage()
+		struct StreamingInfo
 		{
-			if (mode == Mode::DISCARD_FILEDATA_AFTER_LOAD)
-			{
-				flags &= ~Flags::IMPORT_RETAIN_FILEDATA;
-			}
-
-			locker.lock();
-			std::weak_ptr<ResourceInternal>& weak_resource = resources[name];
-			std::shared_ptr<ResourceInternal> resource = weak_resource.lock();
+			uint32_t first_mip = ~0u;	// in: the top mip to create, ~0u selects the initial mip | out: the top mip that was created
+			bool streamable = false;	// out: the image can be streamed
+			uint32_t width = 0;			// out: full resolution width
+			uint32_t height = 0;		// out: full resolution height
+			uint32_t mip_count = 0;		// out: mip count of the full resolution image
+			uint32_t lowest_mip = 0;	// out: the least detailed mip that can be the top mip
+			uint64_t mip0_size = 0;		// out: memory size of the full resolution mip0
+		};
+		static constexpr uint32_t streaming_initial_resolution = 64; // streamed images are created from the mip with this resolution until they are requested
 
-			static bool basis_init = false; // within lock!
-			if (!basis_init)
+		// Selects the top mip of a streamed image and shrinks the texture desc accordingly, returns the first mip that must be created
+		static uint32_t SetupStreaming(TextureDesc& desc, StreamingInfo& info)
+		{
+			const uint32_t block_size = GetFormatBlockSize(desc.format);
+			info.streamable = true;
+			info.width = desc.width;
+			info.height = desc.height;
+			info.mip_count = desc.mip_levels;
+			info.mip0_size = uint64_t((desc.width + block_size - 1) / block_size) * uint64_t((desc.height + block_size - 1) / block_size) * GetFormatStride(desc.format);
+
+			// The top mip must not be smaller than the initial resolution, and mips of block compressed formats must remain block aligned:
+			info.lowest_mip = 0;
+			for (uint32_t mip = 1; mip < info.mip_count; ++mip)
 			{
-				basis_init = true;
-				basist::basisu_transcoder_init();
+				const uint32_t width = desc.width >> mip;
+				const uint32_t height = desc.height >> mip;
+				if (std::max(width, height) < streaming_initial_resolution || std::min(width, height) < block_size || (width % block_size) != 0 || (height % block_size) != 0)
+				{
+					break;
+				}
+				info.lowest_mip = mip;
 			}
 
-			if (resource == nullptr)
-			{
-				resource = std::make_shared<ResourceInternal>();
-				resources[name] = resource;
-				locker.unlock();
-			}
-			else
-			{
-				locker.unlock();
-				Resource retVal;
-				retVal.internal_state = resource;
-				return retVal;
-			}
+			info.first_mip = std::min(info.first_mip, info.lowest_mip);
+			desc.width >>= info.first_mip;
+			desc.height >>= info.first_mip;
+			desc.mip_levels -= info.first_mip;
+			return info.first_mip;
+		}
 
-			if (filedata == nullptr || filesize == 0)
+		// Image that was decoded or transcoded on the CPU, ready to be uploaded to the GPU
+		struct DecodedImage
+		{
+			TextureDesc desc; // the full resolution texture
+			ap::vector<SubresourceData> subresources; // all subresources of desc, the mips above first_mip are not decoded
+			uint32_t first_mip = 0; // the most detailed mip that was decoded
+			bool streamable = false; // single 2D image with a complete mip chain
+			ap::vector<uint8_t> storage; // owns the decoded data
+			std::shared_ptr<const void> external_storage; // owns the data that is not in storage, such as a decoder allocation or a mapped cache file
+		};
+
+		// Decodes KTX2, BASIS and the stb_image formats
+		//	streaming : if not null, only the mips from the streamed top mip are decoded, if the image is streamable (optional)
+		static bool DecodeImage(const std::string& ext, const uint8_t* filedata, size_t filesize, DecodedImage& image, StreamingInfo* streaming)
+		{
+			TextureDesc& desc = image.desc;
+			if (!ext.compare("KTX2"))
 			{
-				if (!ap::helper::FileRead(name, resource->filedata))
+				basist::ktx2_transcoder transcoder(&g_basis_global_codebook);
+				if (!transcoder.init(filedata, (uint32_t)filesize))
 				{
-					resource.reset();
-					return Resource();
+					return false;
+				}
+				desc.bind_flags = BindFlag::SHADER_RESOURCE;
+				desc.width = transcoder.get_width();
+				desc.height = transcoder.get_height();
+				desc.array_size = std::max(desc.array_size, transcoder.get_layers() * transcoder.get_faces());
+				desc.mip_levels = transcoder.get_levels();
+				if (transcoder.get_faces() == 6)
+				{
+					desc.misc_flags = ResourceMiscFlag::TEXTURECUBE;
 				}
-				filedata = resource->filedata.data();
-				filesize = resource->filedata.size();
-			}
-
-			std::string ext = ap::helper::toUpper(ap::helper::GetExtensionFromFileName(name));
-			DataType type;
 
-			// dynamic type selection:
-			{
-				auto it = types.find(ext);
-				if (it != types.end())
+				basist::transcoder_texture_format fmt;
+				if (transcoder.get_has_alpha())
 				{
-					type = it->second;
+					fmt = basist::transcoder_texture_format::cTFBC3_RGBA;
+					desc.format = Format::BC3_UNORM;
 				}
 				else
 				{
-					return Resource();
+					fmt = basist::transcoder_texture_format::cTFBC1_RGB;
+					desc.format = Format::BC1_UNORM;
 				}
-			}
-
-			bool success = false;
+				uint32_t bytes_per_block = basis_get_bytes_per_block_or_pixel(fmt);
 
-			switch (type)
-			{
-			case DataType::IMAGE:
-			{
-				GraphicsDevice* device = ap::graphics::GetDevice();
-				if (!ext.compare("KTX2"))
+				image.streamable = transcoder.get_layers() <= 1 && transcoder.get_faces() == 1;
+				if (streaming != nullptr && image.streamable)
 				{
-					basist::ktx2_transcoder transcoder(&g_basis_global_codebook);
-					if (transcoder.init(filedata, (uint32_t)filesize))
-					{
-						TextureDesc desc;
-						desc.bind_flags = BindFlag::SHADER_RESOURCE;
-						desc.width = transcoder.get_width();
-						desc.height = transcoder.get_height();
-						desc.array_size = std::max(desc.array_size, transcoder.get_layers() * transcoder.get_faces());
-						desc.mip_levels = transcoder.get_levels();
-						if (transcoder.get_faces() == 6)
-						{
-							desc.misc_flags = ResourceMiscFlag::TEXTURECUBE;
-						}
-
-						basist::transcoder_texture_format fmt;
-						if (transcoder.get_has_alpha())
-						{
-							fmt = basist::transcoder_texture_format::cTFBC3_RGBA;
-							desc.format = Format::BC3_UNORM;
-						}
-						else
-						{
-							fmt = basist::transcoder_texture_format::cTFBC1_RGB;
-							desc.format = Format::BC1_UNORM;
-						}
-						uint32_t bytes_per_block = basis_get_bytes_per_block_or_pixel(fmt);
-
-						if (transcoder.start_transcoding())
-						{
-							// all subresources will use one allocation for transcoder destination, so compute combined size:
-							size_t transcoded_data_size = 0;
-							for (uint32_t layer = 0; layer < std::max(1u, transcoder.get_layers()); ++layer)
-							{
-								for (uint32_t face = 0; face < transcoder.get_faces(); ++face)
-								{
-									for (uint32_t mip = 0; mip < transcoder.get_levels(); ++mip)
-									{
-										basist::ktx2_image_level_info level_info;
-										if (transcoder.get_image_level_info(level_info, mip, layer, face))
-										{
-											transcoded_data_size += level_info.m_total_blocks * bytes_per_block;
-										}
-									}
-								}
-							}
-							ap::vector<uint8_t*> transcoded_data(transcoded_data_size);
-
-							ap::vector<SubresourceData> InitData;
-							size_t transcoded_data_offset = 0;
-							for (uint32_t layer = 0; layer < std::max(1u, transcoder.get_layers()); ++layer)
-							{
-								for (uint32_t face = 0; face < transcoder.get_faces(); ++face)
-								{
-									for (uint32_t mip = 0; mip < transcoder.get_levels(); ++mip)
-									{
-										basist::ktx2_image_level_info level_info;
-										if (transcoder.get_image_level_info(level_info, mip, layer, face))
-										{
-											void* data_ptr = transcoded_data.data() + transcoded_data_offset;
-											transcoded_data_offset += level_info.m_total_blocks * bytes_per_block;
-											if (transcoder.transcode_image_level(
-												mip, layer, face,
-												data_ptr,
-												level_info.m_total_blocks,
-												fmt
-											))
-											{
-												SubresourceData subresourceData;
-												subresourceData.data_ptr = data_ptr;
-												subresourceData.row_pitch = level_info.m_num_blocks_x * bytes_per_block;
-												subresourceData.slice_pitch = subresourceData.row_pitch * level_info.m_num_blocks_y;
-												InitData.push_back(subresourceData);
-											}
-										}
-									}
-								}
-							}
+					TextureDesc streaming_desc = desc;
+					image.first_mip = SetupStreaming(streaming_desc, *streaming);
+				}
 
-							if (!InitData.empty())
-							{
-								success = device->CreateTexture(&desc, InitData.data(), &resource->texture);
-								device->SetName(&resource->texture, name.c_str());
-							}
-						}
-						transcoder.clear();
-					}
+				if (!transcoder.start_transcoding())
+				{
+					return false;
 				}
-				else if (!ext.compare("BASIS"))
+
+				// all subresources will use one allocation for transcoder destination, so compute combined size:
+				struct TranscodeJob
 				{
-					basist::basisu_transcoder transcoder(&g_basis_global_codebook);
-					if (transcoder.validate_header(filedata, (uint32_t)filesize))
+					uint32_t layer;
+					uint32_t face;
+					uint32_t mip;
+					uint32_t total_blocks;
+					uint8_t* data_ptr;
+				};
+				ap::vector<TranscodeJob> jobs;
+				ap::vector<size_t> offsets;
+				image.subresources.resize(desc.array_size * desc.mip_levels);
+				size_t transcoded_data_size = 0;
+				for (uint32_t layer = 0; layer < std::max(1u, transcoder.get_layers()); ++layer)
+				{
+					for (uint32_t face = 0; face < transcoder.get_faces(); ++face)
 					{
-						basist::basisu_file_info fileInfo;
-						if (transcoder.get_file_info(filedata, (uint32_t)filesize, fileInfo))
+						for (uint32_t mip = image.first_mip; mip < transcoder.get_levels(); ++mip)
 						{
-							uint32_t image_index = 0;
-							basist::basisu_image_info info;
-							if (transcoder.get_image_info(filedata, (uint32_t)filesize, info, image_index))
+							basist::ktx2_image_level_info level_info;
+							if (!transcoder.get_image_level_info(level_info, mip, layer, face))
 							{
-								TextureDesc desc;
-								desc.bind_flags = BindFlag::SHADER_RESOURCE;
-								desc.width = info.m_width;
-								desc.height = info.m_height;
-								desc.mip_levels = info.m_total_levels;
-
-								basist::transcoder_texture_format fmt;
-								if (info.m_alpha_flag)
-								{
-									fmt = basist::transcoder_texture_format::cTFBC3_RGBA;
-									desc.format = Format::BC3_UNORM;
-								}
-								else
-								{
-									fmt = basist::transcoder_texture_format::cTFBC1_RGB;
-									desc.format = Format::BC1_UNORM;
-								}
-								uint32_t bytes_per_block = basis_get_bytes_per_block_or_pixel(fmt);
-
-								if (transcoder.start_transcoding(filedata, (uint32_t)filesize))
-								{
-									// all subresources will use one allocation for transcoder destination, so compute combined size:
-									size_t transcoded_data_size = 0;
-									for (uint32_t mip = 0; mip < desc.mip_levels; ++mip)
-									{
-										basist::basisu_image_level_info level_info;
-										if (transcoder.get_image_level_info(filedata, (uint32_t)filesize, level_info, image_index, mip))
-										{
-											transcoded_data_size += level_info.m_total_blocks * bytes_per_block;
-										}
-									}
-									ap::vector<uint8_t*> transcoded_data(transcoded_data_size);
-
-									ap::vector<SubresourceData> InitData;
-									size_t transcoded_data_offset = 0;
-									for (uint32_t mip = 0; mip < desc.mip_levels; ++mip)
-									{
-										basist::basisu_image_level_info level_info;
-										if (transcoder.get_image_level_info(filedata, (uint32_t)filesize, level_info, 0, mip))
-										{
-											void* data_ptr = transcoded_data.data() + transcoded_data_offset;
-											transcoded_data_offset += level_info.m_total_blocks * bytes_per_block;
-											if (transcoder.transcode_image_level(
-												filedata, (uint32_t)filesize, image_index,
-												mip,
-												data_ptr,
-												info.m_total_blocks,
-												fmt
-											))
-											{
-												SubresourceData subresourceData;
-												subresourceData.data_ptr = data_ptr;
-												subresourceData.row_pitch = level_info.m_num_blocks_x * bytes_per_block;
-												subresourceData.slice_pitch = subresourceData.row_pitch * level_info.m_num_blocks_y;
-												InitData.push_back(subresourceData);
-											}
-										}
-									}
-
-									if (!InitData.empty())
-									{
-										success = device->CreateTexture(&desc, InitData.data(), &resource->texture);
-										device->SetName(&resource->texture, name.c_str());
-									}
-								}
+								return false;
 							}
+							TranscodeJob job;
+							job.layer = layer;
+							job.face = face;
+							job.mip = mip;
+							job.total_blocks = level_info.m_total_blocks;
+							jobs.push_back(job);
+							offsets.push_back(transcoded_data_size);
+							transcoded_data_size += level_info.m_total_blocks * bytes_per_block;
+
+							SubresourceData& subresourceData = image.subresources[(layer * transcoder.get_faces() + face) * desc.mip_levels + mip];
+							subresourceData.row_pitch = level_info.m_num_blocks_x * bytes_per_block;
+							subresourceData.slice_pitch = subresourceData.row_pitch * level_info.m_num_blocks_y;
 						}
 					}
 				}
-				else if (!ext.compare("DDS"))
+				image.storage.resize(transcoded_data_size);
+				for (size_t i = 0; i < jobs.size(); ++i)
 				{
-					// Load dds
-
-					tinyddsloader::DDSFile dds;
-					auto result = dds.Load(filedata, filesize);
+					TranscodeJob& job = jobs[i];
+					job.data_ptr = image.storage.data() + offsets[i];
+					image.subresources[(job.layer * transcoder.get_faces() + job.face) * desc.mip_levels + job.mip].data_ptr = job.data_ptr;
+				}
 
-					if (result == tinyddsloader::Result::Success)
+				// Subresources are independent, so they are transcoded in parallel, each job with its own transcoder state:
+				ap::vector<basist::ktx2_transcoder_state> states(jobs.size());
+				std::atomic_bool success{ true };
+				ap::jobsystem::context ctx;
+				ctx.priority = ap::jobsystem::GetLoadingPriority();
+				ap::jobsystem::Dispatch(ctx, (uint32_t)jobs.size(), 1, [&](ap::jobsystem::JobArgs args) {
+					const TranscodeJob& job = jobs[args.jobIndex];
+					basist::ktx2_transcoder_state& state = states[args.jobIndex];
+					state.clear(); // the state has no constructor
+					if (!transcoder.transcode_image_level(
+						job.mip, job.layer, job.face,
+						job.data_ptr,
+						job.total_blocks,
+						fmt,
+						0, 0, 0, -1, -1,
+						&state
+					))
 					{
-						TextureDesc desc;
-						desc.array_size = 1;
-						desc.bind_flags = BindFlag::SHADER_RESOURCE;
-						desc.width = dds.GetWidth();
-						desc.height = dds.GetHeight();
-						desc.depth = dds.GetDepth();
-						desc.mip_levels = dds.GetMipCount();
-						desc.array_size = dds.GetArraySize();
-						desc.format = Format::R8G8B8A8_UNORM;
-						desc.layout = ResourceState::SHADER_RESOURCE;
-
-						if (dds.IsCubemap())
-						{
-							desc.misc_flags |= ResourceMiscFlag::TEXTURECUBE;
-						}
-
-						auto ddsFormat = dds.GetFormat();
-
-						switch (ddsFormat)
-						{
-						case tinyddsloader::DDSFile::DXGIFormat::R32G32B32A32_Float: desc.format = Format::R32G32B32A32_FLOAT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R32G32B32A32_UInt: desc.format = Format::R32G32B32A32_UINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R32G32B32A32_SInt: desc.format = Format::R32G32B32A32_SINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R32G32B32_Float: desc.format = Format::R32G32B32_FLOAT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R32G32B32_UInt: desc.format = Format::R32G32B32_UINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R32G32B32_SInt: desc.format = Format::R32G32B32_SINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R16G16B16A16_Float: desc.format = Format::R16G16B16A16_FLOAT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R16G16B16A16_UNorm: desc.format = Format::R16G16B16A16_UNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R16G16B16A16_UInt: desc.format = Format::R16G16B16A16_UINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R16G16B16A16_SNorm: desc.format = Format::R16G16B16A16_SNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R16G16B16A16_SInt: desc.format = Format::R16G16B16A16_SINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R32G32_Float: desc.format = Format::R32G32_FLOAT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R32G32_UInt: desc.format = Format::R32G32_UINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R32G32_SInt: desc.format = Format::R32G32_SINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R10G10B10A2_UNorm: desc.format = Format::R10G10B10A2_UNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R10G10B10A2_UInt: desc.format = Format::R10G10B10A2_UINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R11G11B10_Float: desc.format = Format::R11G11B10_FLOAT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::B8G8R8A8_UNorm: desc.format = Format::B8G8R8A8_UNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::B8G8R8A8_UNorm_SRGB: desc.format = Format::B8G8R8A8_UNORM_SRGB; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R8G8B8A8_UNorm: desc.format = Format::R8G8B8A8_UNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R8G8B8A8_UNorm_SRGB: desc.format = Format::R8G8B8A8_UNORM_SRGB; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R8G8B8A8_UInt: desc.format = Format::R8G8B8A8_UINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R8G8B8A8_SNorm: desc.format = Format::R8G8B8A8_SNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R8G8B8A8_SInt: desc.format = Format::R8G8B8A8_SINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R16G16_Float: desc.format = Format::R16G16_FLOAT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R16G16_UNorm: desc.format = Format::R16G16_UNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R16G16_UInt: desc.format = Format::R16G16_UINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R16G16_SNorm: desc.format = Format::R16G16_SNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R16G16_SInt: desc.format = Format::R16G16_SINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::D32_Float: desc.format = Format::D32_FLOAT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R32_Float: desc.format = Format::R32_FLOAT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R32_UInt: desc.format = Format::R32_UINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R32_SInt: desc.format = Format::R32_SINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R8G8_UNorm: desc.format = Format::R8G8_UNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R8G8_UInt: desc.format = Format::R8G8_UINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R8G8_SNorm: desc.format = Format::R8G8_SNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R8G8_SInt: desc.format = Format::R8G8_SINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R16_Float: desc.format = Format::R16_FLOAT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::D16_UNorm: desc.format = Format::D16_UNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R16_UNorm: desc.format = Format::R16_UNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R16_UInt: desc.format = Format::R16_UINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R16_SNorm: desc.format = Format::R16_SNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R16_SInt: desc.format = Format::R16_SINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R8_UNorm: desc.format = Format::R8_UNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R8_UInt: desc.format = Format::R8_UINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R8_SNorm: desc.format = Format::R8_SNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::R8_SInt: desc.format = Format::R8_SINT; break;
-						case tinyddsloader::DDSFile::DXGIFormat::BC1_UNorm: desc.format = Format::BC1_UNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::BC1_UNorm_SRGB: desc.format = Format::BC1_UNORM_SRGB; break;
-						case tinyddsloader::DDSFile::DXGIFormat::BC2_UNorm: desc.format = Format::BC2_UNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::BC2_UNorm_SRGB: desc.format = Format::BC2_UNORM_SRGB; break;
-						case tinyddsloader::DDSFile::DXGIFormat::BC3_UNorm: desc.format = Format::BC3_UNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::BC3_UNorm_SRGB: desc.format = Format::BC3_UNORM_SRGB; break;
-						case tinyddsloader::DDSFile::DXGIFormat::BC4_UNorm: desc.format = Format::BC4_UNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::BC4_SNorm: desc.format = Format::BC4_SNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::BC5_UNorm: desc.format = Format::BC5_UNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::BC5_SNorm: desc.format = Format::BC5_SNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::BC7_UNorm: desc.format = Format::BC7_UNORM; break;
-						case tinyddsloader::DDSFile::DXGIFormat::BC7_UNorm_SRGB: desc.format = Format::BC7_UNORM_SRGB; break;
-						default:
-							assert(0); // incoming format is not supported 
-							break;
-						}
-
-						ap::vector<SubresourceData> InitData;
-						for (uint32_t arrayIndex = 0; arrayIndex < desc.array_size; ++arrayIndex)
-						{
-							for (uint32_t mip = 0; mip < desc.mip_levels; ++mip)
-							{
-								auto imageData = dds.GetImageData(mip, arrayIndex);
-								SubresourceData subresourceData;
-								subresourceData.data_ptr = imageData->m_mem;
-								subresourceData.row_pitch = imageData->m_memPitch;
-								subresourceData.slice_pitch = imageData->m_memSlicePitch;
-								InitData.push_back(subresourceData);
-							}
-						}
-
-						auto dim = dds.GetTextureDimension();
-						switch (dim)
-						{
-						case tinyddsloader::DDSFile::TextureDimension::Texture1D:
-						{
-							desc.type = TextureDesc::Type::TEXTURE_1D;
-						}
-						break;
-						case tinyddsloader::DDSFile::TextureDimension::Texture2D:
-						{
-							desc.type = TextureDesc::Type::TEXTURE_2D;
-						}
-						break;
-						case tinyddsloader::DDSFile::TextureDimension::Texture3D:
-						{
-							desc.type = TextureDesc::Type::TEXTURE_3D;
-						}
-						break;
-						default:
-							assert(0);
-							break;
-						}
-
-						if (IsFormatBlockCompressed(desc.format))
-						{
-							desc.width = std::max(GetFormatBlockSize(desc.format), desc.width);
-							desc.height = std::max(GetFormatBlockSize(desc.format), desc.height);
-						}
-
-						success = device->CreateTexture(&desc, InitData.data(), &resource->texture);
-						device->SetName(&resource->texture, name.c_str());
+						success.store(false);
 					}
-					else assert(0); // failed to load DDS
+				});
+				ap::jobsystem::Wait(ctx);
+				return success.load();
+			}
+			else if (!ext.compare("BASIS"))
+			{
+				basist::basisu_transcoder transcoder(&g_basis_global_codebook);
+				const uint32_t image_index = 0;
+				basist::basisu_image_info info;
+				if (!transcoder.validate_header(filedata, (uint32_t)filesize) ||
+					!transcoder.get_image_info(filedata, (uint32_t)filesize, info, image_index))
+				{
+					return false;
+				}
+				desc.bind_flags = BindFlag::SHADER_RESOURCE;
+				desc.width = info.m_width;
+				desc.height = info.m_height;
+				desc.mip_levels = info.m_total_levels;
 
+				basist::transcoder_texture_format fmt;
+				if (info.m_alpha_flag)
+				{
+					fmt = basist::transcoder_texture_format::cTFBC3_RGBA;
+					desc.format = Format::BC3_UNORM;
 				}
 				else
 				{
-					// png, tga, jpg, etc. loader:
-
-					const int channelCount = 4;
-					int width, height, bpp;
-					unsigned char* rgb = stbi_load_from_memory(filedata, (int)filesize, &width, &height, &bpp, channelCount);
+					fmt = basist::transcoder_texture_format::cTFBC1_RGB;
+					desc.format = Format::BC1_UNORM;
+				}
+				uint32_t bytes_per_block = basis_get_bytes_per_block_or_pixel(fmt);
 
-					if (rgb != nullptr)
-					{
-						TextureDesc desc;
-						desc.height = uint32_t(height);
-						desc.width = uint32_t(width);
-						desc.layout = ResourceState::SHADER_RESOURCE;
+				image.streamable = true;
+				if (streaming != nullptr)
+				{
+					TextureDesc streaming_desc = desc;
+					image.first_mip = SetupStreaming(streaming_desc, *streaming);
+				}
 
-						if (has_flag(flags, Flags::IMPORT_COLORGRADINGLUT))
-						{
-							if (desc.type != TextureDesc::Type::TEXTURE_2D ||
-								desc.width != 256 ||
-								desc.height != 16)
-							{
-								ap::helper::messageBox("The Dimensions must be 256 x 16 for color grading LUT!", "Error");
-							}
-							else
-							{
-								uint32_t data[16 * 16 * 16];
-								int pixel = 0;
-								for (int z = 0; z < 16; ++z)
-								{
-									for (int y = 0; y < 16; ++y)
-									{
-										for (int x = 0; x < 16; ++x)
-										{
-											int coord = x + y * 256 + z * 16;
-											data[pixel++] = ((uint32_t*)rgb)[coord];
-										}
-									}
-								}
+				if (!transcoder.start_transcoding(filedata, (uint32_t)filesize))
+				{
+					return false;
+				}
 
-								desc.type = TextureDesc::Type::TEXTURE_3D;
-								desc.width = 16;
-								desc.height = 16;
-								desc.depth = 16;
-								desc.format = Format::R8G8B8A8_UNORM;
-								desc.bind_flags = BindFlag::SHADER_RESOURCE;
-								SubresourceData InitData;
-								InitData.data_ptr = data;
-								InitData.row_pitch = 16 * sizeof(uint32_t);
-								InitData.slice_pitch = 16 * InitData.row_pitch;
-								success = device->CreateTexture(&desc, &InitData, &resource->texture);
-								device->SetName(&resource->texture, name.c_str());
-							}
-						}
-						else
-						{
-							desc.bind_flags = BindFlag::SHADER_RESOURCE | BindFlag::UNORDERED_ACCESS;
-							desc.format = Format::R8G8B8A8_UNORM;
-							desc.mip_levels = (uint32_t)log2(std::max(width, height)) + 1;
-							desc.usage = Usage::DEFAULT;
-							desc.layout = ResourceState::SHADER_RESOURCE;
-
-							uint32_t mipwidth = width;
-							ap::vector<SubresourceData> InitData(desc.mip_levels);
-							for (uint32_t mip = 0; mip < desc.mip_levels; ++mip)
-							{
-								InitData[mip].data_ptr = rgb; // attention! we don't fill the mips here correctly, just always point to the mip0 data by default. Mip levels will be created using compute shader when needed!
-								InitData[mip].row_pitch = static_cast<uint32_t>(mipwidth * channelCount);
-								mipwidth = std::max(1u, mipwidth / 2);
-							}
+				// all subresources will use one allocation for transcoder destination, so compute combined size:
+				ap::vector<size_t> offsets(desc.mip_levels);
+				ap::vector<uint32_t> total_blocks(desc.mip_levels);
+				image.subresources.resize(desc.mip_levels);
+				size_t transcoded_data_size = 0;
+				for (uint32_t mip = image.first_mip; mip < desc.mip_levels; ++mip)
+				{
+					basist::basisu_image_level_info level_info;
+					if (!transcoder.get_image_level_info(filedata, (uint32_t)filesize, level_info, image_index, mip))
+					{
+						return false;
+					}
+					offsets[mip] = transcoded_data_size;
+					total_blocks[mip] = level_info.m_total_blocks;
+					transcoded_data_size += level_info.m_total_blocks * bytes_per_block;
 
-							success = device->CreateTexture(&desc, InitData.data(), &resource->texture);
-							device->SetName(&resource->texture, name.c_str());
+					SubresourceData& subresourceData = image.subresources[mip];
+					subresourceData.row_pitch = level_info.m_num_blocks_x * bytes_per_block;
+					subresourceData.slice_pitch = subresourceData.row_pitch * level_info.m_num_blocks_y;
+				}
+				image.storage.resize(transcoded_data_size);
+				for (uint32_t mip = image.first_mip; mip < desc.mip_levels; ++mip)
+				{
+					image.subresources[mip].data_ptr = image.storage.data() + offsets[mip];
+				}
 
-							for (uint32_t i = 0; i < resource->texture.desc.mip_levels; ++i)
-							{
-								int subresource_index;
-								subresource_index = device->CreateSubresource(&resource->texture, SubresourceType::SRV, 0, 1, i, 1);
-								assert(subresource_index == i);
-								subresource_index = device->CreateSubresource(&resource->texture, SubresourceType::UAV, 0, 1, i, 1);
-								assert(subresource_index == i);
-							}
-						}
+				// Mips are independent, so they are transcoded in parallel, each job with its own transcoder state:
+				const uint32_t job_count = desc.mip_levels - image.first_mip;
+				ap::vector<basist::basisu_transcoder_state> states(job_count);
+				std::atomic_bool success{ true };
+				ap::jobsystem::context ctx;
+				ctx.priority = ap::jobsystem::GetLoadingPriority();
+				ap::jobsystem::Dispatch(ctx, job_count, 1, [&](ap::jobsystem::JobArgs args) {
+					const uint32_t mip = image.first_mip + args.jobIndex;
+					if (!transcoder.transcode_image_level(
+						filedata, (uint32_t)filesize, image_index,
+						mip,
+						(void*)image.subresources[mip].data_ptr,
+						total_blocks[mip],
+						fmt,
+						0, 0,
+						&states[args.jobIndex]
+					))
+					{
+						success.store(false);
 					}
-					stbi_image_free(rgb);
-				}
-			}
-			break;
-			case DataType::SOUND:
-			{
-				success = ap::audio::CreateSound(filedata, filesize, &resource->sound);
+				});
+				ap::jobsystem::Wait(ctx);
+				return success.load();
 			}
-			break;
-			};
-
-			if (success)
+			else
 			{
-				resource->flags = flags;
+				// png, tga, jpg, etc. loader:
 
-				if (resource->filedata.empty() && has_flag(flags, Flags::IMPORT_RETAIN_FILEDATA))
-				{
-					// resource was loaded with external filedata, and we want to retain filedata
-					resource->filedata.resize(filesize);
-					std::memcpy(resource->filedata.data(), filedata, filesize);
-				}
-				else if (!resource->filedata.empty() && has_flag(flags, Flags::IMPORT_RETAIN_FILEDATA) == 0)
+				const int channelCount = 4;
+				int width, height, bpp;
+				unsigned char* rgb = stbi_load_from_memory(filedata, (int)filesize, &width, &height, &bpp, channelCount);
+				if (rgb == nullptr)
 				{
-					// resource was loaded using file name, and we want to discard filedata
-					resource->filedata.clear();
+					return false;
 				}
-
-				if (type == DataType::IMAGE && resource->texture.desc.mip_levels > 1
-					&& has_flag(resource->texture.desc.bind_flags, BindFlag::UNORDERED_ACCESS))
+				image.external_storage = std::shared_ptr<const void>(rgb, stbi_image_free);
+
+				desc.height = uint32_t(height);
+				desc.width = uint32_t(width);
+				desc.bind_flags = BindFlag::SHADER_RESOURCE | BindFlag::UNORDERED_ACCESS;
+				desc.format = Format::R8G8B8A8_UNORM;
+				desc.mip_levels = (uint32_t)log2(std::max(width, height)) + 1;
+				desc.usage = Usage::DEFAULT;
+				desc.layout = ResourceState::SHADER_RESOURCE;
+
+				uint32_t mipwidth = width;
+				image.subresources.resize(desc.mip_levels);
+				for (uint32_t mip = 0; mip < desc.mip_levels; ++mip)
 				{
-					ap::renderer::AddDeferredMIPGen(resource->texture, true);
+					image.subresources[mip].data_ptr = rgb; // attention! we don't fill the mips here correctly, just always point to the mip0 data by default. Mip levels will be created using compute shader when needed!
+					image.subresources[mip].row_pitch = static_cast<uint32_t>(mipwidth * channelCount);
+					mipwidth = std::max(1u, mipwidth / 2);
 				}
-
-				Resource retVal;
-				retVal.internal_state = resource;
-				return retVal;
+				return true;
 			}
-
-			return Resource();
 		}
 
-		bool Contains(const std::string& name)
+		// Creates the texture from the decoded image, starting from its first decoded mip
+		static bool CreateTexture(const std::string& name, const DecodedImage& image, Texture& texture)
 		{
-			bool result = false;
-			locker.lock();
-			auto it = resources.find(name);
-			if (it != resources.end())
+			GraphicsDevice* device = ap::graphics::GetDevice();
+			TextureDesc desc = image.desc;
+			desc.width >>= image.first_mip;
+			desc.height >>= image.first_mip;
+			desc.mip_levels -= image.first_mip;
+
+			bool success = device->CreateTexture(&desc, image.subresources.data() + image.first_mip, &texture);
+			device->SetName(&texture, name.c_str());
+
+			if (success && has_flag(desc.bind_flags, BindFlag::UNORDERED_ACCESS))
 			{
-				auto resource = it->second.lock();
-				result = resource != nullptr;
+				// Mip levels will be created using compute shader:
+				for (uint32_t i = 0; i < texture.desc.mip_levels; ++i)
+				{
+					int subresource_index;
+					subresource_index = device->CreateSubresource(&texture, SubresourceType::SRV, 0, 1, i, 1);
+					assert(subresource_index == i);
+					subresource_index = device->CreateSubresource(&texture, SubresourceType::UAV, 0, 1, i, 1);
+					assert(subresource_index == i);
+				}
 			}
-			locker.unlock();
-			return result;
+			return success;
 		}
 
-		void Clear()
+		// Transcoded texture cache:
+		//	Every cache file contains the TextureCacheHeader, followed by a TextureCacheSubresource table and the subresource data
+		static constexpr uint64_t texture_cache_magic = 0x4548434143545041ull; // "APTCACHE"
+		static constexpr uint32_t texture_cache_version = 1;
+		static constexpr uint64_t texture_cache_alignment = 16;
+		static const char* texture_cache_extension = ".texcache";
+		struct TextureCacheHeader
 		{
-			locker.lock();
-			resources.clear();
-			locker.unlock();
-		}
+			uint64_t magic;
+			uint64_t key;
+			uint32_t version;
+			uint32_t subresource_count;
+			uint32_t type;
+			uint32_t width;
+			uint32_t height;
+			uint32_t depth;
+			uint32_t array_size;
+			uint32_t mip_levels;
+			uint32_t format;
+			uint32_t usage;
+			uint32_t bind_flags;
+			uint32_t misc_flags;
+			uint32_t layout;
+			uint32_t streamable;
+		};
+		struct TextureCacheSubresource
+		{
+			uint64_t offset;
+			uint32_t row_pitch;
+			uint32_t slice_pitch;
+		};
 
+		// Decoded images are identified by the file contents, the formats that the decoders target and the import flags that affect decoding
+		static uint64_t ComputeTextureCacheKey(const uint8_t* filedata, size_t filesize, Flags flags)
+		{
+			const uint32_t target[] = {
+				texture_cache_version,
+				(uint32_t)basist::transcoder_texture_format::cTFBC1_RGB,
+				(uint32_t)basist::transcoder_texture_format::cTFBC3_RGBA,
+				(uint32_t)Format::R8G8B8A8_UNORM,
+				(uint32_t)(flags & Flags::IMPORT_COLORGRADINGLUT),
+			};
+			return ap::helper::data_hash(filedata, filesize, ap::helper::data_hash(target, sizeof(target)));
+		}
+		static bool IsTextureCacheable(const std::string& ext, Flags flags)
+		{
+			// DDS is already GPU ready, color grading LUT is tiny
+			return !texture_cache_directory.empty() && ext.compare("DDS") && !has_flag(flags, Flags::IMPORT_COLORGRADINGLUT);
+		}
+		static std::string GetTextureCachePath(uint64_t key)
+		{
+			char filename[32];
+			snprintf(filename, sizeof(filename), "%016llx", (unsigned long long)key);
+			return texture_cache_directory + "/" + filename + texture_cache_extension;
+		}
+		static uint64_t GetSubresourceSize(const TextureDesc& desc, uint32_t mip, uint32_t row_pitch)
+		{
+			const uint32_t block_size = GetFormatBlockSize(desc.format);
+			const uint32_t rows = (std::max(1u, desc.height >> mip) + block_size - 1) / block_size;
+			return uint64_t(rows) * uint64_t(row_pitch) * uint64_t(std::max(1u, desc.depth >> mip));
+		}
 
-		void Serialize(ap::Archive& archive, ResourceSerializer& seri)
+		static bool ReadTextureCache(uint64_t key, DecodedImage& image)
 		{
-			if (archive.IsReadMode())
+			const std::string path = GetTextureCachePath(key);
+			if (!ap::helper::FileExists(path))
 			{
-				size_t serializable_count = 0;
-				archive >> serializable_count;
+				return false;
+			}
 
-				struct TempResource
+			size_t size = 0;
+			std::shared_ptr<const uint8_t> mapped = ap::helper::FileMap(path, size);
+			const uint8_t* data = mapped.get();
+			if (data == nullptr)
+			{
+				if (!ap::helper::FileRead(path, image.storage))
 				{
-					std::string name;
-					Flags flags = Flags::NONE;
-					ap::vector<uint8_t> filedata;
-				};
-				ap::vector<TempResource> temp_resources;
-				temp_resources.resize(serializable_count);
+					return false;
+				}
+				data = image.storage.data();
+				size = image.storage.size();
+			}
 
-				ap::jobsystem::context ctx;
-				std::mutex seri_locker;
-				for (size_t i = 0; i < serializable_count; ++i)
+			if (size < sizeof(TextureCacheHeader))
+			{
+				return false;
+			}
+			TextureCacheHeader header;
+			std::memcpy(&header, data, sizeof(header));
+			if (header.magic != texture_cache_magic || header.version != texture_cache_version || header.key != key ||
+				header.mip_levels == 0 || header.subresource_count != header.array_size * header.mip_levels ||
+				size < sizeof(TextureCacheHeader) + uint64_t(header.subresource_count) * sizeof(TextureCacheSubresource))
+			{
+				return false;
+			}
+
+			TextureDesc& desc = image.desc;
+			desc.type = (TextureDesc::Type)header.type;
+			desc.width = header.width;
+			desc.height = header.height;
+			desc.depth = header.depth;
+			desc.array_size = header.array_size;
+			desc.mip_levels = header.mip_levels;
+			desc.format = (Format)header.format;
+			desc.usage = (Usage)header.usage;
+			desc.bind_flags = (BindFlag)header.bind_flags;
+			desc.misc_flags = (ResourceMiscFlag)header.misc_flags;
+			desc.layout = (ResourceState)header.layout;
+			image.streamable = header.streamable != 0;
+
+			const TextureCacheSubresource* table = (const TextureCacheSubresource*)(data + sizeof(TextureCacheHeader));
+			image.subresources.resize(header.subresource_count);
+			for (uint32_t i = 0; i < header.subresource_count; ++i)
+			{
+				const TextureCacheSubresource& entry = table[i];
+				if (entry.offset > size || GetSubresourceSize(desc, i % desc.mip_levels, entry.row_pitch) > size - entry.offset)
 				{
-					auto& resource = temp_resources[i];
+					return false;
+				}
+				image.subresources[i].data_ptr = data + entry.offset;
+				image.subresources[i].row_pitch = entry.row_pitch;
+				image.subresources[i].slice_pitch = entry.slice_pitch;
+			}
+			image.external_storage = mapped;
+
+			// The modification time marks the entry as recently used for PruneTextureCache():
+			std::error_code ec;
+			std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+			return true;
+		}
+
+		static bool WriteTextureCache(uint64_t key, const DecodedImage& image)
+		{
+			assert(image.first_mip == 0); // the cache must contain the full mip chain
+			const TextureDesc& desc = image.desc;
+
+			// Subresources can share data (stb_image mips all refer to mip0), that is written only once:
+			ap::vector<TextureCacheSubresource> table(image.subresources.size());
+			uint64_t size = sizeof(TextureCacheHeader) + table.size() * sizeof(TextureCacheSubresource);
+			for (size_t i = 0; i < image.subresources.size(); ++i)
+			{
+				const SubresourceData& subresource = image.subresources[i];
+				table[i].row_pitch = subresource.row_pitch;
+				table[i].slice_pitch = subresource.slice_pitch;
+				table[i].offset = 0;
+				for (size_t j = 0; j < i; ++j)
+				{
+					if (image.subresources[j].data_ptr == subresource.data_ptr)
+					{
+						table[i].offset = table[j].offset;
+						break;
+					}
+				}
+				if (table[i].offset == 0)
+				{
+					size = (size + texture_cache_alignment - 1) / texture_cache_alignment * texture_cache_alignment;
+					table[i].offset = size;
+					size += GetSubresourceSize(desc, uint32_t(i % desc.mip_levels), subresource.row_pitch);
+				}
+			}
+
+			TextureCacheHeader header = {};
+			header.magic = texture_cache_magic;
+			header.key = key;
+			header.version = texture_cache_version;
+			header.subresource_count = (uint32_t)table.size();
+			header.type = (uint32_t)desc.type;
+			header.width = desc.width;
+			header.height = desc.height;
+			header.depth = desc.depth;
+			header.array_size = desc.array_size;
+			header.mip_levels = desc.mip_levels;
+			header.format = (uint32_t)desc.format;
+			header.usage = (uint32_t)desc.usage;
+			header.bind_flags = (uint32_t)desc.bind_flags;
+			header.misc_flags = (uint32_t)desc.misc_flags;
+			header.layout = (uint32_t)desc.layout;
+			header.streamable = image.streamable ? 1 : 0;
+
+			ap::vector<uint8_t> filedata((size_t)size);
+			std::memcpy(filedata.data(), &header, sizeof(header));
+			std::memcpy(filedata.data() + sizeof(header), table.data(), table.size() * sizeof(TextureCacheSubresource));
+			for (size_t i = 0; i < image.subresources.size(); ++i)
+			{
+				const uint64_t subresource_size = GetSubresourceSize(desc, uint32_t(i % desc.mip_levels), table[i].row_pitch);
+				std::memcpy(filedata.data() + table[i].offset, image.subresources[i].data_ptr, (size_t)subresource_size);
+			}
+
+			// The file is written under a temporary name and renamed, so that other threads and processes never see a partial file:
+			const std::string path = GetTextureCachePath(key);
+			const std::string temp_path = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+			ap::helper::DirectoryCreate(texture_cache_directory);
+			if (!ap::helper::FileWrite(temp_path, filedata.data(), filedata.size()))
+			{
+				return false;
+			}
+			std::error_code ec;
+			std::filesystem::rename(temp_path, path, ec);
+			if (ec)
+			{
+				std::filesystem::remove(temp_path, ec);
+				return false;
+			}
+			return true;
+		}
+
+		// Creates the texture from image file data
+		//	streaming : if not null, the image is created starting from streaming->first_mip when the format supports it (optional)
+		static bool CreateImage(const std::string& name, const std::string& ext, Flags flags, const uint8_t* filedata, size_t filesize, Texture& texture, StreamingInfo* streaming)
+		{
+			bool success = false;
+			GraphicsDevice* device = ap::graphics::GetDevice();
+			if (!ext.compare("DDS"))
+			{
+				// Load dds
+
+				tinyddsloader::DDSFile dds;
+				auto result = dds.Load(filedata, filesize);
+
+				if (result == tinyddsloader::Result::Success)
+				{
+					TextureDesc desc;
+					desc.array_size = 1;
+					desc.bind_flags = BindFlag::SHADER_RESOURCE;
+					desc.width = dds.GetWidth();
+					desc.height = dds.GetHeight();
+					desc.depth = dds.GetDepth();
+					desc.mip_levels = dds.GetMipCount();
+					desc.array_size = dds.GetArraySize();
+					desc.format = Format::R8G8B8A8_UNORM;
+					desc.layout = ResourceState::SHADER_RESOURCE;
+
+					if (dds.IsCubemap())
+					{
+						desc.misc_flags |= ResourceMiscFlag::TEXTURECUBE;
+					}
+
+					auto ddsFormat = dds.GetFormat();
+
+					switch (ddsFormat)
+					{
+					case tinyddsloader::DDSFile::DXGIFormat::R32G32B32A32_Float: desc.format = Format::R32G32B32A32_FLOAT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R32G32B32A32_UInt: desc.format = Format::R32G32B32A32_UINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R32G32B32A32_SInt: desc.format = Format::R32G32B32A32_SINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R32G32B32_Float: desc.format = Format::R32G32B32_FLOAT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R32G32B32_UInt: desc.format = Format::R32G32B32_UINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R32G32B32_SInt: desc.format = Format::R32G32B32_SINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R16G16B16A16_Float: desc.format = Format::R16G16B16A16_FLOAT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R16G16B16A16_UNorm: desc.format = Format::R16G16B16A16_UNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R16G16B16A16_UInt: desc.format = Format::R16G16B16A16_UINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R16G16B16A16_SNorm: desc.format = Format::R16G16B16A16_SNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R16G16B16A16_SInt: desc.format = Format::R16G16B16A16_SINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R32G32_Float: desc.format = Format::R32G32_FLOAT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R32G32_UInt: desc.format = Format::R32G32_UINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R32G32_SInt: desc.format = Format::R32G32_SINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R10G10B10A2_UNorm: desc.format = Format::R10G10B10A2_UNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R10G10B10A2_UInt: desc.format = Format::R10G10B10A2_UINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R11G11B10_Float: desc.format = Format::R11G11B10_FLOAT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::B8G8R8A8_UNorm: desc.format = Format::B8G8R8A8_UNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::B8G8R8A8_UNorm_SRGB: desc.format = Format::B8G8R8A8_UNORM_SRGB; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R8G8B8A8_UNorm: desc.format = Format::R8G8B8A8_UNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R8G8B8A8_UNorm_SRGB: desc.format = Format::R8G8B8A8_UNORM_SRGB; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R8G8B8A8_UInt: desc.format = Format::R8G8B8A8_UINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R8G8B8A8_SNorm: desc.format = Format::R8G8B8A8_SNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R8G8B8A8_SInt: desc.format = Format::R8G8B8A8_SINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R16G16_Float: desc.format = Format::R16G16_FLOAT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R16G16_UNorm: desc.format = Format::R16G16_UNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R16G16_UInt: desc.format = Format::R16G16_UINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R16G16_SNorm: desc.format = Format::R16G16_SNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R16G16_SInt: desc.format = Format::R16G16_SINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::D32_Float: desc.format = Format::D32_FLOAT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R32_Float: desc.format = Format::R32_FLOAT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R32_UInt: desc.format = Format::R32_UINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R32_SInt: desc.format = Format::R32_SINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R8G8_UNorm: desc.format = Format::R8G8_UNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R8G8_UInt: desc.format = Format::R8G8_UINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R8G8_SNorm: desc.format = Format::R8G8_SNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R8G8_SInt: desc.format = Format::R8G8_SINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R16_Float: desc.format = Format::R16_FLOAT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::D16_UNorm: desc.format = Format::D16_UNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R16_UNorm: desc.format = Format::R16_UNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R16_UInt: desc.format = Format::R16_UINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R16_SNorm: desc.format = Format::R16_SNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R16_SInt: desc.format = Format::R16_SINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R8_UNorm: desc.format = Format::R8_UNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R8_UInt: desc.format = Format::R8_UINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R8_SNorm: desc.format = Format::R8_SNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::R8_SInt: desc.format = Format::R8_SINT; break;
+					case tinyddsloader::DDSFile::DXGIFormat::BC1_UNorm: desc.format = Format::BC1_UNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::BC1_UNorm_SRGB: desc.format = Format::BC1_UNORM_SRGB; break;
+					case tinyddsloader::DDSFile::DXGIFormat::BC2_UNorm: desc.format = Format::BC2_UNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::BC2_UNorm_SRGB: desc.format = Format::BC2_UNORM_SRGB; break;
+					case tinyddsloader::DDSFile::DXGIFormat::BC3_UNorm: desc.format = Format::BC3_UNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::BC3_UNorm_SRGB: desc.format = Format::BC3_UNORM_SRGB; break;
+					case tinyddsloader::DDSFile::DXGIFormat::BC4_UNorm: desc.format = Format::BC4_UNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::BC4_SNorm: desc.format = Format::BC4_SNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::BC5_UNorm: desc.format = Format::BC5_UNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::BC5_SNorm: desc.format = Format::BC5_SNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::BC7_UNorm: desc.format = Format::BC7_UNORM; break;
+					case tinyddsloader::DDSFile::DXGIFormat::BC7_UNorm_SRGB: desc.format = Format::BC7_UNORM_SRGB; break;
+					default:
+						assert(0); // incoming format is not supported 
+						break;
+					}
+
+					uint32_t first_mip = 0;
+					if (streaming != nullptr && dds.GetTextureDimension() == tinyddsloader::DDSFile::TextureDimension::Texture2D && desc.array_size == 1 && !dds.IsCubemap())
+					{
+						first_mip = SetupStreaming(desc, *streaming);
+					}
+
+					ap::vector<SubresourceData> InitData;
+					for (uint32_t arrayIndex = 0; arrayIndex < desc.array_size; ++arrayIndex)
+					{
+						for (uint32_t mip = first_mip; mip < dds.GetMipCount(); ++mip)
+						{
+							auto imageData = dds.GetImageData(mip, arrayIndex);
+							SubresourceData subresourceData;
+							subresourceData.data_ptr = imageData->m_mem;
+							subresourceData.row_pitch = imageData->m_memPitch;
+							subresourceData.slice_pitch = imageData->m_memSlicePitch;
+							InitData.push_back(subresourceData);
+						}
+					}
+
+					auto dim = dds.GetTextureDimension();
+					switch (dim)
+					{
+					case tinyddsloader::DDSFile::TextureDimension::Texture1D:
+					{
+						desc.type = TextureDesc::Type::TEXTURE_1D;
+					}
+					break;
+					case tinyddsloader::DDSFile::TextureDimension::Texture2D:
+					{
+						desc.type = TextureDesc::Type::TEXTURE_2D;
+					}
+					break;
+					case tinyddsloader::DDSFile::TextureDimension::Texture3D:
+					{
+						desc.type = TextureDesc::Type::TEXTURE_3D;
+					}
+					break;
+					default:
+						assert(0);
+						break;
+					}
+
+					if (IsFormatBlockCompressed(desc.format))
+					{
+						desc.width = std::max(GetFormatBlockSize(desc.format), desc.width);
+						desc.height = std::max(GetFormatBlockSize(desc.format), desc.height);
+					}
+
+					success = device->CreateTexture(&desc, InitData.data(), &texture);
+					device->SetName(&texture, name.c_str());
+				}
+				else assert(0); // failed to load DDS
+
+			}
+			else if (has_flag(flags, Flags::IMPORT_COLORGRADINGLUT))
+			{
+				const int channelCount = 4;
+				int width, height, bpp;
+				unsigned char* rgb = stbi_load_from_memory(filedata, (int)filesize, &width, &height, &bpp, channelCount);
+
+				if (rgb != nullptr)
+				{
+					if (width != 256 || height != 16)
+					{
+						ap::helper::messageBox("The Dimensions must be 256 x 16 for color grading LUT!", "Error");
+					}
+					else
+					{
+						uint32_t data[16 * 16 * 16];
+						int pixel = 0;
+						for (int z = 0; z < 16; ++z)
+						{
+							for (int y = 0; y < 16; ++y)
+							{
+								for (int x = 0; x < 16; ++x)
+								{
+									int coord = x + y * 256 + z * 16;
+									data[pixel++] = ((uint32_t*)rgb)[coord];
+								}
+							}
+						}
+
+						TextureDesc desc;
+						desc.type = TextureDesc::Type::TEXTURE_3D;
+						desc.width = 16;
+						desc.height = 16;
+						desc.depth = 16;
+						desc.format = Format::R8G8B8A8_UNORM;
+						desc.bind_flags = BindFlag::SHADER_RESOURCE;
+						desc.layout = ResourceState::SHADER_RESOURCE;
+						SubresourceData InitData;
+						InitData.data_ptr = data;
+						InitData.row_pitch = 16 * sizeof(uint32_t);
+						InitData.slice_pitch = 16 * InitData.row_pitch;
+						success = device->CreateTexture(&desc, &InitData, &texture);
+						device->SetName(&texture, name.c_str());
+					}
+				}
+				stbi_image_free(rgb);
+			}
+			else
+			{
+				DecodedImage image;
+				bool decoded = false;
+				if (IsTextureCacheable(ext, flags))
+				{
+					// The cache contains the full mip chain, streaming selects the top mip from it
+					const uint64_t key = ComputeTextureCacheKey(filedata, filesize, flags);
+					decoded = ReadTextureCache(key, image);
+					if (!decoded)
+					{
+						image = DecodedImage();
+						decoded = DecodeImage(ext, filedata, filesize, image, nullptr);
+						if (decoded)
+						{
+							WriteTextureCache(key, image);
+						}
+					}
+					if (decoded && streaming != nullptr && image.streamable)
+					{
+						TextureDesc streaming_desc = image.desc;
+						image.first_mip = SetupStreaming(streaming_desc, *streaming);
+					}
+				}
+				else
+				{
+					decoded = DecodeImage(ext, filedata, filesize, image, streaming);
+				}
+
+				if (decoded)
+				{
+					success = CreateTexture(name, image, texture);
+				}
+			}
+			return success;
+		}
+
+		// Loads the resource contents, the resource must be claimed by the calling thread (LOAD_RUNNING)
+		static bool LoadInternal(ResourceInternal* resource, const std::string& name, Flags flags, const uint8_t* filedata, size_t filesize)
+		{
+			if (filedata == nullptr || filesize == 0)
+			{
+				if (!ap::helper::FileRead(name, resource->filedata))
+				{
+					return false;
+				}
+				filedata = resource->filedata.data();
+				filesize = resource->filedata.size();
+			}
+
+			std::string ext = ap::helper::toUpper(ap::helper::GetExtensionFromFileName(name));
+			DataType type;
+
+			// dynamic type selection:
+			{
+				auto it = types.find(ext);
+				if (it != types.end())
+				{
+					type = it->second;
+				}
+				else
+				{
+					return false;
+				}
+			}
+
+			bool success = false;
+
+			switch (type)
+			{
+			case DataType::IMAGE:
+			{
+				StreamingInfo streaming;
+				const bool streaming_allowed = texture_streaming_enabled && has_flag(flags, Flags::IMPORT_STREAMING);
+				success = CreateImage(name, ext, flags, filedata, filesize, resource->texture, streaming_allowed ? &streaming : nullptr);
+				if (success && streaming.streamable && streaming.lowest_mip > 0)
+				{
+					resource->name = name;
+					resource->streaming = true;
+					resource->streaming_width = streaming.width;
+					resource->streaming_height = streaming.height;
+					resource->residency.mip_count = streaming.mip_count;
+					resource->residency.lowest_mip = streaming.lowest_mip;
+					resource->residency.mip0_size = streaming.mip0_size;
+					resource->residency.target_mip = streaming.first_mip;
+					resource->resident_mip = streaming.first_mip;
+				}
+			}
+			break;
+			case DataType::SOUND:
+			{
+				success = ap::audio::CreateSound(filedata, filesize, &resource->sound);
+			}
+			break;
+			};
+
+			if (success)
+			{
+				resource->flags = flags;
+
+				if (resource->streaming && has_flag(flags, Flags::IMPORT_RETAIN_FILEDATA) == 0)
+				{
+					// streaming creates the detailed mips later from the file data, but it must not be embedded by the serializer
+					if (resource->filedata.empty())
+					{
+						resource->streaming_filedata.resize(filesize);
+						std::memcpy(resource->streaming_filedata.data(), filedata, filesize);
+					}
+					else
+					{
+						resource->streaming_filedata = std::move(resource->filedata);
+						resource->filedata.clear();
+					}
+				}
+
+				if (resource->filedata.empty() && has_flag(flags, Flags::IMPORT_RETAIN_FILEDATA))
+				{
+					// resource was loaded with external filedata, and we want to retain filedata
+					resource->filedata.resize(filesize);
+					std::memcpy(resource->filedata.data(), filedata, filesize);
+				}
+				else if (!resource->filedata.empty() && has_flag(flags, Flags::IMPORT_RETAIN_FILEDATA) == 0)
+				{
+					// resource was loaded using file name, and we want to discard filedata
+					resource->filedata.clear();
+				}
+
+				if (type == DataType::IMAGE && resource->texture.desc.mip_levels > 1
+					&& has_flag(resource->texture.desc.bind_flags, BindFlag::UNORDERED_ACCESS))
+				{
+					ap::renderer::AddDeferredMIPGen(resource->texture, true);
+				}
+
+				return true;
+			}
+
+			return false;
+		}
+
+		// Background loads started by LoadAsync()
+		struct AsyncLoader
+		{
+			ap::jobsystem::context ctx;
+			AsyncLoader()
+			{
+				ctx.priority = ap::jobsystem::Priority::Streaming; // resource loading must not block frame jobs
+			}
+		};
+		static AsyncLoader async_loader;
+
+		// Must be called within lock!
+		static void InitializeTranscoder()
+		{
+			static bool basis_init = false;
+			if (!basis_init)
+			{
+				basis_init = true;
+				basist::basisu_transcoder_init();
+			}
+		}
+
+		// Publish the result of the load, and schedule the waiting LoadAsync() callbacks to the next thread safe point
+		static void FinishLoad(const std::shared_ptr<ResourceInternal>& resource, bool success)
+		{
+			if (success && resource->streaming)
+			{
+				streaming_locker.lock();
+				streaming_resources.push_back(resource);
+				streaming_locker.unlock();
+			}
+
+			resource->callback_locker.lock();
+			resource->state.store(success ? ResourceInternal::LOAD_SUCCEEDED : ResourceInternal::LOAD_FAILED);
+			ap::vector<std::function<void(Resource)>> callbacks = std::move(resource->callbacks);
+			resource->callbacks.clear();
+			resource->callback_locker.unlock();
+
+			if (!callbacks.empty())
+			{
+				Resource result;
+				if (success)
+				{
+					result.internal_state = resource;
+				}
+				ap::eventhandler::Subscribe_Once(ap::eventhandler::EVENT_THREAD_SAFE_POINT, [callbacks, result](uint64_t userdata) {
+					for (auto& callback : callbacks)
+					{
+						callback(result);
+					}
+				});
+			}
+		}
+
+		// Call the callback at the next thread safe point after the resource finished loading
+		static void AddCallback(const std::shared_ptr<ResourceInternal>& resource, const std::function<void(Resource)>& callback)
+		{
+			resource->callback_locker.lock();
+			const uint32_t state = resource->state.load();
+			if (state == ResourceInternal::LOAD_QUEUED || state == ResourceInternal::LOAD_RUNNING)
+			{
+				resource->callbacks.push_back(callback);
+				resource->callback_locker.unlock();
+				return;
+			}
+			resource->callback_locker.unlock();
+
+			Resource result;
+			if (state == ResourceInternal::LOAD_SUCCEEDED)
+			{
+				result.internal_state = resource;
+			}
+			ap::eventhandler::Subscribe_Once(ap::eventhandler::EVENT_THREAD_SAFE_POINT, [callback, result](uint64_t userdata) {
+				callback(result);
+			});
+		}
+
+		// Wait until an other thread finishes loading the resource
+		//	If the load was only queued, the current thread takes it over instead, so waiting never depends on a job that hasn't started
+		static bool WaitLoad(const std::shared_ptr<ResourceInternal>& resource, Flags flags, const uint8_t* filedata, size_t filesize)
+		{
+			uint32_t expected = ResourceInternal::LOAD_QUEUED;
+			if (resource->state.compare_exchange_strong(expected, ResourceInternal::LOAD_RUNNING))
+			{
+				const bool success = LoadInternal(resource.get(), resource->name, flags, filedata, filesize);
+				FinishLoad(resource, success);
+				return success;
+			}
+			while (resource->state.load() == ResourceInternal::LOAD_RUNNING)
+			{
+				std::this_thread::yield();
+			}
+			return resource->state.load() == ResourceInternal::LOAD_SUCCEEDED;
+		}
+
+		Resource Load(const std::string& name, Flags flags, const uint8_t* filedata, size_t filesize)
+		{
+			if (mode == Mode::DISCARD_FILEDATA_AFTER_LOAD)
+			{
+				flags &= ~Flags::IMPORT_RETAIN_FILEDATA;
+			}
+
+			locker.lock();
+			std::weak_ptr<ResourceInternal>& weak_resource = resources[name];
+			std::shared_ptr<ResourceInternal> resource = weak_resource.lock();
+			InitializeTranscoder();
+
+			if (resource == nullptr || resource->state.load() == ResourceInternal::LOAD_FAILED)
+			{
+				// The entry is published in LOAD_RUNNING state, so concurrent requests will wait for this load instead of using a half loaded resource:
+				resource = std::make_shared<ResourceInternal>();
+				resource->state.store(ResourceInternal::LOAD_RUNNING);
+				weak_resource = resource;
+				locker.unlock();
+			}
+			else
+			{
+				locker.unlock();
+				Resource retVal;
+				if (WaitLoad(resource, flags, filedata, filesize))
+				{
+					retVal.internal_state = resource;
+				}
+				return retVal;
+			}
+
+			const bool success = LoadInternal(resource.get(), name, flags, filedata, filesize);
+			FinishLoad(resource, success);
+
+			Resource retVal;
+			if (success)
+			{
+				retVal.internal_state = resource;
+			}
+			return retVal;
+		}
+
+		LoadHandle LoadAsync(const std::string& name, Flags flags, std::function<void(Resource)> callback)
+		{
+			if (mode == Mode::DISCARD_FILEDATA_AFTER_LOAD)
+			{
+				flags &= ~Flags::IMPORT_RETAIN_FILEDATA;
+			}
+
+			locker.lock();
+			std::weak_ptr<ResourceInternal>& weak_resource = resources[name];
+			std::shared_ptr<ResourceInternal> resource = weak_resource.lock();
+			InitializeTranscoder();
+
+			bool queued = false;
+			if (resource == nullptr || resource->state.load() == ResourceInternal::LOAD_FAILED)
+			{
+				resource = std::make_shared<ResourceInternal>();
+				resource->state.store(ResourceInternal::LOAD_QUEUED);
+				resource->name = name;
+				resource->flags = flags;
+				weak_resource = resource;
+				queued = true;
+			}
+			locker.unlock();
+
+			if (callback != nullptr)
+			{
+				AddCallback(resource, callback);
+			}
+
+			if (queued)
+			{
+				ap::jobsystem::Execute(async_loader.ctx, [resource](ap::jobsystem::JobArgs args) {
+					uint32_t expected = ResourceInternal::LOAD_QUEUED;
+					if (resource->state.compare_exchange_strong(expected, ResourceInternal::LOAD_RUNNING))
+					{
+						FinishLoad(resource, LoadInternal(resource.get(), resource->name, resource->flags, nullptr, 0));
+					}
+				});
+			}
+
+			LoadHandle handle;
+			handle.internal_state = resource;
+			return handle;
+		}
+
+		bool LoadHandle::IsReady() const
+		{
+			const ResourceInternal* resource = (ResourceInternal*)internal_state.get();
+			const uint32_t state = resource->state.load();
+			return state == ResourceInternal::LOAD_SUCCEEDED || state == ResourceInternal::LOAD_FAILED;
+		}
+		Resource LoadHandle::Get() const
+		{
+			std::shared_ptr<ResourceInternal> resource = std::static_pointer_cast<ResourceInternal>(internal_state);
+			Resource retVal;
+			if (WaitLoad(resource, resource->flags, nullptr, 0))
+			{
+				retVal.internal_state = resource;
+			}
+			return retVal;
+		}
+
+		bool Contains(const std::string& name)
+		{
+			bool result = false;
+			locker.lock();
+			auto it = resources.find(name);
+			if (it != resources.end())
+			{
+				auto resource = it->second.lock();
+				result = resource != nullptr;
+			}
+			locker.unlock();
+			return result;
+		}
+
+		void Clear()
+		{
+			locker.lock();
+			resources.clear();
+			locker.unlock();
+		}
+
+		void SetTextureStreamingEnabled(bool value)
+		{
+			texture_streaming_enabled = value;
+		}
+		bool IsTextureStreamingEnabled()
+		{
+			return texture_streaming_enabled;
+		}
+		void SetTextureStreamingMemoryBudget(uint64_t bytes)
+		{
+			texture_streaming_budget = bytes;
+		}
+		uint64_t GetTextureStreamingMemoryBudget()
+		{
+			return texture_streaming_budget;
+		}
+
+		void StreamingRequest(const Resource& resource, float resolution)
+		{
+			ResourceInternal* resourceinternal = (ResourceInternal*)resource.internal_state.get();
+			if (resourceinternal == nullptr || !resourceinternal->streaming || resolution <= 0)
+			{
+				return;
+			}
+
+			const float size = (float)std::max(resourceinternal->streaming_width, resourceinternal->streaming_height);
+			uint32_t mip = 0;
+			if (resolution < size)
+			{
+				mip = std::min((uint32_t)std::log2(size / resolution), resourceinternal->residency.mip_count - 1);
+			}
+
+			// Keep the most detailed request from all the views and threads:
+			uint32_t prev = resourceinternal->requested_mip.load();
+			while (mip < prev && !resourceinternal->requested_mip.compare_exchange_weak(prev, mip));
+		}
+
+		uint64_t ComputeStreamingMemorySize(const StreamingResidency& residency, uint32_t first_mip)
+		{
+			uint64_t size = 0;
+			for (uint32_t mip = first_mip; mip < residency.mip_count; ++mip)
+			{
+				size += std::max<uint64_t>(1, residency.mip0_size >> (2 * mip));
+			}
+			return size;
+		}
+
+		void ComputeStreamingResidency(StreamingResidency* residencies, size_t count, uint64_t budget)
+		{
+			uint64_t total = 0;
+			for (size_t i = 0; i < count; ++i)
+			{
+				StreamingResidency& residency = residencies[i];
+				residency.target_mip = std::min(residency.requested_mip, residency.lowest_mip);
+				total += ComputeStreamingMemorySize(residency, residency.target_mip);
+			}
+			if (total <= budget)
+			{
+				return;
+			}
+
+			// Over budget: drop the top mips one by one, always from the texture that has the largest top mip currently
+			auto top_mip_size = [&](size_t i) {
+				return residencies[i].mip0_size >> (2 * residencies[i].target_mip);
+			};
+			auto compare = [&](size_t a, size_t b) {
+				return top_mip_size(a) < top_mip_size(b);
+			};
+			ap::vector<size_t> heap;
+			heap.reserve(count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (residencies[i].target_mip < residencies[i].lowest_mip)
+				{
+					heap.push_back(i);
+				}
+			}
+			std::make_heap(heap.begin(), heap.end(), compare);
+			while (total > budget && !heap.empty())
+			{
+				std::pop_heap(heap.begin(), heap.end(), compare);
+				const size_t i = heap.back();
+				heap.pop_back();
+				StreamingResidency& residency = residencies[i];
+				total -= std::max<uint64_t>(1, residency.mip0_size >> (2 * residency.target_mip));
+				residency.target_mip++;
+				if (residency.target_mip < residency.lowest_mip)
+				{
+					heap.push_back(i);
+					std::push_heap(heap.begin(), heap.end(), compare);
+				}
+			}
+		}
+
+		void UpdateStreamingResources()
+		{
+			static constexpr uint32_t unrequested_frame_threshold = 60; // frames to wait before reducing the resolution, to avoid reloading mips back and forth
+			static constexpr uint32_t max_jobs_per_update = 8;
+
+			static ap::vector<std::shared_ptr<ResourceInternal>> streamed;
+			static ap::vector<StreamingResidency> residencies;
+			streamed.clear();
+			residencies.clear();
+
+			streaming_locker.lock();
+			for (size_t i = 0; i < streaming_resources.size();)
+			{
+				std::shared_ptr<ResourceInternal> resource = streaming_resources[i].lock();
+				if (resource == nullptr)
+				{
+					streaming_resources[i] = std::move(streaming_resources.back());
+					streaming_resources.pop_back();
+					continue;
+				}
+				streamed.push_back(std::move(resource));
+				i++;
+			}
+			streaming_locker.unlock();
+
+			for (auto& resource : streamed)
+			{
+				// Swap in the finished texture, the old one is released by the graphics device after the GPU finished using it:
+				if (resource->streaming_state.load() == ResourceInternal::STREAMING_DONE)
+				{
+					if (resource->streaming_texture.IsValid())
+					{
+						resource->texture = std::move(resource->streaming_texture);
+						resource->resident_mip = resource->streaming_texture_mip;
+					}
+					resource->streaming_texture = {};
+					resource->streaming_state.store(ResourceInternal::STREAMING_IDLE);
+				}
+
+				// More detail is accepted immediately, less detail only when it was requested for a while:
+				const uint32_t requested_mip = resource->requested_mip.exchange(~0u);
+				if (requested_mip <= resource->residency.requested_mip)
+				{
+					resource->residency.requested_mip = requested_mip;
+					resource->unrequested_frames = 0;
+				}
+				else if (++resource->unrequested_frames > unrequested_frame_threshold)
+				{
+					resource->residency.requested_mip = requested_mip;
+					resource->unrequested_frames = 0;
+				}
+				residencies.push_back(resource->residency);
+			}
+
+			ComputeStreamingResidency(residencies.data(), residencies.size(), texture_streaming_budget);
+
+			uint32_t job_count = 0;
+			for (size_t i = 0; i < streamed.size(); ++i)
+			{
+				std::shared_ptr<ResourceInternal>& resource = streamed[i];
+				const uint32_t target_mip = residencies[i].target_mip;
+				resource->residency.target_mip = target_mip;
+				if (target_mip == resource->resident_mip || resource->streaming_state.load() != ResourceInternal::STREAMING_IDLE || job_count >= max_jobs_per_update)
+				{
+					continue;
+				}
+				resource->streaming_state.store(ResourceInternal::STREAMING_RUNNING);
+				job_count++;
+
+				ap::jobsystem::Execute(async_loader.ctx, [resource, target_mip](ap::jobsystem::JobArgs args) {
+					const ap::vector<uint8_t>& filedata = resource->streaming_filedata.empty() ? resource->filedata : resource->streaming_filedata;
+					const std::string ext = ap::helper::toUpper(ap::helper::GetExtensionFromFileName(resource->name));
+					StreamingInfo streaming;
+					streaming.first_mip = target_mip;
+					Texture texture;
+					if (CreateImage(resource->name, ext, resource->flags, filedata.data(), filedata.size(), texture, &streaming))
+					{
+						resource->streaming_texture = std::move(texture);
+						resource->streaming_texture_mip = streaming.first_mip;
+					}
+					resource->streaming_state.store(ResourceInternal::STREAMING_DONE);
+				});
+			}
+		}
+
+		void SetTextureCacheDirectory(const std::string& directory)
+		{
+			texture_cache_directory = directory;
+		}
+		const std::string& GetTextureCacheDirectory()
+		{
+			return texture_cache_directory;
+		}
+
+		size_t PrewarmTextureCache(const ap::vector<std::string>& fileNames)
+		{
+			if (texture_cache_directory.empty())
+			{
+				return 0;
+			}
+			locker.lock();
+			InitializeTranscoder();
+			locker.unlock();
+
+			std::atomic<size_t> count{ 0 };
+			ap::jobsystem::context ctx;
+			ctx.priority = ap::jobsystem::GetLoadingPriority();
+			ap::jobsystem::Dispatch(ctx, (uint32_t)fileNames.size(), 1, [&](ap::jobsystem::JobArgs args) {
+				const std::string& name = fileNames[args.jobIndex];
+				const std::string ext = ap::helper::toUpper(ap::helper::GetExtensionFromFileName(name));
+				auto it = types.find(ext);
+				if (it == types.end() || it->second != DataType::IMAGE || !IsTextureCacheable(ext, Flags::NONE))
+				{
+					return;
+				}
+				ap::vector<uint8_t> filedata;
+				if (!ap::helper::FileRead(name, filedata))
+				{
+					return;
+				}
+				const uint64_t key = ComputeTextureCacheKey(filedata.data(), filedata.size(), Flags::NONE);
+				if (ap::helper::FileExists(GetTextureCachePath(key)))
+				{
+					return;
+				}
+				DecodedImage image;
+				if (DecodeImage(ext, filedata.data(), filedata.size(), image, nullptr) && WriteTextureCache(key, image))
+				{
+					count.fetch_add(1);
+				}
+			});
+			ap::jobsystem::Wait(ctx);
+			return count.load();
+		}
+
+		uint64_t PruneTextureCache(uint64_t max_size)
+		{
+			struct CacheFile
+			{
+				std::filesystem::path path;
+				std::filesystem::file_time_type time;
+				uint64_t size;
+			};
+			ap::vector<CacheFile> files;
+			uint64_t total_size = 0;
+
+			std::error_code ec;
+			for (auto& entry : std::filesystem::directory_iterator(texture_cache_directory, ec))
+			{
+				if (!entry.is_regular_file(ec))
+				{
+					continue;
+				}
+				const std::filesystem::path& path = entry.path();
+				if (path.extension() == ".tmp" && path.filename().string().find(texture_cache_extension) != std::string::npos)
+				{
+					// leftover from an interrupted write, but it can also be a write in progress, so only delete old ones:
+					if (std::filesystem::file_time_type::clock::now() - entry.last_write_time(ec) > std::chrono::hours(1))
+					{
+						std::filesystem::remove(path, ec);
+					}
+					continue;
+				}
+				if (path.extension() != texture_cache_extension)
+				{
+					continue;
+				}
+				CacheFile file;
+				file.path = path;
+				file.time = entry.last_write_time(ec);
+				file.size = entry.file_size(ec);
+				total_size += file.size;
+				files.push_back(file);
+			}
+
+			// Delete the least recently used files first:
+			std::sort(files.begin(), files.end(), [](const CacheFile& a, const CacheFile& b) {
+				return a.time < b.time;
+			});
+			for (auto& file : files)
+			{
+				if (total_size <= max_size)
+				{
+					break;
+				}
+				if (std::filesystem::remove(file.path, ec))
+				{
+					total_size -= file.size;
+				}
+			}
+			return total_size;
+		}
+
+
+		void Serialize(ap::Archive& archive, ResourceSerializer& seri)
+		{
+			if (archive.IsReadMode())
+			{
+				size_t serializable_count = 0;
+				archive >> serializable_count;
+
+				struct TempResource
+				{
+					std::string name;
+					Flags flags = Flags::NONE;
+					const uint8_t* filedata = nullptr; // points into the archive, which outlives the loading jobs
+					size_t filesize = 0;
+				};
+				ap::vector<TempResource> temp_resources;
+				temp_resources.resize(serializable_count);
+
+				ap::jobsystem::context ctx;
+				ctx.priority = ap::jobsystem::GetLoadingPriority(); // streaming only when this is an asynchronous load
+				std::mutex seri_locker;
+				for (size_t i = 0; i < serializable_count; ++i)
+				{
+					auto& resource = temp_resources[i];
 
 					archive >> resource.name;
 					uint32_t flags_temp;
 					archive >> flags_temp;
 					resource.flags = (Flags)flags_temp;
-					archive >> resource.filedata;
+					resource.filedata = archive.MapVector<uint8_t>(resource.filesize);
 
 					resource.name = archive.GetSourceDirectory() + resource.name;
 
 					// "Loading" the resource can happen asynchronously to serialization of file data, to improve performance
 					ap::jobsystem::Execute(ctx, [i, &temp_resources, &seri_locker, &seri](ap::jobsystem::JobArgs args) {
 						auto& tmp_resource = temp_resources[i];
-						auto res = Load(tmp_resource.name, tmp_resource.flags, tmp_resource.filedata.data(), tmp_resource.filedata.size());
+						auto res = Load(tmp_resource.name, tmp_resource.flags, tmp_resource.filedata, tmp_resource.filesize);
 						seri_locker.lock();
 						seri.resources.push_back(res);
 						seri_locker.unlock();
@@ -713,31 +1608,28 @@ namespace ap
 				}
 				else
 				{
-					// Count embedded resources:
+					// Collect embedded resources, only the finished ones, because the others can still be written by loading threads:
+					ap::vector<std::pair<std::string, std::shared_ptr<ResourceInternal>>> embedded_resources;
 					for (auto& it : resources)
 					{
 						std::shared_ptr<ResourceInternal> resource = it.second.lock();
-						if (resource != nullptr && !resource->filedata.empty())
+						if (resource != nullptr && resource->state.load() == ResourceInternal::LOAD_SUCCEEDED && !resource->filedata.empty())
 						{
-							serializable_count++;
+							embedded_resources.emplace_back(it.first, std::move(resource));
 						}
 					}
 
 					// Write all embedded resources:
+					serializable_count = embedded_resources.size();
 					archive << serializable_count;
-					for (auto& it : resources)
+					for (auto& it : embedded_resources)
 					{
-						std::shared_ptr<ResourceInternal> resource = it.second.lock();
+						std::string name = it.first;
+						ap::helper::MakePathRelative(archive.GetSourceDirectory(), name);
 
-						if (resource != nullptr && !resource->filedata.empty())
-						{
-							std::string name = it.first;
-							ap::helper::MakePathRelative(archive.GetSourceDirectory(), name);
-
-							archive << name;
-							archive << (uint32_t)resource->flags;
-							archive << resource->filedata;
-						}
+						archive << name;
+						archive << (uint32_t)it.second->flags;
+						archive << it.second->filedata;
 					}
 				}
 				locker.unlock();
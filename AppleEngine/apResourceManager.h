@@ -7,6 +7,7 @@
 #include "apVector.h"
 
 #include <memory>
+#include <functional>
 
 namespace ap
 {
@@ -46,6 +47,7 @@ namespace ap
 			NONE = 0,
 			IMPORT_COLORGRADINGLUT = 1 << 0, // image import will convert resource to 3D color grading LUT
 			IMPORT_RETAIN_FILEDATA = 1 << 1, // file data will be kept for later reuse. This is necessary for keeping the resource serializable
+			IMPORT_STREAMING = 1 << 2, // image will be created with its low resolution mips only, the detailed mips are streamed in when requested with StreamingRequest()
 		};
 
 		// Load a resource
@@ -59,11 +61,74 @@ namespace ap
 			const uint8_t* filedata = nullptr,
 			size_t filesize = 0
 		);
+
+		// Handle to a resource that is loading in the background, returned by LoadAsync()
+		struct LoadHandle
+		{
+			std::shared_ptr<void> internal_state;
+			inline bool IsValid() const { return internal_state.get() != nullptr; }
+
+			// Check if loading finished, either successfully or not
+			bool IsReady() const;
+			// Returns the resource, waiting for it to finish loading if necessary. The resource is invalid if loading failed
+			//	If no thread started the loading yet, the calling thread will perform it instead of waiting
+			Resource Get() const;
+		};
+		// Load a resource from file asynchronously, on a background job
+		//	Concurrent requests for the same resource (with Load() or LoadAsync()) share a single load
+		//	name : file name of resource
+		//	flags : specify flags that modify behaviour (optional)
+		//	callback : called at the next EVENT_THREAD_SAFE_POINT after loading finished, the resource is invalid if loading failed (optional)
+		LoadHandle LoadAsync(
+			const std::string& name,
+			Flags flags = Flags::NONE,
+			std::function<void(Resource)> callback = nullptr
+		);
 		// Check if a resource is currently loaded
 		bool Contains(const std::string& name);
 		// Invalidate all resources
 		void Clear();
 
+		// Texture streaming: images loaded with IMPORT_STREAMING are created from a low resolution mip first
+		//	The more detailed mips are loaded in the background when requested, while keeping the streamed textures within the memory budget
+		//	Supported for KTX2, BASIS and 2D DDS images, other images are always loaded fully
+		void SetTextureStreamingEnabled(bool value);
+		bool IsTextureStreamingEnabled();
+		void SetTextureStreamingMemoryBudget(uint64_t bytes);
+		uint64_t GetTextureStreamingMemoryBudget();
+		// Request the resolution that a streamed texture is displayed with (in pixels). It is thread safe, can be called from rendering jobs every frame
+		void StreamingRequest(const Resource& resource, float resolution);
+		// Starts loading the requested mips and replaces the textures whose loading finished
+		//	Must be called once per frame, at a point where the textures are not used by other threads
+		void UpdateStreamingResources();
+
+		// Mip residency of a streamed texture
+		struct StreamingResidency
+		{
+			uint32_t mip_count = 1;			// mip count of the full resolution texture
+			uint32_t lowest_mip = 0;		// the least detailed mip that can be the top mip, this will always be resident
+			uint32_t requested_mip = ~0u;	// the most detailed mip that was requested, ~0u if the texture is not requested
+			uint64_t mip0_size = 0;			// memory size of the full resolution mip0 in bytes
+			uint32_t target_mip = 0;		// output of ComputeStreamingResidency(): the top mip that should be resident
+		};
+		// Returns the memory size of the mip chain starting from first_mip
+		uint64_t ComputeStreamingMemorySize(const StreamingResidency& residency, uint32_t first_mip);
+		// Computes the target mips of streamed textures, so that the requested mips fit into the memory budget
+		//	If the requests don't fit, the top mips of the largest textures are dropped first
+		//	This only computes the policy, it doesn't use the graphics device
+		void ComputeStreamingResidency(StreamingResidency* residencies, size_t count, uint64_t budget);
+
+		// Transcoded texture cache: images that need decoding or transcoding (KTX2, BASIS, PNG, JPG, TGA, BMP) are stored in a GPU ready form on disk
+		//	Later loads of the same image read the cache file instead of decoding it again
+		//	Cache entries are identified by the hash of the file contents, the target formats and the import flags that modify the decoded image
+		//	directory : the cache location, empty string disables the cache (default)
+		void SetTextureCacheDirectory(const std::string& directory);
+		const std::string& GetTextureCacheDirectory();
+		// Creates the missing cache entries of image files, without creating any textures. Returns the number of new cache entries
+		size_t PrewarmTextureCache(const ap::vector<std::string>& fileNames);
+		// Deletes the least recently used cache entries until the size of the cache is at most max_size bytes. Returns the remaining size
+		uint64_t PruneTextureCache(uint64_t max_size);
+
 		struct ResourceSerializer
 		{
 			ap::vector<Resource> resources;
@@ -372,7 +372,7 @@ namespace ap::scene
 		{
 			if (!x.name.empty())
 			{
-				x.resource = ap::resourcemanager::Load(x.name, ap::resourcemanager::Flags::IMPORT_RETAIN_FILEDATA);
+				x.resource = ap::resourcemanager::Load(x.name, ap::resourcemanager::Flags::IMPORT_RETAIN_FILEDATA | ap::resourcemanager::Flags::IMPORT_STREAMING);
 			}
 		}
 	}
@@ -730,6 +730,41 @@ namespace ap::scene
 			assert(success);
 			device->SetName(&BLAS, "BLAS");
 		}
+
+		BuildBVH();
+	}
+	void MeshComponent::BuildBVH()
+	{
+		bvh.Clear();
+
+		if (IsSkinned() || !targets.empty())
+		{
+			// Deformed meshes are intersected per triangle with their current vertex positions
+			return;
+		}
+
+		ap::vector<AABB> triangle_aabbs;
+		triangle_aabbs.reserve(indices.size() / 3);
+		for (auto& subset : subsets)
+		{
+			for (uint32_t i = 0; i + 2 < subset.indexCount; i += 3)
+			{
+				const uint32_t first = subset.indexOffset + i;
+				const XMFLOAT3& p0 = vertex_positions[indices[first + 0]];
+				const XMFLOAT3& p1 = vertex_positions[indices[first + 1]];
+				const XMFLOAT3& p2 = vertex_positions[indices[first + 2]];
+				AABB& aabb = triangle_aabbs.emplace_back(ap::math::Min(p0, ap::math::Min(p1, p2)), ap::math::Max(p0, ap::math::Max(p1, p2)));
+				aabb.userdata = first;
+			}
+		}
+
+		bvh.Build(triangle_aabbs.data(), (uint32_t)triangle_aabbs.size());
+
+		// Remap leaves from the build array to the triangle index offsets:
+		for (auto& leaf : bvh.leaf_indices)
+		{
+			leaf = triangle_aabbs[leaf].userdata;
+		}
 	}
 	void MeshComponent::WriteShaderMesh(ShaderMesh* dest) const
 	{
@@ -1458,6 +1493,13 @@ namespace ap::scene
 
 
 
+	// Object BVHs above this size are rebuilt by a background job instead of stalling the frame
+	static constexpr uint32_t OBJECT_BVH_ASYNC_BUILD_THRESHOLD = 32768;
+
+	Scene::~Scene()
+	{
+		ap::jobsystem::Wait(object_bvh_build_ctx);
+	}
 	void Scene::Update(float dt)
 	{
 		this->dt = dt;
@@ -1586,60 +1628,53 @@ namespace ap::scene
 			queryAllocator.store(0);
 		}
 
-		ap::jobsystem::context ctx;
+		if (hierarchy_order_dirty)
+		{
+			SortHierarchy();
+		}
 
-		ap::jobsystem::Execute(ctx, [&](ap::jobsystem::JobArgs args) {
+		// The update systems are expressed as a task graph, each system starts as soon as the systems it depends on are finished:
+		ap::jobsystem::TaskGraph graph;
+		using TaskID = ap::jobsystem::TaskGraph::TaskID;
+
+		const TaskID task_tlas_clear = graph.AddTask([&](ap::jobsystem::context& ctx) {
 			// Must not keep inactive TLAS instances, so zero them out for safety:
 			std::memset(TLAS_instancesMapped, 0, TLAS_instancesUpload->desc.size);
 		});
 
-		RunPreviousFrameTransformUpdateSystem(ctx);
-
-		RunAnimationUpdateSystem(ctx);
-
-		RunTransformUpdateSystem(ctx);
-
-		ap::jobsystem::Wait(ctx); // dependencies
-
-		RunHierarchyUpdateSystem(ctx);
-
-		RunMeshUpdateSystem(ctx);
-
-		RunMaterialUpdateSystem(ctx);
+		const TaskID task_prev_transform = graph.AddTask([&](ap::jobsystem::context& ctx) { RunPreviousFrameTransformUpdateSystem(ctx); });
+		const TaskID task_animation = graph.AddTask([&](ap::jobsystem::context& ctx) { RunAnimationUpdateSystem(ctx); });
+		const TaskID task_weather = graph.AddTask([&](ap::jobsystem::context& ctx) { RunWeatherUpdateSystem(ctx); });
+		const TaskID task_impostor = graph.AddTask([&](ap::jobsystem::context& ctx) { RunImpostorUpdateSystem(ctx); });
 
-		ap::jobsystem::Wait(ctx); // dependencies
+		// Local transforms are written by animations, world matrices must be saved before they are overwritten:
+		const TaskID task_transform = graph.AddTask([&](ap::jobsystem::context& ctx) { RunTransformUpdateSystem(ctx); }, { task_prev_transform, task_animation });
+		const TaskID task_hierarchy = graph.AddTask([&](ap::jobsystem::context& ctx) { RunHierarchyUpdateSystem(ctx); }, { task_transform });
 
-		RunSpringUpdateSystem(ctx);
+		// Morph weights and material parameters can be animated:
+		const TaskID task_material = graph.AddTask([&](ap::jobsystem::context& ctx) { RunMaterialUpdateSystem(ctx); }, { task_animation });
+		const TaskID task_mesh = graph.AddTask([&](ap::jobsystem::context& ctx) { RunMeshUpdateSystem(ctx); }, { task_animation, task_material });
 
-		RunInverseKinematicsUpdateSystem(ctx);
+		// Springs, IK and armatures modify and read world transforms in this order:
+		const TaskID task_spring = graph.AddTask([&](ap::jobsystem::context& ctx) { RunSpringUpdateSystem(ctx); }, { task_hierarchy, task_weather });
+		const TaskID task_ik = graph.AddTask([&](ap::jobsystem::context& ctx) { RunInverseKinematicsUpdateSystem(ctx); }, { task_spring });
+		const TaskID task_armature = graph.AddTask([&](ap::jobsystem::context& ctx) { RunArmatureUpdateSystem(ctx); }, { task_ik });
 
-		RunArmatureUpdateSystem(ctx);
+		// Physics writes the final world transforms of simulated objects, everything below reads them:
+		const TaskID task_physics = graph.AddTask([&](ap::jobsystem::context& ctx) { ap::physics::RunPhysicsUpdateSystem(ctx, *this, dt); }, { task_armature, task_mesh });
 
-		RunImpostorUpdateSystem(ctx);
+		graph.AddTask([&](ap::jobsystem::context& ctx) { RunObjectUpdateSystem(ctx); }, { task_physics, task_material, task_impostor, task_tlas_clear });
+		const TaskID task_camera = graph.AddTask([&](ap::jobsystem::context& ctx) { RunCameraUpdateSystem(ctx); }, { task_physics });
+		graph.AddTask([&](ap::jobsystem::context& ctx) { RunDecalUpdateSystem(ctx); }, { task_physics, task_material });
+		graph.AddTask([&](ap::jobsystem::context& ctx) { RunProbeUpdateSystem(ctx); }, { task_physics });
+		graph.AddTask([&](ap::jobsystem::context& ctx) { RunForceUpdateSystem(ctx); }, { task_physics });
+		graph.AddTask([&](ap::jobsystem::context& ctx) { RunLightUpdateSystem(ctx); }, { task_physics, task_weather });
+		graph.AddTask([&](ap::jobsystem::context& ctx) { RunParticleUpdateSystem(ctx); }, { task_physics, task_weather });
+		graph.AddTask([&](ap::jobsystem::context& ctx) { RunSoundUpdateSystem(ctx); }, { task_physics, task_camera });
 
-		RunWeatherUpdateSystem(ctx);
-
-		ap::jobsystem::Wait(ctx); // dependencies
-
-		ap::physics::RunPhysicsUpdateSystem(ctx, *this, dt);
-
-		RunObjectUpdateSystem(ctx);
-
-		RunCameraUpdateSystem(ctx);
-
-		RunDecalUpdateSystem(ctx);
-
-		RunProbeUpdateSystem(ctx);
-
-		RunForceUpdateSystem(ctx);
-
-		RunLightUpdateSystem(ctx);
-
-		RunParticleUpdateSystem(ctx);
-
-		RunSoundUpdateSystem(ctx);
-
-		ap::jobsystem::Wait(ctx); // dependencies
+		ap::jobsystem::context ctx;
+		graph.Run(ctx);
+		ap::jobsystem::Wait(ctx); // all systems
 
 		// Merge parallel bounds computation (depends on object update system):
 		bounds = AABB();
@@ -1648,6 +1683,71 @@ namespace ap::scene
 			bounds = AABB::Merge(bounds, group_bound);
 		}
 
+		// CPU BVH over the object bounds (depends on object update system):
+		changed_objects.resize(changed_object_count.load());
+		occluder_objects.resize(occluder_object_count.load());
+		const uint32_t object_count = (uint32_t)aabb_objects.GetCount();
+		bool object_bvh_refit = true;
+		if (object_bvh.leaf_count != object_count || object_bvh.IsRebuildRecommended())
+		{
+			if (object_count < OBJECT_BVH_ASYNC_BUILD_THRESHOLD)
+			{
+				object_bvh.Build(object_count > 0 ? &aabb_objects[0] : nullptr, object_count, 1);
+				object_bvh_refit = false;
+			}
+			else if (!ap::jobsystem::IsBusy(object_bvh_build_ctx))
+			{
+				if (object_bvh_pending.IsValid() && object_bvh_pending.leaf_count == object_count)
+				{
+					// The background build finished, it only needs a refit because it was built from the bounds of an earlier frame:
+					std::swap(object_bvh, object_bvh_pending);
+					object_bvh_pending.Clear();
+					object_bvh.Refit(&aabb_objects[0]);
+					object_bvh_refit = false;
+				}
+				else
+				{
+					// Building a large tree would stall the frame, so it's done in the background
+					//	Until it's finished, the current tree is refitted if it still matches the objects, otherwise the queries test every object
+					object_bvh_pending_aabbs.assign(&aabb_objects[0], &aabb_objects[0] + object_count);
+					object_bvh_build_ctx.priority = ap::jobsystem::Priority::Streaming;
+					ap::jobsystem::Execute(object_bvh_build_ctx, [this](ap::jobsystem::JobArgs args) {
+						object_bvh_pending.Build(object_bvh_pending_aabbs.data(), (uint32_t)object_bvh_pending_aabbs.size(), 1);
+					});
+				}
+			}
+		}
+		if (object_bvh_refit && object_bvh.IsValid() && object_bvh.leaf_count == object_count && !changed_objects.empty())
+		{
+			if (changed_objects.size() > aabb_objects.GetCount() / 8)
+			{
+				// When many objects moved, it's faster to update all nodes linearly:
+				object_bvh.Refit(&aabb_objects[0]);
+			}
+			else
+			{
+				object_bvh.Refit(&aabb_objects[0], changed_objects.data(), (uint32_t)changed_objects.size());
+			}
+		}
+
+		// Lights and decals are few, their BVHs are simply refitted completely:
+		if (light_bvh.leaf_count != (uint32_t)aabb_lights.GetCount() || light_bvh.IsRebuildRecommended())
+		{
+			light_bvh.Build(aabb_lights.GetCount() > 0 ? &aabb_lights[0] : nullptr, (uint32_t)aabb_lights.GetCount(), 1);
+		}
+		else if (light_bvh.IsValid())
+		{
+			light_bvh.Refit(&aabb_lights[0]);
+		}
+		if (decal_bvh.leaf_count != (uint32_t)aabb_decals.GetCount() || decal_bvh.IsRebuildRecommended())
+		{
+			decal_bvh.Build(aabb_decals.GetCount() > 0 ? &aabb_decals[0] : nullptr, (uint32_t)aabb_decals.GetCount(), 1);
+		}
+		else if (decal_bvh.IsValid())
+		{
+			decal_bvh.Refit(&aabb_decals[0]);
+		}
+
 		if (lightmap_refresh_needed.load())
 		{
 			SetAccelerationStructureUpdateRequested(true);
@@ -1846,6 +1946,15 @@ namespace ap::scene
 
 		TLAS = RaytracingAccelerationStructure();
 		BVH.Clear();
+		ap::jobsystem::Wait(object_bvh_build_ctx);
+		object_bvh.Clear();
+		object_bvh_pending.Clear();
+		object_bvh_pending_aabbs.clear();
+		light_bvh.Clear();
+		decal_bvh.Clear();
+		changed_objects.clear();
+		object_slot_entities.clear();
+		occluder_objects.clear();
 		waterRipples.clear();
 
 		surfelBuffer = {};
@@ -1864,6 +1973,7 @@ namespace ap::scene
 		transforms.Merge(other.transforms);
 		prev_transforms.Merge(other.prev_transforms);
 		hierarchy.Merge(other.hierarchy);
+		hierarchy_order_dirty = true;
 		materials.Merge(other.materials);
 		meshes.Merge(other.meshes);
 		impostors.Merge(other.impostors);
@@ -1895,7 +2005,7 @@ namespace ap::scene
 	void Scene::Entity_Remove(Entity entity)
 	{
 		Component_Detach(entity); // special case, this will also remove entity from hierarchy but also do more!
-		hierarchy.Remove(entity);
+		hierarchy.Remove_KeepSorted(entity); // keep the hierarchy sorted by depth
 
 		names.Remove(entity);
 		layers.Remove(entity);
@@ -2194,26 +2304,23 @@ namespace ap::scene
 			Component_Detach(entity);
 		}
 
-
-		HierarchyComponent* parentcomponent = hierarchy.GetComponent(entity);
-		if (parentcomponent == nullptr)
+		if (!hierarchy.Contains(entity))
 		{
-			parentcomponent = &hierarchy.Create(entity);
+			hierarchy.Create(entity);
 		}
-
-		parentcomponent->parentID = parent;
-
-		HierarchyComponent* parentHierarchy = hierarchy.GetComponent(parent);
-		if (parentHierarchy == nullptr)
+		if (!hierarchy.Contains(parent))
 		{
-			parentHierarchy = &hierarchy.Create(parent);
+			hierarchy.Create(parent);
 		}
 
+		HierarchyComponent* parentHierarchy = hierarchy.GetComponent(parent);
 		if (std::find(parentHierarchy->childrenID.begin(), parentHierarchy->childrenID.end(),entity ) == parentHierarchy->childrenID.end())
 		{
 			parentHierarchy->childrenID.push_back(entity);
 		}
-		
+
+		hierarchy.GetComponent(entity)->parentID = parent;
+		hierarchy_order_dirty = true;
 
 		TransformComponent* transform_parent = transforms.GetComponent(parent);
 		if (transform_parent == nullptr)
@@ -2234,6 +2341,7 @@ namespace ap::scene
 			transform_child->UpdateTransform();
 		}
 		transform_child->UpdateTransform_Parented(*transform_parent);
+		transform_child->SetDirty(); // the world matrix changed, this will be propagated to the descendants in the next update
 
 		LayerComponent* layer_parent = layers.GetComponent(parent);
 		if (layer_parent == nullptr)
@@ -2264,9 +2372,10 @@ namespace ap::scene
 				layer->propagationMask = ~0;
 			}
 
+			const Entity parentID = parent->parentID;
 			parent->parentID = ap::ecs::INVALID_ENTITY;
 
-			HierarchyComponent* parentHierarchy = hierarchy.GetComponent(parent->parentID);
+			HierarchyComponent* parentHierarchy = hierarchy.GetComponent(parentID);
 			if (parentHierarchy != nullptr)
 			{
 				parentHierarchy->childrenID.erase(std::remove(parentHierarchy->childrenID.begin(), parentHierarchy->childrenID.end(), entity), parentHierarchy->childrenID.end());
@@ -2278,28 +2387,123 @@ namespace ap::scene
 			
 			//if(parent->childrenID.size() == 0)
 				//hierarchy.Remove(entity);
-			
+
+			// The detached subtree becomes a root:
+			hierarchy_order_dirty = true;
 		}
 	}
 	void Scene::Component_DetachChildren(Entity parent)
 	{
-		for (size_t i = 0; i < hierarchy.GetCount(); )
+		// Detaching reorders the hierarchy, so the children are collected first:
+		ap::vector<Entity> children;
+		for (size_t i = 0; i < hierarchy.GetCount(); ++i)
 		{
 			if (hierarchy[i].parentID == parent)
 			{
-				Entity entity = hierarchy.GetEntity(i);
-				Component_Detach(entity);
+				children.push_back(hierarchy.GetEntity(i));
 			}
-			else
+		}
+		for (Entity entity : children)
+		{
+			Component_Detach(entity);
+		}
+	}
+
+	void Scene::SortHierarchy()
+	{
+		hierarchy_order_dirty = false;
+		const size_t count = hierarchy.GetCount();
+
+		// Compute the depth of every entry, entries whose parent is not in the hierarchy are roots:
+		ap::vector<uint32_t> depths(count, ~0u);
+		ap::vector<size_t> chain;
+		uint32_t maxDepth = 0;
+		for (size_t i = 0; i < count; ++i)
+		{
+			chain.clear();
+			size_t index = i;
+			while (index != ap::ecs::INVALID_INDEX && depths[index] == ~0u && chain.size() <= count)
+			{
+				chain.push_back(index);
+				const Entity parentID = hierarchy[index].parentID;
+				index = parentID == INVALID_ENTITY ? ap::ecs::INVALID_INDEX : hierarchy.GetIndex(parentID);
+			}
+			uint32_t depth = (index != ap::ecs::INVALID_INDEX && depths[index] != ~0u) ? depths[index] + 1 : 0;
+			for (auto it = chain.rbegin(); it != chain.rend(); ++it)
 			{
-				++i;
+				depths[*it] = depth++;
 			}
+			maxDepth = std::max(maxDepth, depth);
+		}
+
+		// Counting sort by depth, the order within a level is kept:
+		ap::vector<size_t> offsets(maxDepth + 1, 0);
+		for (uint32_t depth : depths)
+		{
+			offsets[depth]++;
+		}
+		size_t offset = 0;
+		for (size_t& x : offsets)
+		{
+			const size_t levelCount = x;
+			x = offset;
+			offset += levelCount;
 		}
+		ap::vector<size_t> order(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			order[offsets[depths[i]]++] = i;
+		}
+
+		ap::ecs::ComponentManager<HierarchyComponent, ap::ecs::SparseLookup> sorted(count);
+		for (size_t i : order)
+		{
+			HierarchyComponent& component = sorted.Create(hierarchy.GetEntity(i));
+			component = std::move(hierarchy[i]);
+			component.depth = depths[i];
+		}
+		hierarchy.Clear();
+		hierarchy.Merge(sorted);
 	}
 
 
 	const uint32_t small_subtask_groupsize = 64;
 
+	// Transforms that are collected within a job group, so that their matrices can be computed together at the end of the group
+	struct TransformBatch
+	{
+		uint32_t count;
+		TransformComponent* transforms[small_subtask_groupsize];
+		const TransformComponent* parents[small_subtask_groupsize];
+		bool parent_local[small_subtask_groupsize]; // the parent is not in the hierarchy, its local matrix is used instead of the world matrix
+	};
+
+	// Computes the local matrices into the world matrices, 4 transforms at a time
+	inline void ComputeLocalMatrices(TransformComponent* const* transforms, uint32_t count)
+	{
+		uint32_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			const XMFLOAT3* S[4];
+			const XMFLOAT4* R[4];
+			const XMFLOAT3* T[4];
+			XMFLOAT4X4* W[4];
+			for (uint32_t j = 0; j < 4; ++j)
+			{
+				TransformComponent& transform = *transforms[i + j];
+				S[j] = &transform.scale_local;
+				R[j] = &transform.rotation_local;
+				T[j] = &transform.translation_local;
+				W[j] = &transform.world;
+			}
+			ap::math::ComposeMatrix4(S, R, T, W);
+		}
+		for (; i < count; ++i)
+		{
+			XMStoreFloat4x4(&transforms[i]->world, transforms[i]->GetLocalMatrix());
+		}
+	}
+
 	void Scene::RunPreviousFrameTransformUpdateSystem(ap::jobsystem::context& ctx)
 	{
 		ap::jobsystem::Dispatch(ctx, (uint32_t)prev_transforms.GetCount(), small_subtask_groupsize, [&](ap::jobsystem::JobArgs args) {
@@ -2308,7 +2512,12 @@ namespace ap::scene
 			Entity entity = prev_transforms.GetEntity(args.jobIndex);
 			const TransformComponent& transform = *transforms.GetComponent(entity);
 
-			prev_transform.world_prev = transform.world;
+			// The changed state is still from the previous frame here, if it's not set then world_prev is already equal to world:
+			if (transform.IsChanged() || !prev_transform.initialized)
+			{
+				prev_transform.world_prev = transform.world;
+				prev_transform.initialized = true;
+			}
 		});
 	}
 	void Scene::RunAnimationUpdateSystem(ap::jobsystem::context& ctx)
@@ -2613,68 +2822,150 @@ namespace ap::scene
 	}
 	void Scene::RunTransformUpdateSystem(ap::jobsystem::context& ctx)
 	{
+		changed_transforms.resize(transforms.GetCount());
+		changed_transform_count.store(0);
+
 		ap::jobsystem::Dispatch(ctx, (uint32_t)transforms.GetCount(), small_subtask_groupsize, [&](ap::jobsystem::JobArgs args) {
 
+			TransformBatch& batch = *(TransformBatch*)args.sharedmemory;
+			if (args.isFirstJobInGroup)
+			{
+				batch.count = 0;
+			}
+
 			TransformComponent& transform = transforms[args.jobIndex];
-			transform.UpdateTransform();
-		});
+			transform.changed = transform.IsDirty();
+			if (transform.changed)
+			{
+				transform.SetDirty(false);
+				batch.transforms[batch.count++] = &transform;
+				changed_transforms[changed_transform_count.fetch_add(1)] = transforms.GetEntity(args.jobIndex);
+			}
+
+			if (args.isLastJobInGroup && batch.count > 0)
+			{
+				ComputeLocalMatrices(batch.transforms, batch.count);
+			}
+		}, sizeof(TransformBatch));
 	}
 	void Scene::RunHierarchyUpdateSystem(ap::jobsystem::context& ctx)
 	{
-		ap::jobsystem::Dispatch(ctx, (uint32_t)hierarchy.GetCount(), small_subtask_groupsize, [&](ap::jobsystem::JobArgs args) {
-
-			HierarchyComponent& hier = hierarchy[args.jobIndex];
-			Entity entity = hierarchy.GetEntity(args.jobIndex);
-
-			
-			TransformComponent* transform_child = transforms.GetComponent(entity);
-			XMMATRIX worldmatrix;
-			if (transform_child != nullptr)
+		// The hierarchy is sorted by depth, so the levels are processed one after the other and the parent world matrices are already final
+		//	Entries within a level are independent, they are processed in parallel
+		assert(!hierarchy_order_dirty); // SortHierarchy() must be called before
+		ap::jobsystem::context level_ctx;
+		level_ctx.priority = ctx.priority;
+
+		const uint32_t count = (uint32_t)hierarchy.GetCount();
+		uint32_t level_start = 0;
+		while (level_start < count)
+		{
+			const uint32_t depth = hierarchy[level_start].depth;
+			uint32_t level_end = level_start + 1;
+			while (level_end < count && hierarchy[level_end].depth == depth)
 			{
-				worldmatrix = transform_child->GetLocalMatrix();
+				level_end++;
 			}
 
-			LayerComponent* layer_child = layers.GetComponent(entity);
-			if (layer_child != nullptr)
-			{
-				layer_child->propagationMask = ~0u; // clear propagation mask to full
-			}
+			auto update = [this, level_start](ap::jobsystem::JobArgs args) {
 
-			if (transform_child == nullptr && layer_child == nullptr)
-				return;
+				TransformBatch& batch = *(TransformBatch*)args.sharedmemory;
+				if (args.isFirstJobInGroup)
+				{
+					batch.count = 0;
+				}
 
-			Entity parentID = hier.parentID;
-			while (parentID != INVALID_ENTITY)
-			{
-				TransformComponent* transform_parent = transforms.GetComponent(parentID);
-				if (transform_child != nullptr && transform_parent != nullptr)
+				const uint32_t index = level_start + args.jobIndex;
+				const HierarchyComponent& hier = hierarchy[index];
+				Entity entity = hierarchy.GetEntity(index);
+
+				TransformComponent* transform_child = transforms.GetComponent(entity);
+				LayerComponent* layer_child = layers.GetComponent(entity);
+
+				const TransformComponent* transform_parent = nullptr;
+				const LayerComponent* layer_parent = nullptr;
+				if (hier.parentID != INVALID_ENTITY)
 				{
-					worldmatrix *= transform_parent->GetLocalMatrix();
+					transform_parent = transforms.GetComponent(hier.parentID);
+					layer_parent = layers.GetComponent(hier.parentID);
 				}
 
-				LayerComponent* layer_parent = layers.GetComponent(parentID);
-				if (layer_child != nullptr && layer_parent != nullptr)
+				// Only recompute if the local transform or the parent changed (the parent's changed state is final, because it was in a previous level):
+				if (transform_child != nullptr && (transform_child->IsChanged() || (transform_parent != nullptr && transform_parent->IsChanged())))
 				{
-					layer_child->propagationMask &= layer_parent->layerMask;
+					batch.transforms[batch.count] = transform_child;
+					batch.parents[batch.count] = transform_parent;
+					// Roots can have a parent without hierarchy component, its world matrix is not updated by this system:
+					batch.parent_local[batch.count] = hier.depth == 0;
+					batch.count++;
+
+					if (!transform_child->IsChanged())
+					{
+						// Changed only because of the parent, it wasn't added to the list by the TransformUpdateSystem:
+						transform_child->changed = true;
+						changed_transforms[changed_transform_count.fetch_add(1)] = entity;
+					}
 				}
 
-				const HierarchyComponent* hier_recursive = hierarchy.GetComponent(parentID);
-				if (hier_recursive != nullptr)
+				if (layer_child != nullptr)
 				{
-					parentID = hier_recursive->parentID;
+					layer_child->propagationMask = ~0u;
+					if (layer_parent != nullptr)
+					{
+						layer_child->propagationMask = layer_parent->layerMask & (hier.depth > 0 ? layer_parent->propagationMask : ~0u);
+					}
 				}
-				else
+
+				if (args.isLastJobInGroup && batch.count > 0)
 				{
-					parentID = INVALID_ENTITY;
+					ComputeLocalMatrices(batch.transforms, batch.count);
+					for (uint32_t i = 0; i < batch.count; ++i)
+					{
+						const TransformComponent* parent = batch.parents[i];
+						if (parent != nullptr)
+						{
+							TransformComponent& transform = *batch.transforms[i];
+							const XMMATRIX parentmatrix = batch.parent_local[i] ? parent->GetLocalMatrix() : XMLoadFloat4x4(&parent->world);
+							XMStoreFloat4x4(&transform.world, XMLoadFloat4x4(&transform.world) * parentmatrix);
+						}
+					}
 				}
-			}
+			};
 
-			if (transform_child != nullptr)
+			const uint32_t level_count = level_end - level_start;
+			if (level_count <= small_subtask_groupsize)
 			{
-				XMStoreFloat4x4(&transform_child->world, worldmatrix);
+				// Small levels (deep chains) are not worth the dispatch:
+				TransformBatch batch;
+				ap::jobsystem::JobArgs args = {};
+				args.sharedmemory = &batch;
+				for (args.jobIndex = 0; args.jobIndex < level_count; ++args.jobIndex)
+				{
+					args.groupIndex = args.jobIndex;
+					args.isFirstJobInGroup = args.jobIndex == 0;
+					args.isLastJobInGroup = args.jobIndex == level_count - 1;
+					update(args);
+				}
+			}
+			else
+			{
+				ap::jobsystem::Dispatch(level_ctx, level_count, small_subtask_groupsize, update, sizeof(TransformBatch));
+				ap::jobsystem::Wait(level_ctx);
 			}
 
-		});
+			level_start = level_end;
+		}
+
+		changed_transforms.resize(changed_transform_count.load());
+	}
+	void Scene::SetTransformChanged(Entity entity)
+	{
+		TransformComponent* transform = transforms.GetComponent(entity);
+		if (transform != nullptr && !transform->IsChanged())
+		{
+			transform->changed = true;
+			changed_transforms.push_back(entity);
+		}
 	}
 	void Scene::RunSpringUpdateSystem(ap::jobsystem::context& ctx)
 	{
@@ -2756,12 +3047,16 @@ namespace ap::scene
 				saved_parent.Rotate(Q);
 				saved_parent.UpdateTransform();
 				std::swap(saved_parent.world, parent_transform->world); // only store temporary result, not modifying actual local space!
+				parent_transform->SetDirty(); // the world matrix must be recomputed from local space in the next frame, even if nothing else changes it
+				SetTransformChanged(hier->parentID);
 			}
 
 			XMStoreFloat3(&spring.center_of_mass, position_target);
 			velocity *= spring.damping;
 			XMStoreFloat3(&spring.velocity, velocity);
 			*((XMFLOAT3*)&transform->world._41) = spring.center_of_mass;
+			transform->SetDirty(); // temporary result too, like the parent's world matrix
+			SetTransformChanged(entity);
 		}
 	}
 	void Scene::RunInverseKinematicsUpdateSystem(ap::jobsystem::context& ctx)
@@ -2860,6 +3155,7 @@ namespace ap::scene
 				{
 					transform_child->UpdateTransform_Parented(*transform_parent);
 				}
+				SetTransformChanged(entity); // the IK chains were modified in world space, everything in the hierarchy is treated as changed
 			}
 		}
 	}
@@ -3154,12 +3450,19 @@ namespace ap::scene
 
 		parallel_bounds.clear();
 		parallel_bounds.resize((size_t)ap::jobsystem::DispatchGroupCount((uint32_t)objects.GetCount(), small_subtask_groupsize));
+
+		changed_objects.resize(objects.GetCount());
+		changed_object_count.store(0);
+		object_slot_entities.resize(objects.GetCount(), INVALID_ENTITY);
+		occluder_objects.resize(objects.GetCount());
+		occluder_object_count.store(0);
 		
 		ap::jobsystem::Dispatch(ctx, (uint32_t)objects.GetCount(), small_subtask_groupsize, [&](ap::jobsystem::JobArgs args) {
 
 			Entity entity = objects.GetEntity(args.jobIndex);
 			ObjectComponent& object = objects[args.jobIndex];
 			AABB& aabb = aabb_objects[args.jobIndex];
+			const AABB aabb_prev = aabb;
 
 			// Update occlusion culling status:
 			if (!ap::renderer::GetFreezeCullingCameraEnabled())
@@ -3286,6 +3589,12 @@ namespace ap::scene
 						object.prev_transform_index = -1;
 					}
 
+					// Skinned, morphed and simulated meshes are not occluders, their triangles don't match the mesh data:
+					if (object.IsOccluder() && !object.IsDynamic() && softbody == nullptr && !mesh->indices.empty())
+					{
+						occluder_objects[occluder_object_count.fetch_add(1)] = args.jobIndex;
+					}
+
 					// Create GPU instance data:
 					const XMFLOAT4X4& worldMatrix = object.transform_index >= 0 ? transforms[object.transform_index].world : ap::math::IDENTITY_MATRIX;
 					const XMFLOAT4X4& worldMatrixPrev = object.prev_transform_index >= 0 ? prev_transforms[object.prev_transform_index].world_prev : ap::math::IDENTITY_MATRIX;
@@ -3403,6 +3712,15 @@ namespace ap::scene
 				}
 			}
 
+			// Static objects will usually not change, so the BVH can skip them:
+			if (aabb._min.x != aabb_prev._min.x || aabb._min.y != aabb_prev._min.y || aabb._min.z != aabb_prev._min.z ||
+				aabb._max.x != aabb_prev._max.x || aabb._max.y != aabb_prev._max.y || aabb._max.z != aabb_prev._max.z ||
+				aabb.layerMask != aabb_prev.layerMask || object_slot_entities[args.jobIndex] != entity)
+			{
+				changed_objects[changed_object_count.fetch_add(1)] = args.jobIndex;
+				object_slot_entities[args.jobIndex] = entity;
+			}
+
 		}, sizeof(AABB));
 	}
 	void Scene::RunCameraUpdateSystem(ap::jobsystem::context& ctx)
@@ -4019,126 +4337,258 @@ namespace ap::scene
 		return INVALID_ENTITY;
 	}
 
-	PickResult Pick(const Ray& ray, uint32_t renderTypeMask, uint32_t layerMask, const Scene& scene)
+	// Current object space vertex positions of a mesh for the CPU scene queries
+	struct MeshQueryVertices
 	{
-		PickResult result;
+		const XMFLOAT3* positions = nullptr;
+		const MeshComponent::Vertex_POS* positions_vertex = nullptr;
 
-		if (scene.objects.GetCount() > 0)
+		inline XMVECTOR Load(uint32_t index) const
 		{
-			const XMVECTOR rayOrigin = XMLoadFloat3(&ray.origin);
-			const XMVECTOR rayDirection = XMVector3Normalize(XMLoadFloat3(&ray.direction));
+			return positions != nullptr ? XMLoadFloat3(positions + index) : positions_vertex[index].LoadPOS();
+		}
+	};
+	// Returns true if the triangle BVH of the mesh can be used, false if the mesh is deformed and its triangles must be tested one by one
+	//	skinned_positions	:	storage for the skinned vertex positions, so that every vertex is only skinned once per object
+	static bool GetMeshQueryVertices(const Scene& scene, Entity meshID, const MeshComponent& mesh, MeshQueryVertices& vertices, ap::vector<XMFLOAT3>& skinned_positions)
+	{
+		const SoftBodyPhysicsComponent* softbody = scene.softbodies.GetComponent(meshID);
+		if (softbody != nullptr && !softbody->vertex_positions_simulation.empty())
+		{
+			vertices.positions_vertex = softbody->vertex_positions_simulation.data();
+			return false;
+		}
 
-			for (size_t i = 0; i < scene.aabb_objects.GetCount(); ++i)
+		const ArmatureComponent* armature = mesh.IsSkinned() ? scene.armatures.GetComponent(mesh.armatureID) : nullptr;
+		if (armature != nullptr && !armature->boneData.empty())
+		{
+			skinned_positions.resize(mesh.vertex_positions.size());
+			for (size_t i = 0; i < skinned_positions.size(); ++i)
 			{
-				const AABB& aabb = scene.aabb_objects[i];
-				if (!ray.intersects(aabb))
-				{
-					continue;
-				}
+				XMStoreFloat3(&skinned_positions[i], SkinVertex(mesh, *armature, (uint32_t)i));
+			}
+			vertices.positions = skinned_positions.data();
+			return false;
+		}
 
-				const ObjectComponent& object = scene.objects[i];
-				if (object.meshID == INVALID_ENTITY)
-				{
-					continue;
-				}
-				if (!(renderTypeMask & object.GetRenderTypes()))
-				{
-					continue;
-				}
+		if (!mesh.vertex_positions_morphed.empty())
+		{
+			vertices.positions_vertex = mesh.vertex_positions_morphed.data();
+			return false;
+		}
+
+		vertices.positions = mesh.vertex_positions.data();
+		return mesh.bvh.IsValid();
+	}
+	// Returns the mesh of the object if it passes the query filters, otherwise nullptr
+	static const MeshComponent* GetQueryMesh(const Scene& scene, size_t objectIndex, uint32_t renderTypeMask, uint32_t layerMask)
+	{
+		const ObjectComponent& object = scene.objects[objectIndex];
+		if (object.meshID == INVALID_ENTITY)
+		{
+			return nullptr;
+		}
+		if (!(renderTypeMask & object.GetRenderTypes()))
+		{
+			return nullptr;
+		}
 
-				Entity entity = scene.aabb_objects.GetEntity(i);
-				const LayerComponent* layer = scene.layers.GetComponent(entity);
-				if (layer != nullptr && !(layer->GetLayerMask() & layerMask))
+		Entity entity = scene.aabb_objects.GetEntity(objectIndex);
+		const LayerComponent* layer = scene.layers.GetComponent(entity);
+		if (layer != nullptr && !(layer->GetLayerMask() & layerMask))
+		{
+			return nullptr;
+		}
+
+		return scene.meshes.GetComponent(object.meshID);
+	}
+	static int GetSubsetIndex(const MeshComponent& mesh, uint32_t indexOffset)
+	{
+		for (size_t i = 0; i < mesh.subsets.size(); ++i)
+		{
+			const MeshComponent::MeshSubset& subset = mesh.subsets[i];
+			if (indexOffset >= subset.indexOffset && indexOffset < subset.indexOffset + subset.indexCount)
+			{
+				return (int)i;
+			}
+		}
+		return -1;
+	}
+	// Calls callback(size_t objectIndex) for the objects whose bounds pass test(const AABB&), until the callback returns false
+	template<typename NodeTest, typename ObjectCallback>
+	static void ForEachQueryObject(const Scene& scene, uint32_t layerMask, NodeTest test, ObjectCallback callback)
+	{
+		if (scene.object_bvh.leaf_count == (uint32_t)scene.aabb_objects.GetCount())
+		{
+			scene.object_bvh.Intersects(test, layerMask, [&](uint32_t objectIndex) { return callback((size_t)objectIndex); });
+			return;
+		}
+
+		// The BVH is only up to date after Scene::Update(), until then all objects are tested:
+		for (size_t i = 0; i < scene.aabb_objects.GetCount(); ++i)
+		{
+			if (test(scene.aabb_objects[i]) && !callback(i))
+			{
+				return;
+			}
+		}
+	}
+	// Calls callback(uint32_t indexOffset) for the triangles of the mesh subsets, until the callback returns false
+	//	When use_bvh is true, only the triangles are visited whose object space bounds pass test(const AABB&)
+	template<typename NodeTest, typename TriangleCallback>
+	static void ForEachQueryTriangle(const MeshComponent& mesh, bool use_bvh, NodeTest test, TriangleCallback callback)
+	{
+		if (use_bvh)
+		{
+			mesh.bvh.Intersects(test, ~0u, callback);
+			return;
+		}
+
+		for (auto& subset : mesh.subsets)
+		{
+			for (uint32_t i = 0; i + 2 < subset.indexCount; i += 3)
+			{
+				if (!callback(subset.indexOffset + i))
 				{
-					continue;
+					return;
 				}
+			}
+		}
+	}
+
+	// Intersects the triangles of one object with the rays of mask and updates their results if closer hits were found
+	//	rayOrigins, rayDirections and results are indexed by the bits of mask, the ray directions must be normalized
+	static void PickObject(
+		const Scene& scene,
+		size_t objectIndex,
+		const XMVECTOR* rayOrigins,
+		const XMVECTOR* rayDirections,
+		uint32_t mask,
+		uint32_t renderTypeMask,
+		uint32_t layerMask,
+		PickResult* results,
+		ap::vector<XMFLOAT3>& skinned_positions
+	)
+	{
+		const MeshComponent* mesh = GetQueryMesh(scene, objectIndex, renderTypeMask, layerMask);
+		if (mesh == nullptr)
+		{
+			return;
+		}
 
-				const MeshComponent& mesh = *scene.meshes.GetComponent(object.meshID);
-				const SoftBodyPhysicsComponent* softbody = scene.softbodies.GetComponent(object.meshID);
-				const bool softbody_active = softbody != nullptr && !softbody->vertex_positions_simulation.empty();
+		const ObjectComponent& object = scene.objects[objectIndex];
+		Entity entity = scene.aabb_objects.GetEntity(objectIndex);
 
-				const XMMATRIX objectMat = object.transform_index >= 0 ? XMLoadFloat4x4(&scene.transforms[object.transform_index].world) : XMMatrixIdentity();
-				const XMMATRIX objectMat_Inverse = XMMatrixInverse(nullptr, objectMat);
+		MeshQueryVertices vertices;
+		const bool use_bvh = GetMeshQueryVertices(scene, object.meshID, *mesh, vertices, skinned_positions);
 
-				const XMVECTOR rayOrigin_local = XMVector3Transform(rayOrigin, objectMat_Inverse);
-				const XMVECTOR rayDirection_local = XMVector3Normalize(XMVector3TransformNormal(rayDirection, objectMat_Inverse));
+		const XMMATRIX objectMat = object.transform_index >= 0 ? XMLoadFloat4x4(&scene.transforms[object.transform_index].world) : XMMatrixIdentity();
+		const XMMATRIX objectMat_Inverse = XMMatrixInverse(nullptr, objectMat);
 
-				const ArmatureComponent* armature = mesh.IsSkinned() ? scene.armatures.GetComponent(mesh.armatureID) : nullptr;
+		XMVECTOR rayOrigins_local[4];
+		XMVECTOR rayDirections_local[4];
+		for (uint32_t lane = 0; lane < 4; ++lane)
+		{
+			if (mask & (1u << lane))
+			{
+				rayOrigins_local[lane] = XMVector3Transform(rayOrigins[lane], objectMat_Inverse);
+				rayDirections_local[lane] = XMVector3Normalize(XMVector3TransformNormal(rayDirections[lane], objectMat_Inverse));
+			}
+		}
 
-				int subsetCounter = 0;
-				for (auto& subset : mesh.subsets)
+		auto report_hit = [&](uint32_t lane, uint32_t indexOffset, int subsetIndex, const XMVECTOR& p0, const XMVECTOR& p1, const XMVECTOR& p2, float distance, const XMFLOAT2& bary) {
+			PickResult& result = results[lane];
+			const XMVECTOR pos = XMVector3Transform(XMVectorAdd(rayOrigins_local[lane], rayDirections_local[lane] * distance), objectMat);
+			distance = ap::math::Distance(pos, rayOrigins[lane]);
+
+			if (distance < result.distance)
+			{
+				const XMVECTOR nor = XMVector3Normalize(XMVector3TransformNormal(XMVector3Cross(XMVectorSubtract(p2, p1), XMVectorSubtract(p1, p0)), objectMat));
+
+				result.entity = entity;
+				XMStoreFloat3(&result.position, pos);
+				XMStoreFloat3(&result.normal, nor);
+				result.distance = distance;
+				result.subsetIndex = subsetIndex;
+				result.vertexID0 = (int)mesh->indices[indexOffset + 0];
+				result.vertexID1 = (int)mesh->indices[indexOffset + 1];
+				result.vertexID2 = (int)mesh->indices[indexOffset + 2];
+				result.bary = bary;
+			}
+		};
+
+		if (use_bvh)
+		{
+			for (uint32_t lane = 0; lane < 4; ++lane)
+			{
+				if ((mask & (1u << lane)) == 0)
 				{
-					for (size_t i = 0; i < subset.indexCount; i += 3)
+					continue;
+				}
+
+				// The local ray direction is normalized, so local distances are scaled to world distances by the length of the transformed direction:
+				const float scale = XMVectorGetX(XMVector3Length(XMVector3TransformNormal(rayDirections_local[lane], objectMat)));
+				float tmax_local = results[lane].distance / scale;
+				mesh->bvh.IntersectsRay(Ray(rayOrigins_local[lane], rayDirections_local[lane]), tmax_local, ~0u, [&](uint32_t indexOffset, float& tmax) {
+					const XMVECTOR p0 = vertices.Load(mesh->indices[indexOffset + 0]);
+					const XMVECTOR p1 = vertices.Load(mesh->indices[indexOffset + 1]);
+					const XMVECTOR p2 = vertices.Load(mesh->indices[indexOffset + 2]);
+
+					float distance;
+					XMFLOAT2 bary;
+					if (ap::math::RayTriangleIntersects(rayOrigins_local[lane], rayDirections_local[lane], p0, p1, p2, distance, bary))
 					{
-						const uint32_t i0 = mesh.indices[subset.indexOffset + i + 0];
-						const uint32_t i1 = mesh.indices[subset.indexOffset + i + 1];
-						const uint32_t i2 = mesh.indices[subset.indexOffset + i + 2];
+						report_hit(lane, indexOffset, GetSubsetIndex(*mesh, indexOffset), p0, p1, p2, distance, bary);
+						tmax = results[lane].distance / scale;
+					}
+				});
+			}
+			return;
+		}
 
-						XMVECTOR p0;
-						XMVECTOR p1;
-						XMVECTOR p2;
+		// Deformed meshes have no BVH, their triangles are tested four at a time:
+		for (size_t subsetIndex = 0; subsetIndex < mesh->subsets.size(); ++subsetIndex)
+		{
+			const MeshComponent::MeshSubset& subset = mesh->subsets[subsetIndex];
+			for (uint32_t i = 0; i + 2 < subset.indexCount; i += 12)
+			{
+				const uint32_t triangle_count = std::min(4u, (subset.indexCount - i) / 3);
+				XMVECTOR P0[4];
+				XMVECTOR P1[4];
+				XMVECTOR P2[4];
+				for (uint32_t j = 0; j < triangle_count; ++j)
+				{
+					P0[j] = vertices.Load(mesh->indices[subset.indexOffset + i + j * 3 + 0]);
+					P1[j] = vertices.Load(mesh->indices[subset.indexOffset + i + j * 3 + 1]);
+					P2[j] = vertices.Load(mesh->indices[subset.indexOffset + i + j * 3 + 2]);
+				}
+				ap::math::TrianglePacket4 triangles;
+				triangles.Load(P0, P1, P2, triangle_count);
 
-						if (softbody_active)
-						{
-							p0 = softbody->vertex_positions_simulation[i0].LoadPOS();
-							p1 = softbody->vertex_positions_simulation[i1].LoadPOS();
-							p2 = softbody->vertex_positions_simulation[i2].LoadPOS();
-						}
-						else
-						{
-							if (armature == nullptr)
-							{
-								if (mesh.vertex_positions_morphed.empty())
-							    {
-									p0 = XMLoadFloat3(&mesh.vertex_positions[i0]);
-									p1 = XMLoadFloat3(&mesh.vertex_positions[i1]);
-									p2 = XMLoadFloat3(&mesh.vertex_positions[i2]);
-								}
-								else
-								{
-								    p0 = mesh.vertex_positions_morphed[i0].LoadPOS();
-								    p1 = mesh.vertex_positions_morphed[i1].LoadPOS();
-								    p2 = mesh.vertex_positions_morphed[i2].LoadPOS();
-								}
-							}
-							else
-							{
-								p0 = SkinVertex(mesh, *armature, i0);
-								p1 = SkinVertex(mesh, *armature, i1);
-								p2 = SkinVertex(mesh, *armature, i2);
-							}
-						}
+				for (uint32_t lane = 0; lane < 4; ++lane)
+				{
+					if ((mask & (1u << lane)) == 0)
+					{
+						continue;
+					}
 
-						float distance;
-						XMFLOAT2 bary;
-						if (ap::math::RayTriangleIntersects(rayOrigin_local, rayDirection_local, p0, p1, p2, distance, bary))
+					float distances[4];
+					XMFLOAT2 barys[4];
+					const uint32_t hits = ap::math::RayTriangleIntersects4(rayOrigins_local[lane], rayDirections_local[lane], triangles, distances, barys);
+					for (uint32_t j = 0; j < triangle_count; ++j)
+					{
+						if (hits & (1u << j))
 						{
-							const XMVECTOR pos = XMVector3Transform(XMVectorAdd(rayOrigin_local, rayDirection_local*distance), objectMat);
-							distance = ap::math::Distance(pos, rayOrigin);
-
-							if (distance < result.distance)
-							{
-								const XMVECTOR nor = XMVector3Normalize(XMVector3TransformNormal(XMVector3Cross(XMVectorSubtract(p2, p1), XMVectorSubtract(p1, p0)), objectMat));
-
-								result.entity = entity;
-								XMStoreFloat3(&result.position, pos);
-								XMStoreFloat3(&result.normal, nor);
-								result.distance = distance;
-								result.subsetIndex = subsetCounter;
-								result.vertexID0 = (int)i0;
-								result.vertexID1 = (int)i1;
-								result.vertexID2 = (int)i2;
-								result.bary = bary;
-							}
+							report_hit(lane, subset.indexOffset + i + j * 3, (int)subsetIndex, P0[j], P1[j], P2[j], distances[j], barys[j]);
 						}
 					}
-					subsetCounter++;
 				}
-
 			}
 		}
-
-		// Construct a matrix that will orient to position (P) according to surface normal (N):
+	}
+	// Construct a matrix that will orient to position (P) according to surface normal (N):
+	static void ComputePickOrientation(const Ray& ray, PickResult& result)
+	{
 		XMVECTOR N = XMLoadFloat3(&result.normal);
 		XMVECTOR P = XMLoadFloat3(&result.position);
 		XMVECTOR E = XMLoadFloat3(&ray.origin);
@@ -4146,9 +4596,98 @@ namespace ap::scene
 		XMVECTOR B = XMVector3Normalize(XMVector3Cross(T, N));
 		XMMATRIX M = { T, N, B, P };
 		XMStoreFloat4x4(&result.orientation, M);
+	}
+
+	PickResult Pick(const Ray& ray, uint32_t renderTypeMask, uint32_t layerMask, const Scene& scene)
+	{
+		PickResult result;
+
+		if (scene.objects.GetCount() > 0)
+		{
+			const XMVECTOR rayOrigin = XMLoadFloat3(&ray.origin);
+			const XMVECTOR rayDirection = XMVector3Normalize(XMLoadFloat3(&ray.direction));
+			ap::vector<XMFLOAT3> skinned_positions;
+
+			if (scene.object_bvh.leaf_count == (uint32_t)scene.aabb_objects.GetCount())
+			{
+				// Objects are visited front to back, farther objects are culled by the closest hit so far:
+				float tmax_world = result.distance;
+				scene.object_bvh.IntersectsRay(Ray(rayOrigin, rayDirection), tmax_world, layerMask, [&](uint32_t objectIndex, float& tmax) {
+					PickObject(scene, objectIndex, &rayOrigin, &rayDirection, 1, renderTypeMask, layerMask, &result, skinned_positions);
+					tmax = result.distance;
+				});
+			}
+			else
+			{
+				// The BVH is only up to date after Scene::Update(), until then all objects are tested:
+				for (size_t i = 0; i < scene.aabb_objects.GetCount(); ++i)
+				{
+					if (ray.intersects(scene.aabb_objects[i]))
+					{
+						PickObject(scene, i, &rayOrigin, &rayDirection, 1, renderTypeMask, layerMask, &result, skinned_positions);
+					}
+				}
+			}
+		}
+
+		ComputePickOrientation(ray, result);
 
 		return result;
 	}
+	void Pick(const Ray* rays, size_t count, PickResult* results, uint32_t renderTypeMask, uint32_t layerMask, const Scene& scene)
+	{
+		if (count == 0)
+		{
+			return;
+		}
+		if (scene.object_bvh.leaf_count != (uint32_t)scene.aabb_objects.GetCount() || scene.objects.GetCount() == 0)
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				results[i] = Pick(rays[i], renderTypeMask, layerMask, scene);
+			}
+			return;
+		}
+
+		// The rays are traced through the object BVH in packets of four, then each object is intersected with the rays of the packet that reached it:
+		ap::jobsystem::context ctx;
+		ap::jobsystem::Dispatch(ctx, uint32_t((count + 3) / 4), 16, [&](ap::jobsystem::JobArgs args) {
+			const size_t first = size_t(args.jobIndex) * 4;
+			const uint32_t packet_count = (uint32_t)std::min(count - first, size_t(4));
+			PickResult* packet_results = results + first;
+
+			XMVECTOR rayOrigins[4];
+			XMVECTOR rayDirections[4];
+			Ray packet_rays[4];
+			for (uint32_t lane = 0; lane < packet_count; ++lane)
+			{
+				packet_results[lane] = PickResult();
+				rayOrigins[lane] = XMLoadFloat3(&rays[first + lane].origin);
+				rayDirections[lane] = XMVector3Normalize(XMLoadFloat3(&rays[first + lane].direction));
+				packet_rays[lane] = Ray(rayOrigins[lane], rayDirections[lane]);
+			}
+
+			RayPacket4 packet;
+			packet.Load(packet_rays, packet_count);
+			ap::vector<XMFLOAT3> skinned_positions;
+			scene.object_bvh.IntersectsRayPacket(packet, layerMask, [&](uint32_t objectIndex, uint32_t mask) {
+				PickObject(scene, objectIndex, rayOrigins, rayDirections, mask, renderTypeMask, layerMask, packet_results, skinned_positions);
+				for (uint32_t lane = 0; lane < packet_count; ++lane)
+				{
+					if (mask & (1u << lane))
+					{
+						packet.SetTMax(lane, packet_results[lane].distance);
+					}
+				}
+			});
+
+			for (uint32_t lane = 0; lane < packet_count; ++lane)
+			{
+				ComputePickOrientation(rays[first + lane], packet_results[lane]);
+			}
+		});
+		ap::jobsystem::Wait(ctx);
+	}
 
 	SceneIntersectSphereResult SceneIntersectSphere(const Sphere& sphere, uint32_t renderTypeMask, uint32_t layerMask, const Scene& scene)
 	{
@@ -4156,197 +4695,157 @@ namespace ap::scene
 		XMVECTOR Center = XMLoadFloat3(&sphere.center);
 		XMVECTOR Radius = XMVectorReplicate(sphere.radius);
 		XMVECTOR RadiusSq = XMVectorMultiply(Radius, Radius);
+		AABB sphere_aabb;
+		sphere_aabb.createFromHalfWidth(sphere.center, XMFLOAT3(sphere.radius, sphere.radius, sphere.radius));
 
 		if (scene.objects.GetCount() > 0)
 		{
+			ap::vector<XMFLOAT3> skinned_positions;
 
-			for (size_t i = 0; i < scene.aabb_objects.GetCount(); ++i)
-			{
-				const AABB& aabb = scene.aabb_objects[i];
-				if (!sphere.intersects(aabb))
+			ForEachQueryObject(scene, layerMask, [&](const AABB& aabb) { return sphere.intersects(aabb); }, [&](size_t objectIndex) {
+				const MeshComponent* meshptr = GetQueryMesh(scene, objectIndex, renderTypeMask, layerMask);
+				if (meshptr == nullptr)
 				{
-					continue;
+					return true;
 				}
+				const MeshComponent& mesh = *meshptr;
 
-				const ObjectComponent& object = scene.objects[i];
-				if (object.meshID == INVALID_ENTITY)
-				{
-					continue;
-				}
-				if (!(renderTypeMask & object.GetRenderTypes()))
-				{
-					continue;
-				}
+				const ObjectComponent& object = scene.objects[objectIndex];
+				Entity entity = scene.aabb_objects.GetEntity(objectIndex);
 
-				Entity entity = scene.aabb_objects.GetEntity(i);
-				const LayerComponent* layer = scene.layers.GetComponent(entity);
-				if (layer != nullptr && !(layer->GetLayerMask() & layerMask))
-				{
-					continue;
-				}
-
-				const MeshComponent& mesh = *scene.meshes.GetComponent(object.meshID);
-				const SoftBodyPhysicsComponent* softbody = scene.softbodies.GetComponent(object.meshID);
-				const bool softbody_active = softbody != nullptr && !softbody->vertex_positions_simulation.empty();
+				MeshQueryVertices vertices;
+				const bool use_bvh = GetMeshQueryVertices(scene, object.meshID, mesh, vertices, skinned_positions);
 
 				const XMMATRIX objectMat = object.transform_index >= 0 ? XMLoadFloat4x4(&scene.transforms[object.transform_index].world) : XMMatrixIdentity();
 
-				const ArmatureComponent* armature = mesh.IsSkinned() ? scene.armatures.GetComponent(mesh.armatureID) : nullptr;
+				// The triangle BVH is in object space:
+				const AABB sphere_aabb_local = sphere_aabb.transform(XMMatrixInverse(nullptr, objectMat));
 
-				int subsetCounter = 0;
-				for (auto& subset : mesh.subsets)
-				{
-					for (size_t i = 0; i < subset.indexCount; i += 3)
-					{
-						const uint32_t i0 = mesh.indices[subset.indexOffset + i + 0];
-						const uint32_t i1 = mesh.indices[subset.indexOffset + i + 1];
-						const uint32_t i2 = mesh.indices[subset.indexOffset + i + 2];
+				bool hit = false;
+				ForEachQueryTriangle(mesh, use_bvh, [&](const AABB& aabb) { return sphere_aabb_local.intersects(aabb) != AABB::OUTSIDE; }, [&](uint32_t indexOffset) {
+					XMVECTOR p0 = vertices.Load(mesh.indices[indexOffset + 0]);
+					XMVECTOR p1 = vertices.Load(mesh.indices[indexOffset + 1]);
+					XMVECTOR p2 = vertices.Load(mesh.indices[indexOffset + 2]);
 
-						XMVECTOR p0;
-						XMVECTOR p1;
-						XMVECTOR p2;
-
-						if (softbody_active)
-						{
-							p0 = softbody->vertex_positions_simulation[i0].LoadPOS();
-							p1 = softbody->vertex_positions_simulation[i1].LoadPOS();
-							p2 = softbody->vertex_positions_simulation[i2].LoadPOS();
-						}
-						else
-						{
-							if (armature == nullptr)
-							{
-								p0 = XMLoadFloat3(&mesh.vertex_positions[i0]);
-								p1 = XMLoadFloat3(&mesh.vertex_positions[i1]);
-								p2 = XMLoadFloat3(&mesh.vertex_positions[i2]);
-							}
-							else
-							{
-								p0 = SkinVertex(mesh, *armature, i0);
-								p1 = SkinVertex(mesh, *armature, i1);
-								p2 = SkinVertex(mesh, *armature, i2);
-							}
-						}
+					p0 = XMVector3Transform(p0, objectMat);
+					p1 = XMVector3Transform(p1, objectMat);
+					p2 = XMVector3Transform(p2, objectMat);
 
-						p0 = XMVector3Transform(p0, objectMat);
-						p1 = XMVector3Transform(p1, objectMat);
-						p2 = XMVector3Transform(p2, objectMat);
+					XMFLOAT3 min, max;
+					XMStoreFloat3(&min, XMVectorMin(p0, XMVectorMin(p1, p2)));
+					XMStoreFloat3(&max, XMVectorMax(p0, XMVectorMax(p1, p2)));
+					AABB aabb_triangle(min, max);
+					if (sphere.intersects(aabb_triangle) == AABB::OUTSIDE)
+					{
+						return true;
+					}
 
-						XMFLOAT3 min, max;
-						XMStoreFloat3(&min, XMVectorMin(p0, XMVectorMin(p1, p2)));
-						XMStoreFloat3(&max, XMVectorMax(p0, XMVectorMax(p1, p2)));
-						AABB aabb_triangle(min, max);
-						if (sphere.intersects(aabb_triangle) == AABB::OUTSIDE)
-						{
-							continue;
-						}
+					// Compute the plane of the triangle (has to be normalized).
+					XMVECTOR N = XMVector3Normalize(XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0)));
 
-						// Compute the plane of the triangle (has to be normalized).
-						XMVECTOR N = XMVector3Normalize(XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0)));
+					// Assert that the triangle is not degenerate.
+					assert(!XMVector3Equal(N, XMVectorZero()));
 
-						// Assert that the triangle is not degenerate.
-						assert(!XMVector3Equal(N, XMVectorZero()));
+					// Find the nearest feature on the triangle to the sphere.
+					XMVECTOR Dist = XMVector3Dot(XMVectorSubtract(Center, p0), N);
 
-						// Find the nearest feature on the triangle to the sphere.
-						XMVECTOR Dist = XMVector3Dot(XMVectorSubtract(Center, p0), N);
+					if (!mesh.IsDoubleSided() && XMVectorGetX(Dist) > 0)
+					{
+						return true; // pass through back faces
+					}
 
-						if (!mesh.IsDoubleSided() && XMVectorGetX(Dist) > 0)
-						{
-							continue; // pass through back faces
-						}
+					// If the center of the sphere is farther from the plane of the triangle than
+					// the radius of the sphere, then there cannot be an intersection.
+					XMVECTOR NoIntersection = XMVectorLess(Dist, XMVectorNegate(Radius));
+					NoIntersection = XMVectorOrInt(NoIntersection, XMVectorGreater(Dist, Radius));
 
-						// If the center of the sphere is farther from the plane of the triangle than
-						// the radius of the sphere, then there cannot be an intersection.
-						XMVECTOR NoIntersection = XMVectorLess(Dist, XMVectorNegate(Radius));
-						NoIntersection = XMVectorOrInt(NoIntersection, XMVectorGreater(Dist, Radius));
+					// Project the center of the sphere onto the plane of the triangle.
+					XMVECTOR Point0 = XMVectorNegativeMultiplySubtract(N, Dist, Center);
 
-						// Project the center of the sphere onto the plane of the triangle.
-						XMVECTOR Point0 = XMVectorNegativeMultiplySubtract(N, Dist, Center);
+					// Is it inside all the edges? If so we intersect because the distance 
+					// to the plane is less than the radius.
+					//XMVECTOR Intersection = DirectX::Internal::PointOnPlaneInsideTriangle(Point0, p0, p1, p2);
 
-						// Is it inside all the edges? If so we intersect because the distance 
-						// to the plane is less than the radius.
-						//XMVECTOR Intersection = DirectX::Internal::PointOnPlaneInsideTriangle(Point0, p0, p1, p2);
+					// Compute the cross products of the vector from the base of each edge to 
+					// the point with each edge vector.
+					XMVECTOR C0 = XMVector3Cross(XMVectorSubtract(Point0, p0), XMVectorSubtract(p1, p0));
+					XMVECTOR C1 = XMVector3Cross(XMVectorSubtract(Point0, p1), XMVectorSubtract(p2, p1));
+					XMVECTOR C2 = XMVector3Cross(XMVectorSubtract(Point0, p2), XMVectorSubtract(p0, p2));
 
-						// Compute the cross products of the vector from the base of each edge to 
-						// the point with each edge vector.
-						XMVECTOR C0 = XMVector3Cross(XMVectorSubtract(Point0, p0), XMVectorSubtract(p1, p0));
-						XMVECTOR C1 = XMVector3Cross(XMVectorSubtract(Point0, p1), XMVectorSubtract(p2, p1));
-						XMVECTOR C2 = XMVector3Cross(XMVectorSubtract(Point0, p2), XMVectorSubtract(p0, p2));
+					// If the cross product points in the same direction as the normal the the
+					// point is inside the edge (it is zero if is on the edge).
+					XMVECTOR Zero = XMVectorZero();
+					XMVECTOR Inside0 = XMVectorLessOrEqual(XMVector3Dot(C0, N), Zero);
+					XMVECTOR Inside1 = XMVectorLessOrEqual(XMVector3Dot(C1, N), Zero);
+					XMVECTOR Inside2 = XMVectorLessOrEqual(XMVector3Dot(C2, N), Zero);
 
-						// If the cross product points in the same direction as the normal the the
-						// point is inside the edge (it is zero if is on the edge).
-						XMVECTOR Zero = XMVectorZero();
-						XMVECTOR Inside0 = XMVectorLessOrEqual(XMVector3Dot(C0, N), Zero);
-						XMVECTOR Inside1 = XMVectorLessOrEqual(XMVector3Dot(C1, N), Zero);
-						XMVECTOR Inside2 = XMVectorLessOrEqual(XMVector3Dot(C2, N), Zero);
+					// If the point inside all of the edges it is inside.
+					XMVECTOR Intersection = XMVectorAndInt(XMVectorAndInt(Inside0, Inside1), Inside2);
 
-						// If the point inside all of the edges it is inside.
-						XMVECTOR Intersection = XMVectorAndInt(XMVectorAndInt(Inside0, Inside1), Inside2);
+					bool inside = XMVector4EqualInt(XMVectorAndCInt(Intersection, NoIntersection), XMVectorTrueInt());
 
-						bool inside = XMVector4EqualInt(XMVectorAndCInt(Intersection, NoIntersection), XMVectorTrueInt());
+					// Find the nearest point on each edge.
 
-						// Find the nearest point on each edge.
+					// Edge 0,1
+					XMVECTOR Point1 = DirectX::Internal::PointOnLineSegmentNearestPoint(p0, p1, Center);
 
-						// Edge 0,1
-						XMVECTOR Point1 = DirectX::Internal::PointOnLineSegmentNearestPoint(p0, p1, Center);
+					// If the distance to the center of the sphere to the point is less than 
+					// the radius of the sphere then it must intersect.
+					Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point1)), RadiusSq));
 
-						// If the distance to the center of the sphere to the point is less than 
-						// the radius of the sphere then it must intersect.
-						Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point1)), RadiusSq));
+					// Edge 1,2
+					XMVECTOR Point2 = DirectX::Internal::PointOnLineSegmentNearestPoint(p1, p2, Center);
 
-						// Edge 1,2
-						XMVECTOR Point2 = DirectX::Internal::PointOnLineSegmentNearestPoint(p1, p2, Center);
+					// If the distance to the center of the sphere to the point is less than 
+					// the radius of the sphere then it must intersect.
+					Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point2)), RadiusSq));
 
-						// If the distance to the center of the sphere to the point is less than 
-						// the radius of the sphere then it must intersect.
-						Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point2)), RadiusSq));
+					// Edge 2,0
+					XMVECTOR Point3 = DirectX::Internal::PointOnLineSegmentNearestPoint(p2, p0, Center);
 
-						// Edge 2,0
-						XMVECTOR Point3 = DirectX::Internal::PointOnLineSegmentNearestPoint(p2, p0, Center);
+					// If the distance to the center of the sphere to the point is less than 
+					// the radius of the sphere then it must intersect.
+					Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point3)), RadiusSq));
 
-						// If the distance to the center of the sphere to the point is less than 
-						// the radius of the sphere then it must intersect.
-						Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point3)), RadiusSq));
+					bool intersects = XMVector4EqualInt(XMVectorAndCInt(Intersection, NoIntersection), XMVectorTrueInt());
 
-						bool intersects = XMVector4EqualInt(XMVectorAndCInt(Intersection, NoIntersection), XMVectorTrueInt());
-
-						if (intersects)
+					if (intersects)
+					{
+						XMVECTOR bestPoint = Point0;
+						if (!inside)
 						{
-							XMVECTOR bestPoint = Point0;
-							if (!inside)
-							{
-								// If the sphere center's projection on the triangle plane is not within the triangle,
-								//	determine the closest point on triangle to the sphere center
-								float bestDist = XMVectorGetX(XMVector3LengthSq(Point1 - Center));
-								bestPoint = Point1;
+							// If the sphere center's projection on the triangle plane is not within the triangle,
+							//	determine the closest point on triangle to the sphere center
+							float bestDist = XMVectorGetX(XMVector3LengthSq(Point1 - Center));
+							bestPoint = Point1;
 
-								float d = XMVectorGetX(XMVector3LengthSq(Point2 - Center));
-								if (d < bestDist)
-								{
-									bestDist = d;
-									bestPoint = Point2;
-								}
-								d = XMVectorGetX(XMVector3LengthSq(Point3 - Center));
-								if (d < bestDist)
-								{
-									bestDist = d;
-									bestPoint = Point3;
-								}
+							float d = XMVectorGetX(XMVector3LengthSq(Point2 - Center));
+							if (d < bestDist)
+							{
+								bestDist = d;
+								bestPoint = Point2;
+							}
+							d = XMVectorGetX(XMVector3LengthSq(Point3 - Center));
+							if (d < bestDist)
+							{
+								bestDist = d;
+								bestPoint = Point3;
 							}
-							XMVECTOR intersectionVec = Center - bestPoint;
-							XMVECTOR intersectionVecLen = XMVector3Length(intersectionVec);
-
-							result.entity = entity;
-							result.depth = sphere.radius - XMVectorGetX(intersectionVecLen);
-							XMStoreFloat3(&result.position, bestPoint);
-							XMStoreFloat3(&result.normal, intersectionVec / intersectionVecLen);
-							return result;
 						}
+						XMVECTOR intersectionVec = Center - bestPoint;
+						XMVECTOR intersectionVecLen = XMVector3Length(intersectionVec);
+
+						result.entity = entity;
+						result.depth = sphere.radius - XMVectorGetX(intersectionVecLen);
+						XMStoreFloat3(&result.position, bestPoint);
+						XMStoreFloat3(&result.normal, intersectionVec / intersectionVecLen);
+						hit = true;
+						return false;
 					}
-					subsetCounter++;
-				}
-
-			}
+					return true;
+				});
+				return !hit;
+			});
 		}
 
 		return result;
@@ -4365,265 +4864,223 @@ namespace ap::scene
 
 		if (scene.objects.GetCount() > 0)
 		{
+			ap::vector<XMFLOAT3> skinned_positions;
 
-			for (size_t i = 0; i < scene.aabb_objects.GetCount(); ++i)
-			{
-				const AABB& aabb = scene.aabb_objects[i];
-				if (capsule_aabb.intersects(aabb) == AABB::INTERSECTION_TYPE::OUTSIDE)
+			ForEachQueryObject(scene, layerMask, [&](const AABB& aabb) { return capsule_aabb.intersects(aabb) != AABB::OUTSIDE; }, [&](size_t objectIndex) {
+				const MeshComponent* meshptr = GetQueryMesh(scene, objectIndex, renderTypeMask, layerMask);
+				if (meshptr == nullptr)
 				{
-					continue;
+					return true;
 				}
+				const MeshComponent& mesh = *meshptr;
 
-				const ObjectComponent& object = scene.objects[i];
-				if (object.meshID == INVALID_ENTITY)
-				{
-					continue;
-				}
-				if (!(renderTypeMask & object.GetRenderTypes()))
-				{
-					continue;
-				}
-
-				Entity entity = scene.aabb_objects.GetEntity(i);
-				const LayerComponent* layer = scene.layers.GetComponent(entity);
-				if (layer != nullptr && !(layer->GetLayerMask() & layerMask))
-				{
-					continue;
-				}
+				const ObjectComponent& object = scene.objects[objectIndex];
+				Entity entity = scene.aabb_objects.GetEntity(objectIndex);
 
-				const MeshComponent& mesh = *scene.meshes.GetComponent(object.meshID);
-				const SoftBodyPhysicsComponent* softbody = scene.softbodies.GetComponent(object.meshID);
-				const bool softbody_active = softbody != nullptr && !softbody->vertex_positions_simulation.empty();
+				MeshQueryVertices vertices;
+				const bool use_bvh = GetMeshQueryVertices(scene, object.meshID, mesh, vertices, skinned_positions);
 
 				const XMMATRIX objectMat = object.transform_index >= 0 ? XMLoadFloat4x4(&scene.transforms[object.transform_index].world) : XMMatrixIdentity();
 
-				const ArmatureComponent* armature = mesh.IsSkinned() ? scene.armatures.GetComponent(mesh.armatureID) : nullptr;
+				// The triangle BVH is in object space:
+				const AABB capsule_aabb_local = capsule_aabb.transform(XMMatrixInverse(nullptr, objectMat));
 
-				int subsetCounter = 0;
-				for (auto& subset : mesh.subsets)
-				{
-					for (size_t i = 0; i < subset.indexCount; i += 3)
+				bool hit = false;
+				ForEachQueryTriangle(mesh, use_bvh, [&](const AABB& aabb) { return capsule_aabb_local.intersects(aabb) != AABB::OUTSIDE; }, [&](uint32_t indexOffset) {
+					XMVECTOR p0 = vertices.Load(mesh.indices[indexOffset + 0]);
+					XMVECTOR p1 = vertices.Load(mesh.indices[indexOffset + 1]);
+					XMVECTOR p2 = vertices.Load(mesh.indices[indexOffset + 2]);
+
+					p0 = XMVector3Transform(p0, objectMat);
+					p1 = XMVector3Transform(p1, objectMat);
+					p2 = XMVector3Transform(p2, objectMat);
+
+					XMFLOAT3 min, max;
+					XMStoreFloat3(&min, XMVectorMin(p0, XMVectorMin(p1, p2)));
+					XMStoreFloat3(&max, XMVectorMax(p0, XMVectorMax(p1, p2)));
+					AABB aabb_triangle(min, max);
+					if (capsule_aabb.intersects(aabb_triangle) == AABB::OUTSIDE)
 					{
-						const uint32_t i0 = mesh.indices[subset.indexOffset + i + 0];
-						const uint32_t i1 = mesh.indices[subset.indexOffset + i + 1];
-						const uint32_t i2 = mesh.indices[subset.indexOffset + i + 2];
+						return true;
+					}
 
-						XMVECTOR p0;
-						XMVECTOR p1;
-						XMVECTOR p2;
+					// Compute the plane of the triangle (has to be normalized).
+					XMVECTOR N = XMVector3Normalize(XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0)));
+					
+					XMVECTOR ReferencePoint;
+					XMVECTOR d = XMVector3Normalize(B - A);
+					if (abs(XMVectorGetX(XMVector3Dot(N, d))) < FLT_EPSILON)
+					{
+						// Capsule line cannot be intersected with triangle plane (they are parallel)
+						//	In this case, just take a point from triangle
+						ReferencePoint = p0;
+					}
+					else
+					{
+						// Intersect capsule line with triangle plane:
+						XMVECTOR t = XMVector3Dot(N, (Base - p0) / XMVectorAbs(XMVector3Dot(N, d)));
+						XMVECTOR LinePlaneIntersection = Base + d * t;
 
-						if (softbody_active)
-						{
-							p0 = softbody->vertex_positions_simulation[i0].LoadPOS();
-							p1 = softbody->vertex_positions_simulation[i1].LoadPOS();
-							p2 = softbody->vertex_positions_simulation[i2].LoadPOS();
-						}
-						else
-						{
-							if (armature == nullptr || armature->boneData.empty())
-							{
-								p0 = XMLoadFloat3(&mesh.vertex_positions[i0]);
-								p1 = XMLoadFloat3(&mesh.vertex_positions[i1]);
-								p2 = XMLoadFloat3(&mesh.vertex_positions[i2]);
-							}
-							else
-							{
-								p0 = SkinVertex(mesh, *armature, i0);
-								p1 = SkinVertex(mesh, *armature, i1);
-								p2 = SkinVertex(mesh, *armature, i2);
-							}
-						}
-						
-						p0 = XMVector3Transform(p0, objectMat);
-						p1 = XMVector3Transform(p1, objectMat);
-						p2 = XMVector3Transform(p2, objectMat);
-
-						XMFLOAT3 min, max;
-						XMStoreFloat3(&min, XMVectorMin(p0, XMVectorMin(p1, p2)));
-						XMStoreFloat3(&max, XMVectorMax(p0, XMVectorMax(p1, p2)));
-						AABB aabb_triangle(min, max);
-						if (capsule_aabb.intersects(aabb_triangle) == AABB::OUTSIDE)
-						{
-							continue;
-						}
+						// Compute the cross products of the vector from the base of each edge to 
+						// the point with each edge vector.
+						XMVECTOR C0 = XMVector3Cross(XMVectorSubtract(LinePlaneIntersection, p0), XMVectorSubtract(p1, p0));
+						XMVECTOR C1 = XMVector3Cross(XMVectorSubtract(LinePlaneIntersection, p1), XMVectorSubtract(p2, p1));
+						XMVECTOR C2 = XMVector3Cross(XMVectorSubtract(LinePlaneIntersection, p2), XMVectorSubtract(p0, p2));
+
+						// If the cross product points in the same direction as the normal the the
+						// point is inside the edge (it is zero if is on the edge).
+						XMVECTOR Zero = XMVectorZero();
+						XMVECTOR Inside0 = XMVectorLessOrEqual(XMVector3Dot(C0, N), Zero);
+						XMVECTOR Inside1 = XMVectorLessOrEqual(XMVector3Dot(C1, N), Zero);
+						XMVECTOR Inside2 = XMVectorLessOrEqual(XMVector3Dot(C2, N), Zero);
 
-						// Compute the plane of the triangle (has to be normalized).
-						XMVECTOR N = XMVector3Normalize(XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0)));
-						
-						XMVECTOR ReferencePoint;
-						XMVECTOR d = XMVector3Normalize(B - A);
-						if (abs(XMVectorGetX(XMVector3Dot(N, d))) < FLT_EPSILON)
+						// If the point inside all of the edges it is inside.
+						XMVECTOR Intersection = XMVectorAndInt(XMVectorAndInt(Inside0, Inside1), Inside2);
+
+						bool inside = XMVectorGetIntX(Intersection) != 0;
+
+						if (inside)
 						{
-							// Capsule line cannot be intersected with triangle plane (they are parallel)
-							//	In this case, just take a point from triangle
-							ReferencePoint = p0;
+							ReferencePoint = LinePlaneIntersection;
 						}
 						else
 						{
-							// Intersect capsule line with triangle plane:
-							XMVECTOR t = XMVector3Dot(N, (Base - p0) / XMVectorAbs(XMVector3Dot(N, d)));
-							XMVECTOR LinePlaneIntersection = Base + d * t;
+							// Find the nearest point on each edge.
 
-							// Compute the cross products of the vector from the base of each edge to 
-							// the point with each edge vector.
-							XMVECTOR C0 = XMVector3Cross(XMVectorSubtract(LinePlaneIntersection, p0), XMVectorSubtract(p1, p0));
-							XMVECTOR C1 = XMVector3Cross(XMVectorSubtract(LinePlaneIntersection, p1), XMVectorSubtract(p2, p1));
-							XMVECTOR C2 = XMVector3Cross(XMVectorSubtract(LinePlaneIntersection, p2), XMVectorSubtract(p0, p2));
+							// Edge 0,1
+							XMVECTOR Point1 = ap::math::ClosestPointOnLineSegment(p0, p1, LinePlaneIntersection);
 
-							// If the cross product points in the same direction as the normal the the
-							// point is inside the edge (it is zero if is on the edge).
-							XMVECTOR Zero = XMVectorZero();
-							XMVECTOR Inside0 = XMVectorLessOrEqual(XMVector3Dot(C0, N), Zero);
-							XMVECTOR Inside1 = XMVectorLessOrEqual(XMVector3Dot(C1, N), Zero);
-							XMVECTOR Inside2 = XMVectorLessOrEqual(XMVector3Dot(C2, N), Zero);
+							// Edge 1,2
+							XMVECTOR Point2 = ap::math::ClosestPointOnLineSegment(p1, p2, LinePlaneIntersection);
 
-							// If the point inside all of the edges it is inside.
-							XMVECTOR Intersection = XMVectorAndInt(XMVectorAndInt(Inside0, Inside1), Inside2);
+							// Edge 2,0
+							XMVECTOR Point3 = ap::math::ClosestPointOnLineSegment(p2, p0, LinePlaneIntersection);
 
-							bool inside = XMVectorGetIntX(Intersection) != 0;
-
-							if (inside)
+							ReferencePoint = Point1;
+							float bestDist = XMVectorGetX(XMVector3LengthSq(Point1 - LinePlaneIntersection));
+							float d = abs(XMVectorGetX(XMVector3LengthSq(Point2 - LinePlaneIntersection)));
+							if (d < bestDist)
 							{
-								ReferencePoint = LinePlaneIntersection;
+								bestDist = d;
+								ReferencePoint = Point2;
 							}
-							else
+							d = abs(XMVectorGetX(XMVector3LengthSq(Point3 - LinePlaneIntersection)));
+							if (d < bestDist)
 							{
-								// Find the nearest point on each edge.
-
-								// Edge 0,1
-								XMVECTOR Point1 = ap::math::ClosestPointOnLineSegment(p0, p1, LinePlaneIntersection);
-
-								// Edge 1,2
-								XMVECTOR Point2 = ap::math::ClosestPointOnLineSegment(p1, p2, LinePlaneIntersection);
-
-								// Edge 2,0
-								XMVECTOR Point3 = ap::math::ClosestPointOnLineSegment(p2, p0, LinePlaneIntersection);
-
-								ReferencePoint = Point1;
-								float bestDist = XMVectorGetX(XMVector3LengthSq(Point1 - LinePlaneIntersection));
-								float d = abs(XMVectorGetX(XMVector3LengthSq(Point2 - LinePlaneIntersection)));
-								if (d < bestDist)
-								{
-									bestDist = d;
-									ReferencePoint = Point2;
-								}
-								d = abs(XMVectorGetX(XMVector3LengthSq(Point3 - LinePlaneIntersection)));
-								if (d < bestDist)
-								{
-									bestDist = d;
-									ReferencePoint = Point3;
-								}
+								bestDist = d;
+								ReferencePoint = Point3;
 							}
+						}
 
 
-						}
+					}
 
-						// Place a sphere on closest point on line segment to intersection:
-						XMVECTOR Center = ap::math::ClosestPointOnLineSegment(A, B, ReferencePoint);
+					// Place a sphere on closest point on line segment to intersection:
+					XMVECTOR Center = ap::math::ClosestPointOnLineSegment(A, B, ReferencePoint);
 
-						// Assert that the triangle is not degenerate.
-						assert(!XMVector3Equal(N, XMVectorZero()));
+					// Assert that the triangle is not degenerate.
+					assert(!XMVector3Equal(N, XMVectorZero()));
 
-						// Find the nearest feature on the triangle to the sphere.
-						XMVECTOR Dist = XMVector3Dot(XMVectorSubtract(Center, p0), N);
+					// Find the nearest feature on the triangle to the sphere.
+					XMVECTOR Dist = XMVector3Dot(XMVectorSubtract(Center, p0), N);
 
-						if (!mesh.IsDoubleSided() && XMVectorGetX(Dist) > 0)
-						{
-							continue; // pass through back faces
-						}
+					if (!mesh.IsDoubleSided() && XMVectorGetX(Dist) > 0)
+					{
+						return true; // pass through back faces
+					}
 
-						// If the center of the sphere is farther from the plane of the triangle than
-						// the radius of the sphere, then there cannot be an intersection.
-						XMVECTOR NoIntersection = XMVectorLess(Dist, XMVectorNegate(Radius));
-						NoIntersection = XMVectorOrInt(NoIntersection, XMVectorGreater(Dist, Radius));
+					// If the center of the sphere is farther from the plane of the triangle than
+					// the radius of the sphere, then there cannot be an intersection.
+					XMVECTOR NoIntersection = XMVectorLess(Dist, XMVectorNegate(Radius));
+					NoIntersection = XMVectorOrInt(NoIntersection, XMVectorGreater(Dist, Radius));
 
-						// Project the center of the sphere onto the plane of the triangle.
-						XMVECTOR Point0 = XMVectorNegativeMultiplySubtract(N, Dist, Center);
+					// Project the center of the sphere onto the plane of the triangle.
+					XMVECTOR Point0 = XMVectorNegativeMultiplySubtract(N, Dist, Center);
 
-						// Is it inside all the edges? If so we intersect because the distance 
-						// to the plane is less than the radius.
-						//XMVECTOR Intersection = DirectX::Internal::PointOnPlaneInsideTriangle(Point0, p0, p1, p2);
+					// Is it inside all the edges? If so we intersect because the distance 
+					// to the plane is less than the radius.
+					//XMVECTOR Intersection = DirectX::Internal::PointOnPlaneInsideTriangle(Point0, p0, p1, p2);
 
-						// Compute the cross products of the vector from the base of each edge to 
-						// the point with each edge vector.
-						XMVECTOR C0 = XMVector3Cross(XMVectorSubtract(Point0, p0), XMVectorSubtract(p1, p0));
-						XMVECTOR C1 = XMVector3Cross(XMVectorSubtract(Point0, p1), XMVectorSubtract(p2, p1));
-						XMVECTOR C2 = XMVector3Cross(XMVectorSubtract(Point0, p2), XMVectorSubtract(p0, p2));
+					// Compute the cross products of the vector from the base of each edge to 
+					// the point with each edge vector.
+					XMVECTOR C0 = XMVector3Cross(XMVectorSubtract(Point0, p0), XMVectorSubtract(p1, p0));
+					XMVECTOR C1 = XMVector3Cross(XMVectorSubtract(Point0, p1), XMVectorSubtract(p2, p1));
+					XMVECTOR C2 = XMVector3Cross(XMVectorSubtract(Point0, p2), XMVectorSubtract(p0, p2));
 
-						// If the cross product points in the same direction as the normal the the
-						// point is inside the edge (it is zero if is on the edge).
-						XMVECTOR Zero = XMVectorZero();
-						XMVECTOR Inside0 = XMVectorLessOrEqual(XMVector3Dot(C0, N), Zero);
-						XMVECTOR Inside1 = XMVectorLessOrEqual(XMVector3Dot(C1, N), Zero);
-						XMVECTOR Inside2 = XMVectorLessOrEqual(XMVector3Dot(C2, N), Zero);
+					// If the cross product points in the same direction as the normal the the
+					// point is inside the edge (it is zero if is on the edge).
+					XMVECTOR Zero = XMVectorZero();
+					XMVECTOR Inside0 = XMVectorLessOrEqual(XMVector3Dot(C0, N), Zero);
+					XMVECTOR Inside1 = XMVectorLessOrEqual(XMVector3Dot(C1, N), Zero);
+					XMVECTOR Inside2 = XMVectorLessOrEqual(XMVector3Dot(C2, N), Zero);
 
-						// If the point inside all of the edges it is inside.
-						XMVECTOR Intersection = XMVectorAndInt(XMVectorAndInt(Inside0, Inside1), Inside2);
+					// If the point inside all of the edges it is inside.
+					XMVECTOR Intersection = XMVectorAndInt(XMVectorAndInt(Inside0, Inside1), Inside2);
 
-						bool inside = XMVector4EqualInt(XMVectorAndCInt(Intersection, NoIntersection), XMVectorTrueInt());
+					bool inside = XMVector4EqualInt(XMVectorAndCInt(Intersection, NoIntersection), XMVectorTrueInt());
 
-						// Find the nearest point on each edge.
+					// Find the nearest point on each edge.
 
-						// Edge 0,1
-						XMVECTOR Point1 = ap::math::ClosestPointOnLineSegment(p0, p1, Center);
+					// Edge 0,1
+					XMVECTOR Point1 = ap::math::ClosestPointOnLineSegment(p0, p1, Center);
 
-						// If the distance to the center of the sphere to the point is less than 
-						// the radius of the sphere then it must intersect.
-						Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point1)), RadiusSq));
+					// If the distance to the center of the sphere to the point is less than 
+					// the radius of the sphere then it must intersect.
+					Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point1)), RadiusSq));
 
-						// Edge 1,2
-						XMVECTOR Point2 = ap::math::ClosestPointOnLineSegment(p1, p2, Center);
+					// Edge 1,2
+					XMVECTOR Point2 = ap::math::ClosestPointOnLineSegment(p1, p2, Center);
 
-						// If the distance to the center of the sphere to the point is less than 
-						// the radius of the sphere then it must intersect.
-						Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point2)), RadiusSq));
+					// If the distance to the center of the sphere to the point is less than 
+					// the radius of the sphere then it must intersect.
+					Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point2)), RadiusSq));
 
-						// Edge 2,0
-						XMVECTOR Point3 = ap::math::ClosestPointOnLineSegment(p2, p0, Center);
+					// Edge 2,0
+					XMVECTOR Point3 = ap::math::ClosestPointOnLineSegment(p2, p0, Center);
 
-						// If the distance to the center of the sphere to the point is less than 
-						// the radius of the sphere then it must intersect.
-						Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point3)), RadiusSq));
+					// If the distance to the center of the sphere to the point is less than 
+					// the radius of the sphere then it must intersect.
+					Intersection = XMVectorOrInt(Intersection, XMVectorLessOrEqual(XMVector3LengthSq(XMVectorSubtract(Center, Point3)), RadiusSq));
 
-						bool intersects = XMVector4EqualInt(XMVectorAndCInt(Intersection, NoIntersection), XMVectorTrueInt());
+					bool intersects = XMVector4EqualInt(XMVectorAndCInt(Intersection, NoIntersection), XMVectorTrueInt());
 
-						if (intersects)
+					if (intersects)
+					{
+						XMVECTOR bestPoint = Point0;
+						if (!inside)
 						{
-							XMVECTOR bestPoint = Point0;
-							if (!inside)
-							{
-								// If the sphere center's projection on the triangle plane is not within the triangle,
-								//	determine the closest point on triangle to the sphere center
-								float bestDist = XMVectorGetX(XMVector3LengthSq(Point1 - Center));
-								bestPoint = Point1;
+							// If the sphere center's projection on the triangle plane is not within the triangle,
+							//	determine the closest point on triangle to the sphere center
+							float bestDist = XMVectorGetX(XMVector3LengthSq(Point1 - Center));
+							bestPoint = Point1;
 
-								float d = XMVectorGetX(XMVector3LengthSq(Point2 - Center));
-								if (d < bestDist)
-								{
-									bestDist = d;
-									bestPoint = Point2;
-								}
-								d = XMVectorGetX(XMVector3LengthSq(Point3 - Center));
-								if (d < bestDist)
-								{
-									bestDist = d;
-									bestPoint = Point3;
-								}
+							float d = XMVectorGetX(XMVector3LengthSq(Point2 - Center));
+							if (d < bestDist)
+							{
+								bestDist = d;
+								bestPoint = Point2;
+							}
+							d = XMVectorGetX(XMVector3LengthSq(Point3 - Center));
+							if (d < bestDist)
+							{
+								bestDist = d;
+								bestPoint = Point3;
 							}
-							XMVECTOR intersectionVec = Center - bestPoint;
-							XMVECTOR intersectionVecLen = XMVector3Length(intersectionVec);
-
-							result.entity = entity;
-							result.depth = capsule.radius - XMVectorGetX(intersectionVecLen);
-							XMStoreFloat3(&result.position, bestPoint);
-							XMStoreFloat3(&result.normal, intersectionVec / intersectionVecLen);
-							return result;
 						}
+						XMVECTOR intersectionVec = Center - bestPoint;
+						XMVECTOR intersectionVecLen = XMVector3Length(intersectionVec);
+
+						result.entity = entity;
+						result.depth = capsule.radius - XMVectorGetX(intersectionVecLen);
+						XMStoreFloat3(&result.position, bestPoint);
+						XMStoreFloat3(&result.normal, intersectionVec / intersectionVecLen);
+						hit = true;
+						return false;
 					}
-					subsetCounter++;
-				}
-
-			}
+					return true;
+				});
+				return !hit;
+			});
 		}
 
 		return result;
@@ -10,6 +10,7 @@
 #include "apResourceManager.h"
 #include "apSpinLock.h"
 #include "apGPUBVH.h"
+#include "apBVH.h"
 #include "apOcean.h"
 #include "apSprite.h"
 #include "apMath.h"
@@ -71,9 +72,13 @@ namespace ap::scene
 		//	- by calling UpdateTransform()
 		//	- or by calling SetDirty() and letting the TransformUpdateSystem handle the updating
 		XMFLOAT4X4 world = ap::math::IDENTITY_MATRIX;
+		// The world matrix was changed in the current frame, either because the transform was dirty or because a parent changed
+		//	It is updated by the TransformUpdateSystem and the HierarchyUpdateSystem, systems after those can skip unchanged transforms
+		bool changed = true;
 
 		inline void SetDirty(bool value = true) { if (value) { _flags |= DIRTY; } else { _flags &= ~DIRTY; } }
 		inline bool IsDirty() const { return _flags & DIRTY; }
+		inline bool IsChanged() const { return changed; }
 
 		XMFLOAT3 GetPosition() const;
 		XMFLOAT4 GetRotation() const;
@@ -110,6 +115,7 @@ namespace ap::scene
 	{
 		// Non-serialized attributes:
 		XMFLOAT4X4 world_prev;
+		bool initialized = false; // world_prev is only copied when the transform changed, except for the first time
 
 		void Serialize(ap::Archive& archive, ap::ecs::EntitySerializer& seri);
 	};
@@ -121,6 +127,8 @@ namespace ap::scene
 		ap::ecs::Entity parentID = ap::ecs::INVALID_ENTITY;
 		uint32_t layerMask_bind; // saved child layermask at the time of binding
 
+		// Non-serialized attributes:
+		uint32_t depth = 0; // distance from the root, Scene sorts the hierarchy by this (only valid after Scene::SortHierarchy())
 
 		void Serialize(ap::Archive& archive, ap::ecs::EntitySerializer& seri);
 	};
@@ -411,6 +419,10 @@ namespace ap::scene
 		mutable bool dirty_morph = false;
 		mutable bool dirty_subsets = true;
 
+		// CPU triangle BVH for scene queries, built by CreateRenderData() if the mesh is not deformed by skinning or morph targets
+		//	bvh.leaf_indices contain the offset of the first index of each triangle in the indices array
+		ap::BVH bvh;
+
 		inline void SetRenderable(bool value) { if (value) { _flags |= RENDERABLE; } else { _flags &= ~RENDERABLE; } }
 		inline void SetDoubleSided(bool value) { if (value) { _flags |= DOUBLE_SIDED; } else { _flags &= ~DOUBLE_SIDED; } }
 		inline void SetDynamic(bool value) { if (value) { _flags |= DYNAMIC; } else { _flags &= ~DYNAMIC; } }
@@ -428,6 +440,8 @@ namespace ap::scene
 
 		// Recreates GPU resources for index/vertex buffers
 		void CreateRenderData();
+		// Recreates the CPU triangle BVH (called by CreateRenderData)
+		void BuildBVH();
 		void WriteShaderMesh(ShaderMesh* dest) const;
 
 		enum COMPUTE_NORMALS
@@ -624,6 +638,7 @@ namespace ap::scene
 			IMPOSTOR_PLACEMENT = 1 << 3,
 			REQUEST_PLANAR_REFLECTION = 1 << 4,
 			LIGHTMAP_RENDER_REQUEST = 1 << 5,
+			OCCLUDER = 1 << 6,
 		};
 		uint32_t _flags = RENDERABLE | CAST_SHADOW;
 
@@ -673,6 +688,8 @@ namespace ap::scene
 		inline void SetImpostorPlacement(bool value) { if (value) { _flags |= IMPOSTOR_PLACEMENT; } else { _flags &= ~IMPOSTOR_PLACEMENT; } }
 		inline void SetRequestPlanarReflection(bool value) { if (value) { _flags |= REQUEST_PLANAR_REFLECTION; } else { _flags &= ~REQUEST_PLANAR_REFLECTION; } }
 		inline void SetLightmapRenderRequest(bool value) { if (value) { _flags |= LIGHTMAP_RENDER_REQUEST; } else { _flags &= ~LIGHTMAP_RENDER_REQUEST; } }
+		// The mesh of occluder objects is rasterized for software occlusion culling, it should be a large static mesh with few triangles
+		inline void SetOccluder(bool value) { if (value) { _flags |= OCCLUDER; } else { _flags &= ~OCCLUDER; } }
 
 		inline bool IsRenderable() const { return _flags & RENDERABLE; }
 		inline bool IsCastingShadow() const { return _flags & CAST_SHADOW; }
@@ -680,6 +697,7 @@ namespace ap::scene
 		inline bool IsImpostorPlacement() const { return _flags & IMPOSTOR_PLACEMENT; }
 		inline bool IsRequestPlanarReflection() const { return _flags & REQUEST_PLANAR_REFLECTION; }
 		inline bool IsLightmapRenderRequested() const { return _flags & LIGHTMAP_RENDER_REQUEST; }
+		inline bool IsOccluder() const { return _flags & OCCLUDER; }
 
 		inline float GetTransparency() const { return 1 - color.w; }
 		inline uint32_t GetRenderTypes() const { return rendertypeMask; }
@@ -1246,10 +1264,10 @@ namespace ap::scene
 	struct Scene
 	{
 		ap::ecs::ComponentManager<NameComponent> names;
-		ap::ecs::ComponentManager<LayerComponent> layers;
-		ap::ecs::ComponentManager<TransformComponent> transforms;
-		ap::ecs::ComponentManager<PreviousFrameTransformComponent> prev_transforms;
-		ap::ecs::ComponentManager<HierarchyComponent> hierarchy;
+		ap::ecs::ComponentManager<LayerComponent, ap::ecs::SparseLookup> layers;
+		ap::ecs::ComponentManager<TransformComponent, ap::ecs::SparseLookup> transforms;
+		ap::ecs::ComponentManager<PreviousFrameTransformComponent, ap::ecs::SparseLookup> prev_transforms;
+		ap::ecs::ComponentManager<HierarchyComponent, ap::ecs::SparseLookup> hierarchy;
 		ap::ecs::ComponentManager<MaterialComponent> materials;
 		ap::ecs::ComponentManager<MeshComponent> meshes;
 		ap::ecs::ComponentManager<ImpostorComponent> impostors;
@@ -1287,11 +1305,35 @@ namespace ap::scene
 		ap::SpinLock locker;
 		ap::primitive::AABB bounds;
 		ap::vector<ap::primitive::AABB> parallel_bounds;
+		bool hierarchy_order_dirty = false; // the hierarchy order will be rebuilt before it is used next time
+		// Entities whose transform world matrix changed in the current frame (in no particular order)
+		//	This is complete after the InverseKinematicsUpdateSystem finished (springs and IK modify world matrices after the hierarchy update)
+		ap::vector<ap::ecs::Entity> changed_transforms;
+		std::atomic<uint32_t> changed_transform_count{ 0 };
+		// Marks the transform of an entity as changed in the current frame and adds it to changed_transforms (not thread safe)
+		void SetTransformChanged(ap::ecs::Entity entity);
 		WeatherComponent weather;
 		ap::graphics::RaytracingAccelerationStructure TLAS;
 		ap::graphics::GPUBuffer TLAS_instancesUpload[ap::graphics::GraphicsDevice::GetBufferCount()];
 		void* TLAS_instancesMapped = nullptr;
 		ap::GPUBVH BVH; // this is for non-hardware accelerated raytracing
+		ap::BVH object_bvh; // CPU BVH over aabb_objects for scene queries and visibility culling, refitted in every Update()
+		ap::BVH object_bvh_pending; // large scenes rebuild the object_bvh in the background into this, it replaces object_bvh when finished
+		ap::vector<ap::primitive::AABB> object_bvh_pending_aabbs; // copy of aabb_objects that object_bvh_pending is built from
+		ap::jobsystem::context object_bvh_build_ctx;
+		ap::BVH light_bvh; // CPU BVH over aabb_lights for visibility culling
+		ap::BVH decal_bvh; // CPU BVH over aabb_decals for visibility culling
+		// Indices of the objects whose aabb changed in the current frame (in no particular order), the object_bvh only refits above these
+		//	This is complete after the ObjectUpdateSystem finished
+		ap::vector<uint32_t> changed_objects;
+		std::atomic<uint32_t> changed_object_count{ 0 };
+		// The entity of every object slot in the last ObjectUpdateSystem, removing an object moves another one into its slot without changing the object count
+		//	A slot whose entity changed is refitted like a changed aabb, because the moved object can have the same aabb as before
+		ap::vector<ap::ecs::Entity> object_slot_entities;
+		// Indices of the objects that can be rasterized into a software occlusion buffer (static occluder objects with a mesh)
+		//	This is complete after the ObjectUpdateSystem finished
+		ap::vector<uint32_t> occluder_objects;
+		std::atomic<uint32_t> occluder_object_count{ 0 };
 		mutable bool acceleration_structure_update_requested = false;
 		void SetAccelerationStructureUpdateRequested(bool value = true) { acceleration_structure_update_requested = value; }
 		bool IsAccelerationStructureUpdateRequested() const { return acceleration_structure_update_requested; }
@@ -1374,6 +1416,8 @@ namespace ap::scene
 		mutable ap::vector<ap::Sprite> waterRipples;
 		void PutWaterRipple(const std::string& image, const XMFLOAT3& pos);
 
+		~Scene();
+
 		// Update all components by a given timestep (in seconds):
 		//	This is an expensive function, prefer to call it only once per frame!
 		void Update(float dt);
@@ -1451,6 +1495,11 @@ namespace ap::scene
 		// Detaches all children from an entity (if there are any):
 		void Component_DetachChildren(ap::ecs::Entity parent);
 
+		// The hierarchy is sorted by depth for the update, so parents are always before their children and each depth level is contiguous
+		//	Attaching, detaching, serialization and merging only mark the order dirty, Update() sorts the whole hierarchy once before it's used
+		//	(moving entries on every attach would cost O(n) each, so building a large hierarchy would be quadratic)
+		void SortHierarchy();
+
 		void Serialize(ap::Archive& archive);
 
 		void RunPreviousFrameTransformUpdateSystem(ap::jobsystem::context& ctx);
@@ -1534,6 +1583,9 @@ namespace ap::scene
 	//	layerMask		:	filter based on layer
 	//	scene			:	the scene that will be traced against the ray
 	PickResult Pick(const ap::primitive::Ray& ray, uint32_t renderTypeMask = ap::enums::RENDERTYPE_OPAQUE, uint32_t layerMask = ~0, const Scene& scene = GetScene());
+	// Batched version of Pick(), the rays are traced in parallel on the job system
+	//	results			:	array of count elements that receives the closest intersection of each ray
+	void Pick(const ap::primitive::Ray* rays, size_t count, PickResult* results, uint32_t renderTypeMask = ap::enums::RENDERTYPE_OPAQUE, uint32_t layerMask = ~0, const Scene& scene = GetScene());
 
 	struct SceneIntersectSphereResult
 	{
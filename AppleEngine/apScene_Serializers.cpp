@@ -6,6 +6,7 @@
 #include "apBacklog.h"
 #include "apTimer.h"
 #include "apVector.h"
+#include <algorithm>
 
 using namespace ap::ecs;
 
@@ -45,6 +46,7 @@ namespace ap::scene
 
 			SetDirty();
 			UpdateTransform();
+			SetDirty(); // stays dirty, so the next scene update treats it as changed and applies the hierarchy
 		}
 		else
 		{
@@ -1309,6 +1311,157 @@ namespace ap::scene
 		}
 	}
 
+	// Calls func(index, manager) for every component manager that is serialized in the chunked layout (archive version >= 75)
+	//	The order of managers is part of the file format, new ones must be added to the end!
+	template<typename F>
+	static void ForEachSerializedComponentManager(Scene& scene, F func)
+	{
+		uint32_t index = 0;
+		func(index++, scene.names);
+		func(index++, scene.layers);
+		func(index++, scene.transforms);
+		func(index++, scene.prev_transforms);
+		func(index++, scene.hierarchy);
+		func(index++, scene.materials);
+		func(index++, scene.meshes);
+		func(index++, scene.impostors);
+		func(index++, scene.objects);
+		func(index++, scene.aabb_objects);
+		func(index++, scene.rigidbodies);
+		func(index++, scene.softbodies);
+		func(index++, scene.armatures);
+		func(index++, scene.lights);
+		func(index++, scene.aabb_lights);
+		func(index++, scene.cameras);
+		func(index++, scene.probes);
+		func(index++, scene.aabb_probes);
+		func(index++, scene.forces);
+		func(index++, scene.decals);
+		func(index++, scene.aabb_decals);
+		func(index++, scene.animations);
+		func(index++, scene.emitters);
+		func(index++, scene.hairs);
+		func(index++, scene.weathers);
+		func(index++, scene.sounds);
+		func(index++, scene.inverse_kinematics);
+		func(index++, scene.springs);
+		func(index++, scene.animation_datas);
+	}
+
+	// The components are stored in chunks, which are read concurrently on the job system
+	//	Layout: entity table, component counts, chunk ranges, chunks
+	//	The entity table contains every serialized entity, so the entity remap is resolved before reading the chunks and it is only read while they are processed
+	static void SerializeChunked(Scene& scene, ap::Archive& archive, ap::vector<ap::Archive>& chunks, EntitySerializer& seri)
+	{
+		struct ChunkRange
+		{
+			uint32_t manager = 0;
+			uint64_t offset = 0;
+			uint64_t count = 0;
+		};
+		ap::vector<ChunkRange> ranges;
+
+		if (archive.IsReadMode())
+		{
+			ap::vector<uint64_t> entity_table;
+			archive >> entity_table;
+			seri.remap.reserve(entity_table.size());
+			for (uint64_t mem : entity_table)
+			{
+				seri.remap[mem] = CreateEntity();
+			}
+			seri.remap_resolved = true;
+
+			ForEachSerializedComponentManager(scene, [&](uint32_t, auto& manager) {
+				size_t count;
+				archive >> count;
+				manager.BeginSerializeRanges(count);
+			});
+
+			size_t range_count;
+			archive >> range_count;
+			ranges.resize(range_count);
+			for (ChunkRange& range : ranges)
+			{
+				archive >> range.manager;
+				archive >> range.offset;
+				archive >> range.count;
+			}
+
+			archive.ReadChunks(chunks);
+			assert(chunks.size() == ranges.size());
+
+			ap::jobsystem::context ctx;
+			ctx.priority = ap::jobsystem::GetLoadingPriority();
+			ap::jobsystem::Dispatch(ctx, (uint32_t)chunks.size(), 1, [&](ap::jobsystem::JobArgs args) {
+				const ChunkRange& range = ranges[args.jobIndex];
+				ap::Archive& chunk = chunks[args.jobIndex];
+				ForEachSerializedComponentManager(scene, [&](uint32_t index, auto& manager) {
+					if (index == range.manager)
+					{
+						manager.SerializeRange(chunk, seri, (size_t)range.offset, (size_t)range.count);
+					}
+				});
+			});
+			ap::jobsystem::Wait(ctx);
+
+			ForEachSerializedComponentManager(scene, [&](uint32_t, auto& manager) {
+				ap::jobsystem::Execute(ctx, [&manager](ap::jobsystem::JobArgs) {
+					manager.EndSerializeRanges();
+				});
+			});
+			ap::jobsystem::Wait(ctx);
+		}
+		else
+		{
+			static constexpr size_t chunk_size = 256 * 1024; // a new chunk is started when the current one grows larger than this (in bytes)
+
+			ForEachSerializedComponentManager(scene, [&](uint32_t index, auto& manager) {
+				const size_t count = manager.GetCount();
+				size_t offset = 0;
+				while (offset < count)
+				{
+					ChunkRange& range = ranges.emplace_back();
+					range.manager = index;
+					range.offset = offset;
+					ap::Archive& chunk = chunks.emplace_back(archive.CreateChunk());
+					while (offset < count && chunk.GetPos() < chunk_size)
+					{
+						manager.SerializeRange(chunk, seri, offset, 1);
+						offset++;
+					}
+					range.count = offset - range.offset;
+				}
+			});
+
+			// The entity table is made of every entity that owns a serialized component, references are not collected while writing:
+			ap::vector<uint64_t> entity_table;
+			ForEachSerializedComponentManager(scene, [&](uint32_t, auto& manager) {
+				for (size_t i = 0; i < manager.GetCount(); ++i)
+				{
+					entity_table.push_back(manager.GetEntity(i));
+				}
+			});
+			std::sort(entity_table.begin(), entity_table.end());
+			entity_table.erase(std::unique(entity_table.begin(), entity_table.end()), entity_table.end());
+			archive << entity_table;
+
+			ForEachSerializedComponentManager(scene, [&](uint32_t, auto& manager) {
+				archive << manager.GetCount();
+			});
+
+			archive << ranges.size();
+			for (const ChunkRange& range : ranges)
+			{
+				archive << range.manager;
+				archive << range.offset;
+				archive << range.count;
+			}
+
+			archive.WriteChunks(chunks.data(), chunks.size());
+		}
+	}
+
 	void Scene::Serialize(ap::Archive& archive)
 	{
 		ap::Timer timer;
@@ -1331,49 +1484,67 @@ namespace ap::scene
 			ap::resourcemanager::Serialize(archive, resource_seri);
 		}
 
+		// The chunks must outlive the serialization subtasks, because those can reference them:
+		ap::vector<ap::Archive> chunks;
+
 		// With this we will ensure that serialized entities are unique and persistent across the scene:
 		EntitySerializer seri;
 
-		names.Serialize(archive, seri);
-		layers.Serialize(archive, seri);
-		transforms.Serialize(archive, seri);
-		prev_transforms.Serialize(archive, seri);
-		hierarchy.Serialize(archive, seri);
-		materials.Serialize(archive, seri);
-		meshes.Serialize(archive, seri);
-		impostors.Serialize(archive, seri);
-		objects.Serialize(archive, seri);
-		aabb_objects.Serialize(archive, seri);
-		rigidbodies.Serialize(archive, seri);
-		softbodies.Serialize(archive, seri);
-		armatures.Serialize(archive, seri);
-		lights.Serialize(archive, seri);
-		aabb_lights.Serialize(archive, seri);
-		cameras.Serialize(archive, seri);
-		probes.Serialize(archive, seri);
-		aabb_probes.Serialize(archive, seri);
-		forces.Serialize(archive, seri);
-		decals.Serialize(archive, seri);
-		aabb_decals.Serialize(archive, seri);
-		animations.Serialize(archive, seri);
-		emitters.Serialize(archive, seri);
-		hairs.Serialize(archive, seri);
-		weathers.Serialize(archive, seri);
-		if (archive.GetVersion() >= 30)
-		{
-			sounds.Serialize(archive, seri);
-		}
-		if (archive.GetVersion() >= 37)
-		{
-			inverse_kinematics.Serialize(archive, seri);
-		}
-		if (archive.GetVersion() >= 38)
+		if (archive.GetVersion() >= 75)
 		{
-			springs.Serialize(archive, seri);
+			SerializeChunked(*this, archive, chunks, seri);
+			if (archive.IsReadMode())
+			{
+				hierarchy_order_dirty = true;
+			}
 		}
-		if (archive.GetVersion() >= 46)
+		else
 		{
-			animation_datas.Serialize(archive, seri);
+			names.Serialize(archive, seri);
+			layers.Serialize(archive, seri);
+			transforms.Serialize(archive, seri);
+			prev_transforms.Serialize(archive, seri);
+			hierarchy.Serialize(archive, seri);
+			if (archive.IsReadMode())
+			{
+				hierarchy_order_dirty = true;
+			}
+			materials.Serialize(archive, seri);
+			meshes.Serialize(archive, seri);
+			impostors.Serialize(archive, seri);
+			objects.Serialize(archive, seri);
+			aabb_objects.Serialize(archive, seri);
+			rigidbodies.Serialize(archive, seri);
+			softbodies.Serialize(archive, seri);
+			armatures.Serialize(archive, seri);
+			lights.Serialize(archive, seri);
+			aabb_lights.Serialize(archive, seri);
+			cameras.Serialize(archive, seri);
+			probes.Serialize(archive, seri);
+			aabb_probes.Serialize(archive, seri);
+			forces.Serialize(archive, seri);
+			decals.Serialize(archive, seri);
+			aabb_decals.Serialize(archive, seri);
+			animations.Serialize(archive, seri);
+			emitters.Serialize(archive, seri);
+			hairs.Serialize(archive, seri);
+			weathers.Serialize(archive, seri);
+			if (archive.GetVersion() >= 30)
+			{
+				sounds.Serialize(archive, seri);
+			}
+			if (archive.GetVersion() >= 37)
+			{
+				inverse_kinematics.Serialize(archive, seri);
+			}
+			if (archive.GetVersion() >= 38)
+			{
+				springs.Serialize(archive, seri);
+			}
+			if (archive.GetVersion() >= 46)
+			{
+				animation_datas.Serialize(archive, seri);
+			}
 		}
 
 		ap::backlog::post("Scene serialize took " + std::to_string(timer.elapsed_seconds()) + " sec");
@@ -1435,6 +1606,7 @@ namespace ap::scene
 				{
 					auto& component = hierarchy.Create(entity);
 					component.Serialize(archive, seri);
+					hierarchy_order_dirty = true;
 				}
 			}
 			{
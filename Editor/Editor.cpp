@@ -1069,6 +1069,10 @@ void Editor::ImGuiRender_Renderer()
 	if (DrawCheckbox("Occlusion Culling", OcclusionCullingEnabled))
 		ap::renderer::SetOcclusionCullingEnabled(OcclusionCullingEnabled);
 
+	bool SoftwareOcclusionCullingEnabled = ap::renderer::GetSoftwareOcclusionCullingEnabled();
+	if (DrawCheckbox("Software Occlusion Culling", SoftwareOcclusionCullingEnabled))
+		ap::renderer::SetSoftwareOcclusionCullingEnabled(SoftwareOcclusionCullingEnabled);
+
 	
 	float resolutionScale = renderComponent.resolutionScale;
 	if (DrawSliderFloat("Resolution Scale", resolutionScale, 0.25f, 2.0f,"%.2f"))
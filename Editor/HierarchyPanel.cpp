@@ -1622,6 +1622,10 @@ namespace Panel
 
 						PropertyGridSpacing();
 
+						bool isOccluder = object->IsOccluder();
+						if (DrawCheckbox("Occluder", isOccluder))
+							object->SetOccluder(isOccluder);
+
 						{
 							std::vector<std::string> items;
 							for (int i = 0; i < mesh.subsets.size(); i++)
@@ -0,0 +1,325 @@
+// Measures saving and loading a scene-like archive with the bulk array path of ap::Archive, against serializing the same arrays element by element (the path that was used before)
+//	The payload is made of meshes (positions, normals, uvs, 32-bit indices, a name) and embedded resource files (byte blobs)
+//	On Linux it also measures the memory that a load allocates, with the file memory mapped and with the file read into memory (how files were opened before)
+//	Options:
+//		--megabytes N : approximate size of the payload (default: 500)
+#include "TestCommon.h"
+#include "apArchive.h"
+#include "apHelper.h"
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+
+#if defined(__linux__)
+#include <malloc.h>
+#endif
+
+namespace
+{
+	struct Mesh
+	{
+		std::string name;
+		ap::vector<XMFLOAT3> positions;
+		ap::vector<XMFLOAT3> normals;
+		ap::vector<XMFLOAT2> uvs;
+		ap::vector<uint32_t> indices;
+	};
+	struct Payload
+	{
+		ap::vector<Mesh> meshes;
+		ap::vector<ap::vector<uint8_t>> files;
+	};
+
+	Payload CreatePayload(size_t megabytes)
+	{
+		constexpr uint32_t vertex_count = 64 * 1024;
+		constexpr size_t file_size = 4 * 1024 * 1024;
+		constexpr size_t mesh_size = vertex_count * (sizeof(XMFLOAT3) * 2 + sizeof(XMFLOAT2) + sizeof(uint32_t) * 3);
+
+		std::mt19937 rng(11);
+		std::uniform_real_distribution<float> dist(-1, 1);
+
+		Payload payload;
+		size_t size = 0;
+		while (size < megabytes * 1024 * 1024)
+		{
+			Mesh& mesh = payload.meshes.emplace_back();
+			mesh.name = "mesh_" + std::to_string(payload.meshes.size());
+			mesh.positions.resize(vertex_count);
+			mesh.normals.resize(vertex_count);
+			mesh.uvs.resize(vertex_count);
+			mesh.indices.resize(vertex_count * 3);
+			for (uint32_t i = 0; i < vertex_count; ++i)
+			{
+				mesh.positions[i] = XMFLOAT3(dist(rng), dist(rng), dist(rng));
+				mesh.normals[i] = XMFLOAT3(dist(rng), dist(rng), dist(rng));
+				mesh.uvs[i] = XMFLOAT2(dist(rng), dist(rng));
+			}
+			for (size_t i = 0; i < mesh.indices.size(); ++i)
+			{
+				mesh.indices[i] = (uint32_t)(rng() % vertex_count);
+			}
+			size += mesh_size;
+
+			// one embedded file per 4 meshes, like textures referenced by materials
+			if (payload.meshes.size() % 4 == 0)
+			{
+				ap::vector<uint8_t>& file = payload.files.emplace_back(file_size);
+				for (uint8_t& x : file)
+				{
+					x = (uint8_t)rng();
+				}
+				size += file_size;
+			}
+		}
+		return payload;
+	}
+
+	// Element by element serialization, as ap::Archive did it for every array before the bulk path
+	template<typename T>
+	void WriteElements(ap::Archive& archive, const ap::vector<T>& data)
+	{
+		archive << data.size();
+		for (const T& x : data)
+		{
+			archive << x;
+		}
+	}
+	template<typename T>
+	void ReadElements(ap::Archive& archive, ap::vector<T>& data)
+	{
+		size_t count;
+		archive >> count;
+		data.resize(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			archive >> data[i];
+		}
+	}
+	void WriteElements(ap::Archive& archive, const std::string& data)
+	{
+		archive << data.length();
+		for (char x : data)
+		{
+			archive << x;
+		}
+	}
+	void ReadElements(ap::Archive& archive, std::string& data)
+	{
+		size_t count;
+		archive >> count;
+		data.resize(count);
+		for (size_t i = 0; i < count; ++i)
+		{
+			archive >> data[i];
+		}
+	}
+
+	template<bool bulk>
+	void Serialize(ap::Archive& archive, Payload& payload)
+	{
+		if (archive.IsReadMode())
+		{
+			size_t mesh_count, file_count;
+			archive >> mesh_count;
+			archive >> file_count;
+			payload.meshes.resize(mesh_count);
+			payload.files.resize(file_count);
+		}
+		else
+		{
+			archive << payload.meshes.size();
+			archive << payload.files.size();
+		}
+
+		auto serialize = [&](auto& data) {
+			if constexpr (bulk)
+			{
+				if (archive.IsReadMode())
+				{
+					archive >> data;
+				}
+				else
+				{
+					archive << data;
+				}
+			}
+			else
+			{
+				if (archive.IsReadMode())
+				{
+					ReadElements(archive, data);
+				}
+				else
+				{
+					WriteElements(archive, data);
+				}
+			}
+		};
+		for (Mesh& mesh : payload.meshes)
+		{
+			serialize(mesh.name);
+			serialize(mesh.positions);
+			serialize(mesh.normals);
+			serialize(mesh.uvs);
+			serialize(mesh.indices);
+		}
+		for (ap::vector<uint8_t>& file : payload.files)
+		{
+			serialize(file);
+		}
+	}
+
+	bool IsEqual(const XMFLOAT2& a, const XMFLOAT2& b) { return a.x == b.x && a.y == b.y; }
+	bool IsEqual(const XMFLOAT3& a, const XMFLOAT3& b) { return a.x == b.x && a.y == b.y && a.z == b.z; }
+	bool IsEqual(uint32_t a, uint32_t b) { return a == b; }
+	bool IsEqual(uint8_t a, uint8_t b) { return a == b; }
+
+	template<typename T>
+	bool IsEqual(const ap::vector<T>& a, const ap::vector<T>& b)
+	{
+		if (a.size() != b.size())
+			return false;
+		for (size_t i = 0; i < a.size(); ++i)
+		{
+			if (!IsEqual(a[i], b[i]))
+				return false;
+		}
+		return true;
+	}
+
+	bool IsEqual(const Payload& a, const Payload& b)
+	{
+		if (a.meshes.size() != b.meshes.size() || a.files.size() != b.files.size())
+			return false;
+		for (size_t i = 0; i < a.meshes.size(); ++i)
+		{
+			const Mesh& x = a.meshes[i];
+			const Mesh& y = b.meshes[i];
+			if (x.name != y.name || !IsEqual(x.positions, y.positions) || !IsEqual(x.normals, y.normals) || !IsEqual(x.uvs, y.uvs) || !IsEqual(x.indices, y.indices))
+				return false;
+		}
+		for (size_t i = 0; i < a.files.size(); ++i)
+		{
+			if (!IsEqual(a.files[i], b.files[i]))
+				return false;
+		}
+		return true;
+	}
+
+	struct Result
+	{
+		double write_ms = 0;
+		double load_ms = 0;
+		size_t file_size = 0;
+	};
+
+	template<bool bulk>
+	Result Measure(Payload& payload, const std::string& fileName, uint32_t repetitions)
+	{
+		Result result;
+		result.write_ms = ap::test::MeasureBest(repetitions, [&] {
+			ap::Archive archive;
+			Serialize<bulk>(archive, payload);
+			result.file_size = archive.GetPos();
+			AP_CHECK(archive.SaveFile(fileName));
+		});
+
+		// The file was just written, so it is loaded from the OS file cache
+		Payload loaded;
+		result.load_ms = ap::test::MeasureBest(repetitions, [&] {
+			loaded = {};
+			ap::Archive archive(fileName);
+			AP_CHECK(archive.IsOpen());
+			Serialize<bulk>(archive, loaded);
+		});
+		AP_CHECK(IsEqual(payload, loaded));
+
+		std::filesystem::remove(fileName);
+		return result;
+	}
+
+	// Returns the resident anonymous (heap) memory of the process in bytes, or 0 if it can't be queried
+	//	Mapped file pages are not included, they belong to the OS file cache and they can be evicted at any time
+	size_t GetAnonymousMemory()
+	{
+#if defined(__linux__)
+		malloc_trim(0); // freed heap memory is returned to the OS, so it is not counted
+		std::ifstream status("/proc/self/status");
+		std::string line;
+		while (std::getline(status, line))
+		{
+			if (line.compare(0, 8, "RssAnon:") == 0)
+			{
+				return (size_t)std::stoull(line.substr(8)) * 1024;
+			}
+		}
+#endif
+		return 0;
+	}
+
+	// Returns the heap memory that is allocated while the loaded payload and the archive are both alive, which is the peak of a load
+	size_t MeasureLoadMemory(Payload& payload, const std::string& fileName, bool mapped)
+	{
+		{
+			ap::Archive archive;
+			Serialize<true>(archive, payload);
+			AP_CHECK(archive.SaveFile(fileName));
+		}
+		const size_t before = GetAnonymousMemory();
+		size_t peak = 0;
+		{
+			Payload loaded;
+			ap::vector<uint8_t> filedata;
+			ap::Archive archive;
+			if (mapped)
+			{
+				archive = ap::Archive(fileName);
+			}
+			else
+			{
+				AP_CHECK(ap::helper::FileRead(fileName, filedata));
+				archive = ap::Archive(filedata.data());
+			}
+			AP_CHECK(archive.IsOpen());
+			Serialize<true>(archive, loaded);
+			peak = GetAnonymousMemory() - before;
+			AP_CHECK(IsEqual(payload, loaded));
+		}
+		std::filesystem::remove(fileName);
+		return peak;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = ap::test::IsQuick(argc, argv);
+	const uint32_t megabytes = ap::test::GetArgument(argc, argv, "--megabytes", quick ? 16 : 500);
+	const uint32_t repetitions = quick ? 1 : 3;
+
+	Payload payload = CreatePayload(megabytes);
+	const std::string fileName = (std::filesystem::temp_directory_path() / "ap_archive_benchmark.apscene").string();
+
+	const Result elements = Measure<false>(payload, fileName, repetitions);
+	const Result bulk = Measure<true>(payload, fileName, repetitions);
+	AP_CHECK(bulk.file_size < elements.file_size); // 32-bit indices are no longer widened to 64 bits
+
+	const size_t read_memory = MeasureLoadMemory(payload, fileName, false);
+	const size_t mapped_memory = MeasureLoadMemory(payload, fileName, true);
+	if (read_memory > 0)
+	{
+		// Reading the file holds a copy of the whole file next to the loaded payload, mapping it doesn't:
+		AP_CHECK(mapped_memory + bulk.file_size / 2 < read_memory);
+	}
+
+	std::printf("%zu meshes, %zu embedded files, best of %u runs\n", payload.meshes.size(), payload.files.size(), repetitions);
+	std::printf("element by element: %7.1f MB file, save %8.1f ms, load %8.1f ms\n", elements.file_size / (1024.0 * 1024.0), elements.write_ms, elements.load_ms);
+	std::printf("bulk:               %7.1f MB file, save %8.1f ms, load %8.1f ms\n", bulk.file_size / (1024.0 * 1024.0), bulk.write_ms, bulk.load_ms);
+	if (read_memory > 0)
+	{
+		std::printf("peak heap memory of a bulk load: file read into memory %7.1f MB, memory mapped file %7.1f MB\n", read_memory / (1024.0 * 1024.0), mapped_memory / (1024.0 * 1024.0));
+	}
+	return 0;
+}
@@ -0,0 +1,236 @@
+// Compares saving and loading an archive file in the raw format and in the compressed container format
+//	Loads are measured with the file in the OS file cache (warm) and with the file's cached pages dropped before opening (cold)
+//	The payload is scene-like: grid meshes (positions, normals, uvs, indices) and embedded files that are already compressed (random bytes)
+//	Options:
+//		--megabytes N : approximate size of the payload (default: 256)
+//		--threads N : number of worker threads (default: all cores)
+#include "TestCommon.h"
+#include "apArchive.h"
+#include "apJobSystem.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <random>
+#include <string>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	struct Mesh
+	{
+		ap::vector<XMFLOAT3> positions;
+		ap::vector<XMFLOAT3> normals;
+		ap::vector<XMFLOAT2> uvs;
+		ap::vector<uint32_t> indices;
+	};
+	struct Payload
+	{
+		ap::vector<Mesh> meshes;
+		ap::vector<ap::vector<uint8_t>> files;
+	};
+
+	void Write(ap::Archive& archive, const Payload& payload)
+	{
+		archive << payload.meshes.size();
+		archive << payload.files.size();
+		for (const Mesh& mesh : payload.meshes)
+		{
+			archive << mesh.positions;
+			archive << mesh.normals;
+			archive << mesh.uvs;
+			archive << mesh.indices;
+		}
+		for (const ap::vector<uint8_t>& file : payload.files)
+		{
+			archive << file;
+		}
+	}
+
+	void Read(ap::Archive& archive, Payload& payload)
+	{
+		size_t mesh_count, file_count;
+		archive >> mesh_count;
+		archive >> file_count;
+		payload.meshes.resize(mesh_count);
+		payload.files.resize(file_count);
+		for (Mesh& mesh : payload.meshes)
+		{
+			archive >> mesh.positions;
+			archive >> mesh.normals;
+			archive >> mesh.uvs;
+			archive >> mesh.indices;
+		}
+		for (ap::vector<uint8_t>& file : payload.files)
+		{
+			archive >> file;
+		}
+	}
+
+	Payload CreatePayload(size_t megabytes)
+	{
+		constexpr uint32_t grid = 256;
+		constexpr uint32_t vertex_count = grid * grid;
+		constexpr uint32_t index_count = (grid - 1) * (grid - 1) * 6;
+		constexpr size_t file_size = 4 * 1024 * 1024;
+		constexpr size_t mesh_size = vertex_count * (sizeof(XMFLOAT3) * 2 + sizeof(XMFLOAT2)) + index_count * sizeof(uint32_t);
+
+		std::mt19937 rng(5);
+		std::uniform_real_distribution<float> noise(-0.01f, 0.01f);
+
+		Payload payload;
+		size_t size = 0;
+		while (size < megabytes * 1024 * 1024)
+		{
+			const float seed = float(payload.meshes.size());
+			Mesh& mesh = payload.meshes.emplace_back();
+			mesh.positions.resize(vertex_count);
+			mesh.normals.resize(vertex_count);
+			mesh.uvs.resize(vertex_count);
+			mesh.indices.reserve(index_count);
+			for (uint32_t y = 0; y < grid; ++y)
+			{
+				for (uint32_t x = 0; x < grid; ++x)
+				{
+					const uint32_t i = y * grid + x;
+					const float height = std::sin(x * 0.05f + seed) * std::cos(y * 0.05f) + noise(rng);
+					mesh.positions[i] = XMFLOAT3(float(x), height, float(y));
+					XMStoreFloat3(&mesh.normals[i], XMVector3Normalize(XMVectorSet(noise(rng), 1, noise(rng), 0)));
+					mesh.uvs[i] = XMFLOAT2(x / float(grid - 1), y / float(grid - 1));
+				}
+			}
+			for (uint32_t y = 0; y < grid - 1; ++y)
+			{
+				for (uint32_t x = 0; x < grid - 1; ++x)
+				{
+					const uint32_t i = y * grid + x;
+					mesh.indices.insert(mesh.indices.end(), { i, i + grid, i + 1, i + 1, i + grid, i + grid + 1 });
+				}
+			}
+			size += mesh_size;
+
+			// one embedded file per 4 meshes
+			if (payload.meshes.size() % 4 == 0)
+			{
+				ap::vector<uint8_t>& file = payload.files.emplace_back(file_size);
+				for (uint8_t& x : file)
+				{
+					x = (uint8_t)rng();
+				}
+				size += file_size;
+			}
+		}
+		return payload;
+	}
+
+	// Writes out the file's dirty pages, then removes the file from the OS file cache, so that the next open reads it from the disk
+	bool DropFileCache(const std::string& fileName)
+	{
+#if defined(__linux__)
+		const int fd = open(fileName.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		const bool success = fdatasync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+		close(fd);
+		return success;
+#else
+		return false;
+#endif
+	}
+
+	struct Result
+	{
+		size_t file_size = 0;
+		double save_ms = 0;
+		double warm_ms = 0;
+		double cold_ms = -1; // negative if the file cache can't be dropped on this platform
+	};
+
+	Result Measure(const Payload& payload, const std::string& fileName, bool compressed, uint32_t repetitions)
+	{
+		ap::Archive source;
+		Write(source, payload);
+
+		Result result;
+		result.save_ms = ap::test::MeasureBest(repetitions, [&] {
+			AP_CHECK(source.SaveFile(fileName, compressed));
+		});
+		result.file_size = (size_t)std::filesystem::file_size(fileName);
+
+		Payload loaded;
+		auto load = [&] {
+			loaded = {};
+			ap::Archive archive(fileName);
+			AP_CHECK(archive.IsOpen());
+			Read(archive, loaded);
+		};
+
+		load(); // brings the file into the OS file cache
+		result.warm_ms = ap::test::MeasureBest(repetitions, load);
+
+		if (DropFileCache(fileName))
+		{
+			result.cold_ms = 1e30;
+			for (uint32_t i = 0; i < repetitions; ++i)
+			{
+				AP_CHECK(DropFileCache(fileName));
+				result.cold_ms = std::min(result.cold_ms, ap::test::MeasureBest(1, load));
+			}
+		}
+
+		AP_CHECK(loaded.meshes.size() == payload.meshes.size() && loaded.files.size() == payload.files.size());
+		for (size_t i = 0; i < payload.meshes.size(); ++i)
+		{
+			AP_CHECK(std::memcmp(loaded.meshes[i].positions.data(), payload.meshes[i].positions.data(), payload.meshes[i].positions.size() * sizeof(XMFLOAT3)) == 0);
+			AP_CHECK(std::memcmp(loaded.meshes[i].normals.data(), payload.meshes[i].normals.data(), payload.meshes[i].normals.size() * sizeof(XMFLOAT3)) == 0);
+			AP_CHECK(std::memcmp(loaded.meshes[i].uvs.data(), payload.meshes[i].uvs.data(), payload.meshes[i].uvs.size() * sizeof(XMFLOAT2)) == 0);
+			AP_CHECK(loaded.meshes[i].indices == payload.meshes[i].indices);
+		}
+		for (size_t i = 0; i < payload.files.size(); ++i)
+		{
+			AP_CHECK(loaded.files[i] == payload.files[i]);
+		}
+
+		std::filesystem::remove(fileName);
+		return result;
+	}
+
+	void Print(const char* name, const Result& result, size_t payload_size)
+	{
+		const double megabytes = payload_size / (1024.0 * 1024.0);
+		std::printf("%-10s %7.1f MB file, save %7.1f ms, warm load %7.1f ms (%6.0f MB/s)", name, result.file_size / (1024.0 * 1024.0), result.save_ms, result.warm_ms, megabytes * 1000 / result.warm_ms);
+		if (result.cold_ms >= 0)
+		{
+			std::printf(", cold load %7.1f ms (%6.0f MB/s)", result.cold_ms, megabytes * 1000 / result.cold_ms);
+		}
+		std::printf("\n");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = ap::test::IsQuick(argc, argv);
+	const uint32_t megabytes = ap::test::GetArgument(argc, argv, "--megabytes", quick ? 16 : 256);
+	const uint32_t repetitions = quick ? 1 : 3;
+	ap::jobsystem::Initialize(ap::test::GetArgument(argc, argv, "--threads", ~0u));
+
+	const Payload payload = CreatePayload(megabytes);
+	const std::string fileName = (std::filesystem::temp_directory_path() / "ap_compressed_archive_benchmark.apscene").string();
+
+	const Result raw = Measure(payload, fileName, false, repetitions);
+	const Result compressed = Measure(payload, fileName, true, repetitions);
+	AP_CHECK(compressed.file_size < raw.file_size);
+
+	std::printf("%zu meshes, %zu embedded files, %u worker threads, best of %u runs\n", payload.meshes.size(), payload.files.size(), ap::jobsystem::GetThreadCount(), repetitions);
+	if (raw.cold_ms < 0)
+	{
+		std::printf("cold loads are not measured, the file cache can't be dropped on this platform\n");
+	}
+	Print("raw", raw, raw.file_size);
+	Print("compressed", compressed, raw.file_size);
+	return 0;
+}
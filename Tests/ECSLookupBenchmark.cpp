@@ -0,0 +1,87 @@
+// Compares the HashLookup and SparseLookup entity to component index mapping of ecs::ComponentManager
+//	Lookups are made in random entity order, like the hierarchy update and picking resolve their parents and components
+#include "TestCommon.h"
+#include "apECS.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace ap::ecs;
+
+struct TestComponent
+{
+	float value[16] = {};
+	void Serialize(ap::Archive& archive, EntitySerializer& seri) {}
+};
+
+template<typename Lookup>
+static void RunBenchmark(const char* name, size_t entityCount, uint32_t repetitions)
+{
+	ComponentManager<TestComponent, Lookup> manager;
+	std::vector<Entity> entities(entityCount);
+	for (size_t i = 0; i < entityCount; ++i)
+	{
+		entities[i] = CreateEntity();
+		manager.Create(entities[i]).value[0] = float(i);
+	}
+	std::mt19937 rng(42);
+	std::shuffle(entities.begin(), entities.end(), rng);
+
+	float sum = 0;
+	const double lookup_ms = ap::test::MeasureBest(repetitions, [&] {
+		for (Entity entity : entities)
+		{
+			sum += manager.GetComponent(entity)->value[0];
+		}
+	});
+	size_t found = 0;
+	const double contains_ms = ap::test::MeasureBest(repetitions, [&] {
+		found = 0;
+		for (Entity entity : entities)
+		{
+			found += manager.Contains(entity) ? 1 : 0;
+		}
+	});
+	AP_CHECK(found == entityCount);
+
+	// Remove every second entity, the rest must still resolve to the right component:
+	const double remove_ms = ap::test::MeasureBest(1, [&] {
+		for (size_t i = 0; i < entityCount; i += 2)
+		{
+			manager.Remove(entities[i]);
+		}
+	});
+	for (size_t i = 0; i < entityCount; ++i)
+	{
+		const bool removed = (i % 2) == 0;
+		AP_CHECK(manager.Contains(entities[i]) == !removed);
+		if (!removed)
+		{
+			AP_CHECK(manager.GetComponent(entities[i]) == &manager[manager.GetIndex(entities[i])]);
+		}
+	}
+	AP_CHECK(manager.GetCount() == entityCount / 2);
+
+	std::printf("%-6s %8zu entities | GetComponent: %6.2f ns | Contains: %6.2f ns | Remove: %6.2f ns (checksum %g)\n",
+		name, entityCount,
+		lookup_ms * 1e6 / entityCount,
+		contains_ms * 1e6 / entityCount,
+		remove_ms * 1e6 / (entityCount / 2),
+		sum
+	);
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = ap::test::IsQuick(argc, argv);
+	const uint32_t repetitions = quick ? 1 : 10;
+	for (size_t entityCount : { size_t(10000), size_t(100000), size_t(1000000) })
+	{
+		if (quick && entityCount > 10000)
+			break;
+		RunBenchmark<HashLookup>("hash", entityCount, repetitions);
+		RunBenchmark<SparseLookup>("sparse", entityCount, repetitions);
+	}
+	return 0;
+}
@@ -0,0 +1,96 @@
+// Measures the scene hierarchy: building it with Component_Attach, and the transform + hierarchy update of every node in a frame
+//	The nodes are chains (like bones of skeletons), the chain length sets the depth of the hierarchy
+//	The world matrices are checked against the parent chain computed one by one
+#include "TestCommon.h"
+#include "apScene.h"
+
+#include <cmath>
+#include <vector>
+
+using namespace ap::ecs;
+using namespace ap::scene;
+
+static void RunBenchmark(uint32_t nodeCount, uint32_t depth, uint32_t repetitions)
+{
+	const uint32_t chainLength = depth + 1;
+	const uint32_t chainCount = nodeCount / chainLength;
+
+	Scene scene;
+	std::vector<Entity> entities;
+	entities.reserve(chainCount * chainLength);
+	for (uint32_t i = 0; i < chainCount * chainLength; ++i)
+	{
+		Entity entity = CreateEntity();
+		TransformComponent& transform = scene.transforms.Create(entity);
+		const float f = float(i % 97);
+		transform.translation_local = XMFLOAT3(f * 0.01f, 1, -f * 0.02f);
+		XMStoreFloat4(&transform.rotation_local, XMQuaternionRotationRollPitchYaw(f * 0.001f, f * 0.002f, 0.01f));
+		transform.scale_local = XMFLOAT3(1.001f, 0.999f, 1);
+		entities.push_back(entity);
+	}
+
+	const double attach_ms = ap::test::MeasureBest(1, [&] {
+		for (uint32_t chain = 0; chain < chainCount; ++chain)
+		{
+			for (uint32_t i = 1; i < chainLength; ++i)
+			{
+				scene.Component_Attach(entities[chain * chainLength + i], entities[chain * chainLength + i - 1], true);
+			}
+		}
+		scene.SortHierarchy(); // Scene::Update() does this before the update systems
+	});
+
+	ap::jobsystem::context ctx;
+	const double update_ms = ap::test::MeasureBest(repetitions, [&] {
+		for (size_t i = 0; i < scene.transforms.GetCount(); ++i)
+		{
+			scene.transforms[i].SetDirty();
+		}
+		scene.RunTransformUpdateSystem(ctx);
+		ap::jobsystem::Wait(ctx);
+		scene.RunHierarchyUpdateSystem(ctx);
+		ap::jobsystem::Wait(ctx);
+	});
+
+	// Reference: every world matrix is the product of the local matrices along the chain
+	float max_error = 0;
+	for (uint32_t chain = 0; chain < chainCount; chain += std::max(1u, chainCount / 64))
+	{
+		XMMATRIX world = XMMatrixIdentity();
+		for (uint32_t i = 0; i < chainLength; ++i)
+		{
+			const TransformComponent& transform = *scene.transforms.GetComponent(entities[chain * chainLength + i]);
+			world = transform.GetLocalMatrix() * world;
+			XMFLOAT4X4 expected;
+			XMStoreFloat4x4(&expected, world);
+			for (int r = 0; r < 4; ++r)
+			{
+				for (int c = 0; c < 4; ++c)
+				{
+					const float error = std::abs(expected.m[r][c] - transform.world.m[r][c]) / std::max(1.0f, std::abs(expected.m[r][c]));
+					max_error = std::max(max_error, error);
+				}
+			}
+		}
+	}
+	AP_CHECK(max_error < 1e-3f);
+
+	std::printf("depth %2u (%6u chains) | attach + sort: %7.2f ms | update: %7.2f ms (%5.1f ns/node) | max error: %g\n",
+		depth, chainCount, attach_ms, update_ms, update_ms * 1e6 / (chainCount * chainLength), max_error);
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = ap::test::IsQuick(argc, argv);
+	const uint32_t nodeCount = quick ? 2000 : 100000;
+	const uint32_t repetitions = quick ? 1 : 10;
+
+	ap::jobsystem::Initialize(ap::test::GetArgument(argc, argv, "--threads", ~0u));
+	std::printf("%u nodes, %u threads, best of %u updates\n", nodeCount, ap::jobsystem::GetThreadCount(), repetitions);
+
+	for (uint32_t depth : { 1u, 2u, 4u, 8u, 16u, 32u, 64u })
+	{
+		RunBenchmark(nodeCount, depth, repetitions);
+	}
+	return 0;
+}
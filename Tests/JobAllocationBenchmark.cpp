@@ -0,0 +1,80 @@
+// Counts the heap allocations made by the job system during Dispatch, and measures the cost of dispatching 100k job groups
+//	After warm-up, the job blocks and queues are all reused, so dispatching must not allocate
+#include "TestCommon.h"
+#include "apJobSystem.h"
+
+#include <atomic>
+#include <functional>
+#include <new>
+
+static std::atomic<size_t> allocation_count{ 0 };
+
+void* operator new(size_t size)
+{
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	void* ptr = std::malloc(size);
+	if (ptr == nullptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+void operator delete(void* ptr, size_t) noexcept
+{
+	std::free(ptr);
+}
+
+using namespace ap::jobsystem;
+
+int main(int argc, char** argv)
+{
+	const bool quick = ap::test::IsQuick(argc, argv);
+	const uint32_t groupCount = quick ? 10000 : 100000;
+	const uint32_t repetitions = quick ? 2 : 10;
+
+	Initialize(ap::test::GetArgument(argc, argv, "--threads", ~0u));
+
+	// A capture of 56 bytes, which used to make std::function allocate on every job copy:
+	struct Payload
+	{
+		uint64_t values[6] = {};
+	} payload;
+	std::atomic<uint64_t> sum{ 0 };
+	auto dispatch = [&](uint32_t count) {
+		context ctx;
+		Dispatch(ctx, count, 1, [&sum, payload](JobArgs args) { sum += args.jobIndex + payload.values[0]; });
+		Wait(ctx);
+	};
+
+	// How many jobs are in flight at the same time depends on the scheduling, and some freed jobs stay in the caches of the workers
+	//	So the warm-up dispatches are larger than the measured ones, then the pool always has enough jobs
+	for (int warmup = 0; warmup < 10; ++warmup)
+	{
+		dispatch(groupCount * 2);
+	}
+
+	const size_t allocations_before = allocation_count.load();
+	const double dispatch_ms = ap::test::MeasureBest(repetitions, [&] { dispatch(groupCount); });
+	const size_t allocations = allocation_count.load() - allocations_before;
+
+	std::printf("%u threads, %u groups per dispatch\n", GetThreadCount(), groupCount);
+	std::printf("inline capture: %.2f ms per dispatch (%.1f ns/group), %zu allocations in %u dispatches\n", dispatch_ms, dispatch_ms * 1e6 / groupCount, allocations, repetitions);
+
+	// An std::function with a large capture allocates whenever it is copied: once into the temporary JobFunction argument and once into the job storage
+	//	That is per dispatch, not per group:
+	std::function<void(JobArgs)> function = [&sum, payload](JobArgs args) { sum += args.jobIndex + payload.values[0]; };
+	const size_t function_allocations_before = allocation_count.load();
+	const double function_ms = ap::test::MeasureBest(repetitions, [&] {
+		context ctx;
+		Dispatch(ctx, groupCount, 1, function);
+		Wait(ctx);
+	});
+	const size_t function_allocations = allocation_count.load() - function_allocations_before;
+	std::printf("std::function: %.2f ms per dispatch (%.1f ns/group), %zu allocations in %u dispatches\n", function_ms, function_ms * 1e6 / groupCount, function_allocations, repetitions);
+
+	AP_CHECK(allocations == 0);
+	AP_CHECK(function_allocations <= 2 * repetitions);
+	return 0;
+}
@@ -0,0 +1,94 @@
+// Measures the job submission and execution overhead with empty and tiny jobs
+//	Without --threads, the benchmark runs itself once for every worker thread count in 1, 2, 4, ... up to the core count
+//	(the job system can only be initialized once per process), so the output shows how the scheduling scales
+#include "TestCommon.h"
+#include "apJobSystem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+
+using namespace ap::jobsystem;
+
+static void RunBenchmark(uint32_t jobCount, uint32_t repetitions)
+{
+	// Empty jobs only measure the scheduler:
+	const double empty_ms = ap::test::MeasureBest(repetitions, [&] {
+		context ctx;
+		Dispatch(ctx, jobCount, 1, [](JobArgs) {});
+		Wait(ctx);
+	});
+
+	// Tiny jobs do about a hundred nanoseconds of work each, which is the size of many scene update jobs:
+	std::atomic<uint32_t> sink{ 0 };
+	const double tiny_ms = ap::test::MeasureBest(repetitions, [&] {
+		context ctx;
+		Dispatch(ctx, jobCount, 1, [&](JobArgs args) {
+			uint32_t x = args.jobIndex;
+			for (int i = 0; i < 64; ++i)
+			{
+				x = x * 1664525u + 1013904223u;
+			}
+			if (x == 0)
+				sink++;
+		});
+		Wait(ctx);
+	});
+
+	// Several threads dispatching at the same time, like the scene and renderer update does:
+	const uint32_t submitters = 4;
+	const double contended_ms = ap::test::MeasureBest(repetitions, [&] {
+		std::thread threads[submitters];
+		for (auto& thread : threads)
+		{
+			thread = std::thread([&] {
+				context ctx;
+				Dispatch(ctx, jobCount / submitters, 1, [](JobArgs) {});
+				Wait(ctx);
+			});
+		}
+		for (auto& thread : threads)
+		{
+			thread.join();
+		}
+	});
+
+	std::printf("%7u threads | empty: %8.2f ms (%6.1f ns/job) | tiny: %8.2f ms (%6.1f ns/job) | %u submitters: %8.2f ms (%6.1f ns/job)\n",
+		GetThreadCount(),
+		empty_ms, empty_ms * 1e6 / jobCount,
+		tiny_ms, tiny_ms * 1e6 / jobCount,
+		submitters, contended_ms, contended_ms * 1e6 / jobCount
+	);
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = ap::test::IsQuick(argc, argv);
+	const uint32_t jobCount = quick ? 10000 : 1000000;
+	const uint32_t repetitions = quick ? 1 : 10;
+
+	if (ap::test::HasArgument(argc, argv, "--threads"))
+	{
+		Initialize(ap::test::GetArgument(argc, argv, "--threads", ~0u));
+		RunBenchmark(jobCount, repetitions);
+		return 0;
+	}
+
+	std::printf("%u jobs, best of %u runs\n", jobCount, repetitions);
+	const uint32_t maxThreads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+	for (uint32_t threads = 1;; threads = std::min(threads * 2, maxThreads))
+	{
+		std::string command = std::string("\"") + argv[0] + "\" --threads " + std::to_string(threads);
+		if (quick)
+		{
+			command += " --quick";
+		}
+		std::fflush(stdout);
+		if (std::system(command.c_str()) != 0)
+			return 1;
+		if (threads == maxThreads)
+			break;
+	}
+	return 0;
+}
@@ -0,0 +1,262 @@
+#include "TestCommon.h"
+#include "apJobSystem.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace ap::jobsystem;
+
+static void TestDispatch()
+{
+	for (uint32_t groupSize : { 1u, 7u, 64u, 1000u })
+	{
+		std::atomic<uint64_t> sum{ 0 };
+		std::atomic<uint32_t> groups{ 0 };
+		context ctx;
+		Dispatch(ctx, 100000, groupSize, [&](JobArgs args) {
+			sum += args.jobIndex;
+			if (args.isFirstJobInGroup)
+				groups++;
+			AP_CHECK(args.jobIndex == args.groupID * groupSize + args.groupIndex);
+		});
+		Wait(ctx);
+		AP_CHECK(sum == 100000ull * 99999ull / 2);
+		AP_CHECK(groups == DispatchGroupCount(100000, groupSize));
+	}
+}
+
+static void TestSharedMemory()
+{
+	std::atomic<uint32_t> mismatches{ 0 };
+	context ctx;
+	Dispatch(ctx, 4096, 64, [&](JobArgs args) {
+		uint32_t* shared = (uint32_t*)args.sharedmemory;
+		if (args.isFirstJobInGroup)
+			*shared = 0;
+		(*shared)++;
+		if (args.isLastJobInGroup && *shared != 64)
+			mismatches++;
+	}, sizeof(uint32_t));
+	Wait(ctx);
+	AP_CHECK(mismatches == 0);
+}
+
+static void TestNestedWait()
+{
+	// Jobs that wait on their own inner contexts must not deadlock, even with a single worker
+	std::atomic<uint64_t> sum{ 0 };
+	context ctx;
+	Dispatch(ctx, 64, 1, [&](JobArgs) {
+		context inner;
+		Dispatch(inner, 1000, 10, [&](JobArgs) { sum++; });
+		Wait(inner);
+	});
+	Wait(ctx);
+	AP_CHECK(sum == 64 * 1000);
+}
+
+static void TestExternalThreads()
+{
+	// Threads that are not workers submit and wait concurrently
+	std::atomic<uint64_t> total{ 0 };
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 8; ++t)
+	{
+		threads.emplace_back([&] {
+			for (int i = 0; i < 20; ++i)
+			{
+				context ctx;
+				Dispatch(ctx, 1000, 3, [&](JobArgs) { total++; });
+				Wait(ctx);
+			}
+		});
+	}
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+	AP_CHECK(total == 8 * 20 * 1000);
+}
+
+static void TestPriorities()
+{
+	for (Priority priority : { Priority::High, Priority::Normal, Priority::Streaming })
+	{
+		std::atomic<uint32_t> count{ 0 };
+		context ctx;
+		ctx.priority = priority;
+		Dispatch(ctx, 1000, 10, [&](JobArgs) { count++; });
+		Execute(ctx, [&](JobArgs) { count++; });
+		Wait(ctx);
+		AP_CHECK(count == 1001);
+		AP_CHECK(!IsBusy(ctx));
+	}
+}
+
+static void TestStreamingWait()
+{
+	// A thread that waits on a streaming context executes the streaming jobs itself, even while every streaming worker is busy
+	const uint32_t streamingThreads = GetThreadCount(Priority::Streaming);
+	std::atomic<uint32_t> started{ 0 };
+	std::atomic_bool release{ false };
+	context blocker;
+	blocker.priority = Priority::Streaming;
+	for (uint32_t i = 0; i < streamingThreads; ++i)
+	{
+		Execute(blocker, [&](JobArgs) {
+			started++;
+			while (!release.load())
+			{
+				std::this_thread::yield();
+			}
+		});
+	}
+	while (started.load() < streamingThreads)
+	{
+		std::this_thread::yield();
+	}
+
+	std::atomic<uint32_t> executed_here{ 0 };
+	context ctx;
+	ctx.priority = Priority::Streaming;
+	Dispatch(ctx, 100, 1, [&](JobArgs) {
+		if (GetCurrentWorkerIndex() == ~0u)
+			executed_here++;
+	});
+	Wait(ctx);
+	AP_CHECK(executed_here == 100);
+
+	release.store(true);
+	Wait(blocker);
+}
+
+static void TestLoadingPriority()
+{
+	// Loading work waited on by the main thread or a frame worker is executed by the frame workers, on streaming workers it stays streaming
+	AP_CHECK(GetLoadingPriority() == Priority::Normal);
+	for (Priority priority : { Priority::High, Priority::Normal, Priority::Streaming })
+	{
+		std::atomic<uint32_t> mismatches{ 0 };
+		context ctx;
+		ctx.priority = priority;
+		Dispatch(ctx, 100, 1, [&](JobArgs) {
+			const uint32_t worker = GetCurrentWorkerIndex();
+			const Priority expected = worker != ~0u && worker >= GetThreadCount(Priority::High) ? Priority::Streaming : Priority::Normal;
+			if (GetLoadingPriority() != expected)
+				mismatches++;
+		});
+		Wait(ctx);
+		AP_CHECK(mismatches == 0);
+	}
+}
+
+static void TestStreamingThreadPriority()
+{
+#if defined(__linux__)
+	// Streaming workers run with SCHED_BATCH and a higher nice value than the frame workers
+	auto get_nice = [] { return getpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid)); };
+	std::atomic<int> frame_nice{ 0 };
+	std::atomic<int> streaming_nice{ 0 };
+	std::atomic<int> streaming_policy{ -1 };
+	context ctx;
+	Execute(ctx, [&](JobArgs) { frame_nice = get_nice(); });
+	Wait(ctx);
+	ctx.priority = Priority::Streaming;
+	std::atomic<uint32_t> streaming_jobs{ 0 };
+	while (streaming_jobs.load() == 0)
+	{
+		// the waiting thread can execute the job itself, so it's repeated until a streaming worker picked it up
+		Execute(ctx, [&](JobArgs) {
+			if (GetCurrentWorkerIndex() == ~0u)
+				return;
+			streaming_nice = get_nice();
+			streaming_policy = sched_getscheduler(0);
+			streaming_jobs++;
+		});
+		Wait(ctx);
+	}
+	AP_CHECK(streaming_policy == SCHED_BATCH);
+	AP_CHECK(streaming_nice > frame_nice);
+#endif
+}
+
+static void TestTaskGraph()
+{
+	// Every task records its finishing order, dependencies must be finished before the task starts
+	std::atomic<uint32_t> order{ 0 };
+	uint32_t finished[4] = {};
+	TaskGraph graph;
+	auto a = graph.AddTask([&](context& ctx) { finished[0] = ++order; });
+	auto b = graph.AddTask([&](context& ctx) { finished[1] = ++order; }, { a });
+	auto c = graph.AddTask([&](context& ctx) { finished[2] = ++order; }, { a });
+	graph.AddTask([&](context& ctx) { finished[3] = ++order; }, { b, c });
+
+	for (int run = 0; run < 10; ++run)
+	{
+		order = 0;
+		context ctx;
+		graph.Run(ctx);
+		Wait(ctx);
+		AP_CHECK(finished[0] == 1);
+		AP_CHECK(finished[1] > finished[0] && finished[2] > finished[0]);
+		AP_CHECK(finished[3] == 4);
+	}
+}
+
+static void TestTaskGraphJobs()
+{
+	// Jobs spawned into a task's context finish before the dependent tasks start
+	//	A task that needs its results immediately waits on a local context (as RunPhysicsUpdateSystem does), never on its own context
+	std::atomic<uint32_t> spawned{ 0 };
+	std::atomic<uint32_t> waited{ 0 };
+	uint32_t spawned_seen = 0;
+	uint32_t waited_seen = 0;
+	TaskGraph graph;
+	auto a = graph.AddTask([&](context& ctx) {
+		Dispatch(ctx, 1000, 10, [&](JobArgs) { spawned++; });
+	});
+	auto b = graph.AddTask([&](context& ctx) {
+		context local_ctx;
+		local_ctx.priority = ctx.priority;
+		Dispatch(local_ctx, 1000, 10, [&](JobArgs) { waited++; });
+		Wait(local_ctx);
+		waited_seen = waited.load();
+	});
+	graph.AddTask([&](context& ctx) {
+		spawned_seen = spawned.load();
+	}, { a, b });
+
+	context ctx;
+	graph.Run(ctx);
+	Wait(ctx);
+	AP_CHECK(waited_seen == 1000);
+	AP_CHECK(spawned_seen == 1000);
+}
+
+int main(int argc, char** argv)
+{
+	Initialize(ap::test::GetArgument(argc, argv, "--threads", ~0u));
+	std::printf("worker threads: %u\n", GetThreadCount());
+
+	TestDispatch();
+	TestSharedMemory();
+	TestNestedWait();
+	TestExternalThreads();
+	TestPriorities();
+	TestStreamingWait();
+	TestLoadingPriority();
+	TestStreamingThreadPriority();
+	TestTaskGraph();
+	TestTaskGraphJobs();
+
+	std::printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,79 @@
+// Compares composing local matrices one by one (TransformComponent::GetLocalMatrix()) with math::ComposeMatrix4(), which composes 4 at a time
+//	Both results must match, the largest difference is printed
+#include "TestCommon.h"
+#include "apScene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace ap::scene;
+
+int main(int argc, char** argv)
+{
+	const bool quick = ap::test::IsQuick(argc, argv);
+	const uint32_t count = quick ? 1000 : 100000;
+	const uint32_t repetitions = quick ? 1 : 20;
+
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> dist(-10, 10);
+	std::vector<TransformComponent> transforms(count);
+	for (TransformComponent& transform : transforms)
+	{
+		transform.scale_local = XMFLOAT3(std::abs(dist(rng)) + 0.1f, std::abs(dist(rng)) + 0.1f, std::abs(dist(rng)) + 0.1f);
+		XMStoreFloat4(&transform.rotation_local, XMQuaternionNormalize(XMVectorSet(dist(rng), dist(rng), dist(rng), dist(rng))));
+		transform.translation_local = XMFLOAT3(dist(rng), dist(rng), dist(rng));
+	}
+	std::vector<XMFLOAT4X4> scalar(count);
+	std::vector<XMFLOAT4X4> batched(count);
+
+	const double scalar_ms = ap::test::MeasureBest(repetitions, [&] {
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			XMStoreFloat4x4(&scalar[i], transforms[i].GetLocalMatrix());
+		}
+	});
+
+	const double batched_ms = ap::test::MeasureBest(repetitions, [&] {
+		uint32_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			const XMFLOAT3* S[4];
+			const XMFLOAT4* R[4];
+			const XMFLOAT3* T[4];
+			XMFLOAT4X4* W[4];
+			for (uint32_t j = 0; j < 4; ++j)
+			{
+				S[j] = &transforms[i + j].scale_local;
+				R[j] = &transforms[i + j].rotation_local;
+				T[j] = &transforms[i + j].translation_local;
+				W[j] = &batched[i + j];
+			}
+			ap::math::ComposeMatrix4(S, R, T, W);
+		}
+		for (; i < count; ++i)
+		{
+			XMStoreFloat4x4(&batched[i], transforms[i].GetLocalMatrix());
+		}
+	});
+
+	float max_error = 0;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		for (int r = 0; r < 4; ++r)
+		{
+			for (int c = 0; c < 4; ++c)
+			{
+				max_error = std::max(max_error, std::abs(scalar[i].m[r][c] - batched[i].m[r][c]) / std::max(1.0f, std::abs(scalar[i].m[r][c])));
+			}
+		}
+	}
+	AP_CHECK(max_error < 1e-5f);
+
+	std::printf("%u matrices, best of %u runs\n", count, repetitions);
+	std::printf("GetLocalMatrix:  %.3f ms (%.1f ns/matrix)\n", scalar_ms, scalar_ms * 1e6 / count);
+	std::printf("ComposeMatrix4:  %.3f ms (%.1f ns/matrix)\n", batched_ms, batched_ms * 1e6 / count);
+	std::printf("max relative difference: %g\n", max_error);
+	return 0;
+}
@@ -0,0 +1,216 @@
+// Tests the software occlusion buffer against an analytic reference: no box may be reported occluded unless the occluders really hide it
+//	The camera is at the origin looking down +z, so view distances are z and the screen position of a point is (x / z, y / z)
+//	Rectangles that face the camera hide a box if they cover its screen rectangle in front of its nearest point, a floor hides everything under it
+#include "TestCommon.h"
+#include "apOcclusionBuffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+using namespace ap::primitive;
+
+static constexpr uint32_t WIDTH = 256;
+static constexpr uint32_t HEIGHT = 144;
+static constexpr float FOV = XM_PI / 3.0f;
+static constexpr float NEAR_Z = 0.1f;
+static const float TAN_Y = std::tan(FOV * 0.5f);
+static const float TAN_X = TAN_Y * float(WIDTH) / float(HEIGHT);
+
+static std::mt19937 rng(2468);
+
+static float Random(float min, float max)
+{
+	return std::uniform_real_distribution<float>(min, max)(rng);
+}
+
+static XMMATRIX GetProjection()
+{
+	return XMMatrixPerspectiveFovLH(FOV, float(WIDTH) / float(HEIGHT), 1000.0f, NEAR_Z); // reversed depth, like the cameras
+}
+
+// Rectangle facing the camera at distance z, given by its screen extents (x / z and y / z)
+struct ScreenRect
+{
+	float left, right, bottom, top;
+	float z;
+};
+
+static const XMFLOAT3 quad_positions[] = { XMFLOAT3(0, 0, 0), XMFLOAT3(1, 0, 0), XMFLOAT3(0, 1, 0), XMFLOAT3(1, 1, 0) };
+static const uint32_t quad_indices[] = { 0, 1, 2, 2, 1, 3 };
+
+static ap::OcclusionBuffer::Occluder CreateOccluder(const ScreenRect& rect)
+{
+	ap::OcclusionBuffer::Occluder occluder;
+	occluder.positions = quad_positions;
+	occluder.indices = quad_indices;
+	occluder.index_count = arraysize(quad_indices);
+	const XMMATRIX world =
+		XMMatrixScaling((rect.right - rect.left) * rect.z, (rect.top - rect.bottom) * rect.z, 1) *
+		XMMatrixTranslation(rect.left * rect.z, rect.bottom * rect.z, rect.z);
+	XMStoreFloat4x4(&occluder.world, world);
+	return occluder;
+}
+
+// Screen rectangle of the box, clamped to the screen, returns false if the box is not in front of the near plane or not on the screen
+static bool GetScreenRect(const AABB& aabb, ScreenRect& rect)
+{
+	if (aabb._min.z < NEAR_Z)
+		return false;
+	rect = { std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest(), aabb._min.z };
+	for (int i = 0; i < 8; ++i)
+	{
+		const XMFLOAT3 corner = aabb.corner(i);
+		rect.left = std::min(rect.left, corner.x / corner.z);
+		rect.right = std::max(rect.right, corner.x / corner.z);
+		rect.bottom = std::min(rect.bottom, corner.y / corner.z);
+		rect.top = std::max(rect.top, corner.y / corner.z);
+	}
+	rect.left = std::max(rect.left, -TAN_X);
+	rect.right = std::min(rect.right, TAN_X);
+	rect.bottom = std::max(rect.bottom, -TAN_Y);
+	rect.top = std::min(rect.top, TAN_Y);
+	return rect.left < rect.right && rect.bottom < rect.top;
+}
+
+// The box is hidden if the rectangles that are in front of it cover its screen rectangle
+//	The screen rectangle is split into cells by the occluder edges, each cell is either covered or not
+static bool IsOccludedReference(const AABB& aabb, const ap::vector<ScreenRect>& occluders)
+{
+	ScreenRect box;
+	if (!GetScreenRect(aabb, box))
+		return false;
+
+	ap::vector<float> xs = { box.left, box.right };
+	ap::vector<float> ys = { box.bottom, box.top };
+	for (const ScreenRect& rect : occluders)
+	{
+		xs.push_back(std::clamp(rect.left, box.left, box.right));
+		xs.push_back(std::clamp(rect.right, box.left, box.right));
+		ys.push_back(std::clamp(rect.bottom, box.bottom, box.top));
+		ys.push_back(std::clamp(rect.top, box.bottom, box.top));
+	}
+	std::sort(xs.begin(), xs.end());
+	std::sort(ys.begin(), ys.end());
+	for (size_t i = 0; i + 1 < xs.size(); ++i)
+	{
+		for (size_t j = 0; j + 1 < ys.size(); ++j)
+		{
+			if (xs[i] == xs[i + 1] || ys[j] == ys[j + 1])
+				continue;
+			const float x = (xs[i] + xs[i + 1]) * 0.5f;
+			const float y = (ys[j] + ys[j + 1]) * 0.5f;
+			const bool covered = std::any_of(occluders.begin(), occluders.end(), [&](const ScreenRect& rect) {
+				return rect.z < box.z && x > rect.left && x < rect.right && y > rect.bottom && y < rect.top;
+			});
+			if (!covered)
+				return false;
+		}
+	}
+	return true;
+}
+
+// A box around the line of sight through the screen position (x, y), starting at the distance z
+static AABB CreateBox(float x, float y, float z, float size, float depth)
+{
+	return AABB(XMFLOAT3((x - size) * std::abs(z), (y - size) * std::abs(z), z), XMFLOAT3((x + size) * std::abs(z), (y + size) * std::abs(z), z + depth));
+}
+
+static void TestRectangles()
+{
+	// The occluders either overlap or have gaps of many pixels between them, so the pixel centers sample the gaps
+	//	The last one is partly hidden behind the first one
+	const ap::vector<ScreenRect> rects = {
+		{ -0.5f, 0.3f, -0.4f, 0.4f, 10 },
+		{ 0.2f, 0.9f, -0.2f, 0.5f, 20 },
+		{ -0.95f, -0.7f, -0.5f, 0.0f, 5 },
+		{ -0.2f, 0.6f, -0.5f, -0.3f, 30 },
+	};
+	ap::vector<ap::OcclusionBuffer::Occluder> occluders;
+	for (const ScreenRect& rect : rects)
+	{
+		occluders.push_back(CreateOccluder(rect));
+	}
+
+	ap::OcclusionBuffer buffer;
+	buffer.Render(GetProjection(), WIDTH, HEIGHT, NEAR_Z, occluders.data(), (uint32_t)occluders.size());
+	AP_CHECK(buffer.IsValid() && buffer.width == WIDTH && buffer.height == HEIGHT);
+
+	uint32_t expected_count = 0;
+	uint32_t occluded_count = 0;
+	for (int i = 0; i < 20000; ++i)
+	{
+		const AABB aabb = CreateBox(Random(-1.2f, 1.2f), Random(-0.7f, 0.7f), Random(1, 50), Random(0.002f, 0.3f), Random(0.01f, 10));
+		const bool expected = IsOccludedReference(aabb, rects);
+		const bool occluded = buffer.IsOccluded(aabb);
+		AP_CHECK(!occluded || expected);
+		expected_count += expected ? 1 : 0;
+		occluded_count += occluded ? 1 : 0;
+	}
+	// The buffer is conservative, but it must find most of the hidden boxes:
+	AP_CHECK(expected_count > 1000);
+	AP_CHECK(occluded_count > expected_count * 3 / 4);
+
+	// Boxes that reach in front of the near plane or behind the camera are never occluded, even right behind an occluder:
+	for (int i = 0; i < 1000; ++i)
+	{
+		const float z = i % 2 == 0 ? Random(-2, NEAR_Z * 0.99f) : Random(-20, -1);
+		const AABB aabb = CreateBox(Random(-0.3f, 0.1f), Random(-0.2f, 0.2f), z, Random(0.002f, 0.1f), Random(0.01f, 30));
+		AP_CHECK(!buffer.IsOccluded(aabb));
+	}
+
+	// Nothing is occluded by an empty buffer:
+	buffer.Render(GetProjection(), WIDTH, HEIGHT, NEAR_Z, nullptr, 0);
+	AP_CHECK(!buffer.IsOccluded(CreateBox(0, 0, 20, 0.01f, 1)));
+}
+
+static void TestFloor()
+{
+	// A floor below the camera that goes behind it, so its triangles are clipped at the near plane
+	//	Every line of sight to a point under it crosses it in front of the point, everything above it is visible
+	const float floor_y = -1;
+	const XMFLOAT3 positions[] = { XMFLOAT3(-1000, floor_y, -10), XMFLOAT3(1000, floor_y, -10), XMFLOAT3(-1000, floor_y, 1000), XMFLOAT3(1000, floor_y, 1000) };
+	ap::OcclusionBuffer::Occluder occluder;
+	occluder.positions = positions;
+	occluder.indices = quad_indices;
+	occluder.index_count = arraysize(quad_indices);
+	XMStoreFloat4x4(&occluder.world, XMMatrixIdentity());
+
+	ap::OcclusionBuffer buffer;
+	buffer.Render(GetProjection(), WIDTH, HEIGHT, NEAR_Z, &occluder, 1);
+
+	uint32_t under_count = 0;
+	uint32_t occluded_count = 0;
+	for (int i = 0; i < 20000; ++i)
+	{
+		const float x = Random(-20, 20);
+		const float y = Random(-10, 2);
+		const float z = Random(NEAR_Z, 60);
+		const AABB aabb(XMFLOAT3(x, y, z), XMFLOAT3(x + Random(0.01f, 3), y + Random(0.01f, 3), z + Random(0.01f, 10)));
+		const bool under = aabb._max.y < floor_y;
+		const bool occluded = buffer.IsOccluded(aabb);
+		AP_CHECK(!occluded || under);
+		under_count += under ? 1 : 0;
+		occluded_count += occluded ? 1 : 0;
+	}
+	AP_CHECK(under_count > 1000);
+	AP_CHECK(occluded_count > under_count / 4);
+
+	// Under the floor, but reaching in front of the near plane:
+	for (int i = 0; i < 1000; ++i)
+	{
+		const AABB aabb(XMFLOAT3(Random(-5, 0), Random(-5, -3), Random(-2, NEAR_Z * 0.99f)), XMFLOAT3(Random(0, 5), -2, Random(1, 20)));
+		AP_CHECK(!buffer.IsOccluded(aabb));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	ap::jobsystem::Initialize(ap::test::GetArgument(argc, argv, "--threads", ~0u));
+
+	TestRectangles();
+	TestFloor();
+
+	std::printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,271 @@
+// Measures the throughput of the packet intersection kernels against testing one primitive at a time
+//	Ray - AABB: BVH::RayIntersects() for every ray, RayPacket4 and RayPacket8
+//	Ray - triangle: math::RayTriangleIntersects() for every triangle, RayTriangleIntersects4() and RayTriangleIntersects8()
+//	AABB - frustum: Frustum::CheckBoxFast() for each of four frusta, FrustumPacket4
+//	Every variant counts its hits, the counts must match, except for the few rays that graze a triangle edge
+#include "TestCommon.h"
+#include "apBVH.h"
+#include "apMath.h"
+#include "apPrimitive.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace ap::primitive;
+
+static std::mt19937 rng(5);
+
+static float Random(float min, float max)
+{
+	return std::uniform_real_distribution<float>(min, max)(rng);
+}
+
+static uint32_t CountBits(uint32_t mask)
+{
+	uint32_t count = 0;
+	for (; mask != 0; mask &= mask - 1)
+	{
+		count++;
+	}
+	return count;
+}
+
+static void PrintResult(const char* name, double ms, uint64_t tests, uint64_t hits)
+{
+	std::printf("%-34s %8.2f ms | %6.2f ns/test | %llu hits\n", name, ms, ms * 1e6 / double(tests), (unsigned long long)hits);
+}
+
+static void BenchmarkRayAABB(uint32_t rayCount, uint32_t boxCount, uint32_t repetitions)
+{
+	std::vector<Ray> rays;
+	for (uint32_t i = 0; i < rayCount; ++i)
+	{
+		rays.push_back(Ray(XMVectorSet(Random(-50, 50), Random(-50, 50), Random(-50, 50), 0), XMVector3Normalize(XMVectorSet(Random(-1, 1), Random(-1, 1), Random(-1, 1), 0))));
+	}
+	std::vector<AABB> boxes;
+	for (uint32_t i = 0; i < boxCount; ++i)
+	{
+		const XMFLOAT3 center(Random(-50, 50), Random(-50, 50), Random(-50, 50));
+		const XMFLOAT3 extent(Random(0.5f, 5), Random(0.5f, 5), Random(0.5f, 5));
+		boxes.push_back(AABB(XMFLOAT3(center.x - extent.x, center.y - extent.y, center.z - extent.z), XMFLOAT3(center.x + extent.x, center.y + extent.y, center.z + extent.z)));
+	}
+	const float tmax = 60;
+	const uint64_t tests = uint64_t(rayCount) * boxCount;
+
+	uint64_t hits_scalar = 0;
+	const double scalar_ms = ap::test::MeasureBest(repetitions, [&] {
+		hits_scalar = 0;
+		for (const Ray& ray : rays)
+		{
+			const XMVECTOR origin = XMLoadFloat3(&ray.origin);
+			const XMVECTOR direction_inverse = XMLoadFloat3(&ray.direction_inverse);
+			for (const AABB& box : boxes)
+			{
+				float distance;
+				hits_scalar += ap::BVH::RayIntersects(origin, direction_inverse, tmax, box, distance) ? 1 : 0;
+			}
+		}
+	});
+
+	uint64_t hits4 = 0;
+	const double packet4_ms = ap::test::MeasureBest(repetitions, [&] {
+		hits4 = 0;
+		for (uint32_t i = 0; i < rayCount; i += 4)
+		{
+			RayPacket4 packet;
+			packet.Load(rays.data() + i, std::min(4u, rayCount - i), tmax);
+			for (const AABB& box : boxes)
+			{
+				hits4 += CountBits(packet.intersects(box));
+			}
+		}
+	});
+
+	uint64_t hits8 = 0;
+	const double packet8_ms = ap::test::MeasureBest(repetitions, [&] {
+		hits8 = 0;
+		for (uint32_t i = 0; i < rayCount; i += 8)
+		{
+			RayPacket8 packet;
+			packet.Load(rays.data() + i, std::min(8u, rayCount - i), tmax);
+			for (const AABB& box : boxes)
+			{
+				hits8 += CountBits(packet.intersects(box));
+			}
+		}
+	});
+
+	AP_CHECK(hits4 == hits_scalar && hits8 == hits_scalar);
+	AP_CHECK(hits_scalar > 0);
+	PrintResult("ray - AABB, one ray at a time:", scalar_ms, tests, hits_scalar);
+	PrintResult("ray - AABB, RayPacket4:", packet4_ms, tests, hits4);
+	PrintResult("ray - AABB, RayPacket8:", packet8_ms, tests, hits8);
+}
+
+static void BenchmarkRayTriangle(uint32_t rayCount, uint32_t triangleCount, uint32_t repetitions)
+{
+	// Triangles of a mesh in the unit cube, the rays go through the cube
+	auto random_vertex = [](const XMFLOAT3& center) {
+		return XMFLOAT3(center.x + Random(-0.2f, 0.2f), center.y + Random(-0.2f, 0.2f), center.z + Random(-0.2f, 0.2f));
+	};
+	std::vector<XMFLOAT3> V0, V1, V2;
+	for (uint32_t i = 0; i < triangleCount; ++i)
+	{
+		const XMFLOAT3 center(Random(-1, 1), Random(-1, 1), Random(-1, 1));
+		V0.push_back(random_vertex(center));
+		V1.push_back(random_vertex(center));
+		V2.push_back(random_vertex(center));
+	}
+	std::vector<XMFLOAT3> origins, directions;
+	for (uint32_t i = 0; i < rayCount; ++i)
+	{
+		const XMFLOAT3 origin(Random(-3, 3), Random(-3, 3), -3);
+		const XMFLOAT3 target(Random(-1, 1), Random(-1, 1), Random(-1, 1));
+		origins.push_back(origin);
+		XMStoreFloat3(&directions.emplace_back(), XMVector3Normalize(XMLoadFloat3(&target) - XMLoadFloat3(&origin)));
+	}
+	const uint64_t tests = uint64_t(rayCount) * triangleCount;
+
+	uint64_t hits_scalar = 0;
+	const double scalar_ms = ap::test::MeasureBest(repetitions, [&] {
+		hits_scalar = 0;
+		for (uint32_t r = 0; r < rayCount; ++r)
+		{
+			const XMVECTOR origin = XMLoadFloat3(&origins[r]);
+			const XMVECTOR direction = XMLoadFloat3(&directions[r]);
+			for (uint32_t i = 0; i < triangleCount; ++i)
+			{
+				float distance;
+				XMFLOAT2 bary;
+				hits_scalar += ap::math::RayTriangleIntersects(origin, direction, XMLoadFloat3(&V0[i]), XMLoadFloat3(&V1[i]), XMLoadFloat3(&V2[i]), distance, bary) ? 1 : 0;
+			}
+		}
+	});
+
+	// The triangle packets are loaded once, like the four/eight triangle leaves of a BVH
+	auto load_packet = [&](auto& packet, uint32_t first, uint32_t count) {
+		XMVECTOR P0[8], P1[8], P2[8];
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			P0[i] = XMLoadFloat3(&V0[first + i]);
+			P1[i] = XMLoadFloat3(&V1[first + i]);
+			P2[i] = XMLoadFloat3(&V2[first + i]);
+		}
+		packet.Load(P0, P1, P2, count);
+	};
+	std::vector<ap::math::TrianglePacket4> packets4;
+	for (uint32_t i = 0; i < triangleCount; i += 4)
+	{
+		load_packet(packets4.emplace_back(), i, std::min(4u, triangleCount - i));
+	}
+	uint64_t hits4 = 0;
+	const double packet4_ms = ap::test::MeasureBest(repetitions, [&] {
+		hits4 = 0;
+		for (uint32_t r = 0; r < rayCount; ++r)
+		{
+			const XMVECTOR origin = XMLoadFloat3(&origins[r]);
+			const XMVECTOR direction = XMLoadFloat3(&directions[r]);
+			for (const ap::math::TrianglePacket4& packet : packets4)
+			{
+				float distances[4];
+				XMFLOAT2 barys[4];
+				hits4 += CountBits(ap::math::RayTriangleIntersects4(origin, direction, packet, distances, barys));
+			}
+		}
+	});
+
+	std::vector<ap::math::TrianglePacket8> packets8;
+	for (uint32_t i = 0; i < triangleCount; i += 8)
+	{
+		load_packet(packets8.emplace_back(), i, std::min(8u, triangleCount - i));
+	}
+	uint64_t hits8 = 0;
+	const double packet8_ms = ap::test::MeasureBest(repetitions, [&] {
+		hits8 = 0;
+		for (uint32_t r = 0; r < rayCount; ++r)
+		{
+			const XMVECTOR origin = XMLoadFloat3(&origins[r]);
+			const XMVECTOR direction = XMLoadFloat3(&directions[r]);
+			for (const ap::math::TrianglePacket8& packet : packets8)
+			{
+				float distances[8];
+				XMFLOAT2 barys[8];
+				hits8 += CountBits(ap::math::RayTriangleIntersects8(origin, direction, packet, distances, barys));
+			}
+		}
+	});
+
+	// Rays that graze an edge can go either way, because the kernels are summed in a different order (and with FMA in AVX2 builds)
+	AP_CHECK(std::abs(int64_t(hits4) - int64_t(hits_scalar)) <= int64_t(hits_scalar / 1000) && std::abs(int64_t(hits8) - int64_t(hits_scalar)) <= int64_t(hits_scalar / 1000));
+	AP_CHECK(hits_scalar > 0);
+	PrintResult("ray - triangle, one at a time:", scalar_ms, tests, hits_scalar);
+	PrintResult("ray - triangle, TrianglePacket4:", packet4_ms, tests, hits4);
+	PrintResult("ray - triangle, TrianglePacket8:", packet8_ms, tests, hits8);
+}
+
+static void BenchmarkFrustumAABB(uint32_t boxCount, uint32_t repetitions)
+{
+	// Four perspective views from the center, like the cascades or the cube faces of shadow culling
+	Frustum frusta[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		const XMMATRIX view = XMMatrixLookToLH(XMVectorZero(), XMVectorSet(std::cos(i * XM_PIDIV2), 0, std::sin(i * XM_PIDIV2), 0), XMVectorSet(0, 1, 0, 0));
+		frusta[i].Create(XMMatrixMultiply(view, XMMatrixPerspectiveFovLH(XM_PIDIV2, 1, 0.1f, 80)));
+	}
+	FrustumPacket4 packet;
+	packet.Load(frusta, 4);
+
+	std::vector<AABB> boxes;
+	for (uint32_t i = 0; i < boxCount; ++i)
+	{
+		const XMFLOAT3 center(Random(-100, 100), Random(-100, 100), Random(-100, 100));
+		const XMFLOAT3 extent(Random(0.5f, 5), Random(0.5f, 5), Random(0.5f, 5));
+		boxes.push_back(AABB(XMFLOAT3(center.x - extent.x, center.y - extent.y, center.z - extent.z), XMFLOAT3(center.x + extent.x, center.y + extent.y, center.z + extent.z)));
+	}
+	const uint64_t tests = uint64_t(boxCount) * 4;
+
+	uint64_t hits_scalar = 0;
+	const double scalar_ms = ap::test::MeasureBest(repetitions, [&] {
+		hits_scalar = 0;
+		for (const AABB& box : boxes)
+		{
+			for (const Frustum& frustum : frusta)
+			{
+				hits_scalar += frustum.CheckBoxFast(box) ? 1 : 0;
+			}
+		}
+	});
+
+	uint64_t hits4 = 0;
+	const double packet4_ms = ap::test::MeasureBest(repetitions, [&] {
+		hits4 = 0;
+		for (const AABB& box : boxes)
+		{
+			hits4 += CountBits(packet.CheckBoxFast(box));
+		}
+	});
+
+	AP_CHECK(hits4 == hits_scalar);
+	AP_CHECK(hits_scalar > 0);
+	PrintResult("AABB - frustum, one at a time:", scalar_ms, tests, hits_scalar);
+	PrintResult("AABB - frustum, FrustumPacket4:", packet4_ms, tests, hits4);
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = ap::test::IsQuick(argc, argv);
+	const uint32_t repetitions = quick ? 1 : 10;
+
+#ifdef _XM_AVX2_INTRINSICS_
+	std::printf("8-wide packets: AVX2\n");
+#else
+	std::printf("8-wide packets: two 4-wide packets\n");
+#endif // _XM_AVX2_INTRINSICS_
+
+	BenchmarkRayAABB(quick ? 256 : 4096, quick ? 256 : 4096, repetitions);
+	BenchmarkRayTriangle(quick ? 256 : 4096, quick ? 256 : 2048, repetitions);
+	BenchmarkFrustumAABB(quick ? 10000 : 1000000, repetitions);
+	return 0;
+}
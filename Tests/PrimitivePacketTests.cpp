@@ -0,0 +1,386 @@
+// Compares the SIMD packet kernels and traversals with their scalar versions on random, but deterministic inputs
+//	The coordinates are on a coarse grid, so that rays start exactly on box faces and run inside face planes
+//	Axis-parallel rays (zero direction components) and zero-extent boxes (points, segments, flat boxes) are included on purpose
+#include "TestCommon.h"
+#include "apBVH.h"
+#include "apMath.h"
+#include "apPrimitive.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#if defined(AP_TEST_AVX2) && !defined(_XM_AVX2_INTRINSICS_)
+#error The AVX2 build of the tests must use the AVX2 packets
+#endif
+
+using namespace ap::primitive;
+
+static std::mt19937 rng(1234);
+
+static uint32_t CountBits(uint32_t mask)
+{
+	uint32_t count = 0;
+	for (; mask != 0; mask &= mask - 1)
+	{
+		count++;
+	}
+	return count;
+}
+
+static float RandomGrid(int range)
+{
+	return float(std::uniform_int_distribution<int>(-range, range)(rng)) * 0.5f;
+}
+
+static Ray RandomRay()
+{
+	XMFLOAT3 origin(RandomGrid(8), RandomGrid(8), RandomGrid(8));
+	XMFLOAT3 direction(RandomGrid(4), RandomGrid(4), RandomGrid(4));
+	// about half of the rays are parallel to one or two axes:
+	switch (rng() % 6)
+	{
+	case 0: direction.x = 0; break;
+	case 1: direction.y = 0; break;
+	case 2: direction.x = 0; direction.z = 0; break;
+	case 3: direction.y = 0; direction.z = 0; break;
+	default: break;
+	}
+	if (direction.x == 0 && direction.y == 0 && direction.z == 0)
+	{
+		direction.z = 1;
+	}
+	return Ray(origin, direction);
+}
+
+static AABB RandomAABB()
+{
+	XMFLOAT3 a(RandomGrid(8), RandomGrid(8), RandomGrid(8));
+	XMFLOAT3 extent(std::abs(RandomGrid(4)), std::abs(RandomGrid(4)), std::abs(RandomGrid(4)));
+	// some boxes have zero extent on some or all axes:
+	switch (rng() % 5)
+	{
+	case 0: extent = XMFLOAT3(0, 0, 0); break;
+	case 1: extent.x = 0; break;
+	case 2: extent.y = 0; extent.z = 0; break;
+	default: break;
+	}
+	return AABB(a, XMFLOAT3(a.x + extent.x, a.y + extent.y, a.z + extent.z));
+}
+
+// Ray that is aimed at a corner of the box, axis-parallel rays are moved into the plane of the corner, so they run along a face or an edge
+static Ray RandomRayTowards(const AABB& box)
+{
+	const XMFLOAT3 target = box.corner(rng() % 8);
+	Ray ray = RandomRay();
+	XMFLOAT3 origin = ray.origin;
+	XMFLOAT3 direction(target.x - origin.x, target.y - origin.y, target.z - origin.z);
+	if (ray.direction.x == 0)
+	{
+		origin.x = target.x;
+		direction.x = 0;
+	}
+	if (ray.direction.y == 0)
+	{
+		origin.y = target.y;
+		direction.y = 0;
+	}
+	if (ray.direction.z == 0)
+	{
+		origin.z = target.z;
+		direction.z = 0;
+	}
+	if (direction.x == 0 && direction.y == 0 && direction.z == 0)
+	{
+		direction.x = 1;
+	}
+	return Ray(origin, direction);
+}
+
+static float RandomTMax()
+{
+	switch (rng() % 3)
+	{
+	case 0: return std::numeric_limits<float>::max();
+	case 1: return 0;
+	default: return std::abs(RandomGrid(16));
+	}
+}
+
+static void TestRayPackets()
+{
+	uint32_t hits = 0;
+	for (int iteration = 0; iteration < 20000; ++iteration)
+	{
+		const AABB box = RandomAABB();
+		Ray rays[8];
+		float tmax[8];
+		const uint32_t count = 1 + rng() % 8;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			rays[i] = rng() % 2 ? RandomRayTowards(box) : RandomRay();
+			tmax[i] = RandomTMax();
+		}
+		RayPacket4 packet4;
+		packet4.Load(rays, std::min(count, 4u));
+		RayPacket8 packet8;
+		packet8.Load(rays, count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			if (i < 4)
+				packet4.SetTMax(i, tmax[i]);
+			packet8.SetTMax(i, tmax[i]);
+		}
+
+		XMVECTOR distance4;
+		const uint32_t mask4 = packet4.intersects(box, &distance4);
+		float distance8[8];
+		const uint32_t mask8 = packet8.intersects(box, distance8);
+
+		uint32_t expected = 0;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			float distance;
+			if (ap::BVH::RayIntersects(XMLoadFloat3(&rays[i].origin), XMLoadFloat3(&rays[i].direction_inverse), tmax[i], box, distance))
+			{
+				expected |= 1u << i;
+				AP_CHECK(distance8[i] == distance);
+				if (i < 4)
+				{
+					AP_CHECK(XMVectorGetByIndex(distance4, i) == distance);
+				}
+			}
+		}
+		AP_CHECK(mask8 == expected);
+		AP_CHECK(mask4 == (expected & 0xF));
+		hits += CountBits(expected);
+	}
+	AP_CHECK(hits > 1000); // the test must not pass by everything missing
+}
+
+static void TestRayTrianglePackets()
+{
+	uint32_t hits = 0;
+	for (int iteration = 0; iteration < 20000; ++iteration)
+	{
+		const Ray ray = RandomRay();
+		const XMVECTOR origin = XMLoadFloat3(&ray.origin);
+		const XMVECTOR direction = XMLoadFloat3(&ray.direction);
+
+		XMVECTOR V0[8], V1[8], V2[8];
+		const uint32_t count = 1 + rng() % 8;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			// random floats, so that no ray hits exactly an edge, where the summation order of the kernels could decide
+			std::uniform_real_distribution<float> dist(-4, 4);
+			V0[i] = XMVectorSet(dist(rng), dist(rng), dist(rng), 0);
+			V1[i] = XMVectorSet(dist(rng), dist(rng), dist(rng), 0);
+			V2[i] = rng() % 16 == 0 ? V1[i] : XMVectorSet(dist(rng), dist(rng), dist(rng), 0); // some are degenerate
+		}
+
+		ap::math::TrianglePacket4 packet4;
+		packet4.Load(V0, V1, V2, std::min(count, 4u));
+		ap::math::TrianglePacket8 packet8;
+		packet8.Load(V0, V1, V2, count);
+		float dist4[4], dist8[8];
+		XMFLOAT2 bary4[4], bary8[8];
+		const uint32_t mask4 = ap::math::RayTriangleIntersects4(origin, direction, packet4, dist4, bary4);
+		const uint32_t mask8 = ap::math::RayTriangleIntersects8(origin, direction, packet8, dist8, bary8);
+
+		uint32_t expected = 0;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			float dist;
+			XMFLOAT2 bary;
+			if (ap::math::RayTriangleIntersects(origin, direction, V0[i], V1[i], V2[i], dist, bary))
+			{
+				expected |= 1u << i;
+				const float tolerance = 1e-4f * std::max(1.0f, std::abs(dist));
+				AP_CHECK(std::abs(dist8[i] - dist) <= tolerance);
+				AP_CHECK(std::abs(bary8[i].x - bary.x) <= 1e-4f && std::abs(bary8[i].y - bary.y) <= 1e-4f);
+				if (i < 4)
+				{
+					AP_CHECK(std::abs(dist4[i] - dist) <= tolerance);
+					AP_CHECK(std::abs(bary4[i].x - bary.x) <= 1e-4f && std::abs(bary4[i].y - bary.y) <= 1e-4f);
+				}
+			}
+		}
+		AP_CHECK(mask8 == expected);
+		AP_CHECK(mask4 == (expected & 0xF));
+		hits += CountBits(expected);
+	}
+	AP_CHECK(hits > 1000);
+}
+
+static void TestRayPacketTraversal()
+{
+	std::vector<AABB> boxes(2000);
+	for (AABB& box : boxes)
+	{
+		box = RandomAABB();
+	}
+	ap::BVH bvh;
+	bvh.Build(boxes.data(), (uint32_t)boxes.size());
+
+	uint32_t hits = 0;
+	for (int iteration = 0; iteration < 500; ++iteration)
+	{
+		Ray rays[4];
+		const uint32_t count = 1 + rng() % 4;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			rays[i] = RandomRay();
+		}
+
+		// Every leaf that a ray reaches, without shrinking tmax:
+		std::vector<uint32_t> expected[4];
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			float tmax = std::numeric_limits<float>::max();
+			bvh.IntersectsRay(rays[i], tmax, ~0u, [&](uint32_t leaf, float&) {
+				expected[i].push_back(leaf);
+			});
+			std::sort(expected[i].begin(), expected[i].end());
+			hits += (uint32_t)expected[i].size();
+		}
+		std::vector<uint32_t> result[4];
+		RayPacket4 packet;
+		packet.Load(rays, count);
+		bvh.IntersectsRayPacket(packet, ~0u, [&](uint32_t leaf, uint32_t mask) {
+			AP_CHECK(mask != 0 && mask < (1u << count));
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				if (mask & (1u << i))
+				{
+					result[i].push_back(leaf);
+				}
+			}
+		});
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			std::sort(result[i].begin(), result[i].end());
+			AP_CHECK(result[i] == expected[i]);
+		}
+
+		// Closest hit, the leaf boxes are the primitives, the callbacks shrink tmax:
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			float tmax = std::numeric_limits<float>::max();
+			bvh.IntersectsRay(rays[i], tmax, ~0u, [&](uint32_t leaf, float& tmax) {
+				float distance;
+				if (ap::BVH::RayIntersects(XMLoadFloat3(&rays[i].origin), XMLoadFloat3(&rays[i].direction_inverse), tmax, boxes[leaf], distance))
+				{
+					tmax = std::min(tmax, distance);
+				}
+			});
+			float packet_tmax[4] = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+			packet.Load(rays, count);
+			bvh.IntersectsRayPacket(packet, ~0u, [&](uint32_t leaf, uint32_t mask) {
+				XMVECTOR distance;
+				const uint32_t hit = packet.intersects(boxes[leaf], &distance) & mask;
+				for (uint32_t lane = 0; lane < count; ++lane)
+				{
+					if (hit & (1u << lane))
+					{
+						packet_tmax[lane] = std::min(packet_tmax[lane], XMVectorGetByIndex(distance, lane));
+						packet.SetTMax(lane, packet_tmax[lane]);
+					}
+				}
+			});
+			AP_CHECK(packet_tmax[i] == tmax);
+		}
+	}
+	AP_CHECK(hits > 1000);
+}
+
+// Smallest distance of the box's furthest corners from the frustum planes, in double precision, negative if the box is outside
+static double BoxFrustumDistance(const Frustum& frustum, const AABB& box)
+{
+	double result = 1e30;
+	for (const XMFLOAT4& plane : frustum.planes)
+	{
+		const double x = plane.x < 0 ? box._min.x : box._max.x;
+		const double y = plane.y < 0 ? box._min.y : box._max.y;
+		const double z = plane.z < 0 ? box._min.z : box._max.z;
+		result = std::min(result, plane.x * x + plane.y * y + plane.z * z + plane.w);
+	}
+	return result;
+}
+
+static void TestFrustumPackets()
+{
+	// Perspective and orthographic frusta, the orthographic planes are on the grid, so boxes can touch them exactly
+	auto random_frustum = [] {
+		const XMVECTOR eye = XMVectorSet(RandomGrid(8), RandomGrid(8), RandomGrid(8), 1);
+		XMVECTOR dir = XMVectorSet(RandomGrid(4), RandomGrid(4), RandomGrid(4), 0);
+		if (XMVector3Equal(dir, XMVectorZero()))
+		{
+			dir = XMVectorSet(0, 0, 1, 0);
+		}
+		const XMVECTOR up = std::abs(XMVectorGetX(dir)) + std::abs(XMVectorGetZ(dir)) > 0 ? XMVectorSet(0, 1, 0, 0) : XMVectorSet(1, 0, 0, 0);
+		const XMMATRIX view = XMMatrixLookToLH(eye, dir, up);
+		XMMATRIX projection;
+		if (rng() % 2)
+		{
+			projection = XMMatrixPerspectiveFovLH(XM_PIDIV4 + float(rng() % 8) * 0.1f, 1 + float(rng() % 4) * 0.25f, 0.5f, 1 + float(rng() % 16));
+		}
+		else
+		{
+			projection = XMMatrixOrthographicLH(float(2 + 2 * (rng() % 8)), float(2 + 2 * (rng() % 8)), 0, float(1 + rng() % 16));
+		}
+		Frustum frustum;
+		frustum.Create(XMMatrixMultiply(view, projection));
+		return frustum;
+	};
+
+	uint32_t inside = 0;
+	for (int iteration = 0; iteration < 2000; ++iteration)
+	{
+		Frustum frusta[4];
+		const uint32_t count = 1 + rng() % 4;
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			frusta[i] = random_frustum();
+		}
+		FrustumPacket4 packet;
+		packet.Load(frusta, count);
+
+		// Like the shadow culling, every box is tested against the packets of all frusta
+		for (int b = 0; b < 32; ++b)
+		{
+			const AABB box = RandomAABB();
+			uint32_t expected = 0;
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				if (frusta[i].CheckBoxFast(box))
+				{
+					expected |= 1u << i;
+				}
+			}
+			// The scalar plane distance is a 4D dot product, its summation order depends on the instruction set, the packet's doesn't
+			//	So the results can only differ for boxes that touch a plane, within rounding
+			const uint32_t mask = packet.CheckBoxFast(box);
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				if (((mask ^ expected) >> i) & 1)
+				{
+					AP_CHECK(std::abs(BoxFrustumDistance(frusta[i], box)) < 1e-5);
+				}
+			}
+			AP_CHECK((mask >> count) == 0);
+			inside += CountBits(expected);
+		}
+	}
+	AP_CHECK(inside > 1000);
+}
+
+int main(int argc, char** argv)
+{
+	TestRayPackets();
+	TestRayTrianglePackets();
+	TestRayPacketTraversal();
+	TestFrustumPackets();
+
+	std::printf("ok\n");
+	return 0;
+}
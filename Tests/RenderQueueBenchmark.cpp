@@ -0,0 +1,161 @@
+// Measures sorting a render queue of a synthetic scene, and the state changes that the sorted queue causes in RenderMeshes()
+//	The old order sorts by the packed batch data (distance first), the new order sorts by the state aware keys of RenderBatchKey
+//	The state changes are counted by replaying the queue the way RenderMeshes() binds states:
+//		draws: one instanced draw for every run of the same mesh, each also binds the mesh's index buffer
+//		pipeline changes: the pipeline bucket differs from the previous draw's
+//		material changes: the material differs from the previous draw's
+//	The radix sort must give the same order as std::stable_sort on the same keys, for both sort directions
+//	Options:
+//		--instances N : number of instances in the queue (default: 100000)
+//		--meshes N : number of meshes (default: 2000)
+//		--materials N : number of materials (default: 300)
+//		--threads N : number of worker threads (default: all cores)
+#include "TestCommon.h"
+#include "apRenderBatch.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace ap::renderer;
+
+namespace
+{
+	constexpr uint32_t bucket_count = 12; // pipeline states that the materials use
+
+	struct Mesh
+	{
+		uint32_t bucket;
+		uint32_t material;
+	};
+
+	struct StateChanges
+	{
+		uint32_t draws = 0;
+		uint32_t pipeline_changes = 0;
+		uint32_t material_changes = 0;
+	};
+
+	StateChanges CountStateChanges(const std::vector<RenderBatch>& queue, const std::vector<Mesh>& meshes)
+	{
+		StateChanges result;
+		uint32_t prev_mesh = ~0u;
+		uint32_t prev_bucket = ~0u;
+		uint32_t prev_material = ~0u;
+		for (const RenderBatch& batch : queue)
+		{
+			const uint32_t meshIndex = batch.GetMeshIndex();
+			if (meshIndex == prev_mesh)
+				continue;
+			prev_mesh = meshIndex;
+			result.draws++;
+			const Mesh& mesh = meshes[meshIndex];
+			if (mesh.bucket != prev_bucket)
+			{
+				result.pipeline_changes++;
+				prev_bucket = mesh.bucket;
+			}
+			if (mesh.material != prev_material)
+			{
+				result.material_changes++;
+				prev_material = mesh.material;
+			}
+		}
+		return result;
+	}
+
+	bool SameOrder(const std::vector<RenderBatch>& a, const std::vector<RenderBatch>& b)
+	{
+		return std::equal(a.begin(), a.end(), b.begin(), [](const RenderBatch& x, const RenderBatch& y) {
+			return x.data == y.data && x.sortKey == y.sortKey;
+		});
+	}
+
+	void Print(const char* name, double ms, const StateChanges& changes)
+	{
+		std::printf("%-28s %7.2f ms, %6u draws and index buffer binds, %6u pipeline changes, %6u material changes\n", name, ms, changes.draws, changes.pipeline_changes, changes.material_changes);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = ap::test::IsQuick(argc, argv);
+	const uint32_t instance_count = ap::test::GetArgument(argc, argv, "--instances", 100000);
+	const uint32_t mesh_count = std::max(1u, ap::test::GetArgument(argc, argv, "--meshes", 2000));
+	const uint32_t material_count = std::max(1u, ap::test::GetArgument(argc, argv, "--materials", 300));
+	const uint32_t repetitions = quick ? 1 : 20;
+	ap::jobsystem::Initialize(ap::test::GetArgument(argc, argv, "--threads", ~0u));
+
+	// Every material uses one pipeline bucket, every mesh uses one material, instances are placed at random distances
+	std::mt19937 rng(24);
+	std::vector<Mesh> meshes(mesh_count);
+	for (uint32_t i = 0; i < mesh_count; ++i)
+	{
+		meshes[i].material = i < material_count ? i : uint32_t(rng() % material_count);
+		meshes[i].bucket = meshes[i].material % bucket_count;
+	}
+	std::uniform_real_distribution<float> distance_distribution(1.0f, 1000.0f);
+	std::vector<RenderBatch> opaque(instance_count);
+	std::vector<RenderBatch> transparent(instance_count);
+	for (uint32_t i = 0; i < instance_count; ++i)
+	{
+		const uint32_t meshIndex = uint32_t(rng() % mesh_count);
+		const Mesh& mesh = meshes[meshIndex];
+		const float distance = distance_distribution(rng);
+		opaque[i].Create(meshIndex, i, distance, RENDERBATCHKEY_OPAQUE.Build(mesh.bucket, mesh.material, meshIndex, distance));
+		transparent[i].Create(meshIndex, i, distance, RENDERBATCHKEY_TRANSPARENT.Build(mesh.bucket, mesh.material, meshIndex, distance));
+	}
+
+	// Every measurement sorts a fresh copy of the unsorted queue, the copy is included in the times
+	std::vector<RenderBatch> sorted;
+	std::vector<RenderBatch> scratch(instance_count);
+
+	const double old_ms = ap::test::MeasureBest(repetitions, [&] {
+		sorted = opaque;
+		std::sort(sorted.begin(), sorted.end(), [](const RenderBatch& a, const RenderBatch& b) {
+			return a.data < b.data;
+		});
+	});
+	const StateChanges old_changes = CountStateChanges(sorted, meshes);
+
+	std::vector<RenderBatch> reference;
+	const double stable_ms = ap::test::MeasureBest(repetitions, [&] {
+		reference = opaque;
+		std::stable_sort(reference.begin(), reference.end(), [](const RenderBatch& a, const RenderBatch& b) {
+			return a.sortKey < b.sortKey;
+		});
+	});
+	const StateChanges stable_changes = CountStateChanges(reference, meshes);
+
+	const double radix_ms = ap::test::MeasureBest(repetitions, [&] {
+		sorted = opaque;
+		RadixSort(sorted.data(), scratch.data(), instance_count, 0);
+	});
+	AP_CHECK(SameOrder(sorted, reference));
+	const StateChanges radix_changes = CountStateChanges(sorted, meshes);
+
+	// Back to front, like the transparent passes:
+	reference = transparent;
+	std::stable_sort(reference.begin(), reference.end(), [](const RenderBatch& a, const RenderBatch& b) {
+		return a.sortKey > b.sortKey;
+	});
+	const double transparent_ms = ap::test::MeasureBest(repetitions, [&] {
+		sorted = transparent;
+		RadixSort(sorted.data(), scratch.data(), instance_count, ~0ull);
+	});
+	AP_CHECK(SameOrder(sorted, reference));
+	const StateChanges transparent_changes = CountStateChanges(sorted, meshes);
+
+	// The state aware order draws every mesh once and changes pipelines and materials only as often as there are of them
+	AP_CHECK(radix_changes.draws <= mesh_count);
+	AP_CHECK(radix_changes.pipeline_changes <= bucket_count);
+	AP_CHECK(radix_changes.material_changes <= material_count);
+	AP_CHECK(radix_changes.draws <= old_changes.draws);
+
+	std::printf("%u instances, %u meshes, %u materials, %u pipeline buckets, %u worker threads, best of %u runs\n", instance_count, mesh_count, material_count, bucket_count, ap::jobsystem::GetThreadCount(), repetitions);
+	Print("old keys, std::sort", old_ms, old_changes);
+	Print("new keys, std::stable_sort", stable_ms, stable_changes);
+	Print("new keys, radix sort", radix_ms, radix_changes);
+	Print("transparent, radix sort", transparent_ms, transparent_changes);
+	return 0;
+}
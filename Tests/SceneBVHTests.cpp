@@ -0,0 +1,209 @@
+// Tests that the object BVH of the scene stays in sync with the objects across Scene::Update() calls, on the null graphics device
+//	Frustum culling through the BVH is checked against testing every object bounds, picking against Pick() without the BVH (which tests every object, see ScenePickTests)
+//	Removing an object moves the last object into its slot, so a remove and a create in the same frame keep the object count with different objects in the slots
+#include "TestCommon.h"
+#include "apGraphicsDevice_Null.h"
+#include "apRenderer.h"
+#include "apScene.h"
+
+#include <algorithm>
+#include <random>
+
+using namespace ap::ecs;
+using namespace ap::graphics;
+using namespace ap::primitive;
+using namespace ap::renderer;
+using namespace ap::scene;
+
+static std::mt19937 rng(5678);
+
+static float Random(float min, float max)
+{
+	return std::uniform_real_distribution<float>(min, max)(rng);
+}
+
+// A closed box mesh of 12 triangles in the [-1, 1] cube
+static Entity CreateBoxMesh(Scene& scene)
+{
+	const Entity material = CreateEntity();
+	scene.materials.Create(material);
+
+	const Entity entity = CreateEntity();
+	MeshComponent& mesh = scene.meshes.Create(entity);
+	for (int i = 0; i < 8; ++i)
+	{
+		mesh.vertex_positions.push_back(XMFLOAT3(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f));
+		mesh.vertex_normals.push_back(XMFLOAT3(0, 1, 0));
+	}
+	mesh.indices = {
+		0, 2, 1, 1, 2, 3, // -z
+		4, 5, 6, 5, 7, 6, // +z
+		0, 1, 4, 1, 5, 4, // -y
+		2, 6, 3, 3, 6, 7, // +y
+		0, 4, 2, 2, 4, 6, // -x
+		1, 3, 5, 3, 7, 5, // +x
+	};
+	MeshComponent::MeshSubset& subset = mesh.subsets.emplace_back();
+	subset.materialID = material;
+	subset.indexOffset = 0;
+	subset.indexCount = (uint32_t)mesh.indices.size();
+	mesh.CreateRenderData();
+	return entity;
+}
+
+static void RandomizeTransform(TransformComponent& transform)
+{
+	transform.translation_local = XMFLOAT3(Random(-50, 50), Random(-10, 10), Random(-50, 50));
+	const float scale = Random(0.5f, 3);
+	transform.scale_local = XMFLOAT3(scale, scale, scale);
+	transform.SetDirty();
+}
+
+static Entity CreateObject(Scene& scene, Entity mesh)
+{
+	static uint32_t counter = 0;
+	const Entity entity = CreateEntity();
+	RandomizeTransform(scene.transforms.Create(entity));
+	scene.layers.Create(entity).layerMask = 1u << (counter++ % 4);
+	scene.objects.Create(entity).meshID = mesh;
+	scene.aabb_objects.Create(entity);
+	return entity;
+}
+
+static void CheckCulling(const Scene& scene)
+{
+	for (uint32_t layerMask : { ~0u, 0b0101u })
+	{
+		for (int i = 0; i < 8; ++i)
+		{
+			CameraComponent camera;
+			camera.CreatePerspective(1920, 1080, 0.1f, Random(20, 100), Random(0.5f, 1.5f));
+			camera.Eye = XMFLOAT3(Random(-60, 60), Random(-5, 5), Random(-60, 60));
+			XMStoreFloat3(&camera.At, XMVector3Normalize(XMVectorSet(Random(-1, 1), Random(-0.2f, 0.2f), Random(-1, 1), 0)));
+			camera.UpdateCamera();
+
+			Visibility vis;
+			vis.scene = &scene;
+			vis.camera = &camera;
+			vis.layerMask = layerMask;
+			vis.flags = Visibility::ALLOW_OBJECTS;
+			UpdateVisibility(vis);
+			ap::vector<uint32_t> visible = vis.visibleObjects;
+			std::sort(visible.begin(), visible.end());
+
+			ap::vector<uint32_t> expected;
+			for (uint32_t objectIndex = 0; objectIndex < (uint32_t)scene.aabb_objects.GetCount(); ++objectIndex)
+			{
+				const AABB& aabb = scene.aabb_objects[objectIndex];
+				if ((aabb.layerMask & layerMask) && camera.frustum.CheckBoxFast(aabb))
+				{
+					expected.push_back(objectIndex);
+				}
+			}
+			AP_CHECK(visible == expected);
+		}
+	}
+}
+
+// A ray is shot at every object from a random place, objects in the way can hit it first
+static void CheckPicking(Scene& scene)
+{
+	const uint32_t rayCount = (uint32_t)scene.aabb_objects.GetCount();
+	uint32_t hits = 0;
+	for (uint32_t i = 0; i < rayCount; ++i)
+	{
+		const XMFLOAT3 origin = XMFLOAT3(Random(-60, 60), Random(-20, 20), Random(-60, 60));
+		const XMFLOAT3 target = scene.aabb_objects[i].getCenter();
+		const Ray ray(XMLoadFloat3(&origin), XMVector3Normalize(XMLoadFloat3(&target) - XMLoadFloat3(&origin)));
+
+		const PickResult result = Pick(ray, ap::enums::RENDERTYPE_OPAQUE, ~0u, scene);
+		ap::BVH object_bvh = std::move(scene.object_bvh);
+		scene.object_bvh.Clear();
+		const PickResult expected = Pick(ray, ap::enums::RENDERTYPE_OPAQUE, ~0u, scene);
+		scene.object_bvh = std::move(object_bvh);
+
+		AP_CHECK(result.entity == expected.entity);
+		AP_CHECK(result.distance == expected.distance);
+		hits += expected.entity != INVALID_ENTITY ? 1 : 0;
+	}
+	AP_CHECK(hits > rayCount * 3 / 4);
+}
+
+static void CheckScene(Scene& scene)
+{
+	AP_CHECK(scene.object_bvh.IsValid() && scene.object_bvh.leaf_count == (uint32_t)scene.aabb_objects.GetCount());
+	CheckCulling(scene);
+	CheckPicking(scene);
+}
+
+int main(int argc, char** argv)
+{
+	ap::jobsystem::Initialize(ap::test::GetArgument(argc, argv, "--threads", ~0u));
+	GraphicsDevice_Null device;
+	GetDevice() = &device;
+
+	const float dt = 1.0f / 60.0f;
+	Scene scene;
+	const Entity mesh = CreateBoxMesh(scene);
+	for (int i = 0; i < 500; ++i)
+	{
+		CreateObject(scene, mesh);
+	}
+	scene.Update(dt);
+	CheckScene(scene);
+
+	// A few objects move a little, only the changed objects are refitted:
+	const float build_cost = scene.object_bvh.build_cost;
+	for (size_t i = 0; i < scene.transforms.GetCount(); i += 50)
+	{
+		scene.transforms[i].Translate(XMFLOAT3(Random(-1, 1), Random(-1, 1), Random(-1, 1)));
+	}
+	scene.Update(dt);
+	AP_CHECK(scene.object_bvh.build_cost == build_cost);
+	CheckScene(scene);
+
+	// Remove and create in the same frame, the objects that are moved into the removed slots don't move
+	//	The tree must be refitted and not rebuilt in this frame, otherwise the moved objects are not tested:
+	AP_CHECK(!scene.object_bvh.IsRebuildRecommended());
+	for (int i = 0; i < 3; ++i)
+	{
+		scene.Entity_Remove(scene.objects.GetEntity(i * 100));
+	}
+	for (int i = 0; i < 3; ++i)
+	{
+		CreateObject(scene, mesh);
+	}
+	scene.Update(dt);
+	AP_CHECK(scene.object_bvh.build_cost == build_cost);
+	CheckScene(scene);
+
+	// The same again with the removed object being the last one, nothing is moved:
+	if (scene.object_bvh.IsRebuildRecommended())
+	{
+		scene.Update(dt);
+	}
+	scene.Entity_Remove(scene.objects.GetEntity(scene.objects.GetCount() - 1));
+	CreateObject(scene, mesh);
+	scene.Update(dt);
+	CheckScene(scene);
+
+	// Many removes and creates, the whole tree is refitted:
+	for (int i = 0; i < 100; ++i)
+	{
+		scene.Entity_Remove(scene.objects.GetEntity(i * 3));
+	}
+	for (int i = 0; i < 100; ++i)
+	{
+		CreateObject(scene, mesh);
+	}
+	scene.Update(dt);
+	CheckScene(scene);
+
+	// Nothing changes in the next frame:
+	scene.Update(dt);
+	AP_CHECK(scene.changed_objects.empty());
+	CheckScene(scene);
+
+	std::printf("ok\n");
+	return 0;
+}
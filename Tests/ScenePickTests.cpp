@@ -0,0 +1,223 @@
+// Tests scene picking through the object and mesh BVHs against testing every triangle of every object in world space, on the null graphics device
+//	Pick() is checked with the BVHs up to date after Scene::Update(), with the object BVH missing (every object is tested), and the batched Pick() against the single ray version
+//	One mesh has a morph target, so it has no triangle BVH and its triangles are tested with the morphed positions
+#include "TestCommon.h"
+#include "apGraphicsDevice_Null.h"
+#include "apScene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace ap::ecs;
+using namespace ap::graphics;
+using namespace ap::primitive;
+using namespace ap::scene;
+
+static std::mt19937 rng(1234);
+
+static float Random(float min, float max)
+{
+	return std::uniform_real_distribution<float>(min, max)(rng);
+}
+
+// Random triangles inside the [-1, 1] cube
+static Entity CreateMesh(Scene& scene, Entity material, uint32_t triangleCount, bool morph)
+{
+	const Entity entity = CreateEntity();
+	MeshComponent& mesh = scene.meshes.Create(entity);
+	for (uint32_t i = 0; i < triangleCount; ++i)
+	{
+		const XMFLOAT3 center = XMFLOAT3(Random(-0.8f, 0.8f), Random(-0.8f, 0.8f), Random(-0.8f, 0.8f));
+		for (int j = 0; j < 3; ++j)
+		{
+			mesh.indices.push_back((uint32_t)mesh.vertex_positions.size());
+			mesh.vertex_positions.push_back(XMFLOAT3(center.x + Random(-0.2f, 0.2f), center.y + Random(-0.2f, 0.2f), center.z + Random(-0.2f, 0.2f)));
+			mesh.vertex_normals.push_back(XMFLOAT3(0, 1, 0));
+		}
+	}
+	MeshComponent::MeshSubset& subset = mesh.subsets.emplace_back();
+	subset.materialID = material;
+	subset.indexOffset = 0;
+	subset.indexCount = (uint32_t)mesh.indices.size();
+
+	if (morph)
+	{
+		MeshComponent::MeshMorphTarget& target = mesh.targets.emplace_back();
+		for (size_t i = 0; i < mesh.vertex_positions.size(); ++i)
+		{
+			target.vertex_positions.push_back(XMFLOAT3(Random(-0.1f, 0.1f), Random(-0.1f, 0.1f), Random(-0.1f, 0.1f)));
+		}
+		target.weight = 0.5f;
+	}
+
+	mesh.CreateRenderData();
+	AP_CHECK(mesh.bvh.IsValid() == !morph);
+	return entity;
+}
+
+static void RandomizeTransform(TransformComponent& transform)
+{
+	transform.translation_local = XMFLOAT3(Random(-20, 20), Random(-20, 20), Random(-20, 20));
+	XMStoreFloat4(&transform.rotation_local, XMQuaternionRotationRollPitchYaw(Random(0, XM_2PI), Random(0, XM_2PI), Random(0, XM_2PI)));
+	const float scale = Random(0.5f, 2);
+	transform.scale_local = XMFLOAT3(scale, scale * Random(0.8f, 1.2f), scale);
+	transform.SetDirty();
+}
+
+static void CreateScene(Scene& scene, uint32_t objectCount)
+{
+	const Entity material = CreateEntity();
+	scene.materials.Create(material);
+
+	Entity meshes[5];
+	for (int i = 0; i < 5; ++i)
+	{
+		meshes[i] = CreateMesh(scene, material, 64 + i * 32, i == 4);
+	}
+
+	for (uint32_t i = 0; i < objectCount; ++i)
+	{
+		const Entity entity = CreateEntity();
+		RandomizeTransform(scene.transforms.Create(entity));
+		scene.layers.Create(entity).layerMask = 1u << (i % 4);
+		ObjectComponent& object = scene.objects.Create(entity);
+		object.meshID = meshes[i % 5];
+		scene.aabb_objects.Create(entity);
+	}
+}
+
+// The reference: every triangle of every object that passes the filters is transformed to world space and intersected with the ray
+static PickResult PickBruteForce(const Scene& scene, const Ray& ray, uint32_t layerMask)
+{
+	PickResult result;
+	const XMVECTOR origin = XMLoadFloat3(&ray.origin);
+	const XMVECTOR direction = XMVector3Normalize(XMLoadFloat3(&ray.direction));
+	for (size_t i = 0; i < scene.objects.GetCount(); ++i)
+	{
+		const ObjectComponent& object = scene.objects[i];
+		const Entity entity = scene.objects.GetEntity(i);
+		if (!(object.GetRenderTypes() & ap::enums::RENDERTYPE_OPAQUE) || !(scene.layers.GetComponent(entity)->GetLayerMask() & layerMask))
+			continue;
+
+		const MeshComponent& mesh = *scene.meshes.GetComponent(object.meshID);
+		const XMMATRIX world = XMLoadFloat4x4(&scene.transforms.GetComponent(entity)->world);
+		auto load = [&](uint32_t index) {
+			XMFLOAT3 position = mesh.vertex_positions[index];
+			for (const MeshComponent::MeshMorphTarget& target : mesh.targets)
+			{
+				position.x += target.weight * target.vertex_positions[index].x;
+				position.y += target.weight * target.vertex_positions[index].y;
+				position.z += target.weight * target.vertex_positions[index].z;
+			}
+			return XMVector3Transform(XMLoadFloat3(&position), world);
+		};
+		for (size_t j = 0; j + 2 < mesh.indices.size(); j += 3)
+		{
+			float distance;
+			XMFLOAT2 bary;
+			if (ap::math::RayTriangleIntersects(origin, direction, load(mesh.indices[j]), load(mesh.indices[j + 1]), load(mesh.indices[j + 2]), distance, bary) && distance < result.distance)
+			{
+				result.entity = entity;
+				result.distance = distance;
+			}
+		}
+	}
+	return result;
+}
+
+static void CheckResult(const PickResult& result, const PickResult& expected)
+{
+	AP_CHECK(result.entity == expected.entity);
+	if (expected.entity != INVALID_ENTITY)
+	{
+		AP_CHECK(std::abs(result.distance - expected.distance) < 1e-3f * std::max(1.0f, expected.distance));
+	}
+}
+
+// Half of the rays are aimed at objects so that most of them hit something
+static std::vector<Ray> CreateRays(const Scene& scene, uint32_t count)
+{
+	std::vector<Ray> rays;
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const XMFLOAT3 origin = XMFLOAT3(Random(-30, 30), Random(-30, 30), Random(-30, 30));
+		XMFLOAT3 target = XMFLOAT3(Random(-30, 30), Random(-30, 30), Random(-30, 30));
+		if (i % 2 == 0)
+		{
+			const AABB& aabb = scene.aabb_objects[std::uniform_int_distribution<size_t>(0, scene.aabb_objects.GetCount() - 1)(rng)];
+			target = aabb.getCenter();
+		}
+		rays.push_back(Ray(XMLoadFloat3(&origin), XMVector3Normalize(XMLoadFloat3(&target) - XMLoadFloat3(&origin))));
+	}
+	return rays;
+}
+
+static void CheckPicking(Scene& scene, uint32_t rayCount)
+{
+	AP_CHECK(scene.object_bvh.leaf_count == (uint32_t)scene.aabb_objects.GetCount());
+	const std::vector<Ray> rays = CreateRays(scene, rayCount);
+
+	for (uint32_t layerMask : { ~0u, 0b0101u })
+	{
+		std::vector<PickResult> expected;
+		uint32_t hits = 0;
+		for (const Ray& ray : rays)
+		{
+			expected.push_back(PickBruteForce(scene, ray, layerMask));
+			hits += expected.back().entity != INVALID_ENTITY ? 1 : 0;
+		}
+		AP_CHECK(hits > rayCount / 8);
+
+		for (size_t i = 0; i < rays.size(); ++i)
+		{
+			CheckResult(Pick(rays[i], ap::enums::RENDERTYPE_OPAQUE, layerMask, scene), expected[i]);
+		}
+
+		std::vector<PickResult> results(rays.size());
+		Pick(rays.data(), rays.size(), results.data(), ap::enums::RENDERTYPE_OPAQUE, layerMask, scene);
+		for (size_t i = 0; i < rays.size(); ++i)
+		{
+			CheckResult(results[i], expected[i]);
+		}
+
+		// Without the object BVH, every object is tested with PickObject():
+		ap::BVH object_bvh = std::move(scene.object_bvh);
+		scene.object_bvh.Clear();
+		for (size_t i = 0; i < rays.size(); ++i)
+		{
+			CheckResult(Pick(rays[i], ap::enums::RENDERTYPE_OPAQUE, layerMask, scene), expected[i]);
+		}
+		Pick(rays.data(), rays.size(), results.data(), ap::enums::RENDERTYPE_OPAQUE, layerMask, scene);
+		for (size_t i = 0; i < rays.size(); ++i)
+		{
+			CheckResult(results[i], expected[i]);
+		}
+		scene.object_bvh = std::move(object_bvh);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	ap::jobsystem::Initialize(ap::test::GetArgument(argc, argv, "--threads", ~0u));
+	GraphicsDevice_Null device;
+	GetDevice() = &device;
+
+	const float dt = 1.0f / 60.0f;
+	Scene scene;
+	CreateScene(scene, 300);
+	scene.Update(dt);
+	CheckPicking(scene, 400);
+
+	// Some objects are moved, the object BVH is refitted above them:
+	for (size_t i = 0; i < scene.transforms.GetCount(); i += 7)
+	{
+		RandomizeTransform(scene.transforms[i]);
+	}
+	scene.Update(dt);
+	CheckPicking(scene, 400);
+
+	std::printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,128 @@
+// Measures scene loading: the chunked layout that is decoded concurrently on the job system, against the sequential layout of older archive versions
+//	The sequential layout is reproduced by serializing the component managers one after another, like Scene::Serialize() does for archive versions < 75
+//	Run with --threads N to see how the chunked load scales with the number of worker threads
+#include "TestCommon.h"
+#include "apGraphicsDevice_Null.h"
+#include "apScene.h"
+
+#include <string>
+
+using namespace ap::ecs;
+using namespace ap::graphics;
+using namespace ap::scene;
+
+static void CreateBenchmarkScene(Scene& scene, uint32_t objectCount, uint32_t meshCount, uint32_t meshVertexCount)
+{
+	const Entity material = CreateEntity();
+	scene.materials.Create(material);
+
+	ap::vector<Entity> meshes;
+	for (uint32_t i = 0; i < meshCount; ++i)
+	{
+		const Entity entity = CreateEntity();
+		scene.names.Create(entity) = "mesh_" + std::to_string(i);
+		MeshComponent& mesh = scene.meshes.Create(entity);
+		mesh.vertex_positions.resize(meshVertexCount);
+		mesh.vertex_normals.resize(meshVertexCount, XMFLOAT3(0, 1, 0));
+		mesh.vertex_uvset_0.resize(meshVertexCount);
+		for (uint32_t v = 0; v < meshVertexCount; ++v)
+		{
+			mesh.vertex_positions[v] = XMFLOAT3(float(v % 64), float(i), float(v / 64));
+			mesh.vertex_uvset_0[v] = XMFLOAT2(float(v % 64) / 64.0f, float(v / 64) / 64.0f);
+		}
+		for (uint32_t v = 0; v + 2 < meshVertexCount; ++v)
+		{
+			mesh.indices.push_back(v);
+			mesh.indices.push_back(v + 1);
+			mesh.indices.push_back(v + 2);
+		}
+		MeshComponent::MeshSubset& subset = mesh.subsets.emplace_back();
+		subset.materialID = material;
+		subset.indexOffset = 0;
+		subset.indexCount = (uint32_t)mesh.indices.size();
+		meshes.push_back(entity);
+	}
+
+	Entity parent = INVALID_ENTITY;
+	for (uint32_t i = 0; i < objectCount; ++i)
+	{
+		const Entity entity = CreateEntity();
+		scene.names.Create(entity) = "object_" + std::to_string(i);
+		scene.layers.Create(entity).layerMask = i;
+		TransformComponent& transform = scene.transforms.Create(entity);
+		transform.translation_local = XMFLOAT3(float(i % 100), 0, float(i / 100));
+		scene.objects.Create(entity).meshID = meshes[i % meshCount];
+
+		// chains of 8 entities
+		if (i % 8 != 0)
+		{
+			scene.Component_Attach(entity, parent, true);
+		}
+		parent = entity;
+	}
+	scene.SortHierarchy();
+}
+
+// The managers that the benchmark scene uses, in the order of the sequential layout
+static void SerializeSequential(Scene& scene, ap::Archive& archive)
+{
+	EntitySerializer seri;
+	scene.names.Serialize(archive, seri);
+	scene.layers.Serialize(archive, seri);
+	scene.transforms.Serialize(archive, seri);
+	scene.hierarchy.Serialize(archive, seri);
+	scene.materials.Serialize(archive, seri);
+	scene.meshes.Serialize(archive, seri);
+	scene.objects.Serialize(archive, seri);
+}
+
+static void CheckLoadedScene(const Scene& scene, const Scene& source)
+{
+	AP_CHECK(scene.names.GetCount() == source.names.GetCount());
+	AP_CHECK(scene.transforms.GetCount() == source.transforms.GetCount());
+	AP_CHECK(scene.hierarchy.GetCount() == source.hierarchy.GetCount());
+	AP_CHECK(scene.meshes.GetCount() == source.meshes.GetCount());
+	AP_CHECK(scene.objects.GetCount() == source.objects.GetCount());
+	for (size_t i = 0; i < scene.objects.GetCount(); ++i)
+	{
+		AP_CHECK(scene.meshes.Contains(scene.objects[i].meshID));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = ap::test::IsQuick(argc, argv);
+	const uint32_t objectCount = quick ? 5000 : 200000;
+	const uint32_t meshCount = quick ? 20 : 500;
+	const uint32_t meshVertexCount = quick ? 1024 : 16384;
+	const uint32_t repetitions = quick ? 1 : 5;
+
+	ap::jobsystem::Initialize(ap::test::GetArgument(argc, argv, "--threads", ~0u));
+	GraphicsDevice_Null device;
+	GetDevice() = &device;
+
+	ap::Archive chunked;
+	ap::Archive sequential;
+	Scene source;
+	CreateBenchmarkScene(source, objectCount, meshCount, meshVertexCount);
+	source.Serialize(chunked);
+	SerializeSequential(source, sequential);
+
+	std::printf("%u objects, %u meshes of %u vertices, %u threads, best of %u loads\n", objectCount, meshCount, meshVertexCount, ap::jobsystem::GetThreadCount(), repetitions);
+
+	const double sequential_ms = ap::test::MeasureBest(repetitions, [&] {
+		sequential.SetReadModeAndResetPos(true);
+		Scene scene;
+		SerializeSequential(scene, sequential);
+		CheckLoadedScene(scene, source);
+	});
+	const double chunked_ms = ap::test::MeasureBest(repetitions, [&] {
+		chunked.SetReadModeAndResetPos(true);
+		Scene scene;
+		scene.Serialize(chunked);
+		CheckLoadedScene(scene, source);
+	});
+
+	std::printf("sequential: %8.2f ms | chunked: %8.2f ms | speedup: %.2fx\n", sequential_ms, chunked_ms, sequential_ms / chunked_ms);
+	return 0;
+}
@@ -0,0 +1,130 @@
+// Scene serialization round trips in the chunked layout, loaded synchronously from the main thread and asynchronously from a streaming worker
+//	A synchronous load must dispatch its subtasks with Normal priority (executed by the frame workers too), an asynchronous load keeps them on the streaming workers
+#include "TestCommon.h"
+#include "apScene.h"
+
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+using namespace ap::ecs;
+using namespace ap::jobsystem;
+using namespace ap::scene;
+
+// Enough entities that the components are written into many chunks
+static constexpr uint32_t entity_count = 20000;
+
+static void CreateTestScene(Scene& scene)
+{
+	Entity parent = INVALID_ENTITY;
+	for (uint32_t i = 0; i < entity_count; ++i)
+	{
+		Entity entity = CreateEntity();
+		scene.names.Create(entity) = "entity_" + std::to_string(i);
+		scene.layers.Create(entity).layerMask = i;
+		TransformComponent& transform = scene.transforms.Create(entity);
+		transform.translation_local = XMFLOAT3(float(i), float(i % 7), -float(i));
+		transform.scale_local = XMFLOAT3(1, 2, 3);
+
+		// chains of 8 entities
+		if (i % 8 != 0)
+		{
+			scene.Component_Attach(entity, parent, true);
+		}
+		parent = entity;
+	}
+	scene.SortHierarchy();
+}
+
+// Entities are remapped when they are loaded, so they are matched by name
+static void CheckLoadedScene(const Scene& scene)
+{
+	AP_CHECK(scene.names.GetCount() == entity_count);
+	AP_CHECK(scene.transforms.GetCount() == entity_count);
+	AP_CHECK(scene.hierarchy.GetCount() == entity_count); // the chain roots have hierarchy components too, as parents
+
+	std::unordered_map<Entity, uint32_t> indices;
+	for (size_t i = 0; i < scene.names.GetCount(); ++i)
+	{
+		const std::string& name = scene.names[i].name;
+		AP_CHECK(name.compare(0, 7, "entity_") == 0);
+		indices[scene.names.GetEntity(i)] = (uint32_t)std::stoul(name.substr(7));
+	}
+	AP_CHECK(indices.size() == entity_count);
+
+	for (auto& [entity, index] : indices)
+	{
+		const LayerComponent* layer = scene.layers.GetComponent(entity);
+		AP_CHECK(layer != nullptr && layer->layerMask == index);
+		const TransformComponent* transform = scene.transforms.GetComponent(entity);
+		AP_CHECK(transform != nullptr);
+		AP_CHECK(transform->translation_local.x == float(index) && transform->translation_local.y == float(index % 7) && transform->translation_local.z == -float(index));
+		AP_CHECK(transform->scale_local.x == 1 && transform->scale_local.y == 2 && transform->scale_local.z == 3);
+
+		const HierarchyComponent* hierarchy = scene.hierarchy.GetComponent(entity);
+		AP_CHECK(hierarchy != nullptr);
+		if (index % 8 == 0)
+		{
+			AP_CHECK(hierarchy->parentID == INVALID_ENTITY);
+		}
+		else
+		{
+			auto parent = indices.find(hierarchy->parentID);
+			AP_CHECK(parent != indices.end() && parent->second == index - 1);
+		}
+	}
+}
+
+static void TestSynchronousLoad(ap::Archive& archive)
+{
+	{
+		ap::ecs::EntitySerializer seri;
+		AP_CHECK(seri.ctx.priority == Priority::Normal);
+	}
+
+	archive.SetReadModeAndResetPos(true);
+	Scene scene;
+	scene.Serialize(archive);
+	CheckLoadedScene(scene);
+}
+
+static void TestAsynchronousLoad(ap::Archive& archive)
+{
+	archive.SetReadModeAndResetPos(true);
+	Scene scene;
+	bool streaming_serializer = false;
+	context ctx;
+	ctx.priority = Priority::Streaming;
+	Execute(ctx, [&](JobArgs) {
+		{
+			ap::ecs::EntitySerializer seri;
+			streaming_serializer = seri.ctx.priority == Priority::Streaming;
+		}
+		scene.Serialize(archive);
+	});
+	// Wait() would let this thread execute the load itself, so it only polls until a streaming worker finished it:
+	while (IsBusy(ctx))
+	{
+		std::this_thread::yield();
+	}
+	AP_CHECK(streaming_serializer);
+	CheckLoadedScene(scene);
+}
+
+int main(int argc, char** argv)
+{
+	Initialize(ap::test::GetArgument(argc, argv, "--threads", ~0u));
+
+	ap::Archive archive;
+	{
+		Scene scene;
+		CreateTestScene(scene);
+		scene.Serialize(archive);
+	}
+
+	TestSynchronousLoad(archive);
+	TestAsynchronousLoad(archive);
+
+	std::printf("ok\n");
+	return 0;
+}
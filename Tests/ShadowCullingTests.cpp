@@ -0,0 +1,210 @@
+// Tests the shadow view culling of the renderer against culling every view one after the other with the scalar primitive tests, on the null graphics device
+//	The renderer tests four frusta at a time with FrustumPacket4 and scatters the results of object groups into one batch array, the visible sets and their order must be the same
+//	There are more than 64 views, so the view bitmask of an object takes more than one word
+#include "TestCommon.h"
+#include "apGraphicsDevice_Null.h"
+#include "apRenderer.h"
+#include "apScene.h"
+
+#include <algorithm>
+#include <memory>
+#include <random>
+
+using namespace ap::ecs;
+using namespace ap::enums;
+using namespace ap::graphics;
+using namespace ap::primitive;
+using namespace ap::renderer;
+using namespace ap::scene;
+
+static constexpr uint32_t CASCADE_COUNT = 3; // the cascades of a directional light in the renderer
+
+static std::mt19937 rng(4321);
+
+static float Random(float min, float max)
+{
+	return std::uniform_real_distribution<float>(min, max)(rng);
+}
+
+static XMVECTOR RandomDirection()
+{
+	return XMVector3Normalize(XMVectorSet(Random(-1, 1), Random(-1, 1), Random(-1, 1), 0) + XMVectorSet(0, 0.01f, 0, 0));
+}
+
+static XMMATRIX LookTo(const XMVECTOR& eye, const XMVECTOR& direction)
+{
+	const XMVECTOR up = std::abs(XMVectorGetY(direction)) > 0.9f ? XMVectorSet(1, 0, 0, 0) : XMVectorSet(0, 1, 0, 0);
+	return XMMatrixLookToLH(eye, direction, up);
+}
+
+static void CreateScene(Scene& scene, uint32_t objectCount)
+{
+	const Entity opaque = CreateEntity();
+	scene.materials.Create(opaque);
+	const Entity transparent = CreateEntity();
+	scene.materials.Create(transparent).userBlendMode = BLENDMODE_ALPHA;
+
+	Entity meshes[2];
+	for (int i = 0; i < 2; ++i)
+	{
+		meshes[i] = CreateEntity();
+		MeshComponent& mesh = scene.meshes.Create(meshes[i]);
+		mesh.vertex_positions = { XMFLOAT3(-1, -1, -1), XMFLOAT3(1, -1, 1), XMFLOAT3(-1, 1, 1), XMFLOAT3(1, 1, -1) };
+		mesh.vertex_normals.resize(mesh.vertex_positions.size(), XMFLOAT3(0, 1, 0));
+		mesh.indices = { 0, 1, 2, 1, 3, 2 };
+		MeshComponent::MeshSubset& subset = mesh.subsets.emplace_back();
+		subset.materialID = i == 0 ? opaque : transparent;
+		subset.indexOffset = 0;
+		subset.indexCount = (uint32_t)mesh.indices.size();
+		mesh.CreateRenderData();
+	}
+
+	for (uint32_t i = 0; i < objectCount; ++i)
+	{
+		const Entity entity = CreateEntity();
+		TransformComponent& transform = scene.transforms.Create(entity);
+		transform.translation_local = XMFLOAT3(Random(-100, 100), Random(-20, 20), Random(-100, 100));
+		const float scale = Random(0.2f, 4);
+		transform.scale_local = XMFLOAT3(scale, scale, scale);
+		scene.layers.Create(entity).layerMask = 1u << (i % 4);
+		ObjectComponent& object = scene.objects.Create(entity);
+		object.meshID = meshes[i % 7 == 0 ? 1 : 0];
+		object.cascadeMask = i % CASCADE_COUNT;
+		object.SetCastShadow(i % 11 != 0);
+		object.SetRenderable(i % 13 != 0);
+		scene.aabb_objects.Create(entity);
+	}
+}
+
+// Views in the order the renderer gathers them: the cascades of a directional light follow each other, spot and point lights have one view
+static ap::vector<ShadowCullingView> CreateViews(uint32_t lightCount)
+{
+	ap::vector<ShadowCullingView> views;
+	for (uint32_t light = 0; light < lightCount; ++light)
+	{
+		const XMVECTOR direction = RandomDirection();
+		const XMVECTOR position = XMVectorSet(Random(-100, 100), Random(-20, 20), Random(-100, 100), 1);
+		switch (light % 3)
+		{
+		case 0:
+			// Directional: orthographic frusta around the origin that get larger with every cascade
+			for (uint32_t cascade = 0; cascade < CASCADE_COUNT; ++cascade)
+			{
+				ShadowCullingView& view = views.emplace_back();
+				view.type = LightComponent::DIRECTIONAL;
+				view.cascade = cascade;
+				const float size = 10.0f * float(1 << (cascade * 2));
+				const XMMATRIX projection = XMMatrixOrthographicOffCenterLH(-size, size, -size, size, 200, -200); // reversed depth, like the shadow cameras
+				view.frustum.Create(LookTo(XMVectorSet(Random(-30, 30), 0, Random(-30, 30), 1), direction) * projection);
+			}
+			break;
+		case 1:
+		{
+			ShadowCullingView& view = views.emplace_back();
+			view.type = LightComponent::SPOT;
+			view.frustum.Create(LookTo(position, direction) * XMMatrixPerspectiveFovLH(Random(0.3f, 2), 1, Random(20, 100), 0.1f));
+			break;
+		}
+		default:
+		{
+			ShadowCullingView& view = views.emplace_back();
+			view.type = LightComponent::POINT;
+			XMFLOAT3 center;
+			XMStoreFloat3(&center, position);
+			view.sphere = Sphere(center, Random(5, 40));
+			break;
+		}
+		}
+	}
+	return views;
+}
+
+// The reference: every view is culled on its own with the scalar tests
+static void CullReference(const Visibility& vis, const ShadowCullingView& view, ap::vector<uint32_t>& object_indices, bool& transparent)
+{
+	object_indices.clear();
+	transparent = false;
+	for (size_t i = 0; i < vis.scene->aabb_objects.GetCount(); ++i)
+	{
+		const AABB& aabb = vis.scene->aabb_objects[i];
+		const ObjectComponent& object = vis.scene->objects[i];
+		if ((aabb.layerMask & vis.layerMask) == 0 || !object.IsRenderable() || !object.IsCastingShadow())
+			continue;
+		if (view.type == LightComponent::DIRECTIONAL && view.cascade >= CASCADE_COUNT - object.cascadeMask)
+			continue;
+		const bool visible = view.type == LightComponent::POINT ? view.sphere.intersects(aabb) : view.frustum.CheckBoxFast(aabb);
+		if (visible)
+		{
+			object_indices.push_back((uint32_t)i);
+			transparent |= (object.GetRenderTypes() & (RENDERTYPE_TRANSPARENT | RENDERTYPE_WATER)) != 0;
+		}
+	}
+}
+
+static void CheckCulling(const Scene& scene, const ap::vector<ShadowCullingView>& views, uint32_t layerMask)
+{
+	Visibility vis;
+	vis.scene = &scene;
+	vis.layerMask = layerMask;
+
+	const uint32_t view_count = (uint32_t)views.size();
+	ap::vector<ap::vector<uint32_t>> object_indices(view_count);
+	std::unique_ptr<bool[]> transparent(new bool[view_count]);
+	CullShadowViews(vis, views.data(), view_count, object_indices.data(), transparent.get());
+
+	uint32_t empty_views = 0;
+	uint32_t transparent_views = 0;
+	size_t visible_count = 0;
+	for (uint32_t viewIndex = 0; viewIndex < view_count; ++viewIndex)
+	{
+		ap::vector<uint32_t> expected;
+		bool expected_transparent;
+		CullReference(vis, views[viewIndex], expected, expected_transparent);
+		AP_CHECK(object_indices[viewIndex] == expected);
+		AP_CHECK(transparent[viewIndex] == expected_transparent);
+		empty_views += expected.empty() ? 1 : 0;
+		transparent_views += expected_transparent ? 1 : 0;
+		visible_count += expected.size();
+	}
+
+	// The test is only meaningful if the views see different parts of the scene:
+	if (scene.objects.GetCount() > 0)
+	{
+		AP_CHECK(empty_views * 4 < view_count);
+		AP_CHECK(transparent_views > 0);
+		AP_CHECK(visible_count < view_count * scene.objects.GetCount() / 4);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	ap::jobsystem::Initialize(ap::test::GetArgument(argc, argv, "--threads", ~0u));
+	GraphicsDevice_Null device;
+	GetDevice() = &device;
+
+	// The number of lights makes the last frustum packet partially filled:
+	const ap::vector<ShadowCullingView> views = CreateViews(46);
+	const size_t frustum_count = std::count_if(views.begin(), views.end(), [](const ShadowCullingView& view) { return view.type != LightComponent::POINT; });
+	AP_CHECK(views.size() > 64 && frustum_count % 4 != 0);
+
+	// The object count is not a multiple of the culling group size:
+	Scene scene;
+	CreateScene(scene, 3000);
+	scene.Update(1.0f / 60.0f);
+	for (uint32_t layerMask : { ~0u, 0b0110u })
+	{
+		CheckCulling(scene, views, layerMask);
+	}
+
+	// Fewer views than a packet, one of each type:
+	const ap::vector<ShadowCullingView> few_views = { views[0], views[3], views[4] };
+	AP_CHECK(few_views[0].type == LightComponent::DIRECTIONAL && few_views[1].type == LightComponent::SPOT && few_views[2].type == LightComponent::POINT);
+	CheckCulling(scene, few_views, ~0u);
+
+	Scene empty;
+	empty.Update(1.0f / 60.0f);
+	CheckCulling(empty, views, ~0u);
+
+	std::printf("ok\n");
+	return 0;
+}
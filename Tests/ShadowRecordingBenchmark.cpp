@@ -0,0 +1,193 @@
+// Measures recording the shadow maps of a scene into several command lists in parallel against recording them into one, on the null graphics device
+//	The command lists must contain the same draws and render passes as the single list together, only the common resources are bound again in every list
+//	Run with --threads N to see how the recording scales with the number of worker threads
+#include "TestCommon.h"
+#include "apGraphicsDevice_Null.h"
+#include "apRenderer.h"
+#include "apScene.h"
+
+#include <random>
+
+using namespace ap::ecs;
+using namespace ap::graphics;
+using namespace ap::renderer;
+using namespace ap::scene;
+
+static std::mt19937 rng(1357);
+
+static float Random(float min, float max)
+{
+	return std::uniform_real_distribution<float>(min, max)(rng);
+}
+
+// The object pipeline states are created when the renderer loads its shaders, which needs the shader compiler
+//	Custom shaders stand in for them, their pipeline states only have to be valid on the null device
+static int CreateCustomShader(GraphicsDevice& device, const char* name)
+{
+	CustomShader customShader;
+	customShader.name = name;
+	customShader.renderTypeFlags = ap::enums::RENDERTYPE_ALL;
+	PipelineStateDesc desc;
+	for (PipelineState& pso : customShader.pso)
+	{
+		device.CreatePipelineState(&desc, &pso);
+	}
+	return RegisterCustomShader(customShader);
+}
+
+static void CreateBenchmarkScene(GraphicsDevice& device, Scene& scene, uint32_t objectCount, uint32_t lightCount)
+{
+	const int opaqueShader = CreateCustomShader(device, "shadow_benchmark_opaque");
+	const int alphatestShader = CreateCustomShader(device, "shadow_benchmark_alphatest");
+
+	Entity materials[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		materials[i] = CreateEntity();
+		MaterialComponent& material = scene.materials.Create(materials[i]);
+		material.SetCustomShaderID(i == 3 ? alphatestShader : opaqueShader); // the pipeline state changes between the materials
+	}
+
+	Entity meshes[16];
+	for (int i = 0; i < 16; ++i)
+	{
+		meshes[i] = CreateEntity();
+		MeshComponent& mesh = scene.meshes.Create(meshes[i]);
+		mesh.vertex_positions = { XMFLOAT3(-1, -1, -1), XMFLOAT3(1, -1, 1), XMFLOAT3(-1, 1, 1), XMFLOAT3(1, 1, -1) };
+		mesh.vertex_normals.resize(mesh.vertex_positions.size(), XMFLOAT3(0, 1, 0));
+		mesh.indices = { 0, 1, 2, 1, 3, 2, 0, 3, 1, 0, 2, 3 };
+		MeshComponent::MeshSubset& subset = mesh.subsets.emplace_back();
+		subset.materialID = materials[i % 4];
+		subset.indexOffset = 0;
+		subset.indexCount = (uint32_t)mesh.indices.size();
+		mesh.CreateRenderData();
+	}
+
+	for (uint32_t i = 0; i < objectCount; ++i)
+	{
+		const Entity entity = CreateEntity();
+		TransformComponent& transform = scene.transforms.Create(entity);
+		transform.translation_local = XMFLOAT3(Random(-100, 100), Random(0, 10), Random(0, 200));
+		scene.objects.Create(entity).meshID = meshes[i % 16];
+		scene.aabb_objects.Create(entity);
+	}
+
+	// A sun with cascades and spot and point lights spread over the scene:
+	for (uint32_t i = 0; i < lightCount; ++i)
+	{
+		const Entity entity = CreateEntity();
+		TransformComponent& transform = scene.transforms.Create(entity);
+		LightComponent& light = scene.lights.Create(entity);
+		light.SetCastShadow(true);
+		light.range_local = 30;
+		if (i == 0)
+		{
+			light.SetType(LightComponent::DIRECTIONAL);
+			transform.RotateRollPitchYaw(XMFLOAT3(0.3f, 0, 0.5f));
+		}
+		else
+		{
+			light.SetType(i % 2 == 0 ? LightComponent::POINT : LightComponent::SPOT);
+			light.fov = XM_PIDIV2;
+			transform.translation_local = XMFLOAT3(Random(-60, 60), 15, Random(10, 150));
+		}
+		scene.aabb_lights.Create(entity);
+	}
+}
+
+// Records the shadow maps into count command lists and returns the sum of what was recorded
+static GraphicsDevice_Null::CommandListStatistics Record(GraphicsDevice_Null& device, const Visibility& vis, uint32_t count, uint32_t* used_count = nullptr)
+{
+	CommandList cmds[COMMANDLIST_COUNT];
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		cmds[i] = device.BeginCommandList();
+	}
+	DrawShadowmaps(vis, cmds, count);
+	device.SubmitCommandLists();
+
+	GraphicsDevice_Null::CommandListStatistics total;
+	if (used_count != nullptr)
+	{
+		*used_count = 0;
+	}
+	for (uint32_t i = 0; i < device.GetSubmittedCommandListCount(); ++i)
+	{
+		const GraphicsDevice_Null::CommandListStatistics& statistics = device.GetSubmittedStatistics(i);
+		total.commands += statistics.commands;
+		total.render_passes += statistics.render_passes;
+		total.pipeline_changes += statistics.pipeline_changes;
+		total.draws += statistics.draws;
+		total.dispatches += statistics.dispatches;
+		total.barriers += statistics.barriers;
+		if (used_count != nullptr && statistics.commands > 0)
+		{
+			(*used_count)++;
+		}
+	}
+	return total;
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = ap::test::IsQuick(argc, argv);
+	const uint32_t objectCount = quick ? 5000 : 100000;
+	const uint32_t lightCount = quick ? 24 : 64;
+	const uint32_t repetitions = quick ? 3 : 20;
+
+	ap::jobsystem::Initialize(ap::test::GetArgument(argc, argv, "--threads", ~0u));
+	GraphicsDevice_Null device;
+	GetDevice() = &device;
+	SetShadowProps2D(256, 64);
+	SetShadowPropsCube(64, 32);
+
+	Scene scene;
+	CreateBenchmarkScene(device, scene, objectCount, lightCount);
+	scene.Update(1.0f / 60.0f);
+
+	CameraComponent camera;
+	camera.CreatePerspective(1920, 1080, 0.1f, 500);
+	camera.Eye = XMFLOAT3(0, 20, -20);
+	XMStoreFloat3(&camera.At, XMVector3Normalize(XMVectorSet(0, -0.3f, 1, 0)));
+	camera.UpdateCamera();
+
+	Visibility vis;
+	vis.scene = &scene;
+	vis.camera = &camera;
+	vis.flags = Visibility::ALLOW_OBJECTS | Visibility::ALLOW_LIGHTS;
+	UpdateVisibility(vis);
+	AP_CHECK(vis.visibleLights.size() > lightCount / 2);
+
+	// The common resources are bound once in every command list:
+	const CommandList common_cmd = device.BeginCommandList();
+	BindCommonResources(common_cmd);
+	device.SubmitCommandLists();
+	const uint32_t common_commands = device.GetSubmittedStatistics(0).commands;
+
+	uint32_t used_count = 0;
+	const GraphicsDevice_Null::CommandListStatistics single = Record(device, vis, 1, &used_count);
+	AP_CHECK(used_count == 1);
+	AP_CHECK(single.draws > 0 && single.render_passes > 0);
+
+	std::printf("%u objects, %u lights, %u threads, %u draws and %u commands in %u render passes, best of %u recordings\n",
+		objectCount, lightCount, ap::jobsystem::GetThreadCount(), single.draws, single.commands, single.render_passes, repetitions);
+
+	for (uint32_t count : { 2u, 4u, 8u })
+	{
+		const GraphicsDevice_Null::CommandListStatistics multi = Record(device, vis, count, &used_count);
+		AP_CHECK(used_count > 1 && used_count <= count);
+		AP_CHECK(multi.draws == single.draws);
+		AP_CHECK(multi.render_passes == single.render_passes);
+		AP_CHECK(multi.dispatches == single.dispatches);
+		AP_CHECK(multi.barriers == single.barriers);
+
+		// A command list can begin with the pipeline state that the previous one ended with, then it's bound once more:
+		AP_CHECK(multi.pipeline_changes >= single.pipeline_changes && multi.pipeline_changes - single.pipeline_changes < used_count);
+		AP_CHECK(multi.commands == single.commands + (used_count - 1) * common_commands + (multi.pipeline_changes - single.pipeline_changes));
+
+		const double single_ms = ap::test::MeasureBest(repetitions, [&] { Record(device, vis, 1); });
+		const double multi_ms = ap::test::MeasureBest(repetitions, [&] { Record(device, vis, count); });
+		std::printf("1 command list: %8.3f ms | %u command lists (%u used): %8.3f ms | speedup: %.2fx\n", single_ms, count, used_count, multi_ms, single_ms / multi_ms);
+	}
+	return 0;
+}
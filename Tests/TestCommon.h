@@ -0,0 +1,56 @@
+#pragma once
+#include "CommonInclude.h"
+#include "apTimer.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Fails the test program if the expression is false, this also works in release builds (unlike assert)
+#define AP_CHECK(expr) do { if (!(expr)) { std::fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr); std::exit(1); } } while(0)
+
+namespace ap::test
+{
+	// Returns true if the argument was given to the program
+	inline bool HasArgument(int argc, char** argv, const char* name)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			if (std::strcmp(argv[i], name) == 0)
+				return true;
+		}
+		return false;
+	}
+
+	// Returns the value that follows the argument, or defaultValue if the argument was not given
+	inline uint32_t GetArgument(int argc, char** argv, const char* name, uint32_t defaultValue)
+	{
+		for (int i = 1; i < argc - 1; ++i)
+		{
+			if (std::strcmp(argv[i], name) == 0)
+				return (uint32_t)std::strtoul(argv[i + 1], nullptr, 10);
+		}
+		return defaultValue;
+	}
+
+	// Benchmarks are run by ctest with --quick, which only checks that they work with a small workload
+	inline bool IsQuick(int argc, char** argv)
+	{
+		return HasArgument(argc, argv, "--quick");
+	}
+
+	// Runs the function repeatedly and returns the fastest run in milliseconds
+	template<typename F>
+	inline double MeasureBest(uint32_t repetitions, F&& func)
+	{
+		double best = 1e30;
+		for (uint32_t i = 0; i < repetitions; ++i)
+		{
+			ap::Timer timer;
+			func();
+			const double elapsed = timer.elapsed_milliseconds();
+			best = elapsed < best ? elapsed : best;
+		}
+		return best;
+	}
+}
@@ -0,0 +1,33 @@
+// Stand-ins for the engine functions that the tested modules call, but which are only implemented for Windows and DX12,
+//	or which need a window (backlog)
+#include "apBacklog.h"
+#include "apOcean_waveworks.h"
+#include "apPhysics.h"
+
+#include <cstdio>
+
+namespace ap::backlog
+{
+	void post(const std::string& input, LogLevel level)
+	{
+		if (level >= LogLevel::Warning)
+		{
+			std::fprintf(stderr, "%s\n", input.c_str());
+		}
+	}
+}
+
+namespace ap
+{
+	// The scene owns an ocean, but it is never created without the WaveWorks DX12 runtime
+	Ocean2::Ocean2() = default;
+	Ocean2::~Ocean2() = default;
+	void Ocean2::Create() {}
+}
+
+namespace ap::physics
+{
+	// The Bullet backend is not built for the tests, Scene::Update() runs without physics
+	bool IsSimulationEnabled() { return false; }
+	void RunPhysicsUpdateSystem(ap::jobsystem::context& ctx, ap::scene::Scene& scene, float dt) {}
+}
@@ -0,0 +1,256 @@
+// Tests the transcoded texture cache of resourcemanager on the null graphics device: cache keys, rejection of damaged cache files, the temporary file writes and pruning
+//	The source images are uncompressed TGA files, which are decoded with stb_image and cached like the other decoded formats
+#include "TestCommon.h"
+#include "apGraphicsDevice_Null.h"
+#include "apHelper.h"
+#include "apResourceManager.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using namespace ap::graphics;
+using namespace ap::resourcemanager;
+
+static const std::filesystem::path cache_directory = std::filesystem::temp_directory_path() / "ap_texture_cache_tests";
+
+// 32 bit uncompressed TGA, the pixels depend on the seed
+static ap::vector<uint8_t> CreateTGA(uint32_t width, uint32_t height, uint8_t seed)
+{
+	ap::vector<uint8_t> data(18 + width * height * 4);
+	data[2] = 2; // uncompressed true color
+	data[12] = uint8_t(width);
+	data[13] = uint8_t(width >> 8);
+	data[14] = uint8_t(height);
+	data[15] = uint8_t(height >> 8);
+	data[16] = 32; // bits per pixel
+	data[17] = 0x28; // 8 alpha bits, top-left origin
+	for (uint32_t i = 0; i < width * height; ++i)
+	{
+		data[18 + i * 4 + 0] = uint8_t(i * 7 + seed);
+		data[18 + i * 4 + 1] = uint8_t(i / width);
+		data[18 + i * 4 + 2] = seed;
+		data[18 + i * 4 + 3] = 255;
+	}
+	return data;
+}
+
+static std::vector<std::filesystem::path> GetCacheFiles(const std::string& extension)
+{
+	std::vector<std::filesystem::path> files;
+	std::error_code ec; // the directory doesn't exist until the first entry is written
+	for (auto& entry : std::filesystem::directory_iterator(cache_directory, ec))
+	{
+		if (entry.path().extension() == extension)
+		{
+			files.push_back(entry.path());
+		}
+	}
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+static ap::vector<uint8_t> ReadFile(const std::filesystem::path& path)
+{
+	ap::vector<uint8_t> data;
+	AP_CHECK(ap::helper::FileRead(path.string(), data));
+	return data;
+}
+
+// Writes the data, truncated to size bytes
+static void WriteFile(const std::filesystem::path& path, const ap::vector<uint8_t>& data, size_t size)
+{
+	AP_CHECK(ap::helper::FileWrite(path.string(), data.data(), data.size()));
+	std::filesystem::resize_file(path, size);
+}
+
+// Loads the image from memory with a name that wasn't used before, so the resource manager doesn't return an already loaded texture
+static void LoadImage(const ap::vector<uint8_t>& data, uint32_t width, uint32_t height, Flags flags = Flags::NONE)
+{
+	static uint32_t counter = 0;
+	const std::string name = "image" + std::to_string(counter++) + ".tga";
+	ap::Resource resource = Load(name, flags, data.data(), data.size());
+	AP_CHECK(resource.IsValid());
+	const TextureDesc& desc = resource.GetTexture().GetDesc();
+	AP_CHECK(desc.width == width && desc.height == height);
+	Clear();
+}
+
+// A pixel of the cached image is changed, which is still a valid cache file: a load that reads the cache keeps it, a load that decodes again rewrites the file
+static void MarkCacheFile(const std::filesystem::path& path)
+{
+	ap::vector<uint8_t> data = ReadFile(path);
+	data.back() ^= 0xFF;
+	WriteFile(path, data, data.size());
+}
+
+static void TestCacheKey()
+{
+	const ap::vector<uint8_t> image = CreateTGA(64, 32, 1);
+	LoadImage(image, 64, 32);
+	std::vector<std::filesystem::path> files = GetCacheFiles(".texcache");
+	AP_CHECK(files.size() == 1);
+	AP_CHECK(files[0].stem().string().size() == 16); // the 64 bit key in hexadecimal
+
+	// The key only depends on the file contents, not the name, and the import flags that don't change the decoded image share the entry:
+	MarkCacheFile(files[0]);
+	const ap::vector<uint8_t> marked = ReadFile(files[0]);
+	LoadImage(image, 64, 32);
+	LoadImage(image, 64, 32, Flags::IMPORT_STREAMING);
+	LoadImage(image, 64, 32, Flags::IMPORT_RETAIN_FILEDATA);
+	AP_CHECK(GetCacheFiles(".texcache") == files);
+	AP_CHECK(ReadFile(files[0]) == marked);
+
+	// Changing a single byte of the source makes a new entry:
+	ap::vector<uint8_t> modified = image;
+	modified[18 + 100] ^= 1;
+	LoadImage(modified, 64, 32);
+	AP_CHECK(GetCacheFiles(".texcache").size() == 2);
+
+	// The color grading LUT import converts the image, it is never cached:
+	LoadImage(CreateTGA(256, 16, 2), 16, 16, Flags::IMPORT_COLORGRADINGLUT);
+	AP_CHECK(GetCacheFiles(".texcache").size() == 2);
+
+	std::filesystem::remove_all(cache_directory);
+}
+
+static void TestDamagedCacheFiles()
+{
+	const ap::vector<uint8_t> image = CreateTGA(32, 32, 3);
+	LoadImage(image, 32, 32);
+	const std::vector<std::filesystem::path> files = GetCacheFiles(".texcache");
+	AP_CHECK(files.size() == 1);
+	const std::filesystem::path& path = files[0];
+	const ap::vector<uint8_t> original = ReadFile(path);
+	const size_t header_size = 72; // TextureCacheHeader
+	AP_CHECK(original.size() > header_size + 16 + 32 * 32 * 4);
+
+	// Every damaged file must be rejected, the image is decoded again and the cache file is rewritten:
+	auto check_rejected = [&](const ap::vector<uint8_t>& damaged, size_t size) {
+		WriteFile(path, damaged, size);
+		LoadImage(image, 32, 32);
+		AP_CHECK(ReadFile(path) == original);
+	};
+
+	// Truncated files:
+	check_rejected(original, 0);
+	check_rejected(original, header_size - 1);
+	check_rejected(original, header_size + 8); // the subresource table is cut
+	check_rejected(original, original.size() / 2);
+	check_rejected(original, original.size() - 1); // the last row of mip0 is cut
+
+	// Corrupted headers and subresource table:
+	auto corrupt = [&](size_t offset) {
+		ap::vector<uint8_t> damaged = original;
+		damaged[offset] ^= 0x80;
+		return damaged;
+	};
+	check_rejected(corrupt(0), original.size()); // magic
+	check_rejected(corrupt(8), original.size()); // key
+	check_rejected(corrupt(16), original.size()); // version
+	check_rejected(corrupt(20), original.size()); // subresource count
+	check_rejected(corrupt(44), original.size()); // mip levels
+	check_rejected(corrupt(header_size + 7), original.size()); // offset of the first subresource
+
+	std::filesystem::remove_all(cache_directory);
+}
+
+static void TestTemporaryFiles()
+{
+	// Cache files are written under a temporary name and renamed, no temporary files are left after the writes:
+	const std::filesystem::path source_directory = cache_directory / "source";
+	std::filesystem::create_directories(source_directory);
+	ap::vector<std::string> fileNames;
+	for (uint8_t i = 0; i < 8; ++i)
+	{
+		const std::string fileName = (source_directory / ("image" + std::to_string(i) + ".tga")).string();
+		const ap::vector<uint8_t> image = CreateTGA(16, 16, 10 + i);
+		AP_CHECK(ap::helper::FileWrite(fileName, image.data(), image.size()));
+		fileNames.push_back(fileName);
+	}
+	AP_CHECK(PrewarmTextureCache(fileNames) == fileNames.size());
+	AP_CHECK(PrewarmTextureCache(fileNames) == 0); // every entry exists already
+	AP_CHECK(GetCacheFiles(".texcache").size() == fileNames.size());
+	AP_CHECK(GetCacheFiles(".tmp").empty());
+
+	// A temporary file can be a write in progress, so pruning only deletes the ones that were left behind long ago:
+	const std::filesystem::path recent = cache_directory / "0000000000000001.texcache.1.tmp";
+	const std::filesystem::path old = cache_directory / "0000000000000002.texcache.1.tmp";
+	const ap::vector<uint8_t> data(100, 0);
+	WriteFile(recent, data, data.size());
+	WriteFile(old, data, data.size());
+	std::filesystem::last_write_time(old, std::filesystem::file_time_type::clock::now() - std::chrono::hours(2));
+	PruneTextureCache(UINT64_MAX);
+	AP_CHECK(std::filesystem::exists(recent));
+	AP_CHECK(!std::filesystem::exists(old));
+	AP_CHECK(GetCacheFiles(".texcache").size() == fileNames.size());
+
+	std::filesystem::remove_all(cache_directory);
+}
+
+static void TestPrune()
+{
+	std::vector<std::filesystem::path> files;
+	for (uint8_t i = 0; i < 3; ++i)
+	{
+		const std::vector<std::filesystem::path> before = GetCacheFiles(".texcache");
+		LoadImage(CreateTGA(32, 32, 20 + i), 32, 32);
+		const std::vector<std::filesystem::path> after = GetCacheFiles(".texcache");
+		AP_CHECK(after.size() == before.size() + 1);
+		for (auto& path : after)
+		{
+			if (std::find(before.begin(), before.end(), path) == before.end())
+			{
+				files.push_back(path);
+			}
+		}
+	}
+	const uint64_t file_size = std::filesystem::file_size(files[0]);
+	AP_CHECK(std::filesystem::file_size(files[1]) == file_size && std::filesystem::file_size(files[2]) == file_size);
+
+	// Everything fits:
+	AP_CHECK(PruneTextureCache(file_size * 3) == file_size * 3);
+	AP_CHECK(GetCacheFiles(".texcache").size() == 3);
+
+	// The oldest entries are deleted first, reading an entry makes it the most recent:
+	const auto now = std::filesystem::file_time_type::clock::now();
+	std::filesystem::last_write_time(files[0], now - std::chrono::hours(3));
+	std::filesystem::last_write_time(files[1], now - std::chrono::hours(2));
+	std::filesystem::last_write_time(files[2], now - std::chrono::hours(1));
+	LoadImage(CreateTGA(32, 32, 20), 32, 32);
+	AP_CHECK(std::filesystem::last_write_time(files[0]) > now - std::chrono::minutes(1));
+
+	AP_CHECK(PruneTextureCache(file_size * 2 + file_size / 2) == file_size * 2);
+	AP_CHECK(std::filesystem::exists(files[0]));
+	AP_CHECK(!std::filesystem::exists(files[1]));
+	AP_CHECK(std::filesystem::exists(files[2]));
+
+	AP_CHECK(PruneTextureCache(file_size) == file_size);
+	AP_CHECK(std::filesystem::exists(files[0]));
+	AP_CHECK(!std::filesystem::exists(files[2]));
+
+	AP_CHECK(PruneTextureCache(0) == 0);
+	AP_CHECK(GetCacheFiles(".texcache").empty());
+
+	std::filesystem::remove_all(cache_directory);
+}
+
+int main(int argc, char** argv)
+{
+	ap::jobsystem::Initialize(ap::test::GetArgument(argc, argv, "--threads", ~0u));
+	GraphicsDevice_Null device;
+	GetDevice() = &device;
+
+	std::filesystem::remove_all(cache_directory);
+	SetTextureCacheDirectory(cache_directory.string());
+
+	TestCacheKey();
+	TestDamagedCacheFiles();
+	TestTemporaryFiles();
+	TestPrune();
+
+	std::printf("ok\n");
+	return 0;
+}
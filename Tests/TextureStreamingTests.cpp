@@ -0,0 +1,160 @@
+// Tests the texture streaming residency policy (resourcemanager::ComputeStreamingResidency), it doesn't need a graphics device
+#include "TestCommon.h"
+#include "apResourceManager.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace ap::resourcemanager;
+
+static StreamingResidency CreateResidency(uint32_t size, uint32_t requested_mip, uint32_t lowest_mip)
+{
+	StreamingResidency residency;
+	residency.mip_count = 1;
+	while ((size >> residency.mip_count) > 0)
+	{
+		residency.mip_count++;
+	}
+	residency.lowest_mip = lowest_mip;
+	residency.requested_mip = requested_mip;
+	residency.mip0_size = (uint64_t)size * size * 4; // RGBA8
+	return residency;
+}
+
+static uint64_t ComputeTotalSize(const std::vector<StreamingResidency>& residencies)
+{
+	uint64_t total = 0;
+	for (const StreamingResidency& residency : residencies)
+	{
+		total += ComputeStreamingMemorySize(residency, residency.target_mip);
+	}
+	return total;
+}
+
+static void TestMemorySize()
+{
+	const StreamingResidency residency = CreateResidency(1024, 0, 10);
+	AP_CHECK(residency.mip_count == 11);
+	AP_CHECK(ComputeStreamingMemorySize(residency, 10) == 4);
+	AP_CHECK(ComputeStreamingMemorySize(residency, 9) == 4 + 16);
+	AP_CHECK(ComputeStreamingMemorySize(residency, 0) == ComputeStreamingMemorySize(residency, 1) + 1024 * 1024 * 4);
+}
+
+static void TestUnderBudget()
+{
+	// Every request fits, so every texture gets exactly the requested mip
+	std::vector<StreamingResidency> residencies = {
+		CreateResidency(2048, 0, 6),
+		CreateResidency(1024, 2, 5),
+		CreateResidency(512, 1, 4),
+		CreateResidency(256, 3, 3),
+	};
+	uint64_t requested = 0;
+	for (const StreamingResidency& residency : residencies)
+	{
+		requested += ComputeStreamingMemorySize(residency, residency.requested_mip);
+	}
+
+	for (uint64_t budget : { requested, requested * 2, UINT64_MAX })
+	{
+		ComputeStreamingResidency(residencies.data(), residencies.size(), budget);
+		for (const StreamingResidency& residency : residencies)
+		{
+			AP_CHECK(residency.target_mip == residency.requested_mip);
+		}
+	}
+}
+
+static void TestOverBudgetWithTies()
+{
+	// Equal textures are reduced evenly: the largest top mip is always dropped first, so tied textures never differ by more than one mip
+	std::vector<StreamingResidency> residencies;
+	for (int i = 0; i < 8; ++i)
+	{
+		residencies.push_back(CreateResidency(2048, 0, 8));
+	}
+	residencies.push_back(CreateResidency(256, 0, 8)); // small texture, it's not dropped until the large ones are reduced to its size
+
+	uint64_t full = 0;
+	for (const StreamingResidency& residency : residencies)
+	{
+		full += ComputeStreamingMemorySize(residency, 0);
+	}
+	for (uint64_t budget : { full - 1, full / 2, full / 5, full / 17, full / 100 })
+	{
+		ComputeStreamingResidency(residencies.data(), residencies.size(), budget);
+		AP_CHECK(ComputeTotalSize(residencies) <= budget);
+
+		uint32_t min_mip = ~0u;
+		uint32_t max_mip = 0;
+		for (int i = 0; i < 8; ++i)
+		{
+			min_mip = std::min(min_mip, residencies[i].target_mip);
+			max_mip = std::max(max_mip, residencies[i].target_mip);
+		}
+		AP_CHECK(max_mip - min_mip <= 1);
+		AP_CHECK(max_mip >= 1);
+
+		// The small texture's top mip is only dropped when it became the largest: its mip0 equals mip 3 of the large textures
+		const StreamingResidency& small = residencies.back();
+		if (small.target_mip > 0)
+		{
+			AP_CHECK(min_mip >= 3 && small.target_mip <= min_mip - 3 + 1);
+		}
+
+		// Dropping stops as soon as the budget is met, and the dropped mips only get smaller, so restoring any dropped mip would exceed the budget
+		for (StreamingResidency& residency : residencies)
+		{
+			if (residency.target_mip > residency.requested_mip)
+			{
+				residency.target_mip--;
+				AP_CHECK(ComputeTotalSize(residencies) > budget);
+				residency.target_mip++;
+			}
+		}
+	}
+
+	// The result doesn't depend on the order of the tied textures, only on their sizes
+	std::vector<StreamingResidency> reversed(residencies.rbegin(), residencies.rend());
+	const uint64_t budget = full / 5;
+	ComputeStreamingResidency(residencies.data(), residencies.size(), budget);
+	ComputeStreamingResidency(reversed.data(), reversed.size(), budget);
+	AP_CHECK(ComputeTotalSize(residencies) == ComputeTotalSize(reversed));
+	AP_CHECK(residencies.back().target_mip == reversed.front().target_mip);
+}
+
+static void TestLowestMipClamping()
+{
+	std::vector<StreamingResidency> residencies = {
+		CreateResidency(1024, 0, 4),	// requested full resolution
+		CreateResidency(1024, 7, 4),	// requested less detail than the always resident mip
+		CreateResidency(1024, ~0u, 4),	// not requested
+		CreateResidency(64, 0, 0),		// not streamed below mip0, it can't be dropped
+	};
+
+	// Under budget: requests are clamped to the always resident mip
+	ComputeStreamingResidency(residencies.data(), residencies.size(), UINT64_MAX);
+	AP_CHECK(residencies[0].target_mip == 0);
+	AP_CHECK(residencies[1].target_mip == 4);
+	AP_CHECK(residencies[2].target_mip == 4);
+	AP_CHECK(residencies[3].target_mip == 0);
+
+	// Budget that can't be met: every texture stops at its lowest mip, even though the total remains over budget
+	ComputeStreamingResidency(residencies.data(), residencies.size(), 0);
+	for (const StreamingResidency& residency : residencies)
+	{
+		AP_CHECK(residency.target_mip == residency.lowest_mip);
+	}
+	AP_CHECK(ComputeTotalSize(residencies) > 0);
+}
+
+int main(int argc, char** argv)
+{
+	TestMemorySize();
+	TestUnderBudget();
+	TestOverBudgetWithTies();
+	TestLowestMipClamping();
+
+	std::printf("ok\n");
+	return 0;
+}
@@ -0,0 +1,118 @@
+// Measures loading a level's worth of KTX2 textures with resourcemanager on the null graphics device (time to first frame, without the GPU upload)
+//	The textures are 2D images with full mip chains, and every 16th is a cubemap array, which has many subresources that are transcoded in parallel
+//	Loading is measured two ways: Load() one by one from the main thread, and LoadAsync() for every file then waiting for all of them
+//	Options:
+//		--textures N : number of textures (default: 2048)
+//		--size N : resolution of the textures (default: 256)
+//		--threads N : number of worker threads (default: all cores)
+#include "TestCommon.h"
+#include "apGraphicsDevice_Null.h"
+#include "apHelper.h"
+#include "apResourceManager.h"
+
+#include "Utility/basis_universal/encoder/basisu_comp.h"
+
+#include <filesystem>
+#include <string>
+
+extern basist::etc1_global_selector_codebook g_basis_global_codebook;
+
+using namespace ap::graphics;
+
+// Encodes a KTX2 file (ETC1S with generated mips) from procedural images
+//	faces : 1 for a 2D texture, 6 for a cubemap array with layers * 6 images
+static ap::vector<uint8_t> CreateKTX2(uint32_t size, uint32_t faces, uint32_t layers)
+{
+	basisu::basis_compressor_params params;
+	for (uint32_t i = 0; i < faces * layers; ++i)
+	{
+		basisu::image image(size, size);
+		for (uint32_t y = 0; y < size; ++y)
+		{
+			for (uint32_t x = 0; x < size; ++x)
+			{
+				const uint8_t checker = ((x / 16 + y / 16 + i) % 2) ? 200 : 50;
+				image(x, y) = basisu::color_rgba(uint8_t(x * 255 / size), uint8_t(y * 255 / size), checker, 255);
+			}
+		}
+		params.m_source_images.push_back(image);
+	}
+	params.m_tex_type = faces == 6 ? basist::cBASISTexTypeCubemapArray : basist::cBASISTexType2D;
+	params.m_create_ktx2_file = true;
+	params.m_mip_gen = true;
+	params.m_pSel_codebook = &g_basis_global_codebook;
+	params.m_quality_level = 128;
+	params.m_status_output = false;
+	basisu::job_pool jpool(1);
+	params.m_pJob_pool = &jpool;
+
+	basisu::basis_compressor compressor;
+	AP_CHECK(compressor.init(params));
+	AP_CHECK(compressor.process() == basisu::basis_compressor::cECSuccess);
+	const auto& ktx2_file = compressor.get_output_ktx2_file();
+	return ap::vector<uint8_t>(ktx2_file.begin(), ktx2_file.end());
+}
+
+static void CheckTexture(const ap::Resource& resource, bool cubemap, uint32_t size)
+{
+	AP_CHECK(resource.IsValid());
+	const TextureDesc& desc = resource.GetTexture().GetDesc();
+	AP_CHECK(desc.width == size && desc.height == size);
+	AP_CHECK(desc.mip_levels > 1);
+	AP_CHECK(desc.array_size == (cubemap ? 12u : 1u));
+}
+
+int main(int argc, char** argv)
+{
+	const bool quick = ap::test::IsQuick(argc, argv);
+	const uint32_t texture_count = ap::test::GetArgument(argc, argv, "--textures", quick ? 32 : 2048);
+	const uint32_t size = ap::test::GetArgument(argc, argv, "--size", quick ? 64 : 256);
+	ap::jobsystem::Initialize(ap::test::GetArgument(argc, argv, "--threads", ~0u));
+
+	GraphicsDevice_Null device;
+	GetDevice() = &device;
+
+	basisu::basisu_encoder_init();
+	const ap::vector<uint8_t> texture = CreateKTX2(size, 1, 1);
+	const ap::vector<uint8_t> cubemap_array = CreateKTX2(size, 6, 2);
+	auto is_cubemap = [](uint32_t i) { return i % 16 == 15; };
+
+	// Load() from memory, one texture after the other
+	const double load_ms = ap::test::MeasureBest(1, [&] {
+		for (uint32_t i = 0; i < texture_count; ++i)
+		{
+			const ap::vector<uint8_t>& data = is_cubemap(i) ? cubemap_array : texture;
+			ap::Resource resource = ap::resourcemanager::Load("texture" + std::to_string(i) + ".ktx2", ap::resourcemanager::Flags::NONE, data.data(), data.size());
+			CheckTexture(resource, is_cubemap(i), size);
+		}
+	});
+	ap::resourcemanager::Clear();
+
+	// LoadAsync() from files, all of them requested before waiting, like a level that is opened
+	const std::filesystem::path directory = std::filesystem::temp_directory_path() / "ap_texture_transcode_benchmark";
+	std::filesystem::create_directories(directory);
+	ap::vector<std::string> fileNames(texture_count);
+	for (uint32_t i = 0; i < texture_count; ++i)
+	{
+		fileNames[i] = (directory / ("texture" + std::to_string(i) + ".ktx2")).string();
+		AP_CHECK(ap::helper::FileWrite(fileNames[i], is_cubemap(i) ? cubemap_array.data() : texture.data(), is_cubemap(i) ? cubemap_array.size() : texture.size()));
+	}
+	const double async_ms = ap::test::MeasureBest(1, [&] {
+		ap::vector<ap::resourcemanager::LoadHandle> handles(texture_count);
+		for (uint32_t i = 0; i < texture_count; ++i)
+		{
+			handles[i] = ap::resourcemanager::LoadAsync(fileNames[i]);
+		}
+		for (uint32_t i = 0; i < texture_count; ++i)
+		{
+			CheckTexture(handles[i].Get(), is_cubemap(i), size);
+		}
+	});
+	ap::resourcemanager::Clear();
+	std::filesystem::remove_all(directory);
+
+	std::printf("%u textures of %ux%u (every 16th is a 2 layer cubemap array), %u worker threads\n", texture_count, size, size, ap::jobsystem::GetThreadCount());
+	std::printf("Load() one by one:     %8.1f ms (%.3f ms/texture)\n", load_ms, load_ms / texture_count);
+	std::printf("LoadAsync() then wait: %8.1f ms (%.3f ms/texture)\n", async_ms, async_ms / texture_count);
+	return 0;
+}
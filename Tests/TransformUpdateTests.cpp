@@ -0,0 +1,94 @@
+// Tests the transform updates of Scene::Update() that only recompute changed transforms, on the null graphics device
+#include "TestCommon.h"
+#include "apGraphicsDevice_Null.h"
+#include "apScene.h"
+
+#include <cmath>
+
+using namespace ap::ecs;
+using namespace ap::graphics;
+using namespace ap::scene;
+
+static float Distance(const XMFLOAT3& a, const XMFLOAT3& b)
+{
+	return XMVectorGetX(XMVector3Length(XMLoadFloat3(&a) - XMLoadFloat3(&b)));
+}
+
+static bool NearEqual(const XMFLOAT4X4& a, const XMFLOAT4X4& b, float epsilon)
+{
+	for (int i = 0; i < 4; ++i)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			if (std::abs(a.m[i][j] - b.m[i][j]) > epsilon)
+				return false;
+		}
+	}
+	return true;
+}
+
+static void TestSpringOnStaticBone()
+{
+	// root -> bone -> tip, attached in local space, the spring on the tip rotates the bone every frame, but none of them are animated
+	//	The spring's world matrices only last for one frame, the next frame must start again from the local transforms
+	Scene scene;
+	const Entity root = CreateEntity();
+	scene.transforms.Create(root).Translate(XMFLOAT3(0, 1, 0));
+	const Entity bone = CreateEntity();
+	scene.transforms.Create(bone).Translate(XMFLOAT3(0, 2, 0));
+	scene.Component_Attach(bone, root, true);
+	const Entity tip = CreateEntity();
+	scene.transforms.Create(tip).Translate(XMFLOAT3(1, 0, 0));
+	scene.Component_Attach(tip, bone, true);
+
+	// The rest pose, before any spring is added:
+	const float dt = 1.0f / 60.0f;
+	scene.Update(dt);
+	const XMFLOAT4X4 bone_rest = scene.transforms.GetComponent(bone)->world;
+	const XMFLOAT4X4 tip_rest = scene.transforms.GetComponent(tip)->world;
+	const XMFLOAT3 bone_position = scene.transforms.GetComponent(bone)->GetPosition();
+	AP_CHECK(Distance(scene.transforms.GetComponent(tip)->GetPosition(), XMFLOAT3(1, 3, 0)) < 1e-5f);
+
+	SpringComponent& spring = scene.springs.Create(tip);
+	spring.SetGravityEnabled(true);
+
+	// Gravity pulls the tip down, the damped spring settles into a steady pose that doesn't drift
+	XMFLOAT3 tip_positions[2];
+	for (int frame = 0; frame < 600; ++frame)
+	{
+		scene.Update(dt);
+		const TransformComponent& tip_transform = *scene.transforms.GetComponent(tip);
+		const TransformComponent& bone_transform = *scene.transforms.GetComponent(bone);
+		AP_CHECK(Distance(bone_transform.GetPosition(), bone_position) < 1e-4f);
+		AP_CHECK(std::abs(Distance(tip_transform.GetPosition(), bone_position) - 1) < 1e-3f); // stretching is disabled
+		tip_positions[frame % 2] = tip_transform.GetPosition();
+	}
+	AP_CHECK(tip_positions[0].y < 3 - 0.01f); // it's hanging
+	AP_CHECK(Distance(tip_positions[0], tip_positions[1]) < 1e-4f);
+
+	// The pose only depends on the local transforms and the spring state, so it stays the same while the spring is at rest
+	const XMFLOAT4X4 bone_steady = scene.transforms.GetComponent(bone)->world;
+	for (int frame = 0; frame < 60; ++frame)
+	{
+		scene.Update(dt);
+	}
+	AP_CHECK(NearEqual(scene.transforms.GetComponent(bone)->world, bone_steady, 1e-4f));
+
+	// Disabling the spring must restore the rest pose in the next frame
+	scene.springs.GetComponent(tip)->SetDisabled();
+	scene.Update(dt);
+	AP_CHECK(NearEqual(scene.transforms.GetComponent(bone)->world, bone_rest, 1e-5f));
+	AP_CHECK(NearEqual(scene.transforms.GetComponent(tip)->world, tip_rest, 1e-5f));
+}
+
+int main(int argc, char** argv)
+{
+	ap::jobsystem::Initialize(ap::test::GetArgument(argc, argv, "--threads", ~0u));
+	GraphicsDevice_Null device;
+	GetDevice() = &device;
+
+	TestSpringOnStaticBone();
+
+	std::printf("ok\n");
+	return 0;
+}